@@ -0,0 +1,170 @@
+// EventLoop round trips
+//   tasks:     threads QueueInLoop() tasks to a running loop, how many per second
+//              and how many eventfd wakeups they took
+//   ping-pong: two loops on two threads bounce a message over a socketpair, the
+//              time of a round trip through epoll, read and write
+//   echo:      one loop, many socketpairs echoing 64 byte messages by StartRecv
+//              and Send, on epoll and on io_uring: messages per second and
+//              messages per loop iteration (io_uring: per io_uring_enter)
+//
+// usage: EventLoopBench [threads] [tasks per thread] [round trips] [pairs]
+// g++ -O2 -std=c++17 EventLoopBench.cc ../net/EventLoop.cc ../net/Uring.cc ../util/Timer.cc ../util/TimingWheel.cc ../util/LoopClock.cc ../util/Buffer.cc -lpthread -o EventLoopBench
+
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "../net/EventLoop.h"
+
+using namespace mrpc;
+using Clock = std::chrono::steady_clock;
+
+static void Tasks(int threads, long tasks)
+{
+    EventLoop loop;
+    std::atomic<long> count{0};
+    std::atomic<int> done{0};
+
+    const auto start = Clock::now();
+    std::vector<std::thread> producers;
+    for(int t = 0; t < threads; ++t)
+    {
+        producers.emplace_back([&]() {
+            for(long i = 0; i < tasks; ++i)
+                loop.QueueInLoop([&count]() { count.fetch_add(1, std::memory_order_relaxed); });
+            if(done.fetch_add(1) == threads - 1)
+                loop.QueueInLoop([&loop]() { loop.Quit(); });
+        });
+    }
+    loop.Loop();
+    const double sec = std::chrono::duration<double>(Clock::now() - start).count();
+    for(auto& t : producers)
+        t.join();
+
+    printf("tasks      %d threads: %.2f M tasks/s, %llu iterations\n", threads, count.load() / sec / 1e6,
+           static_cast<unsigned long long>(loop.Iterations()));
+}
+
+//echo what comes in, the first side counts round trips
+static void Bounce(EventLoop& loop, int fd, long rounds, bool first, Clock::time_point* end)
+{
+    long seen = 0;
+    loop.Register(fd, [&loop, fd, rounds, first, end, &seen]() {
+        char buf[64];
+        ssize_t n;
+        while((n = ::read(fd, buf, sizeof buf)) > 0)
+        {
+            if(first && ++seen == rounds)
+            {
+                *end = Clock::now();
+                loop.Quit();
+                return;
+            }
+            if(::write(fd, buf, n) != n)
+                perror("write");
+            if(!first && buf[0] == 'q')
+            {
+                loop.Quit();
+                return;
+            }
+        }
+    });
+    if(first && ::write(fd, "p", 1) != 1)
+        perror("write");
+    loop.Loop();
+    loop.Unregister(fd);
+}
+
+static void PingPong(long rounds)
+{
+    int fds[2];
+    if(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) != 0)
+    {
+        perror("socketpair");
+        return;
+    }
+
+    Clock::time_point end;
+    std::thread peer([&]() {
+        EventLoop loop;
+        Bounce(loop, fds[1], rounds, false, nullptr);
+    });
+    const auto start = Clock::now();
+    {
+        EventLoop loop;
+        Bounce(loop, fds[0], rounds, true, &end);
+    }
+    if(::write(fds[0], "q", 1) != 1)
+        perror("write");
+    peer.join();
+
+    printf("ping-pong  %.2f us/round trip\n", std::chrono::duration<double, std::micro>(end - start).count() / rounds);
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
+
+//every pair bounces one message till rounds messages went around in all
+static void Echo(LoopBackend backend, int pairs, long rounds)
+{
+    EventLoop loop(backend);
+    std::vector<int> fds(pairs * 2);
+    for(int i = 0; i < pairs; ++i)
+    {
+        if(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, &fds[i * 2]) != 0)
+        {
+            perror("socketpair");
+            return;
+        }
+    }
+
+    const char message[64] = "ping";
+    long count = 0;
+    for(int fd : fds)
+    {
+        loop.StartRecv(fd, [&loop, &count, rounds, fd](const char* data, std::size_t len, int) {
+            if(len == 0)
+                return;
+            if(++count >= rounds)
+                loop.Quit();
+            loop.Send(fd, BufferVector(Buffer(data, len)));
+        });
+    }
+    for(int i = 0; i < pairs; ++i)
+        loop.Send(fds[i * 2], BufferVector(Buffer(message, sizeof message)));
+
+    const uint64_t iterations = loop.Iterations();
+    const auto start = Clock::now();
+    loop.Loop();
+    const double sec = std::chrono::duration<double>(Clock::now() - start).count();
+    printf("echo %-5s %d pairs: %.2f M messages/s, %.1f messages/iteration\n",
+           loop.Backend() == LoopBackend::kUring ? "uring" : "epoll", pairs, count / sec / 1e6,
+           static_cast<double>(count) / (loop.Iterations() - iterations));
+
+    for(int fd : fds)
+    {
+        loop.Unregister(fd);
+        ::close(fd);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const int threads = argc > 1 ? atoi(argv[1]) : 4;
+    const long tasks = argc > 2 ? atol(argv[2]) : 500000;
+    const long rounds = argc > 3 ? atol(argv[3]) : 100000;
+    const int pairs = argc > 4 ? atoi(argv[4]) : 64;
+
+    Tasks(1, tasks);
+    Tasks(threads, tasks);
+    PingPong(rounds);
+    Echo(LoopBackend::kEpoll, 1, rounds);
+    Echo(LoopBackend::kUring, 1, rounds);
+    Echo(LoopBackend::kEpoll, pairs, rounds * 10);
+    Echo(LoopBackend::kUring, pairs, rounds * 10);
+    return 0;
+}
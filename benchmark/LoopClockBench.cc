@@ -0,0 +1,78 @@
+// The clock reads a loop iteration saves with LoopClock
+// One iteration: Update() of the timers, arm and cancel some request deadlines,
+// take some log timestamps and check some deadlines, like a busy loop does.
+//   fresh:  no clock attached, every call reads the clock
+//   cached: a LoopClock refreshed once per iteration
+//   coarse: the same with the coarse clocks
+//
+// usage: LoopClockBench [iterations] [requests per iteration]
+// g++ -O2 -std=c++17 LoopClockBench.cc ../util/LoopClock.cc ../util/Timer.cc ../util/TimingWheel.cc ../util/TimeUtil.cc -lpthread -o LoopClockBench
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <vector>
+
+#include "../util/LoopClock.h"
+#include "../util/Timer.h"
+#include "../util/TimeUtil.h"
+
+using namespace mrpc;
+using Clock = std::chrono::steady_clock;
+
+static volatile int64_t g_sink;
+
+static void Run(const char* name, LoopClock* clock, int iterations, int requests)
+{
+    if(clock)
+        clock->Attach();
+
+    internal::TimerManager mgr;
+    std::vector<TimerId> ids(requests);
+    int64_t sink = 0;
+
+    const auto start = Clock::now();
+    for(int i = 0; i < iterations; ++i)
+    {
+        if(clock)
+            clock->Refresh();
+
+        mgr.Update();
+        for(int r = 0; r < requests; ++r)
+            ids[r] = mgr.ScheduleAfter(DurationMs(5000), []() {});
+
+        for(int r = 0; r < requests; ++r)
+        {
+            //a log line per request, and its deadline checked
+            Time now;
+            sink += now.Microseconds();
+            sink += LoopClock::SteadyNow() > TimePoint();
+        }
+
+        for(int r = 0; r < requests; ++r)
+            mgr.Cancel(ids[r]);
+    }
+    const double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / iterations;
+
+    g_sink = sink;
+
+    if(clock)
+        clock->Detach();
+    printf("%-7s %9.1f ns/iteration  (%d clock reads avoided)\n", name, ns, clock ? 3 * requests + 1 : 0);
+}
+
+int main(int argc, char** argv)
+{
+    const int iterations = argc > 1 ? atoi(argv[1]) : 200000;
+    const int requests = argc > 2 ? atoi(argv[2]) : 16;
+
+    printf("%d iterations, %d requests each\n", iterations, requests);
+    Run("fresh", nullptr, iterations, requests);
+
+    LoopClock cached;
+    Run("cached", &cached, iterations, requests);
+
+    LoopClock coarse(true);
+    Run("coarse", &coarse, iterations, requests);
+    return 0;
+}
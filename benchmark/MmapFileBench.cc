@@ -0,0 +1,78 @@
+// Sustained write throughput of OMmapFile
+// A writer appends fixed size records and calls Sync() every few records,
+// like Logger::Update does once per drain cycle.
+//
+// usage: MmapFileBench [dir] [total MB] [record bytes] [sync every KB]
+// g++ -O2 -std=c++17 MmapFileBench.cc ../util/MmapFile.cc ../util/Buffer.cc -lpthread -o MmapFileBench
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "../util/MmapFile.h"
+
+using namespace mrpc::internal;
+using Clock = std::chrono::steady_clock;
+
+static double Run(const std::string& file, const SyncOptions& options,
+                  std::size_t total, std::size_t record, std::size_t syncEvery)
+{
+    std::vector<char> data(record, 'x');
+    data.back() = '\n';
+
+    OMmapFile out;
+    out.SetSyncOptions(options);
+    if(!out.Open(file, false))
+        exit(1);
+
+    const auto start = Clock::now();
+    std::size_t sinceSync = 0;
+    for(std::size_t written = 0; written < total; written += record)
+    {
+        out.Write(data.data(), record);
+        sinceSync += record;
+        if(sinceSync >= syncEvery)
+        {
+            out.Sync();
+            sinceSync = 0;
+        }
+    }
+    out.Sync();
+    const auto end = Clock::now();
+    out.Close();
+
+    ::unlink(file.c_str());
+    const double seconds = std::chrono::duration<double>(end - start).count();
+    return total / seconds / (1024 * 1024);
+}
+
+int main(int argc, char** argv)
+{
+    const std::string dir = argc > 1 ? argv[1] : "/tmp";
+    const std::size_t total = (argc > 2 ? atol(argv[2]) : 256) * 1024 * 1024;
+    const std::size_t record = argc > 3 ? atol(argv[3]) : 128;
+    const std::size_t syncEvery = (argc > 4 ? atol(argv[4]) : 64) * 1024;
+    const std::string file = dir + "/mmapfile_bench.dat";
+
+    printf("write %zu MB, %zu bytes per record, sync every %zu KB\n",
+           total >> 20, record, syncEvery >> 10);
+
+    SyncOptions blocking;
+    printf("%-28s %10.1f MB/s\n", "blocking msync(MS_SYNC)", Run(file, blocking, total, record, syncEvery));
+
+    SyncOptions async;
+    async.async = true;
+    printf("%-28s %10.1f MB/s\n", "async sync_file_range", Run(file, async, total, record, syncEvery));
+
+    SyncOptions lazy;
+    lazy.async = true;
+    lazy.interval = std::chrono::milliseconds(1000);
+    lazy.bytes = 64 * 1024 * 1024;
+    printf("%-28s %10.1f MB/s\n", "async, 1s / 64MB", Run(file, lazy, total, record, syncEvery));
+
+    return 0;
+}
@@ -0,0 +1,251 @@
+// Cross-thread handoff under contention, 1 to 64 threads
+//   mpmc:  half the threads push, half pop, through
+//          MpmcQueue one by one, MpmcQueue in batches, and a std::deque under a mutex
+//   mpsc:  all threads push to one consumer, through
+//          MpscQueue one by one, MpscQueue in batches, and a std::vector under a
+//          mutex swapped out by the consumer (how Logger hands its buffers over)
+// A full or empty queue makes the thread yield.
+//
+// usage: MpmcQueueBench [max threads] [items] [batch]
+// g++ -O2 -std=c++17 MpmcQueueBench.cc -lpthread -o MpmcQueueBench
+
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../util/MpmcQueue.h"
+#include "../util/MpscQueue.h"
+
+using namespace mrpc;
+using Clock = std::chrono::steady_clock;
+
+static const std::size_t kCapacity = 4096;
+
+class MutexQueue final
+{
+public:
+    bool TryPush(long value)
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if(values_.size() >= kCapacity)
+            return false;
+        values_.push_back(value);
+        return true;
+    }
+
+    bool TryPop(long& value)
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if(values_.empty())
+            return false;
+        value = values_.front();
+        values_.pop_front();
+        return true;
+    }
+
+private:
+    std::mutex mutex_;
+    std::deque<long> values_;
+};
+
+//run body(thread index) on threads threads, return ns per item
+template <typename Body>
+static double Time(int threads, long items, Body body)
+{
+    std::vector<std::thread> all;
+    const auto start = Clock::now();
+    for(int t = 0; t < threads; ++t)
+        all.emplace_back(body, t);
+    for(auto& t : all)
+        t.join();
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / items;
+}
+
+template <typename Queue>
+static double Mpmc(int threads, long items, std::size_t batch)
+{
+    Queue q(kCapacity);
+    const int producers = threads > 1 ? threads / 2 : 1;
+    const int consumers = threads > 1 ? threads - producers : 1;
+    const long perProducer = items / producers;
+    std::atomic<long> popped{0};
+    const long total = perProducer * producers;
+
+    return Time(producers + consumers, total, [&](int t) {
+        std::vector<long> values(batch);
+        if(t < producers)
+        {
+            for(long i = 0; i < perProducer; )
+            {
+                std::size_t n;
+                if(batch > 1)
+                {
+                    n = std::min<long>(batch, perProducer - i);
+                    for(std::size_t j = 0; j < n; ++j)
+                        values[j] = i + j;
+                    n = q.TryPushBatch(values.data(), n);
+                }
+                else
+                {
+                    n = q.TryPush(i) ? 1 : 0;
+                }
+                if(n == 0)
+                    std::this_thread::yield();
+                i += n;
+            }
+        }
+        else
+        {
+            while(popped.load(std::memory_order_relaxed) < total)
+            {
+                const std::size_t n = batch > 1 ? q.TryPopBatch(values.data(), batch) : q.TryPop(values[0]);
+                if(n == 0)
+                    std::this_thread::yield();
+                else
+                    popped.fetch_add(n, std::memory_order_relaxed);
+            }
+        }
+    });
+}
+
+static double MpmcMutex(int threads, long items)
+{
+    MutexQueue q;
+    const int producers = threads > 1 ? threads / 2 : 1;
+    const int consumers = threads > 1 ? threads - producers : 1;
+    const long perProducer = items / producers;
+    std::atomic<long> popped{0};
+    const long total = perProducer * producers;
+
+    return Time(producers + consumers, total, [&](int t) {
+        long value;
+        if(t < producers)
+        {
+            for(long i = 0; i < perProducer; )
+            {
+                if(q.TryPush(i))
+                    ++i;
+                else
+                    std::this_thread::yield();
+            }
+        }
+        else
+        {
+            while(popped.load(std::memory_order_relaxed) < total)
+            {
+                if(q.TryPop(value))
+                    popped.fetch_add(1, std::memory_order_relaxed);
+                else
+                    std::this_thread::yield();
+            }
+        }
+    });
+}
+
+struct Item : public MpscNode
+{
+    long value_;
+};
+
+//thread 0 consumes, the others produce; one thread: both in turn
+static double Mpsc(int threads, long items, std::size_t batch)
+{
+    const int producers = threads > 1 ? threads - 1 : 1;
+    const long perProducer = items / producers;
+    const long total = perProducer * producers;
+    std::vector<Item> nodes(total);
+    MpscQueue q;
+
+    return Time(producers + 1, total, [&](int t) {
+        std::vector<MpscNode*> batchNodes(batch);
+        if(t > 0)
+        {
+            Item* mine = &nodes[(t - 1) * perProducer];
+            for(long i = 0; i < perProducer; i += batch)
+            {
+                const std::size_t n = std::min<long>(batch, perProducer - i);
+                for(std::size_t j = 0; j < n; ++j)
+                    batchNodes[j] = &mine[i + j];
+                if(batch > 1)
+                {
+                    q.PushBatch(batchNodes.data(), n);
+                }
+                else
+                {
+                    q.Push(batchNodes[0]);
+                }
+            }
+        }
+        else
+        {
+            for(long popped = 0; popped < total; )
+            {
+                const std::size_t n = q.PopBatch(batchNodes.data(), batch);
+                if(n == 0)
+                    std::this_thread::yield();
+                popped += n;
+            }
+        }
+    });
+}
+
+static double MpscMutex(int threads, long items)
+{
+    const int producers = threads > 1 ? threads - 1 : 1;
+    const long perProducer = items / producers;
+    const long total = perProducer * producers;
+    std::mutex mutex;
+    std::vector<long> pending;
+
+    return Time(producers + 1, total, [&](int t) {
+        if(t > 0)
+        {
+            for(long i = 0; i < perProducer; ++i)
+            {
+                std::lock_guard<std::mutex> guard(mutex);
+                pending.push_back(i);
+            }
+        }
+        else
+        {
+            std::vector<long> taken;
+            for(long popped = 0; popped < total; )
+            {
+                {
+                    std::lock_guard<std::mutex> guard(mutex);
+                    taken.swap(pending);
+                }
+                if(taken.empty())
+                    std::this_thread::yield();
+                popped += taken.size();
+                taken.clear();
+            }
+        }
+    });
+}
+
+int main(int argc, char** argv)
+{
+    const int maxThreads = argc > 1 ? atoi(argv[1]) : 64;
+    const long items = argc > 2 ? atol(argv[2]) : 1000000;
+    const std::size_t batch = argc > 3 ? atol(argv[3]) : 16;
+
+    printf("%ld items, batch %zu, %u cores, ns/item\n", items, batch, std::thread::hardware_concurrency());
+    printf("threads |  mpmc   batch   mutex |  mpsc   batch   mutex\n");
+    for(int threads = 1; threads <= maxThreads; threads *= 2)
+    {
+        printf("%7d | %5.1f %7.1f %7.1f | %5.1f %7.1f %7.1f\n", threads,
+               Mpmc<MpmcQueue<long>>(threads, items, 1),
+               Mpmc<MpmcQueue<long>>(threads, items, batch),
+               MpmcMutex(threads, items),
+               Mpsc(threads, items, 1),
+               Mpsc(threads, items, batch),
+               MpscMutex(threads, items));
+    }
+    return 0;
+}
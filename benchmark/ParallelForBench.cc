@@ -0,0 +1,86 @@
+// Scaling of ThreadPool::ParallelFor and ParallelReduce with the number of threads
+// The kernel is compute bound (a few hundred rounds of integer mixing per index over
+// a small array), so it is not limited by memory bandwidth; it should scale close to
+// linear up to the number of cores. The caller takes part, so N threads are a pool of
+// N-1 workers and the caller.
+//
+// usage: ParallelForBench [max threads] [indexes] [grain]
+// g++ -O2 -std=c++17 ParallelForBench.cc ../util/ThreadPool.cc ../util/CpuTopology.cc -lpthread -o ParallelForBench
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "../util/ThreadPool.h"
+
+using namespace mrpc;
+using Clock = std::chrono::steady_clock;
+
+static uint64_t Mix(uint64_t x)
+{
+    for(int round = 0; round < 200; ++round)
+    {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 29;
+    }
+    return x;
+}
+
+int main(int argc, char** argv)
+{
+    const int cores = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    const int maxThreads = argc > 1 ? atoi(argv[1]) : cores;
+    const long n = argc > 2 ? atol(argv[2]) : 1 << 20;
+    const long grain = argc > 3 ? atol(argv[3]) : 256;
+
+    std::vector<uint64_t> out(n);
+    printf("%ld indexes, grain %ld, %d cores\n", n, grain, cores);
+    printf("threads   for ms  speedup   reduce ms  speedup\n");
+
+    double base[2] = {0, 0};
+    for(int threads = 1; threads <= maxThreads; threads *= 2)
+    {
+        ThreadPool pool(threads - 1 > 0 ? threads - 1 : 1);
+        double ms[2];
+        uint64_t check = 0;
+        for(int run = 0; run < 2; ++run)
+        {
+            const auto start = Clock::now();
+            if(run == 0)
+            {
+                if(threads == 1)
+                {
+                    for(long i = 0; i < n; ++i)
+                        out[i] = Mix(i);
+                }
+                else
+                {
+                    pool.ParallelFor(0L, n, grain, [&out](long i) { out[i] = Mix(i); });
+                }
+            }
+            else
+            {
+                if(threads == 1)
+                {
+                    for(long i = 0; i < n; ++i)
+                        check += Mix(i);
+                }
+                else
+                {
+                    check = pool.ParallelReduce(0L, n, grain, uint64_t(0),
+                                                [](long i) { return Mix(i); },
+                                                [](uint64_t a, uint64_t b) { return a + b; });
+                }
+            }
+            ms[run] = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            if(threads == 1)
+                base[run] = ms[run];
+        }
+        printf("%7d %8.1f %8.2fx %11.1f %8.2fx   (%016llx)\n", threads,
+               ms[0], base[0] / ms[0], ms[1], base[1] / ms[1], static_cast<unsigned long long>(check));
+    }
+    return 0;
+}
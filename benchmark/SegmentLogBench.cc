@@ -0,0 +1,76 @@
+// Throughput of SegmentLog for small records
+// Each thread appends records and commits every one of them, so in sync mode
+// the batch size is decided by group commit only.
+//
+// usage: SegmentLogBench [dir] [records per thread] [record bytes]
+// g++ -O2 -std=c++17 SegmentLogBench.cc ../util/SegmentLog.cc ../util/Crc32c.cc ../util/MmapFile.cc ../util/Buffer.cc -lpthread -o SegmentLogBench
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../util/SegmentLog.h"
+
+using namespace mrpc;
+using Clock = std::chrono::steady_clock;
+
+static void Run(const std::string& dir, bool async, int threads, int records, std::size_t size)
+{
+    std::string cmd = "rm -rf " + dir;
+    if(system(cmd.c_str()) != 0)
+        exit(1);
+
+    SegmentLogOptions options;
+    options.async = async;
+
+    SegmentLog log;
+    if(!log.Open(dir, options))
+        exit(1);
+
+    const std::string payload(size, 'r');
+    const auto start = Clock::now();
+
+    std::vector<std::thread> workers;
+    for(int t = 0; t < threads; ++t)
+    {
+        workers.emplace_back([&]()
+        {
+            for(int i = 0; i < records; ++i)
+                log.AppendAndCommit(payload.data(), payload.size());
+        });
+    }
+    for(auto& w : workers)
+        w.join();
+
+    const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    const uint64_t total = log.LastLsn();
+    const uint64_t syncs = log.SyncCount();
+
+    printf("%-6s threads %2d: %10.0f records/s %8.1f MB/s  syncs %8llu  batch %6.1f\n",
+           async ? "async" : "sync", threads,
+           total / seconds,
+           total * (size + SegmentLog::kHeaderSize) / seconds / (1024 * 1024),
+           static_cast<unsigned long long>(syncs),
+           syncs ? double(total) / syncs : 0.0);
+
+    log.Close();
+    system(cmd.c_str());
+}
+
+int main(int argc, char** argv)
+{
+    const std::string dir = std::string(argc > 1 ? argv[1] : "/tmp") + "/segmentlog_bench";
+    const int records = argc > 2 ? atoi(argv[2]) : 20000;
+    const std::size_t size = argc > 3 ? atol(argv[3]) : 64;
+
+    printf("%d records per thread, %zu bytes each\n", records, size);
+    for(int threads : {1, 4, 16})
+        Run(dir, false, threads, records, size);
+    for(int threads : {1, 4, 16})
+        Run(dir, true, threads, records * 10, size);
+
+    return 0;
+}
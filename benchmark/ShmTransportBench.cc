@@ -0,0 +1,149 @@
+// Ping-pong latency: ShmChannel vs loopback TCP
+// The parent sends a message, a forked child echoes it back.
+//
+// usage: ShmTransportBench [round trips] [message bytes]
+// g++ -O2 -std=c++17 ShmTransportBench.cc ../net/ShmTransport.cc ../util/Buffer.cc -lpthread -o ShmTransportBench
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "../net/ShmTransport.h"
+
+using namespace mrpc;
+using Clock = std::chrono::steady_clock;
+
+static void Report(const char* name, std::vector<double>& rtt)
+{
+    std::sort(rtt.begin(), rtt.end());
+    double sum = 0;
+    for(double v : rtt)
+        sum += v;
+    printf("%-10s avg %8.2f us  p50 %8.2f us  p99 %8.2f us\n", name,
+           sum / rtt.size(), rtt[rtt.size() / 2], rtt[rtt.size() * 99 / 100]);
+}
+
+static void BenchShm(int rounds, std::size_t size)
+{
+    ShmChannel channel;
+    if(!channel.CreateMemfd(1 << 20))
+        exit(1);
+
+    pid_t child = ::fork();
+    if(child == 0)
+    {
+        ShmChannel peer;
+        if(!peer.Attach(channel.Fd()))
+            _exit(1);
+        Slice msg;
+        for(int i = 0; i < rounds; ++i)
+        {
+            if(peer.In().Receive(&msg) != ShmRing::kOk)
+                _exit(1);
+            peer.Out().Send(msg.data, msg.len);
+            peer.In().Release();
+        }
+        _exit(0);
+    }
+
+    std::vector<char> payload(size, 'p');
+    std::vector<double> rtt;
+    rtt.reserve(rounds);
+    Slice msg;
+    for(int i = 0; i < rounds; ++i)
+    {
+        const auto start = Clock::now();
+        channel.Out().Send(payload.data(), payload.size());
+        if(channel.In().Receive(&msg) != ShmRing::kOk)
+            exit(1);
+        channel.In().Release();
+        rtt.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+    }
+    ::waitpid(child, nullptr, 0);
+    Report("shm", rtt);
+}
+
+static bool ReadFull(int fd, char* buf, std::size_t len)
+{
+    while(len > 0)
+    {
+        auto n = ::read(fd, buf, len);
+        if(n <= 0)
+            return false;
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+static void BenchTcp(int rounds, std::size_t size)
+{
+    int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof addr;
+    if(::bind(listener, (sockaddr*)&addr, sizeof addr) != 0 || ::listen(listener, 1) != 0 ||
+       ::getsockname(listener, (sockaddr*)&addr, &len) != 0)
+        exit(1);
+
+    pid_t child = ::fork();
+    if(child == 0)
+    {
+        int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+        if(::connect(fd, (sockaddr*)&addr, sizeof addr) != 0)
+            _exit(1);
+        std::vector<char> buf(size);
+        for(int i = 0; i < rounds; ++i)
+        {
+            if(!ReadFull(fd, buf.data(), size))
+                _exit(1);
+            if(::write(fd, buf.data(), size) != (ssize_t)size)
+                _exit(1);
+        }
+        _exit(0);
+    }
+
+    int fd = ::accept(listener, nullptr, nullptr);
+    int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+    std::vector<char> payload(size, 'p');
+    std::vector<double> rtt;
+    rtt.reserve(rounds);
+    for(int i = 0; i < rounds; ++i)
+    {
+        const auto start = Clock::now();
+        if(::write(fd, payload.data(), size) != (ssize_t)size || !ReadFull(fd, payload.data(), size))
+            exit(1);
+        rtt.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+    }
+    ::waitpid(child, nullptr, 0);
+    ::close(fd);
+    ::close(listener);
+    Report("tcp", rtt);
+}
+
+int main(int argc, char** argv)
+{
+    const int rounds = argc > 1 ? atoi(argv[1]) : 100000;
+    const std::size_t size = argc > 2 ? atol(argv[2]) : 64;
+
+    printf("%d round trips of %zu bytes\n", rounds, size);
+    BenchShm(rounds, size);
+    BenchTcp(rounds, size);
+    return 0;
+}
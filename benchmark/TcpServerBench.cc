@@ -0,0 +1,133 @@
+// TcpServer echo over loopback
+//   client threads, each with its own EventLoop, keep one 64 byte message going
+//   around on each of their connections; the server echoes it on one loop per
+//   core. Messages per second in all, and how SO_REUSEPORT spread the
+//   connections and the bytes over the loops
+//
+// usage: TcpServerBench [server loops] [client threads] [connections per thread] [messages] [uring]
+// g++ -O2 -std=c++17 TcpServerBench.cc ../net/TcpServer.cc ../net/EventLoop.cc ../net/Uring.cc ../util/Timer.cc ../util/TimingWheel.cc ../util/LoopClock.cc ../util/Buffer.cc ../util/CpuTopology.cc -lpthread -o TcpServerBench
+
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "../net/TcpServer.h"
+
+using namespace mrpc;
+using Clock = std::chrono::steady_clock;
+
+static int Connect(uint16_t port)
+{
+    const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0)
+    {
+        perror("connect");
+        ::close(fd);
+        return -1;
+    }
+    const int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    ::fcntl(fd, F_SETFL, O_NONBLOCK);
+    return fd;
+}
+
+//bounce a message on every connection till the thread's share went around
+static void Client(uint16_t port, int connections, long messages, std::atomic<long>* total)
+{
+    EventLoop loop;
+    std::vector<int> fds;
+    for(int i = 0; i < connections; ++i)
+    {
+        const int fd = Connect(port);
+        if(fd >= 0)
+            fds.push_back(fd);
+    }
+
+    const char message[64] = "ping";
+    const long bytes = messages * static_cast<long>(sizeof message);
+    long count = 0;
+    for(int fd : fds)
+    {
+        loop.Register(fd, [&loop, &count, bytes, fd]() {
+            char buf[4096];
+            ssize_t n;
+            while((n = ::read(fd, buf, sizeof buf)) > 0)
+            {
+                count += n;
+                if(count >= bytes)
+                {
+                    loop.Quit();
+                    return;
+                }
+                if(::write(fd, buf, n) != n)
+                    perror("write");
+            }
+        });
+        if(::write(fd, message, sizeof message) != static_cast<ssize_t>(sizeof message))
+            perror("write");
+    }
+    loop.Loop();
+    total->fetch_add(count / static_cast<long>(sizeof message));
+
+    for(int fd : fds)
+    {
+        loop.Unregister(fd);
+        ::close(fd);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    TcpServerOptions options;
+    options.host = "127.0.0.1";
+    options.loops = argc > 1 ? atoi(argv[1]) : 0;
+    const int threads = argc > 2 ? atoi(argv[2]) : 2;
+    const int connections = argc > 3 ? atoi(argv[3]) : 32;
+    const long messages = argc > 4 ? atol(argv[4]) : 1000000;
+    options.backend = argc > 5 && atoi(argv[5]) ? LoopBackend::kUring : LoopBackend::kEpoll;
+
+    TcpServer server(options);
+    server.SetMessageCallback([](TcpConnection* conn, Buffer& input) {
+        conn->Send(input.readaddr(), input.readablesize());
+        input.Consume(input.readablesize());
+    });
+    if(!server.Start())
+    {
+        fprintf(stderr, "can't start the server\n");
+        return 1;
+    }
+
+    std::atomic<long> total{0};
+    const auto start = Clock::now();
+    std::vector<std::thread> clients;
+    for(int t = 0; t < threads; ++t)
+        clients.emplace_back(Client, server.Port(), connections, messages / threads, &total);
+    for(auto& t : clients)
+        t.join();
+    const double sec = std::chrono::duration<double>(Clock::now() - start).count();
+
+    printf("echo %-5s %zu loops, %d connections: %.2f M messages/s\n",
+           options.backend == LoopBackend::kUring ? "uring" : "epoll", server.LoopCount(), threads * connections,
+           total.load() / sec / 1e6);
+    for(std::size_t i = 0; i < server.LoopCount(); ++i)
+    {
+        const TcpLoopStats stats = server.Stats(i);
+        printf("  loop %zu: %llu accepted, %.1f MB in\n", i, static_cast<unsigned long long>(stats.accepted),
+               stats.bytesIn / 1e6);
+    }
+    server.Stop();
+    return 0;
+}
@@ -0,0 +1,183 @@
+// ThreadPool (work stealing) against a pool with one mutex-protected queue
+//   fork/join: recursive fib, each level submits one half and computes the other,
+//              waiting threads run pending tasks
+//   fan-out:   one outside thread posts many tiny tasks, then waits for them all
+//   nested:    every fan-out task posts more tasks from a worker
+//
+// usage: ThreadPoolBench [threads] [fib n] [tasks]
+// g++ -O2 -std=c++17 ThreadPoolBench.cc ../util/ThreadPool.cc ../util/CpuTopology.cc -lpthread -o ThreadPoolBench
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "../util/ThreadPool.h"
+
+using namespace mrpc;
+using Clock = std::chrono::steady_clock;
+
+//the usual pool: std::function in a deque under a mutex and a condition variable
+class MutexPool final
+{
+public:
+    explicit MutexPool(std::size_t threads) : stop_(false)
+    {
+        for(std::size_t i = 0; i < threads; ++i)
+        {
+            threads_.emplace_back([this]() {
+                while(true)
+                {
+                    std::function<void ()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex_);
+                        cond_.wait(lock, [this]() { return stop_ || !tasks_.empty(); });
+                        if(tasks_.empty())
+                            return;
+                        task = std::move(tasks_.front());
+                        tasks_.pop_front();
+                    }
+                    task();
+                }
+            });
+        }
+    }
+
+    ~MutexPool()
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            stop_ = true;
+        }
+        cond_.notify_all();
+        for(auto& t : threads_)
+            t.join();
+    }
+
+    template <typename F>
+    void Post(F&& f)
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            tasks_.emplace_back(std::forward<F>(f));
+        }
+        cond_.notify_one();
+    }
+
+    template <typename F, typename... Args>
+    auto Submit(F&& f, Args&&... args) -> std::future<decltype(f(args...))>
+    {
+        using R = decltype(f(args...));
+        auto task = std::make_shared<std::packaged_task<R ()>>(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+        std::future<R> future = task->get_future();
+        Post([task]() { (*task)(); });
+        return future;
+    }
+
+    bool RunPendingTask()
+    {
+        std::function<void ()> task;
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            if(tasks_.empty())
+                return false;
+            task = std::move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+        return true;
+    }
+
+    template <typename T>
+    T Wait(std::future<T>& future)
+    {
+        while(future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            if(!RunPendingTask())
+                std::this_thread::yield();
+        }
+        return future.get();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<std::function<void ()>> tasks_;
+    std::vector<std::thread> threads_;
+    bool stop_;
+};
+
+template <typename Pool>
+static long Fib(Pool& pool, int n)
+{
+    if(n < 2)
+        return n;
+    if(n < 16)
+        return Fib(pool, n - 1) + Fib(pool, n - 2);
+
+    auto left = pool.Submit([&pool, n]() { return Fib(pool, n - 1); });
+    const long right = Fib(pool, n - 2);
+    return pool.Wait(left) + right;
+}
+
+template <typename Pool>
+static void WaitCount(Pool& pool, std::atomic<long>& count, long expect)
+{
+    while(count.load(std::memory_order_acquire) < expect)
+    {
+        if(!pool.RunPendingTask())
+            std::this_thread::yield();
+    }
+}
+
+template <typename Pool>
+static void Run(const char* name, std::size_t threads, int fib, long tasks)
+{
+    Pool pool(threads);
+
+    auto start = Clock::now();
+    auto f = pool.Submit([&pool, fib]() { return Fib(pool, fib); });
+    const long result = pool.Wait(f);
+    const double forkJoin = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+    std::atomic<long> count{0};
+    start = Clock::now();
+    for(long i = 0; i < tasks; ++i)
+        pool.Post([&count]() { count.fetch_add(1, std::memory_order_release); });
+    WaitCount(pool, count, tasks);
+    const double fanOut = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / tasks;
+
+    count = 0;
+    const long kChildren = 64;
+    start = Clock::now();
+    for(long i = 0; i < tasks / kChildren; ++i)
+    {
+        pool.Post([&pool, &count]() {
+            for(long j = 0; j < kChildren; ++j)
+                pool.Post([&count]() { count.fetch_add(1, std::memory_order_release); });
+        });
+    }
+    WaitCount(pool, count, tasks / kChildren * kChildren);
+    const double nested = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / tasks;
+
+    printf("%-12s fib=%ld fork/join %8.1f ms  fan-out %6.1f ns/task  nested %6.1f ns/task\n",
+           name, result, forkJoin, fanOut, nested);
+}
+
+int main(int argc, char** argv)
+{
+    const std::size_t threads = argc > 1 ? atoi(argv[1]) : std::max(1u, std::thread::hardware_concurrency());
+    const int fib = argc > 2 ? atoi(argv[2]) : 30;
+    const long tasks = argc > 3 ? atol(argv[3]) : 1000000;
+
+    printf("threads %zu, fib(%d), %ld tasks\n", threads, fib, tasks);
+    Run<MutexPool>("mutex queue", threads, fib, tasks);
+    Run<ThreadPool>("stealing", threads, fib, tasks);
+    return 0;
+}
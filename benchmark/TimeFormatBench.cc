@@ -0,0 +1,68 @@
+// Cost of a log timestamp, each call on a new time point a few microseconds later
+//   libc:      localtime_r and snprintf, how the prefix used to be made
+//   format:    Time::FormatTime, "2026-10-19[08:30:00.123456]"
+//   iso8601:   Time::FormatIso8601, "2026-10-19T08:30:00.123456+02:00"
+//   epoch:     Time::FormatEpochMicros, "1792391400123456"
+//   micros:    Time::FormatMicros, the 6 digits Logger rewrites within a second
+//
+// usage: TimeFormatBench [calls]
+// g++ -O2 -std=c++17 TimeFormatBench.cc ../util/TimeUtil.cc ../util/LoopClock.cc -lpthread -o TimeFormatBench
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <ctime>
+
+#include "../util/TimeUtil.h"
+
+using namespace mrpc;
+using Clock = std::chrono::steady_clock;
+
+static volatile char g_sink;
+
+static std::size_t Libc(std::chrono::system_clock::time_point when, char* buf)
+{
+    const int64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(when.time_since_epoch()).count();
+    const time_t seconds = micros / 1000000;
+    tm local;
+    ::localtime_r(&seconds, &local);
+    return snprintf(buf, 32, "%04d-%02d-%02d[%02d:%02d:%02d.%06d]", local.tm_year + 1900, local.tm_mon + 1,
+                    local.tm_mday, local.tm_hour, local.tm_min, local.tm_sec, static_cast<int>(micros % 1000000));
+}
+
+template <typename Format>
+static void Run(const char* name, long calls, Format format)
+{
+    const auto base = std::chrono::system_clock::now();
+    char buf[64];
+    const auto start = Clock::now();
+    for(long i = 0; i < calls; ++i)
+    {
+        format(base + std::chrono::microseconds(i * 7), buf);
+        g_sink = buf[i % 20];
+    }
+    const double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / calls;
+    printf("%-8s %6.1f ns   %.*s\n", name, ns, static_cast<int>(format(base, buf)), buf);
+}
+
+int main(int argc, char** argv)
+{
+    const long calls = argc > 1 ? atol(argv[1]) : 5000000;
+
+    printf("%ld calls\n", calls);
+    Run("libc", calls, Libc);
+    Run("format", calls, [](std::chrono::system_clock::time_point when, char* buf) {
+        return Time(when).FormatTime(buf);
+    });
+    Run("iso8601", calls, [](std::chrono::system_clock::time_point when, char* buf) {
+        return Time(when).FormatIso8601(buf);
+    });
+    Run("epoch", calls, [](std::chrono::system_clock::time_point when, char* buf) {
+        return Time(when).FormatEpochMicros(buf);
+    });
+    Run("micros", calls, [](std::chrono::system_clock::time_point when, char* buf) {
+        Time(when).FormatMicros(buf);
+        return std::size_t(6);
+    });
+    return 0;
+}
@@ -0,0 +1,140 @@
+// TimerManager (timing wheel) vs a std::multimap of timers, the former implementation
+// schedule: N timers at random points within 60s
+// cancel:   half of them, by id
+// fire:     N timers spread over 200ms, the cpu time spent in Update() polled every 1ms
+//
+// usage: TimerBench [timers...]
+// g++ -O2 -std=c++17 TimerBench.cc ../util/Timer.cc ../util/TimingWheel.cc ../util/LoopClock.cc -lpthread -o TimerBench
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "../util/Timer.h"
+
+using namespace mrpc;
+using Clock = std::chrono::steady_clock;
+
+// the multimap based manager, as simple as the old one
+class MapTimers
+{
+public:
+    using Id = std::shared_ptr<std::pair<TimePoint, unsigned int>>;
+
+    Id ScheduleAt(const TimePoint& tp, std::function<void ()> f)
+    {
+        Id id = std::make_shared<std::pair<TimePoint, unsigned int>>(tp, ++idGen_);
+        timers_.emplace(tp, Entry{id, std::move(f)});
+        return id;
+    }
+
+    bool Cancel(const Id& id)
+    {
+        auto range = timers_.equal_range(id->first);
+        for(auto it = range.first; it != range.second; ++it)
+        {
+            if(it->second.id->second == id->second)
+            {
+                timers_.erase(it);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Update()
+    {
+        const auto now = Clock::now();
+        while(!timers_.empty() && timers_.begin()->first <= now)
+        {
+            auto f = std::move(timers_.begin()->second.func);
+            timers_.erase(timers_.begin());
+            f();
+        }
+    }
+
+    std::size_t Size() const
+    {
+        return timers_.size();
+    }
+
+private:
+    struct Entry
+    {
+        Id id;          // kept by the timer, as TimerManager did
+        std::function<void ()> func;
+    };
+    std::multimap<TimePoint, Entry> timers_;
+    unsigned int idGen_ = 0;
+};
+
+static double Seconds(Clock::duration d)
+{
+    return std::chrono::duration<double>(d).count();
+}
+
+template <typename Manager>
+static void Run(const char* name, Manager& mgr, int n)
+{
+    using Id = decltype(mgr.ScheduleAt(TimePoint(), std::function<void ()>()));
+
+    std::mt19937 rng(n);
+    std::vector<Id> ids;
+    ids.reserve(n);
+    long fired = 0;
+
+    auto start = Clock::now();
+    const auto base = start + std::chrono::seconds(1);
+    for(int i = 0; i < n; ++i)
+        ids.push_back(mgr.ScheduleAt(base + DurationMs(rng() % 60000), [&fired]() { ++fired; }));
+    const double schedule = Seconds(Clock::now() - start);
+
+    start = Clock::now();
+    for(int i = 0; i < n; i += 2)
+        mgr.Cancel(ids[i]);
+    const double cancel = Seconds(Clock::now() - start);
+    for(int i = 1; i < n; i += 2)
+        mgr.Cancel(ids[i]);
+
+    const auto soon = Clock::now() + DurationMs(5);
+    for(int i = 0; i < n; ++i)
+        mgr.ScheduleAt(soon + std::chrono::microseconds(rng() % 200000), [&fired]() { ++fired; });
+    Clock::duration busy(0);
+    while(mgr.Size() > 0)
+    {
+        const auto t = Clock::now();
+        mgr.Update();
+        busy += Clock::now() - t;
+        std::this_thread::sleep_for(DurationMs(1));
+    }
+
+    printf("%-8s %8d timers  schedule %7.1f ns  cancel %7.1f ns  fire %7.1f ns  (fired %ld)\n", name, n,
+           schedule * 1e9 / n, cancel * 1e9 / (n / 2), Seconds(busy) * 1e9 / n, fired);
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<int> counts;
+    for(int i = 1; i < argc; ++i)
+        counts.push_back(atoi(argv[i]));
+    if(counts.empty())
+        counts = {10000, 100000, 1000000};
+
+    for(int n : counts)
+    {
+        {
+            internal::TimerManager mgr;
+            Run("wheel", mgr, n);
+        }
+        {
+            MapTimers mgr;
+            Run("multimap", mgr, n);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,57 @@
+// Cost of a clock read
+//   steady, system:  std::chrono, clock_gettime through the vDSO
+//   coarse:          CLOCK_MONOTONIC_COARSE, as fine as the kernel tick
+//   tsc ticks:       TscClock::Ticks(), rdtsc
+//   tsc ordered:     TscClock::TicksOrdered(), rdtscp
+//   tsc now:         TscClock::Now(), rdtsc converted to a steady_clock time point
+//   tsc wall:        TscClock::WallNow(), the same as a system_clock time point
+// With the TSC not usable every TscClock call falls back to steady_clock.
+//
+// usage: TscClockBench [calls]
+// g++ -O2 -std=c++17 TscClockBench.cc ../util/TscClock.cc -lpthread -o TscClockBench
+
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <time.h>
+
+#include "../util/TscClock.h"
+
+using namespace mrpc;
+using Clock = std::chrono::steady_clock;
+
+static volatile int64_t g_sink;
+
+template <typename Read>
+static void Run(const char* name, long calls, Read read)
+{
+    int64_t sum = 0;
+    const auto start = Clock::now();
+    for(long i = 0; i < calls; ++i)
+        sum += read();
+    const double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / calls;
+    g_sink = sum;
+    printf("%-12s %6.1f ns\n", name, ns);
+}
+
+int main(int argc, char** argv)
+{
+    const long calls = argc > 1 ? atol(argv[1]) : 20000000;
+
+    TscClock::Calibrate();
+    printf("tsc %s, %.0f MHz, %ld calls\n", TscClock::Enabled() ? "enabled" : "not usable",
+           TscClock::Frequency() / 1e6, calls);
+
+    Run("steady", calls, []() { return std::chrono::steady_clock::now().time_since_epoch().count(); });
+    Run("system", calls, []() { return std::chrono::system_clock::now().time_since_epoch().count(); });
+    Run("coarse", calls, []() {
+        timespec ts;
+        ::clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return static_cast<int64_t>(ts.tv_nsec);
+    });
+    Run("tsc ticks", calls, []() { return static_cast<int64_t>(TscClock::Ticks()); });
+    Run("tsc ordered", calls, []() { return static_cast<int64_t>(TscClock::TicksOrdered()); });
+    Run("tsc now", calls, []() { return TscClock::Now().time_since_epoch().count(); });
+    Run("tsc wall", calls, []() { return TscClock::WallNow().time_since_epoch().count(); });
+    return 0;
+}
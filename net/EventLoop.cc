@@ -0,0 +1,892 @@
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cstdio>
+#include <deque>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "EventLoop.h"
+#include "Uring.h"
+
+namespace mrpc
+{
+
+thread_local EventLoop* EventLoop::current_ = nullptr;
+
+constexpr std::size_t EventLoop::kInitEvents;
+constexpr std::size_t EventLoop::kMaxEvents;
+constexpr int EventLoop::kMaxTasksPerIteration;
+constexpr unsigned EventLoop::kUringEntries;
+constexpr unsigned EventLoop::kUringCqEntries;
+constexpr unsigned EventLoop::kRecvBuffers;
+constexpr unsigned EventLoop::kRecvBufferSize;
+constexpr int EventLoop::kMaxIov;
+constexpr int EventLoop::kAcceptRetryMs;
+
+//the output of an fd used by Send()
+struct EventLoop::SendState
+{
+    BufferVector queued_;       // not handed to the kernel yet
+    BufferVector inflight_;     // io_uring: what the sendmsg under way reads
+    std::vector<iovec> iov_;
+    msghdr msg_ = {};
+    //callbacks, by the byte count they are due at
+    std::deque<std::pair<uint64_t, SendCallback>> done_;
+    uint64_t total_ = 0;        // bytes queued ever
+    uint64_t sent_ = 0;         // of them, taken by the kernel
+};
+
+static int GatherIov(BufferVector& data, iovec* iov, int max)
+{
+    int count = 0;
+    for(Buffer& buf : data)
+    {
+        if(count == max)
+            break;
+        if(buf.readablesize() == 0)
+            continue;
+        iov[count].iov_base = buf.readaddr();
+        iov[count].iov_len = buf.readablesize();
+        ++count;
+    }
+    return count;
+}
+
+//the callbacks due once sent_ went up
+static void TakeDue(std::deque<std::pair<uint64_t, EventLoop::SendCallback>>& done, uint64_t sent,
+                    std::vector<EventLoop::SendCallback>* due)
+{
+    while(!done.empty() && done.front().first <= sent)
+    {
+        due->push_back(std::move(done.front().second));
+        done.pop_front();
+    }
+}
+
+static void RunDue(std::vector<EventLoop::SendCallback>& due, int error)
+{
+    for(auto& f : due)
+        f(error);
+}
+
+EventLoop::EventLoop(LoopBackend backend):thread_(std::this_thread::get_id()),
+                                          epfd_(-1),
+                                          wakeupFd_(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+                                          multishotRecv_(true),
+                                          events_(kInitEvents),
+                                          dispatching_(false),
+                                          wakeupPending_(false),
+                                          quit_(false),
+                                          iterations_(0)
+{
+    if(backend != LoopBackend::kUring || !_InitUring())
+    {
+        epfd_ = ::epoll_create1(EPOLL_CLOEXEC);
+        if(epfd_ < 0)
+            perror("epoll_create1");
+    }
+    if(wakeupFd_ < 0)
+        perror("eventfd");
+
+    Register(wakeupFd_, [this]() { _OnWakeup(); });
+    timers_.SetWakeup([this]() { _Wakeup(); });
+}
+
+EventLoop::~EventLoop()
+{
+    //tasks never run are dropped
+    while(MpscNode* node = tasks_.Pop())
+        delete static_cast<Task*>(node);
+
+    if(uring_)
+    {
+        //cancel what's in the kernel, and wait a little for the sends reading our memory
+        for(std::size_t fd = 0; fd < fds_.size(); ++fd)
+            Unregister(static_cast<int>(fd));
+        for(int i = 0; i < 100 && !orphans_.empty(); ++i)
+        {
+            uring_->Enter(true, 1000000);
+            uring_->ForEachCqe([this](const io_uring_cqe& cqe) { _OnCompletion(cqe.user_data, cqe.res, cqe.flags); });
+        }
+        bufRing_.reset();
+        uring_.reset();
+    }
+
+    if(current_ == this)
+        current_ = nullptr;
+    if(wakeupFd_ >= 0)
+        ::close(wakeupFd_);
+    if(epfd_ >= 0)
+        ::close(epfd_);
+}
+
+bool EventLoop::_InitUring()
+{
+    std::unique_ptr<internal::Uring> ring(new internal::Uring);
+    if(!ring->Init(kUringEntries, kUringCqEntries))
+        return false;
+    std::unique_ptr<internal::BufferRing> buffers(new internal::BufferRing);
+    if(!buffers->Init(ring.get(), 0, kRecvBuffers, kRecvBufferSize))
+        return false;
+
+    uring_ = std::move(ring);
+    bufRing_ = std::move(buffers);
+    return true;
+}
+
+void EventLoop::Loop()
+{
+    assert(IsInLoopThread());
+    while(!quit_.load(std::memory_order_acquire))
+        RunOnce();
+    quit_.store(false, std::memory_order_relaxed);
+
+    timers_.Detach();
+    clock_.Detach();
+    current_ = nullptr;
+}
+
+void EventLoop::RunOnce(int timeoutMs)
+{
+    assert(IsInLoopThread());
+    assert(!current_ || current_ == this);
+    current_ = this;
+    clock_.Attach();
+    timers_.Attach();
+
+    if(uring_)
+        _WaitUring(timeoutMs);
+    else
+        _WaitEpoll(timeoutMs);
+    timers_.Update();
+    _RunTasks();
+}
+
+void EventLoop::_WaitEpoll(int timeoutMs)
+{
+    int timeout = _Timeout();
+    if(timeoutMs >= 0 && (timeout < 0 || timeoutMs < timeout))
+        timeout = timeoutMs;
+
+    const int n = ::epoll_wait(epfd_, events_.data(), static_cast<int>(events_.size()), timeout);
+    clock_.Refresh();
+    ++iterations_;
+    if(n < 0 && errno != EINTR)
+        perror("epoll_wait");
+
+    if(n > 0)
+    {
+        _Dispatch(n);
+        //a full batch: more may be ready, take more next time
+        if(static_cast<std::size_t>(n) == events_.size() && events_.size() < kMaxEvents)
+            events_.resize(events_.size() * 2);
+    }
+}
+
+void EventLoop::_WaitUring(int timeoutMs)
+{
+    int64_t timeout = -1;
+    if(!tasks_.Empty())
+    {
+        timeout = 0;
+    }
+    else
+    {
+        const DurationNs nearest = timers_.PrepareWait();
+        if(nearest != DurationNs::max())
+            timeout = std::max<int64_t>(nearest.count(), 0);
+    }
+    const int64_t limit = static_cast<int64_t>(timeoutMs) * 1000000;
+    if(timeoutMs >= 0 && (timeout < 0 || limit < timeout))
+        timeout = limit;
+
+    //submits all the SQEs queued since the last time, then waits
+    uring_->Enter(timeout != 0, timeout);
+    clock_.Refresh();
+    ++iterations_;
+
+    dispatching_ = true;
+    uring_->ForEachCqe([this](const io_uring_cqe& cqe) { _OnCompletion(cqe.user_data, cqe.res, cqe.flags); });
+    dispatching_ = false;
+    retired_.clear();
+}
+
+void EventLoop::Quit()
+{
+    quit_.store(true, std::memory_order_release);
+    if(!IsInLoopThread())
+        _Wakeup();
+}
+
+int EventLoop::_Timeout()
+{
+    if(!tasks_.Empty())
+        return 0;
+
+    const DurationNs nearest = timers_.PrepareWait();
+    if(nearest == DurationNs::max())
+        return -1;
+    if(nearest <= DurationNs::zero())       // overdue
+        return 0;
+    //rounded up, not to wake before the timer
+    const auto ms = std::chrono::ceil<DurationMs>(nearest).count();
+    return ms > INT_MAX ? INT_MAX : static_cast<int>(ms);
+}
+
+EventLoop::FdEntry* EventLoop::_Entry(int fd) const
+{
+    if(fd < 0 || static_cast<std::size_t>(fd) >= fds_.size())
+        return nullptr;
+    return fds_[fd].get();
+}
+
+EventLoop::FdEntry* EventLoop::_NewEntry(int fd)
+{
+    if(static_cast<std::size_t>(fd) >= fds_.size())
+        fds_.resize(fd + 1);
+    if(!fds_[fd])
+        fds_[fd].reset(new FdEntry);
+    return fds_[fd].get();
+}
+
+bool EventLoop::_Control(int op, int fd, FdEntry* entry)
+{
+    epoll_event ev = {};
+    ev.events = entry->events_;
+    ev.data.u64 = static_cast<uint32_t>(fd) | (static_cast<uint64_t>(entry->generation_) << 32);
+    if(::epoll_ctl(epfd_, op, fd, &ev) != 0)
+    {
+        perror("epoll_ctl");
+        return false;
+    }
+    return true;
+}
+
+template <typename F>
+void EventLoop::_Retire(F& f)
+{
+    if(dispatching_ && f)
+        retired_.push_back([g = std::move(f)]() {});
+    f = nullptr;
+}
+
+bool EventLoop::Register(int fd, Callback onRead, Callback onWrite, bool write)
+{
+    assert(IsInLoopThread());
+    if(fd < 0)
+        return false;
+
+    FdEntry* entry = _NewEntry(fd);
+    if(entry->registered_)
+        return false;
+
+    _Retire(entry->read_);
+    _Retire(entry->write_);
+    entry->events_ = EPOLLIN | EPOLLPRI | EPOLLRDHUP | EPOLLET | (write ? uint32_t(EPOLLOUT) : 0u);
+    ++entry->generation_;
+    if(uring_ ? !_SubmitPoll(fd, entry) : !_Control(EPOLL_CTL_ADD, fd, entry))
+        return false;
+
+    entry->read_ = std::move(onRead);
+    entry->write_ = std::move(onWrite);
+    entry->registered_ = true;
+    return true;
+}
+
+bool EventLoop::EnableWrite(int fd, bool enable)
+{
+    assert(IsInLoopThread());
+    FdEntry* entry = _Entry(fd);
+    if(!entry || !entry->registered_)
+        return false;
+
+    const uint32_t events = enable ? entry->events_ | EPOLLOUT : entry->events_ & ~uint32_t(EPOLLOUT);
+    if(events == entry->events_)
+        return true;
+    //edge-triggered, a MOD with EPOLLOUT reports the fd writable at once if it is
+    entry->events_ = events;
+    if(!uring_)
+        return _Control(EPOLL_CTL_MOD, fd, entry);
+    return _UpdatePoll(fd, entry);
+}
+
+bool EventLoop::Rearm(int fd)
+{
+    assert(IsInLoopThread());
+    FdEntry* entry = _Entry(fd);
+    if(!entry || !entry->registered_)
+        return false;
+
+    //edge-triggered, a MOD reports the fd at once if it is ready
+    if(!uring_)
+        return _Control(EPOLL_CTL_MOD, fd, entry);
+    return _UpdatePoll(fd, entry);
+}
+
+bool EventLoop::_UpdatePoll(int fd, FdEntry* entry)
+{
+    //the poll in place gets the new mask and looks at the fd again; one not armed
+    //any more takes it when it's armed again
+    if(!(entry->armed_ & (1u << kOpPoll)))
+        return true;
+    io_uring_sqe* sqe = uring_->GetSqe();
+    if(!sqe)
+        return false;
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = _Key(kOpPoll, fd, entry);
+    sqe->len = IORING_POLL_UPDATE_EVENTS | IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = entry->events_;
+    sqe->user_data = _Key(kOpCancel, fd, entry);
+    return true;
+}
+
+void EventLoop::Unregister(int fd)
+{
+    assert(IsInLoopThread());
+    FdEntry* entry = _Entry(fd);
+    if(!entry || !entry->registered_)
+        return;
+
+    if(uring_)
+    {
+        for(int op = kOpPoll; op < kOpCancel; ++op)
+        {
+            if(entry->armed_ & (1u << op))
+                _Cancel(op, fd, entry);
+        }
+        //the kernel may be reading it till the send completes
+        if(entry->send_ && (entry->armed_ & (1u << kOpSend)))
+            orphans_.emplace(_Key(kOpSend, fd, entry), std::move(entry->send_));
+    }
+    else
+    {
+        ::epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
+    }
+
+    entry->armed_ = 0;
+    entry->registered_ = false;
+    entry->io_ = false;
+    ++entry->generation_;
+    _Retire(entry->read_);
+    _Retire(entry->write_);
+    _Retire(entry->recv_);
+    _Retire(entry->accept_);
+    entry->send_.reset();
+}
+
+bool EventLoop::IsRegistered(int fd) const
+{
+    const FdEntry* entry = _Entry(fd);
+    return entry && entry->registered_;
+}
+
+void EventLoop::_Dispatch(int n)
+{
+    dispatching_ = true;
+    for(int i = 0; i < n; ++i)
+    {
+        const int fd = static_cast<int>(events_[i].data.u64 & 0xFFFFFFFF);
+        const uint32_t generation = static_cast<uint32_t>(events_[i].data.u64 >> 32);
+        FdEntry* entry = _Entry(fd);
+        if(!entry || !entry->registered_ || entry->generation_ != generation)
+            continue;
+        _Ready(entry, generation, events_[i].events);
+    }
+    dispatching_ = false;
+    retired_.clear();
+}
+
+void EventLoop::_Ready(FdEntry* entry, uint32_t generation, uint32_t revents)
+{
+    if((revents & (EPOLLIN | EPOLLPRI | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && entry->read_)
+        entry->read_();
+
+    //the read callback may have unregistered it
+    if(!entry->registered_ || entry->generation_ != generation)
+        return;
+    if((revents & (EPOLLOUT | EPOLLHUP | EPOLLERR)) && (entry->events_ & EPOLLOUT) && entry->write_)
+        entry->write_();
+}
+
+EventLoop::FdEntry* EventLoop::_IoEntry(int fd)
+{
+    if(fd < 0)
+        return nullptr;
+    FdEntry* entry = _Entry(fd);
+    if(entry && entry->registered_)
+        return entry->io_ ? entry : nullptr;
+
+    if(uring_)
+    {
+        entry = _NewEntry(fd);
+        ++entry->generation_;
+        entry->registered_ = true;
+    }
+    else
+    {
+        //recv/accept on readable, the rest of the output on writable
+        if(!Register(fd, [this, fd]() { _OnReadable(fd); }, [this, fd]() {
+                FdEntry* e = _Entry(fd);
+                _Flush(fd, e);
+            }))
+            return nullptr;
+        entry = _Entry(fd);
+    }
+    entry->io_ = true;
+    return entry;
+}
+
+bool EventLoop::StartRecv(int fd, RecvCallback onData)
+{
+    assert(IsInLoopThread());
+    FdEntry* entry = _IoEntry(fd);
+    if(!entry || entry->recv_ || entry->accept_)
+        return false;
+
+    entry->recv_ = std::move(onData);
+    if(uring_)
+        return _SubmitRecv(fd, entry);
+    //what came before was reported to no one; a MOD reports it again
+    return _Control(EPOLL_CTL_MOD, fd, entry);
+}
+
+bool EventLoop::StartAccept(int fd, AcceptCallback onAccept)
+{
+    assert(IsInLoopThread());
+    FdEntry* entry = _IoEntry(fd);
+    if(!entry || entry->recv_ || entry->accept_)
+        return false;
+
+    entry->accept_ = std::move(onAccept);
+    if(uring_)
+        return _SubmitAccept(fd, entry);
+    return _Control(EPOLL_CTL_MOD, fd, entry);
+}
+
+bool EventLoop::Send(int fd, BufferVector&& data, SendCallback onSent)
+{
+    assert(IsInLoopThread());
+    FdEntry* entry = _IoEntry(fd);
+    if(!entry)
+        return false;
+    if(!entry->send_)
+        entry->send_.reset(new SendState);
+
+    SendState* send = entry->send_.get();
+    send->total_ += data.Totalbytes();
+    if(send->queued_.Isempty())
+    {
+        send->queued_ = std::move(data);
+    }
+    else
+    {
+        for(Buffer& buf : data)
+            send->queued_.Push(std::move(buf));
+    }
+    if(onSent)
+        send->done_.emplace_back(send->total_, std::move(onSent));
+
+    if(uring_)
+    {
+        //one sendmsg at a time keeps the order; the next takes all queued meanwhile
+        if(!(entry->armed_ & (1u << kOpSend)))
+            return _SubmitSend(fd, entry);
+        return true;
+    }
+    //blocked: the rest goes when writable
+    if(!(entry->events_ & EPOLLOUT))
+        _Flush(fd, entry);
+    return true;
+}
+
+std::size_t EventLoop::PendingSend(int fd) const
+{
+    const FdEntry* entry = _Entry(fd);
+    if(!entry || !entry->registered_ || !entry->send_)
+        return 0;
+    return static_cast<std::size_t>(entry->send_->total_ - entry->send_->sent_);
+}
+
+void EventLoop::_OnReadable(int fd)
+{
+    FdEntry* entry = _Entry(fd);
+    const uint32_t generation = entry->generation_;
+    //each callback may unregister the fd
+    auto alive = [entry, generation]() { return entry->registered_ && entry->generation_ == generation; };
+
+    while(alive() && entry->accept_)
+    {
+        const int conn = ::accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(conn >= 0)
+        {
+            entry->accept_(conn);
+            continue;
+        }
+        if(errno == EINTR || errno == ECONNABORTED)
+            continue;
+        if(errno == EAGAIN)
+            break;
+        entry->accept_(-errno);
+        //EMFILE and the like: edge triggered, so nothing wakes us for the queued ones
+        if(alive() && entry->accept_ && !(entry->armed_ & (1u << kOpAccept)))
+        {
+            entry->armed_ |= 1u << kOpAccept;
+            timers_.ScheduleAfter(DurationMs(kAcceptRetryMs), [this, fd, generation]() {
+                FdEntry* e = _Entry(fd);
+                if(!e || e->generation_ != generation)
+                    return;
+                e->armed_ &= ~(1u << kOpAccept);
+                if(e->registered_ && e->accept_)
+                    _OnReadable(fd);
+            });
+        }
+        break;
+    }
+
+    if(alive() && entry->recv_ && !scratch_)
+        scratch_.reset(new char[kRecvBufferSize]);
+    while(alive() && entry->recv_)
+    {
+        const ssize_t n = ::read(fd, scratch_.get(), kRecvBufferSize);
+        if(n > 0)
+        {
+            entry->recv_(scratch_.get(), static_cast<std::size_t>(n), 0);
+            continue;
+        }
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0 && errno == EAGAIN)
+            break;
+
+        const int error = n == 0 ? 0 : -errno;
+        RecvCallback f = std::move(entry->recv_);
+        entry->recv_ = nullptr;
+        f(nullptr, 0, error);
+        break;
+    }
+}
+
+void EventLoop::_Flush(int fd, FdEntry* entry)
+{
+    SendState* send = entry->send_.get();
+    if(!send)
+        return;
+
+    //the callbacks run last, they may Send or Unregister
+    std::vector<SendCallback> due;
+    while(!send->queued_.Isempty())
+    {
+        iovec iov[kMaxIov];
+        msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = GatherIov(send->queued_, iov, kMaxIov);
+        const ssize_t n = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN)
+                break;
+            const int error = -errno;
+            _FailSends(fd, entry, &due);
+            RunDue(due, error);
+            return;
+        }
+        send->queued_.Consume(static_cast<std::size_t>(n));
+        send->sent_ += static_cast<uint64_t>(n);
+    }
+    TakeDue(send->done_, send->sent_, &due);
+    EnableWrite(fd, !send->queued_.Isempty());
+    RunDue(due, 0);
+}
+
+void EventLoop::_FailSends(int fd, FdEntry* entry, std::vector<SendCallback>* due)
+{
+    SendState* send = entry->send_.get();
+    for(auto& done : send->done_)
+        due->push_back(std::move(done.second));
+    send->done_.clear();
+    send->queued_.Clear();
+    send->inflight_.Clear();
+    send->sent_ = send->total_;
+    if(!uring_)
+        EnableWrite(fd, false);
+}
+
+void EventLoop::RunInLoop(Callback f)
+{
+    if(IsInLoopThread())
+        f();
+    else
+        QueueInLoop(std::move(f));
+}
+
+void EventLoop::QueueInLoop(Callback f)
+{
+    Task* task = new Task;
+    task->func_ = std::move(f);
+    tasks_.Push(task);
+    //the loop thread looks at the queue before it sleeps
+    if(!IsInLoopThread())
+        _Wakeup();
+}
+
+void EventLoop::_RunTasks()
+{
+    //from here on a new task writes the eventfd again; the exchange makes the
+    //tasks pushed before an earlier write visible to the pops below
+    wakeupPending_.exchange(false, std::memory_order_acq_rel);
+
+    //a bounded batch, tasks queuing tasks don't starve the fds
+    for(int i = 0; i < kMaxTasksPerIteration; ++i)
+    {
+        MpscNode* node = tasks_.Pop();
+        if(!node)
+            break;
+        std::unique_ptr<Task> task(static_cast<Task*>(node));
+        task->func_();
+    }
+}
+
+void EventLoop::_Wakeup()
+{
+    if(wakeupPending_.exchange(true, std::memory_order_acq_rel))
+        return;
+    const uint64_t one = 1;
+    if(::write(wakeupFd_, &one, sizeof one) != sizeof one && errno != EAGAIN)
+        perror("write eventfd");
+}
+
+void EventLoop::_OnWakeup()
+{
+    uint64_t count;
+    while(::read(wakeupFd_, &count, sizeof count) == sizeof count)
+        ;
+}
+
+bool EventLoop::UsePreciseTimers()
+{
+    if(uring_)
+        return true;
+    const int fd = timers_.TimerFd();
+    if(fd < 0)
+        return false;
+    if(IsRegistered(fd))
+        return true;
+    return Register(fd, [fd]() {
+        uint64_t expirations;
+        while(::read(fd, &expirations, sizeof expirations) == sizeof expirations)
+            ;
+    });
+}
+
+bool EventLoop::_SubmitPoll(int fd, FdEntry* entry)
+{
+    io_uring_sqe* sqe = uring_->GetSqe();
+    if(!sqe)
+        return false;
+    //multishot polls are edge-triggered unless IORING_POLL_ADD_LEVEL
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    sqe->poll32_events = entry->events_;
+    sqe->user_data = _Key(kOpPoll, fd, entry);
+    entry->armed_ |= 1u << kOpPoll;
+    return true;
+}
+
+bool EventLoop::_SubmitRecv(int fd, FdEntry* entry)
+{
+    io_uring_sqe* sqe = uring_->GetSqe();
+    if(!sqe)
+        return false;
+    //len 0: as much as the buffer the kernel picks holds
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = bufRing_->Group();
+    if(multishotRecv_)
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = _Key(kOpRecv, fd, entry);
+    entry->armed_ |= 1u << kOpRecv;
+    return true;
+}
+
+bool EventLoop::_SubmitAccept(int fd, FdEntry* entry)
+{
+    io_uring_sqe* sqe = uring_->GetSqe();
+    if(!sqe)
+        return false;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = _Key(kOpAccept, fd, entry);
+    entry->armed_ |= 1u << kOpAccept;
+    return true;
+}
+
+bool EventLoop::_SubmitSend(int fd, FdEntry* entry)
+{
+    SendState* send = entry->send_.get();
+    if(send->inflight_.Isempty())
+    {
+        if(send->queued_.Isempty())
+            return true;
+        std::swap(send->inflight_, send->queued_);
+    }
+
+    io_uring_sqe* sqe = uring_->GetSqe();
+    if(!sqe)
+        return false;
+    send->iov_.resize(std::min<std::size_t>(send->inflight_.buffers.size(), IOV_MAX));
+    send->msg_ = {};
+    send->msg_.msg_iov = send->iov_.data();
+    send->msg_.msg_iovlen = GatherIov(send->inflight_, send->iov_.data(), static_cast<int>(send->iov_.size()));
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&send->msg_);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = _Key(kOpSend, fd, entry);
+    entry->armed_ |= 1u << kOpSend;
+    return true;
+}
+
+void EventLoop::_Cancel(int op, int fd, FdEntry* entry)
+{
+    io_uring_sqe* sqe = uring_->GetSqe();
+    if(!sqe)
+        return;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = _Key(op, fd, entry);
+    sqe->user_data = _Key(kOpCancel, fd, entry);
+}
+
+void EventLoop::_OnCompletion(uint64_t key, int32_t res, uint32_t flags)
+{
+    const int op = static_cast<int>(key >> 56);
+    const int fd = static_cast<int>(key & 0xFFFFFFFF);
+    const uint32_t generation = static_cast<uint32_t>(key >> 32) & 0xFFFFFF;
+    FdEntry* entry = _Entry(fd);
+    const bool current = entry && entry->registered_ && (entry->generation_ & 0xFFFFFF) == generation;
+    const bool more = flags & IORING_CQE_F_MORE;
+    if(current && !more && op != kOpCancel)
+        entry->armed_ &= ~(1u << op);
+    //still the same registration after a callback
+    auto alive = [entry, &current, generation]() {
+        return current && entry->registered_ && (entry->generation_ & 0xFFFFFF) == generation;
+    };
+
+    switch(op)
+    {
+    case kOpPoll:
+        if(!current || res < 0)
+            return;
+        _Ready(entry, entry->generation_, static_cast<uint32_t>(res));
+        if(!more && alive())
+            _SubmitPoll(fd, entry);
+        return;
+
+    case kOpRecv:
+    {
+        const bool buffer = flags & IORING_CQE_F_BUFFER;
+        const uint16_t id = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+        if(!current || !entry->recv_)
+        {
+            if(buffer)
+                bufRing_->Recycle(id);
+            return;
+        }
+        if(res > 0)
+        {
+            entry->recv_(bufRing_->Data(id), static_cast<std::size_t>(res), 0);
+            bufRing_->Recycle(id);
+            if(!more && alive() && entry->recv_ && !(entry->armed_ & (1u << kOpRecv)))
+                _SubmitRecv(fd, entry);
+            return;
+        }
+        if(buffer)
+            bufRing_->Recycle(id);
+        //ENOBUFS: the ring ran dry with completions not reaped yet, they are by now
+        if(res == -ENOBUFS || (res == -EINVAL && multishotRecv_))
+        {
+            //EINVAL: no multishot recv before 6.0
+            if(res == -EINVAL)
+                multishotRecv_ = false;
+            _SubmitRecv(fd, entry);
+            return;
+        }
+        RecvCallback f = std::move(entry->recv_);
+        entry->recv_ = nullptr;
+        f(nullptr, 0, res < 0 ? res : 0);
+        return;
+    }
+
+    case kOpAccept:
+        if(!current || !entry->accept_)
+        {
+            if(res >= 0)
+                ::close(res);
+            return;
+        }
+        entry->accept_(res);
+        if(more || !alive() || !entry->accept_ || (entry->armed_ & (1u << kOpAccept)))
+            return;
+        if(res >= 0)
+        {
+            _SubmitAccept(fd, entry);
+            return;
+        }
+        //EMFILE and the like: again a bit later, not in a loop
+        timers_.ScheduleAfter(DurationMs(kAcceptRetryMs), [this, fd, generation]() {
+            FdEntry* e = _Entry(fd);
+            if(e && e->registered_ && (e->generation_ & 0xFFFFFF) == generation && e->accept_ &&
+               !(e->armed_ & (1u << kOpAccept)))
+                _SubmitAccept(fd, e);
+        });
+        return;
+
+    case kOpSend:
+    {
+        if(!current)
+        {
+            orphans_.erase(key);
+            return;
+        }
+        SendState* send = entry->send_.get();
+        std::vector<SendCallback> due;
+        if(res < 0)
+        {
+            _FailSends(fd, entry, &due);
+            RunDue(due, res);
+            return;
+        }
+        send->inflight_.Consume(static_cast<std::size_t>(res));
+        send->sent_ += static_cast<uint64_t>(res);
+        TakeDue(send->done_, send->sent_, &due);
+        if(!_SubmitSend(fd, entry))
+        {
+            std::vector<SendCallback> failed;
+            _FailSends(fd, entry, &failed);
+            RunDue(due, 0);
+            RunDue(failed, -EBUSY);
+            return;
+        }
+        RunDue(due, 0);
+        return;
+    }
+
+    default:
+        return;
+    }
+}
+
+}
+//end namespace mrpc
@@ -0,0 +1,255 @@
+#ifndef EVENTLOOP_H_
+#define EVENTLOOP_H_
+
+// Event loop of one thread, around edge-triggered epoll
+// One iteration:
+//   wait in epoll_wait till an fd is ready, a task is queued or the nearest timer
+//   is due (TimerManager::NearestTimer() is the timeout); refresh the LoopClock;
+//   run the callbacks of the ready fds, a batch of events at a time; Update() the
+//   timers; run the tasks queued by QueueInLoop().
+//
+// Fds are registered edge-triggered: a callback is called once per readiness
+// change, so it must read or write till EAGAIN. Write interest is off unless
+// asked for, to be turned on only while there is output pending.
+// EPOLLHUP/EPOLLERR go to the read callback, and to the write one if enabled; a
+// read or write then reports the error.
+//
+// Only QueueInLoop, RunInLoop, Quit and the Remote* methods of Timers() may be
+// called from other threads. Tasks go through a lock-free MpscQueue; the eventfd
+// is written once per batch of them, only when the loop may be asleep.
+//
+// Backends, chosen when the loop is made:
+//   kEpoll: as above.
+//   kUring: io_uring (Uring.h). Registered fds are multishot polls, edge-triggered
+//           too. The SQEs queued in an iteration are submitted by the one
+//           io_uring_enter() that waits for the next, with the nearest timer as
+//           its timeout in ns (no timerfd). Falls back to kEpoll if io_uring is
+//           missing or older than 5.19.
+// StartRecv, StartAccept and Send are completion style and the same on both: on
+// io_uring multishot recv into a provided buffer ring, multishot accept and
+// sendmsg; on epoll readiness with read, accept4 and sendmsg till EAGAIN. An fd
+// used by them is not to be Register()ed.
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include "../util/Buffer.h"
+#include "../util/LoopClock.h"
+#include "../util/MpscQueue.h"
+#include "../util/Timer.h"
+
+namespace mrpc
+{
+
+namespace internal
+{
+class Uring;
+class BufferRing;
+}
+
+enum class LoopBackend
+{
+    kEpoll,
+    kUring,
+};
+
+class EventLoop final
+{
+public:
+    using Callback = std::function<void ()>;
+    //data is good during the call only; len 0 with error 0: the peer closed;
+    //error: -errno. Either of the two ends receiving.
+    using RecvCallback = std::function<void (const char* data, std::size_t len, int error)>;
+    //a new nonblocking connection, or -errno; accepting goes on
+    using AcceptCallback = std::function<void (int fd)>;
+    //0 once the kernel took all the data, -errno when the fd failed
+    using SendCallback = std::function<void (int error)>;
+
+    //bound to the thread constructing it
+    explicit EventLoop(LoopBackend backend = LoopBackend::kEpoll);
+    ~EventLoop();
+
+    EventLoop(const EventLoop& ) = delete;
+    void operator= (const EventLoop& ) = delete;
+
+    //run till Quit()
+    void Loop();
+    //one iteration, waiting at most timeoutMs (-1: till the nearest timer)
+    void RunOnce(int timeoutMs = -1);
+    //from any thread; Loop() returns after the current iteration
+    void Quit();
+
+    //the fd must be nonblocking; onWrite is called only while write is enabled
+    bool Register(int fd, Callback onRead, Callback onWrite = nullptr, bool write = false);
+    bool EnableWrite(int fd, bool enable);
+    //report the fd again next iteration if it's still ready, for a callback that
+    //stopped before EAGAIN so as not to starve the others
+    bool Rearm(int fd);
+    //before closing the fd; its callbacks may be the ones running
+    void Unregister(int fd);
+    bool IsRegistered(int fd) const;
+
+    //the fd must be a nonblocking socket; Unregister() stops it all and drops what
+    //is left to send, those callbacks not called
+    bool StartRecv(int fd, RecvCallback onData);
+    bool StartAccept(int fd, AcceptCallback onAccept);
+    //queue data after what's queued for fd; onSent may be called before Send returns
+    bool Send(int fd, BufferVector&& data, SendCallback onSent = nullptr);
+    //bytes queued for fd the kernel didn't take yet
+    std::size_t PendingSend(int fd) const;
+
+    //the backend in use, kEpoll after a fallback
+    LoopBackend Backend() const
+    {
+        return uring_ ? LoopBackend::kUring : LoopBackend::kEpoll;
+    }
+
+    //run f now if on the loop thread, else queue it
+    void RunInLoop(Callback f);
+    //run f on the loop thread at the end of the iteration, from any thread
+    void QueueInLoop(Callback f);
+
+    bool IsInLoopThread() const
+    {
+        return std::this_thread::get_id() == thread_;
+    }
+
+    //the loop running on this thread, nullptr if none
+    static EventLoop* Current()
+    {
+        return current_;
+    }
+
+    //the timers of this loop, attached to its thread while it runs
+    internal::TimerManager& Timers()
+    {
+        return timers_;
+    }
+    LoopClock& Clock()
+    {
+        return clock_;
+    }
+
+    //wake up on the timerfd of the timers, for timers with a slack under 1ms; by
+    //default the wait is rounded up to whole milliseconds. io_uring waits in ns anyway.
+    bool UsePreciseTimers();
+
+    //iterations so far
+    uint64_t Iterations() const
+    {
+        return iterations_;
+    }
+
+private:
+    struct Task : public MpscNode
+    {
+        Callback func_;
+    };
+
+    struct SendState;
+
+    //by fd; epoll events and io_uring completions carry fd and generation, so one
+    //for an fd unregistered earlier in the batch is dropped
+    struct FdEntry
+    {
+        Callback read_;
+        Callback write_;
+        RecvCallback recv_;
+        AcceptCallback accept_;
+        std::unique_ptr<SendState> send_;
+        uint32_t events_ = 0;
+        uint32_t generation_ = 0;
+        bool registered_ = false;
+        bool io_ = false;           // by StartRecv/StartAccept/Send
+        uint8_t armed_ = 0;         // io_uring: requests in the kernel, a bit per kind; epoll: an accept retry
+    };
+
+    //io_uring user_data: kind << 56 | generation (24 bits) << 32 | fd
+    enum Op
+    {
+        kOpPoll = 1,
+        kOpRecv,
+        kOpAccept,
+        kOpSend,
+        kOpCancel,
+    };
+
+    static constexpr std::size_t kInitEvents = 64;
+    static constexpr std::size_t kMaxEvents = 4096;
+    static constexpr int kMaxTasksPerIteration = 1024;
+    static constexpr unsigned kUringEntries = 256;
+    static constexpr unsigned kUringCqEntries = 4096;
+    static constexpr unsigned kRecvBuffers = 128;
+    static constexpr unsigned kRecvBufferSize = 16384;
+    static constexpr int kMaxIov = 64;
+    static constexpr int kAcceptRetryMs = 10;
+
+    FdEntry* _Entry(int fd) const;
+    FdEntry* _NewEntry(int fd);
+    FdEntry* _IoEntry(int fd);
+    bool _Control(int op, int fd, FdEntry* entry);
+    bool _UpdatePoll(int fd, FdEntry* entry);
+    void _WaitEpoll(int timeoutMs);
+    void _Dispatch(int n);
+    void _Ready(FdEntry* entry, uint32_t generation, uint32_t revents);
+    void _OnReadable(int fd);
+    void _Flush(int fd, FdEntry* entry);
+    void _FailSends(int fd, FdEntry* entry, std::vector<SendCallback>* due);
+    void _RunTasks();
+    void _Wakeup();
+    void _OnWakeup();
+    int _Timeout();
+    //callbacks replaced while dispatching die after the batch, not under their own feet
+    template <typename F>
+    void _Retire(F& f);
+
+    bool _InitUring();
+    void _WaitUring(int timeoutMs);
+    void _OnCompletion(uint64_t key, int32_t res, uint32_t flags);
+    uint64_t _Key(int op, int fd, const FdEntry* entry) const
+    {
+        return static_cast<uint64_t>(op) << 56 | static_cast<uint64_t>(entry->generation_ & 0xFFFFFF) << 32 |
+               static_cast<uint32_t>(fd);
+    }
+    bool _SubmitPoll(int fd, FdEntry* entry);
+    bool _SubmitRecv(int fd, FdEntry* entry);
+    bool _SubmitAccept(int fd, FdEntry* entry);
+    bool _SubmitSend(int fd, FdEntry* entry);
+    void _Cancel(int op, int fd, FdEntry* entry);
+
+    const std::thread::id thread_;
+    int epfd_;
+    const int wakeupFd_;
+
+    std::unique_ptr<internal::Uring> uring_;
+    std::unique_ptr<internal::BufferRing> bufRing_;
+    bool multishotRecv_;
+    //sends of unregistered fds the kernel still reads from, by user_data
+    std::unordered_map<uint64_t, std::unique_ptr<SendState>> orphans_;
+    //epoll: what a recv reads into
+    std::unique_ptr<char[]> scratch_;
+
+    std::vector<epoll_event> events_;
+    std::vector<std::unique_ptr<FdEntry>> fds_;
+    std::vector<Callback> retired_;
+    bool dispatching_;
+
+    MpscQueue tasks_;
+    std::atomic<bool> wakeupPending_;
+    std::atomic<bool> quit_;
+
+    LoopClock clock_;
+    internal::TimerManager timers_;
+    uint64_t iterations_;
+
+    static thread_local EventLoop* current_;
+};
+
+}   // end namespace mrpc
+
+#endif
@@ -0,0 +1,206 @@
+#include <cassert>
+#include <cstring>
+#include <limits>
+#include <endian.h>
+
+#include "RpcFrame.h"
+#include "../util/Crc32c.h"
+
+namespace mrpc
+{
+
+constexpr std::size_t FrameDecoder::kDefaultMaxPayload;
+
+namespace
+{
+
+//header offsets
+constexpr std::size_t kMagicOffset = 0;
+constexpr std::size_t kVersionOffset = 2;
+constexpr std::size_t kFlagsOffset = 3;
+constexpr std::size_t kLengthOffset = 4;
+constexpr std::size_t kRequestIdOffset = 8;
+constexpr std::size_t kMethodIdOffset = 16;
+constexpr std::size_t kCrcOffset = 20;
+
+static_assert(kCrcOffset + 4 == kFrameHeaderSize, "frame header layout");
+
+inline void Put16(char* p, uint16_t v)
+{
+    v = htole16(v);
+    memcpy(p, &v, sizeof v);
+}
+
+inline void Put32(char* p, uint32_t v)
+{
+    v = htole32(v);
+    memcpy(p, &v, sizeof v);
+}
+
+inline void Put64(char* p, uint64_t v)
+{
+    v = htole64(v);
+    memcpy(p, &v, sizeof v);
+}
+
+inline uint16_t Get16(const char* p)
+{
+    uint16_t v;
+    memcpy(&v, p, sizeof v);
+    return le16toh(v);
+}
+
+inline uint32_t Get32(const char* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof v);
+    return le32toh(v);
+}
+
+inline uint64_t Get64(const char* p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof v);
+    return le64toh(v);
+}
+
+//everything but the crc, which is filled in once the payload is summed
+void WriteHeader(const FrameHeader& header, char* p)
+{
+    Put16(p + kMagicOffset, kFrameMagic);
+    p[kVersionOffset] = static_cast<char>(kFrameVersion);
+    p[kFlagsOffset] = static_cast<char>(header.flags);
+    Put32(p + kLengthOffset, header.length);
+    Put64(p + kRequestIdOffset, header.requestId);
+    Put32(p + kMethodIdOffset, header.methodId);
+    Put32(p + kCrcOffset, 0);
+}
+
+void SealHeader(char* p, uint32_t payloadCrc)
+{
+    Put32(p + kCrcOffset, MaskCrc(payloadCrc));
+}
+
+//into the spare room of the Buffer before it, if any: never grow that one, it
+//may be a payload that would be copied then
+void PushCopied(const char* data, std::size_t len, BufferVector* out)
+{
+    if(!out->Isempty() && out->buffers.back().writablesize() > len)
+    {
+        out->buffers.back().PushData(data, len);
+        out->totalbytes += len;
+        return;
+    }
+    out->Append(Buffer(data, len));
+}
+
+}   // end namespace
+
+FrameStatus ParseFrame(const char* data, std::size_t size, std::size_t maxPayload, Frame* frame)
+{
+    if(size < kFrameHeaderSize)
+        return FrameStatus::kIncomplete;
+    if(Get16(data + kMagicOffset) != kFrameMagic)
+        return FrameStatus::kBadMagic;
+    if(static_cast<uint8_t>(data[kVersionOffset]) != kFrameVersion)
+        return FrameStatus::kBadVersion;
+
+    FrameHeader& header = frame->header;
+    header.flags = static_cast<uint8_t>(data[kFlagsOffset]);
+    header.length = Get32(data + kLengthOffset);
+    header.requestId = Get64(data + kRequestIdOffset);
+    header.methodId = Get32(data + kMethodIdOffset);
+    if(header.length > maxPayload)
+        return FrameStatus::kTooLarge;
+    if(size - kFrameHeaderSize < header.length)
+        return FrameStatus::kIncomplete;
+
+    const char* payload = data + kFrameHeaderSize;
+    if(header.flags & kFrameCrc)
+    {
+        const uint32_t crc = Crc32c(payload, header.length, Crc32c(data, kCrcOffset));
+        if(MaskCrc(crc) != Get32(data + kCrcOffset))
+            return FrameStatus::kBadCrc;
+    }
+    frame->payload.data = payload;
+    frame->payload.len = header.length;
+    return FrameStatus::kOk;
+}
+
+void EncodeFrame(FrameHeader header, Buffer&& payload, BufferVector* out)
+{
+    assert(payload.readablesize() <= std::numeric_limits<uint32_t>::max());
+    header.length = static_cast<uint32_t>(payload.readablesize());
+
+    char head[kFrameHeaderSize];
+    WriteHeader(header, head);
+    if(header.flags & kFrameCrc)
+    {
+        uint32_t crc = Crc32c(head, kCrcOffset);
+        if(header.length > 0)
+            crc = Crc32c(payload.readaddr(), header.length, crc);
+        SealHeader(head, crc);
+    }
+
+    PushCopied(head, kFrameHeaderSize, out);
+    out->Append(std::move(payload));
+}
+
+void EncodeFrame(FrameHeader header, BufferVector&& payload, BufferVector* out)
+{
+    assert(payload.Totalbytes() <= std::numeric_limits<uint32_t>::max());
+    header.length = static_cast<uint32_t>(payload.Totalbytes());
+
+    char head[kFrameHeaderSize];
+    WriteHeader(header, head);
+    if(header.flags & kFrameCrc)
+    {
+        uint32_t crc = Crc32c(head, kCrcOffset);
+        for(const Buffer& buf : payload)
+        {
+            if(buf.readablesize() > 0)
+                crc = Crc32c(buf.readaddr(), buf.readablesize(), crc);
+        }
+        SealHeader(head, crc);
+    }
+
+    PushCopied(head, kFrameHeaderSize, out);
+    for(Buffer& buf : payload)
+        out->Append(std::move(buf));
+    payload.Clear();
+}
+
+void EncodeFrame(FrameHeader header, const void* data, std::size_t len, BufferVector* out)
+{
+    assert(len <= std::numeric_limits<uint32_t>::max());
+    header.length = static_cast<uint32_t>(len);
+
+    char head[kFrameHeaderSize];
+    WriteHeader(header, head);
+    if(header.flags & kFrameCrc)
+    {
+        uint32_t crc = Crc32c(head, kCrcOffset);
+        if(len > 0)
+            crc = Crc32c(data, len, crc);
+        SealHeader(head, crc);
+    }
+
+    //the whole frame into the spare room of the Buffer before, or a new one
+    if(!out->Isempty() && out->buffers.back().writablesize() > kFrameHeaderSize + len)
+    {
+        Buffer& back = out->buffers.back();
+        back.PushData(head, kFrameHeaderSize);
+        if(len > 0)
+            back.PushData(data, len);
+        out->totalbytes += kFrameHeaderSize + len;
+        return;
+    }
+    Buffer frame;
+    frame.Assurespace(kFrameHeaderSize + len);
+    frame.PushData(head, kFrameHeaderSize);
+    if(len > 0)
+        frame.PushData(data, len);
+    out->Append(std::move(frame));
+}
+
+}   // end namespace mrpc
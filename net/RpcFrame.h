@@ -0,0 +1,137 @@
+#ifndef RPCFRAME_H_
+#define RPCFRAME_H_
+
+// Length-prefixed RPC frames
+// A frame is a fixed 24 byte header, little-endian, then the payload:
+//   | magic(2) | version(1) | flags(1) | payload length(4) | request id(8) | method id(4) | crc(4) |
+// With kFrameCrc set, crc is the masked crc32c of the first 20 header bytes and
+// the payload; 0 otherwise.
+//
+// Decoding copies nothing: the payload of a frame is a Slice into the input
+// Buffer, consumed once the handler returned. Encoding copies no payload either:
+// the header goes into the spare room of the last Buffer or a Buffer of its own,
+// and the payload Buffers are moved behind it as they are.
+
+#include <cstddef>
+#include <stdint.h>
+#include "../util/Buffer.h"
+
+namespace mrpc
+{
+
+constexpr uint16_t kFrameMagic = 0x4d52;           // "RM" on the wire
+constexpr uint8_t kFrameVersion = 1;
+constexpr std::size_t kFrameHeaderSize = 24;
+
+//flags
+constexpr uint8_t kFrameCrc = 0x01;                 // crc field is checked
+constexpr uint8_t kFrameResponse = 0x02;            // answers the request of the same id
+
+struct FrameHeader
+{
+    uint8_t flags = 0;
+    uint64_t requestId = 0;
+    uint32_t methodId = 0;
+    uint32_t length = 0;                            // of the payload, set by the encoder
+};
+
+struct Frame
+{
+    FrameHeader header;
+    Slice payload;                                  // view into the decoded input
+};
+
+enum class FrameStatus
+{
+    kOk,
+    kIncomplete,                                    // more bytes needed, nothing wrong yet
+    kBadMagic,
+    kBadVersion,
+    kTooLarge,                                      // payload length beyond the limit
+    kBadCrc,
+};
+
+//parse the frame at the front of data; the header is checked as soon as it is
+//there, so garbage fails without waiting for a payload that never comes.
+//kIncomplete with size >= kFrameHeaderSize: frame->header is filled already
+FrameStatus ParseFrame(const char* data, std::size_t size, std::size_t maxPayload, Frame* frame);
+
+//append header and payload to out; header.length is the payload size
+void EncodeFrame(FrameHeader header, Buffer&& payload, BufferVector* out);
+void EncodeFrame(FrameHeader header, BufferVector&& payload, BufferVector* out);
+//small payloads: copied behind the header, one Buffer in all
+void EncodeFrame(FrameHeader header, const void* data, std::size_t len, BufferVector* out);
+
+//frames out of a byte stream, e.g. the input of a TcpConnection
+class FrameDecoder
+{
+public:
+    static constexpr std::size_t kDefaultMaxPayload = 64 * 1024 * 1024;
+
+    explicit FrameDecoder(std::size_t maxPayload = kDefaultMaxPayload):maxPayload_(maxPayload),
+                                                                       status_(FrameStatus::kOk),
+                                                                       wanted_(kFrameHeaderSize),
+                                                                       frames_(0)
+    {
+    }
+
+    //handler(const Frame&) for every complete frame at the front of input, each
+    //consumed after the handler returned: the payload is valid till then and the
+    //handler must not touch input. Incomplete tails stay in input for next time.
+    //false once the stream is bad, Status() tells why; the connection is done then
+    template <typename Handler>
+    bool Decode(Buffer& input, Handler&& handler);
+
+    FrameStatus Status() const
+    {
+        return status_;
+    }
+    //bytes input needs in all to complete the next frame, to reserve ahead
+    std::size_t Wanted() const
+    {
+        return wanted_;
+    }
+    uint64_t Frames() const
+    {
+        return frames_;
+    }
+
+private:
+    const std::size_t maxPayload_;
+    FrameStatus status_;
+    std::size_t wanted_;
+    uint64_t frames_;
+};
+
+template <typename Handler>
+bool FrameDecoder::Decode(Buffer& input, Handler&& handler)
+{
+    if(status_ != FrameStatus::kOk)
+        return false;
+
+    Frame frame;
+    while(input.readablesize() > 0)
+    {
+        const FrameStatus status = ParseFrame(input.readaddr(), input.readablesize(), maxPayload_, &frame);
+        if(status == FrameStatus::kIncomplete)
+        {
+            wanted_ = input.readablesize() < kFrameHeaderSize ? kFrameHeaderSize
+                                                              : kFrameHeaderSize + frame.header.length;
+            return true;
+        }
+        if(status != FrameStatus::kOk)
+        {
+            status_ = status;
+            return false;
+        }
+        handler(static_cast<const Frame&>(frame));
+        input.Consume(kFrameHeaderSize + frame.header.length);
+        ++frames_;
+    }
+    wanted_ = kFrameHeaderSize;
+    return true;
+}
+
+}   // end namespace mrpc
+
+#endif
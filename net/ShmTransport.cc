@@ -0,0 +1,571 @@
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../util/Futex.h"
+#include "ShmTransport.h"
+
+namespace mrpc
+{
+
+namespace internal
+{
+
+// lives at the beginning of the shared region, the two sides touch
+// different cache lines
+struct ShmRingHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+    uint32_t mpsc;
+
+    // written by the consumer
+    alignas(64) std::atomic<uint64_t> head;
+    std::atomic<uint32_t> spaceSeq;         // futex word, producers wait for space
+    std::atomic<uint32_t> consumerWaiting;
+    std::atomic<int32_t> consumerPid;
+
+    // written by the producers
+    alignas(64) std::atomic<uint64_t> tail;
+    std::atomic<uint32_t> dataSeq;          // futex word, the consumer waits for data
+    std::atomic<uint32_t> producerWaiting;
+    std::atomic<int32_t> producerLock;      // mpsc only, pid of the owner or 0
+    std::atomic<int32_t> producerPids[ShmRing::kMaxProducers];
+};
+
+}   // end namespace internal
+
+using internal::ShmRingHeader;
+
+static const uint32_t kRingMagic = 0x4D52494E;     // "MRIN"
+static const uint32_t kRingVersion = 2;
+static const std::size_t kFrameHeader = 8;
+static const uint32_t kWrapMarker = 0xFFFFFFFF;
+static const int kDefaultSpin = 2048;
+static const int kLivenessCheckMs = 100;    // sleep at most so long between pid checks
+
+static std::size_t HeaderSize()
+{
+    return (sizeof(ShmRingHeader) + 63) & ~std::size_t(63);
+}
+
+static std::size_t Align8(std::size_t len)
+{
+    return (len + 7) & ~std::size_t(7);
+}
+
+static int64_t NowMs()
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// sleep on word for at most ms, unless it is not expected any more
+static void SleepOn(std::atomic<uint32_t>* word, uint32_t expected, int ms)
+{
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000L;
+    internal::FutexWait(word, expected, &ts, true);
+}
+
+// spinning only helps if the peer runs on another cpu meanwhile
+static int DefaultSpin()
+{
+    static const int spin = ::sysconf(_SC_NPROCESSORS_ONLN) > 1 ? kDefaultSpin : 0;
+    return spin;
+}
+
+ShmRing::ShmRing():header_(nullptr),
+                   data_(nullptr),
+                   capacity_(0),
+                   pending_(0),
+                   skip_(0),
+                   spin_(DefaultSpin())
+{}
+
+std::size_t ShmRing::RegionSize(std::size_t capacity)
+{
+    return HeaderSize() + capacity;
+}
+
+bool ShmRing::Init(void* mem, std::size_t capacity, bool mpsc)
+{
+    if(!mem || capacity < 64 || (capacity & (capacity - 1)) != 0)
+        return false;
+
+    header_ = new (mem) ShmRingHeader();
+    header_->capacity = capacity;
+    header_->mpsc = mpsc ? 1 : 0;
+    header_->head = 0;
+    header_->tail = 0;
+    header_->spaceSeq = 0;
+    header_->dataSeq = 0;
+    header_->consumerWaiting = 0;
+    header_->producerWaiting = 0;
+    header_->producerLock = 0;
+    header_->consumerPid = 0;
+    for(auto& pid : header_->producerPids)
+        pid = 0;
+    header_->version = kRingVersion;
+    std::atomic_thread_fence(std::memory_order_release);
+    header_->magic = kRingMagic;
+
+    data_ = static_cast<char*>(mem) + HeaderSize();
+    capacity_ = capacity;
+    pending_ = 0;
+    return true;
+}
+
+bool ShmRing::Attach(void* mem, std::size_t size)
+{
+    auto header = static_cast<ShmRingHeader*>(mem);
+    if(!mem || size < HeaderSize() || header->magic != kRingMagic || header->version != kRingVersion)
+        return false;
+    if(RegionSize(header->capacity) > size)
+        return false;
+
+    header_ = header;
+    data_ = static_cast<char*>(mem) + HeaderSize();
+    capacity_ = header->capacity;
+    pending_ = 0;
+    return true;
+}
+
+// a zombie counts as alive until it is reaped
+static bool ProcessAlive(int32_t pid)
+{
+    return ::kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+bool ShmRing::SetProducer()
+{
+    const int32_t self = ::getpid();
+    for(auto& slot : header_->producerPids)
+    {
+        if(slot.load(std::memory_order_relaxed) == self)
+            return true;
+    }
+    // a free slot, or one left by a dead producer
+    for(auto& slot : header_->producerPids)
+    {
+        int32_t pid = slot.load(std::memory_order_relaxed);
+        if((pid == 0 || !ProcessAlive(pid)) && slot.compare_exchange_strong(pid, self, std::memory_order_relaxed))
+            return true;
+    }
+    return false;
+}
+
+void ShmRing::SetConsumer()
+{
+    header_->consumerPid = ::getpid();
+}
+
+std::size_t ShmRing::MaxMessageSize() const
+{
+    // a frame at most half of the ring, so it always fits after a wrap
+    return capacity_ / 2 - kFrameHeader;
+}
+
+// dead once every producer announced is gone, alive if none is announced
+bool ShmRing::_ProducersAlive() const
+{
+    bool announced = false;
+    for(const auto& slot : header_->producerPids)
+    {
+        const int32_t pid = slot.load(std::memory_order_relaxed);
+        if(pid <= 0)
+            continue;
+        if(ProcessAlive(pid))
+            return true;
+        announced = true;
+    }
+    return !announced;
+}
+
+// room for frame after the current tail, skipping the end of ring if it doesn't fit there
+bool ShmRing::_Fits(std::size_t frame) const
+{
+    // head first, tail never falls behind it then
+    const uint64_t head = header_->head.load(std::memory_order_seq_cst);
+    const uint64_t tail = header_->tail.load(std::memory_order_acquire);
+    const std::size_t left = capacity_ - (tail & (capacity_ - 1));
+    const std::size_t need = frame <= left ? frame : left + frame;
+    return capacity_ - (tail - head) >= need;
+}
+
+// a spin lock, held only from _Reserve to _Commit by a mpsc producer
+void ShmRing::_LockProducers()
+{
+    if(!header_->mpsc)
+        return;
+
+    const int32_t self = ::getpid();
+    int spin = 0;
+    while(true)
+    {
+        int32_t owner = 0;
+        if(header_->producerLock.compare_exchange_weak(owner, self, std::memory_order_acquire, std::memory_order_relaxed))
+            return;
+        if(owner == 0)
+            continue;
+        if(++spin < 128)
+        {
+            internal::CpuRelax();
+            continue;
+        }
+        // the owner died before publishing its frame, nothing of it is visible: take over
+        if(!ProcessAlive(owner) &&
+           header_->producerLock.compare_exchange_strong(owner, self, std::memory_order_acquire, std::memory_order_relaxed))
+            return;
+        ::sched_yield();
+    }
+}
+
+void ShmRing::_UnlockProducers()
+{
+    if(header_->mpsc)
+        header_->producerLock.store(0, std::memory_order_release);
+}
+
+char* ShmRing::_Reserve(std::size_t frame, int timeoutMs, Result* result)
+{
+    const int64_t deadline = timeoutMs < 0 ? -1 : NowMs() + timeoutMs;
+    int spin = spin_;
+    while(true)
+    {
+        if(_Fits(frame))
+        {
+            // another producer may have taken the room meanwhile
+            _LockProducers();
+            if(_Fits(frame))
+                break;
+            _UnlockProducers();
+            continue;
+        }
+
+        if(spin-- > 0)
+        {
+            internal::CpuRelax();
+            continue;
+        }
+
+        const int32_t consumer = header_->consumerPid.load(std::memory_order_relaxed);
+        if(consumer > 0 && !ProcessAlive(consumer))
+        {
+            *result = kPeerDead;
+            return nullptr;
+        }
+
+        int wait = kLivenessCheckMs;
+        if(deadline >= 0)
+        {
+            const int64_t rest = deadline - NowMs();
+            if(rest <= 0)
+            {
+                *result = kTimeout;
+                return nullptr;
+            }
+            wait = static_cast<int>(std::min<int64_t>(wait, rest));
+        }
+
+        const uint32_t seq = header_->spaceSeq.load(std::memory_order_acquire);
+        header_->producerWaiting.fetch_add(1, std::memory_order_seq_cst);
+        if(!_Fits(frame))
+            SleepOn(&header_->spaceSeq, seq, wait);
+        header_->producerWaiting.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    const uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+    const std::size_t pos = tail & (capacity_ - 1);
+    const std::size_t left = capacity_ - pos;
+    skip_ = 0;
+    if(frame > left)
+    {
+        // no room for the frame at the end, skip it; published with the frame
+        uint32_t marker = kWrapMarker;
+        memcpy(data_ + pos, &marker, sizeof marker);
+        skip_ = left;
+        return data_;
+    }
+    return data_ + pos;
+}
+
+void ShmRing::_Commit(std::size_t frame)
+{
+    const uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+    header_->tail.store(tail + skip_ + frame, std::memory_order_release);
+    _UnlockProducers();
+
+    // pairs with the consumer announcing itself before its last look at tail
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(header_->consumerWaiting.load(std::memory_order_relaxed))
+    {
+        header_->dataSeq.fetch_add(1, std::memory_order_release);
+        internal::FutexWake(&header_->dataSeq, 1, true);
+    }
+}
+
+ShmRing::Result ShmRing::Send(const void* data, std::size_t len, int timeoutMs)
+{
+    assert(header_);
+    if(len > MaxMessageSize())
+        return kTooLarge;
+
+    const std::size_t frame = kFrameHeader + Align8(len);
+    Result result = kOk;
+    char* dst = _Reserve(frame, timeoutMs, &result);
+    if(!dst)
+        return result;
+
+    const uint32_t len32 = static_cast<uint32_t>(len);
+    memcpy(dst, &len32, sizeof len32);
+    memcpy(dst + kFrameHeader, data, len);
+    _Commit(frame);
+    return kOk;
+}
+
+ShmRing::Result ShmRing::Send(const BufferVector& msg, int timeoutMs)
+{
+    assert(header_);
+    const std::size_t len = msg.Totalbytes();
+    if(len > MaxMessageSize())
+        return kTooLarge;
+
+    const std::size_t frame = kFrameHeader + Align8(len);
+    Result result = kOk;
+    char* dst = _Reserve(frame, timeoutMs, &result);
+    if(!dst)
+        return result;
+
+    const uint32_t len32 = static_cast<uint32_t>(len);
+    memcpy(dst, &len32, sizeof len32);
+    char* p = dst + kFrameHeader;
+    for(const auto& buf : msg)
+    {
+        memcpy(p, buf.readaddr(), buf.readablesize());
+        p += buf.readablesize();
+    }
+    _Commit(frame);
+    return kOk;
+}
+
+ShmRing::Result ShmRing::Receive(Slice* msg, int timeoutMs)
+{
+    assert(header_);
+    if(pending_)
+        Release();
+
+    const int64_t deadline = timeoutMs < 0 ? -1 : NowMs() + timeoutMs;
+    int spin = spin_;
+    while(true)
+    {
+        uint64_t head = header_->head.load(std::memory_order_relaxed);
+        const uint64_t tail = header_->tail.load(std::memory_order_acquire);
+        if(tail != head)
+        {
+            const std::size_t pos = head & (capacity_ - 1);
+            uint32_t len;
+            memcpy(&len, data_ + pos, sizeof len);
+            if(len == kWrapMarker)
+            {
+                pending_ = capacity_ - pos;
+                Release();
+                continue;
+            }
+
+            msg->data = data_ + pos + kFrameHeader;
+            msg->len = len;
+            pending_ = kFrameHeader + Align8(len);
+            return kOk;
+        }
+
+        if(spin-- > 0)
+        {
+            internal::CpuRelax();
+            continue;
+        }
+
+        if(!_ProducersAlive())
+            return kPeerDead;
+
+        int wait = kLivenessCheckMs;
+        if(deadline >= 0)
+        {
+            const int64_t rest = deadline - NowMs();
+            if(rest <= 0)
+                return kTimeout;
+            wait = static_cast<int>(std::min<int64_t>(wait, rest));
+        }
+
+        const uint32_t seq = header_->dataSeq.load(std::memory_order_acquire);
+        header_->consumerWaiting.store(1, std::memory_order_seq_cst);
+        if(header_->tail.load(std::memory_order_seq_cst) == head)
+            SleepOn(&header_->dataSeq, seq, wait);
+        header_->consumerWaiting.store(0, std::memory_order_relaxed);
+    }
+}
+
+void ShmRing::Release()
+{
+    if(!pending_)
+        return;
+
+    const uint64_t head = header_->head.load(std::memory_order_relaxed);
+    header_->head.store(head + pending_, std::memory_order_release);
+    pending_ = 0;
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(header_->producerWaiting.load(std::memory_order_relaxed))
+    {
+        header_->spaceSeq.fetch_add(1, std::memory_order_release);
+        internal::FutexWake(&header_->spaceSeq, INT32_MAX, true);
+    }
+}
+
+static std::size_t RingRegion(std::size_t capacity)
+{
+    static const std::size_t kPageSize = ::sysconf(_SC_PAGESIZE);
+    return (ShmRing::RegionSize(capacity) + kPageSize - 1) & ~(kPageSize - 1);
+}
+
+ShmChannel::ShmChannel():fd_(-1),
+                         memory_(nullptr),
+                         size_(0)
+{}
+
+ShmChannel::~ShmChannel()
+{
+    Close();
+}
+
+void ShmChannel::Close()
+{
+    if(memory_)
+        ::munmap(memory_, size_);
+    if(fd_ != -1)
+        ::close(fd_);
+
+    fd_ = -1;
+    memory_ = nullptr;
+    size_ = 0;
+    out_ = ShmRing();
+    in_ = ShmRing();
+}
+
+bool ShmChannel::CreateMemfd(std::size_t capacity, bool mpsc)
+{
+    Close();
+    int fd = ::memfd_create("mrpc-shm", MFD_CLOEXEC);
+    if(fd == -1)
+    {
+        perror("ShmChannel memfd_create failed");
+        return false;
+    }
+    return _Create(fd, capacity, mpsc);
+}
+
+bool ShmChannel::Create(const std::string& name, std::size_t capacity, bool mpsc)
+{
+    Close();
+    int fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if(fd == -1)
+    {
+        perror("ShmChannel shm_open failed");
+        return false;
+    }
+    return _Create(fd, capacity, mpsc);
+}
+
+void ShmChannel::Unlink(const std::string& name)
+{
+    ::shm_unlink(name.c_str());
+}
+
+bool ShmChannel::_Create(int fd, std::size_t capacity, bool mpsc)
+{
+    fd_ = fd;
+    if(::ftruncate(fd, 2 * RingRegion(capacity)) != 0 || !_Map(fd))
+    {
+        Close();
+        return false;
+    }
+
+    // the creator sends on the first ring and receives on the second
+    char* base = static_cast<char*>(memory_);
+    if(!out_.Init(base, capacity, mpsc) || !in_.Init(base + size_ / 2, capacity, mpsc))
+    {
+        Close();
+        return false;
+    }
+    out_.SetProducer();
+    in_.SetConsumer();
+    return true;
+}
+
+bool ShmChannel::Attach(int fd)
+{
+    Close();
+    fd_ = ::dup(fd);
+    if(fd_ == -1 || !_Map(fd_))
+    {
+        Close();
+        return false;
+    }
+
+    const std::size_t half = size_ / 2;
+    char* base = static_cast<char*>(memory_);
+    if(!in_.Attach(base, half) || !out_.Attach(base + half, half))
+    {
+        Close();
+        return false;
+    }
+    in_.SetConsumer();
+    out_.SetProducer();
+    return true;
+}
+
+bool ShmChannel::Attach(const std::string& name)
+{
+    int fd = ::shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0600);
+    if(fd == -1)
+    {
+        perror("ShmChannel shm_open failed");
+        return false;
+    }
+
+    const bool ok = Attach(fd);
+    ::close(fd);
+    return ok;
+}
+
+bool ShmChannel::_Map(int fd)
+{
+    struct stat st;
+    if(::fstat(fd, &st) != 0 || st.st_size == 0)
+        return false;
+
+    void* mem = ::mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(mem == MAP_FAILED)
+    {
+        perror("ShmChannel mmap failed");
+        return false;
+    }
+
+    memory_ = mem;
+    size_ = st.st_size;
+    return true;
+}
+
+}   // end namespace mrpc
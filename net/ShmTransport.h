@@ -0,0 +1,147 @@
+#ifndef SHMTRANSPORT_H_
+#define SHMTRANSPORT_H_
+
+// Shared-memory transport for peers on the same host
+//
+// ShmRing: a ring of framed messages in shared memory, one direction.
+//   frame: | length(4) | reserved(4) | payload, padded to 8 |
+//   A frame never wraps, a wrap marker fills the end of the ring instead, so a
+//   received message is always one contiguous Slice into the ring.
+//   Single producer by default; with mpsc the producers take a lock in the header
+//   from finding room to publishing the frame, never while waiting for room. The lock
+//   holds the pid of its owner, and is taken over if the owner died meanwhile.
+//   Waiting spins for a while, then sleeps on a futex in the shared header; while
+//   asleep the peers' pids are checked now and then to detect a crashed peer. The
+//   consumer sees the producers dead once every one announced by SetProducer is gone.
+//
+// ShmChannel: two rings in one region (memfd or /dev/shm), one per direction.
+
+#include <string>
+#include <atomic>
+#include <stdint.h>
+#include "../util/Buffer.h"
+
+namespace mrpc
+{
+
+namespace internal
+{
+struct ShmRingHeader;
+}
+
+class ShmRing
+{
+public:
+    enum Result
+    {
+        kOk,
+        kTimeout,
+        kTooLarge,
+        kPeerDead,
+    };
+
+    ShmRing();
+
+    //bytes of shared memory for a ring of capacity bytes, capacity must be a power of 2
+    static std::size_t RegionSize(std::size_t capacity);
+
+    //format the ring in mem, by the creator
+    bool Init(void* mem, std::size_t capacity, bool mpsc = false);
+    //use a ring formatted by the peer
+    bool Attach(void* mem, std::size_t size);
+
+    //announce the pid of this side, for crash detection by the peer.
+    //SetProducer fails if kMaxProducers live producers are announced already
+    bool SetProducer();
+    void SetConsumer();
+
+    static const int kMaxProducers = 16;
+
+    //producer side, timeoutMs < 0 means wait forever
+    Result Send(const void* data, std::size_t len, int timeoutMs = -1);
+    Result Send(const Slice& msg, int timeoutMs = -1)
+    {
+        return Send(msg.data, msg.len, timeoutMs);
+    }
+    //gather the buffers into one message
+    Result Send(const BufferVector& msg, int timeoutMs = -1);
+
+    //consumer side, msg is a view into the ring, valid until Release()
+    Result Receive(Slice* msg, int timeoutMs = -1);
+    void Release();
+
+    //the largest message a ring can carry
+    std::size_t MaxMessageSize() const;
+
+    //spin so many rounds before sleeping on the futex
+    void SetSpin(int spin)
+    {
+        spin_ = spin;
+    }
+
+private:
+    internal::ShmRingHeader* header_;
+    char* data_;
+    std::size_t capacity_;
+    std::size_t pending_;   // size of the frame received but not released
+    std::size_t skip_;      // the end of ring skipped by the frame reserved
+    int spin_;
+
+    //on success the producer lock of a mpsc ring is held until _Commit
+    char* _Reserve(std::size_t frame, int timeoutMs, Result* result);
+    void _Commit(std::size_t frame);
+    bool _Fits(std::size_t frame) const;
+    void _LockProducers();
+    void _UnlockProducers();
+    bool _ProducersAlive() const;
+};
+
+class ShmChannel
+{
+public:
+    ShmChannel();
+    ~ShmChannel();
+
+    ShmChannel(const ShmChannel& ) = delete;
+    void operator= (const ShmChannel& ) = delete;
+
+    //anonymous region by memfd, hand Fd() to the peer by fork or SCM_RIGHTS
+    bool CreateMemfd(std::size_t capacity, bool mpsc = false);
+    //named region in /dev/shm
+    bool Create(const std::string& name, std::size_t capacity, bool mpsc = false);
+
+    //the peer side, by a fd or a name
+    bool Attach(int fd);
+    bool Attach(const std::string& name);
+
+    void Close();
+    //remove the name from /dev/shm, the mappings stay valid
+    static void Unlink(const std::string& name);
+
+    int Fd() const
+    {
+        return fd_;
+    }
+    ShmRing& Out()
+    {
+        return out_;
+    }
+    ShmRing& In()
+    {
+        return in_;
+    }
+
+private:
+    int fd_;
+    void* memory_;
+    std::size_t size_;
+    ShmRing out_;
+    ShmRing in_;
+
+    bool _Create(int fd, std::size_t capacity, bool mpsc);
+    bool _Map(int fd);
+};
+
+}   // end namespace mrpc
+
+#endif
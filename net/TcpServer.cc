@@ -0,0 +1,483 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <thread>
+#include <unordered_map>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "TcpServer.h"
+#include "../util/CpuTopology.h"
+
+namespace mrpc
+{
+
+constexpr std::size_t TcpConnection::kReadSize;
+constexpr std::size_t TcpConnection::kMaxReadPerEvent;
+constexpr int TcpConnection::kMaxIov;
+
+namespace internal
+{
+
+//one loop of the server, its listener and its connections
+struct Reactor
+{
+    TcpServer* server_;
+    int index_;
+    int cpu_;
+    int listenFd_;
+    std::thread thread_;
+    std::atomic<EventLoop*> loop_;
+    std::promise<void> started_;
+    //set by Stop() once done with the loop, which lives till then
+    std::promise<void> released_;
+
+    std::unordered_map<int, std::unique_ptr<TcpConnection>> connections_;
+    //closed, deleted after the callbacks on the stack returned
+    std::vector<std::unique_ptr<TcpConnection>> dead_;
+
+    //written by the loop thread only, read by any
+    alignas(64) std::atomic<uint64_t> accepted_;
+    std::atomic<uint64_t> closed_;
+    std::atomic<uint64_t> bytesIn_;
+    std::atomic<uint64_t> bytesOut_;
+
+    Reactor(TcpServer* server, int index, int cpu, int listenFd):server_(server),
+                                                                 index_(index),
+                                                                 cpu_(cpu),
+                                                                 listenFd_(listenFd),
+                                                                 loop_(nullptr),
+                                                                 accepted_(0),
+                                                                 closed_(0),
+                                                                 bytesIn_(0),
+                                                                 bytesOut_(0)
+    {
+    }
+
+    //one writer: no locked add needed
+    static void Add(std::atomic<uint64_t>& counter, uint64_t n)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    void OnAccept(int fd);
+    void Remove(TcpConnection* conn);
+};
+
+void Reactor::OnAccept(int fd)
+{
+    if(fd < 0)
+    {
+        errno = -fd;
+        perror("accept");
+        return;
+    }
+    if(server_->options_.noDelay)
+    {
+        const int one = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    }
+
+    EventLoop* loop = loop_.load(std::memory_order_relaxed);
+    TcpConnection* conn = new TcpConnection(this, fd);
+    if(!loop->Register(fd, [conn]() { conn->_OnRead(); }, [conn]() { conn->_OnWrite(); }))
+    {
+        delete conn;
+        ::close(fd);
+        return;
+    }
+    connections_[fd].reset(conn);
+    Add(accepted_, 1);
+    if(server_->onConnection_)
+        server_->onConnection_(conn);
+}
+
+void Reactor::Remove(TcpConnection* conn)
+{
+    auto it = connections_.find(conn->Fd());
+    assert(it != connections_.end() && it->second.get() == conn);
+    if(dead_.empty())
+        loop_.load(std::memory_order_relaxed)->QueueInLoop([this]() { dead_.clear(); });
+    dead_.push_back(std::move(it->second));
+    connections_.erase(it);
+}
+
+}   // end namespace internal
+
+using internal::Reactor;
+
+TcpConnection::TcpConnection(Reactor* reactor, int fd):reactor_(reactor),
+                                                       loop_(reactor->loop_.load(std::memory_order_relaxed)),
+                                                       fd_(fd),
+                                                       connected_(true),
+                                                       shutdown_(false),
+                                                       peerClosed_(false)
+{
+}
+
+TcpConnection::~TcpConnection()
+{
+}
+
+int TcpConnection::LoopIndex() const
+{
+    return reactor_->index_;
+}
+
+void TcpConnection::_OnRead()
+{
+    if(peerClosed_)
+        return;
+
+    //edge-triggered: all there is up to kMaxReadPerEvent, then the callback once for all of it
+    std::size_t got = 0;
+    bool eof = false;
+    bool failed = false;
+    while(got < kMaxReadPerEvent)
+    {
+        input_.Assurespace(kReadSize);
+        const std::size_t want = std::min(input_.writablesize(), kMaxReadPerEvent - got);
+        const ssize_t n = ::read(fd_, input_.writeaddr(), want);
+        if(n > 0)
+        {
+            input_.Produce(static_cast<std::size_t>(n));
+            got += static_cast<std::size_t>(n);
+            continue;
+        }
+        if(n < 0 && errno == EINTR)
+            continue;
+        eof = n == 0;
+        failed = n < 0 && errno != EAGAIN;
+        break;
+    }
+    //stopped by the limit: the rest next time, after the other ready fds
+    const bool more = got >= kMaxReadPerEvent;
+
+    Reactor::Add(reactor_->bytesIn_, got);
+    if(got > 0 && reactor_->server_->onMessage_)
+        reactor_->server_->onMessage_(this, input_);
+    //the callback may have closed it already
+    if(!connected_)
+        return;
+    if(failed || (eof && output_.Isempty()))
+    {
+        _Close();
+        return;
+    }
+    //half closed by the peer: the replies still go out, _OnWrite closes after them
+    if(eof)
+        peerClosed_ = true;
+    else if(more)
+        loop_->Rearm(fd_);
+}
+
+void TcpConnection::_OnWrite()
+{
+    if(!_Flush())
+    {
+        _Close();
+        return;
+    }
+    if(output_.Isempty())
+    {
+        if(peerClosed_)
+        {
+            _Close();
+            return;
+        }
+        loop_->EnableWrite(fd_, false);
+        if(shutdown_)
+            ::shutdown(fd_, SHUT_WR);
+    }
+}
+
+bool TcpConnection::_Flush()
+{
+    while(!output_.Isempty())
+    {
+        iovec iov[kMaxIov];
+        int count = 0;
+        for(Buffer& buf : output_)
+        {
+            if(count == kMaxIov)
+                break;
+            iov[count].iov_base = buf.readaddr();
+            iov[count].iov_len = buf.readablesize();
+            ++count;
+        }
+        msghdr msg = {};
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count;
+        const ssize_t n = ::sendmsg(fd_, &msg, MSG_NOSIGNAL);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+                continue;
+            return errno == EAGAIN;
+        }
+        output_.Consume(static_cast<std::size_t>(n));
+        Reactor::Add(reactor_->bytesOut_, static_cast<uint64_t>(n));
+    }
+    return true;
+}
+
+void TcpConnection::Send(const void* data, std::size_t len)
+{
+    assert(loop_->IsInLoopThread());
+    if(!connected_ || shutdown_ || len == 0)
+        return;
+
+    //nothing queued: straight to the socket, only the rest is copied
+    std::size_t written = 0;
+    if(output_.Isempty())
+    {
+        const ssize_t n = ::send(fd_, data, len, MSG_NOSIGNAL);
+        if(n >= 0)
+        {
+            written = static_cast<std::size_t>(n);
+            Reactor::Add(reactor_->bytesOut_, written);
+        }
+        else if(errno != EAGAIN && errno != EINTR)
+        {
+            _Close();
+            return;
+        }
+    }
+    if(written < len)
+    {
+        const bool idle = output_.Isempty();
+        output_.Push(static_cast<const char*>(data) + written, len - written);
+        if(idle)
+            loop_->EnableWrite(fd_, true);
+    }
+}
+
+void TcpConnection::Send(Buffer&& buf)
+{
+    Send(BufferVector(std::move(buf)));
+}
+
+void TcpConnection::Send(BufferVector&& data)
+{
+    assert(loop_->IsInLoopThread());
+    if(!connected_ || shutdown_ || data.Isempty())
+        return;
+
+    //queued already: write interest is on, the socket takes it in order later
+    if(!output_.Isempty())
+    {
+        for(Buffer& buf : data)
+            output_.Push(std::move(buf));
+        return;
+    }
+    output_ = std::move(data);
+
+    if(!_Flush())
+    {
+        _Close();
+        return;
+    }
+    if(!output_.Isempty())
+        loop_->EnableWrite(fd_, true);
+}
+
+void TcpConnection::Shutdown()
+{
+    assert(loop_->IsInLoopThread());
+    if(!connected_ || shutdown_)
+        return;
+    shutdown_ = true;
+    if(output_.Isempty())
+        ::shutdown(fd_, SHUT_WR);
+}
+
+void TcpConnection::Close()
+{
+    assert(loop_->IsInLoopThread());
+    if(connected_)
+        _Close();
+}
+
+void TcpConnection::_Close()
+{
+    connected_ = false;
+    output_.Clear();
+    Reactor::Add(reactor_->closed_, 1);
+    if(reactor_->server_->onConnection_)
+        reactor_->server_->onConnection_(this);
+
+    loop_->Unregister(fd_);
+    ::close(fd_);
+    reactor_->Remove(this);
+}
+
+TcpServer::TcpServer(const TcpServerOptions& options):options_(options),
+                                                      port_(options.port),
+                                                      started_(false)
+{
+}
+
+TcpServer::~TcpServer()
+{
+    Stop();
+}
+
+int TcpServer::_Listen(uint16_t port)
+{
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if(::inet_pton(AF_INET, options_.host.c_str(), &addr.sin_addr) != 1)
+    {
+        fprintf(stderr, "TcpServer: bad address %s\n", options_.host.c_str());
+        return -1;
+    }
+
+    const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+    const int one = 1;
+    ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+    if(::setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof one) != 0 ||
+       ::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0 ||
+       ::listen(fd, options_.backlog) != 0)
+    {
+        perror("TcpServer listen");
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool TcpServer::Start()
+{
+    if(started_)
+        return false;
+
+    const CpuTopology topology = CpuTopology::Detect();
+    std::vector<int> cpus;
+    for(const auto& node : topology.Nodes())
+        cpus.insert(cpus.end(), node.cpus_.begin(), node.cpus_.end());
+    std::size_t loops = options_.loops > 0 ? static_cast<std::size_t>(options_.loops) : cpus.size();
+    if(loops == 0)
+        loops = std::max(1u, std::thread::hardware_concurrency());
+
+    //all listeners on one port: the first one picks it if it's 0
+    uint16_t port = options_.port;
+    for(std::size_t i = 0; i < loops; ++i)
+    {
+        const int fd = _Listen(port);
+        if(fd < 0)
+        {
+            for(auto& reactor : reactors_)
+                ::close(reactor->listenFd_);
+            reactors_.clear();
+            return false;
+        }
+        if(port == 0)
+        {
+            sockaddr_in addr = {};
+            socklen_t len = sizeof addr;
+            ::getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len);
+            port = ntohs(addr.sin_port);
+        }
+        const int cpu = options_.pinLoops && !cpus.empty() ? cpus[i % cpus.size()] : -1;
+        reactors_.emplace_back(new Reactor(this, static_cast<int>(i), cpu, fd));
+    }
+    port_ = port;
+
+    for(auto& reactor : reactors_)
+        reactor->thread_ = std::thread(&TcpServer::_Run, this, reactor.get());
+    //the loops exist when Start returns
+    for(auto& reactor : reactors_)
+        reactor->started_.get_future().wait();
+    started_ = true;
+    return true;
+}
+
+void TcpServer::_Run(Reactor* reactor)
+{
+    if(reactor->cpu_ >= 0)
+        CpuTopology::PinCurrentThread(std::vector<int>(1, reactor->cpu_));
+
+    EventLoop loop(options_.backend);
+    reactor->loop_.store(&loop, std::memory_order_release);
+    if(!loop.StartAccept(reactor->listenFd_, [reactor](int fd) { reactor->OnAccept(fd); }))
+        fprintf(stderr, "TcpServer: loop %d can't accept\n", reactor->index_);
+    reactor->started_.set_value();
+
+    loop.Loop();
+
+    loop.Unregister(reactor->listenFd_);
+    ::close(reactor->listenFd_);
+    while(!reactor->connections_.empty())
+        reactor->connections_.begin()->second->_Close();
+    reactor->dead_.clear();
+
+    //Stop() may still be in Quit(), the loop must outlive it
+    reactor->released_.get_future().wait();
+    reactor->loop_.store(nullptr, std::memory_order_release);
+}
+
+void TcpServer::Stop()
+{
+    if(!started_)
+        return;
+    for(auto& reactor : reactors_)
+    {
+        reactor->loop_.load(std::memory_order_acquire)->Quit();
+        reactor->released_.set_value();
+    }
+    for(auto& reactor : reactors_)
+        reactor->thread_.join();
+    reactors_.clear();
+    started_ = false;
+}
+
+EventLoop* TcpServer::LoopAt(std::size_t i) const
+{
+    return i < reactors_.size() ? reactors_[i]->loop_.load(std::memory_order_acquire) : nullptr;
+}
+
+TcpLoopStats TcpServer::Stats(std::size_t i) const
+{
+    TcpLoopStats stats;
+    if(i >= reactors_.size())
+        return stats;
+    const Reactor& reactor = *reactors_[i];
+    stats.accepted = reactor.accepted_.load(std::memory_order_relaxed);
+    stats.closed = reactor.closed_.load(std::memory_order_relaxed);
+    stats.active = stats.accepted - stats.closed;
+    stats.bytesIn = reactor.bytesIn_.load(std::memory_order_relaxed);
+    stats.bytesOut = reactor.bytesOut_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+TcpLoopStats TcpServer::TotalStats() const
+{
+    TcpLoopStats total;
+    for(std::size_t i = 0; i < reactors_.size(); ++i)
+    {
+        const TcpLoopStats stats = Stats(i);
+        total.accepted += stats.accepted;
+        total.closed += stats.closed;
+        total.active += stats.active;
+        total.bytesIn += stats.bytesIn;
+        total.bytesOut += stats.bytesOut;
+    }
+    return total;
+}
+
+}
+//end namespace mrpc
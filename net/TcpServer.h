@@ -0,0 +1,189 @@
+#ifndef TCPSERVER_H_
+#define TCPSERVER_H_
+
+// Multi-reactor TCP server
+// One EventLoop per core, each on its own thread (pinned to the core) with its
+// own SO_REUSEPORT listener and so its own TimerManager: the kernel spreads the
+// connections over the listeners, and a connection stays on the loop that
+// accepted it for life. No lock is shared between loops.
+//
+// A connection reads into its input Buffer till EAGAIN or kMaxReadPerEvent, then
+// the message callback sees all of it and Consume()s what it used; a connection
+// with more to read is rearmed for the next iteration, after the others. Output
+// goes straight to the socket while nothing is queued; what the socket doesn't
+// take waits in a BufferVector, and write interest is on only while it is there.
+// When the peer closes its write side, reading stops and the connection is closed
+// once the output is out.
+//
+// Callbacks run on the connection's loop; a TcpConnection is used from there
+// only (Loop()->QueueInLoop from elsewhere) and lives till the closed callback
+// returns.
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "EventLoop.h"
+#include "../util/Buffer.h"
+
+namespace mrpc
+{
+
+class TcpServer;
+
+struct TcpServerOptions
+{
+    std::string host = "0.0.0.0";
+    uint16_t port = 0;                          // 0: any, Port() tells which
+    int loops = 0;                              // 0: one per cpu the process may run on
+    bool pinLoops = true;                       // loop i on the i-th allowed cpu
+    LoopBackend backend = LoopBackend::kEpoll;
+    bool noDelay = true;                        // TCP_NODELAY on accepted connections
+    int backlog = 1024;
+};
+
+//what one loop did so far, read from any thread
+struct TcpLoopStats
+{
+    uint64_t accepted = 0;
+    uint64_t closed = 0;
+    uint64_t active = 0;
+    uint64_t bytesIn = 0;
+    uint64_t bytesOut = 0;
+};
+
+namespace internal
+{
+struct Reactor;
+}
+
+class TcpConnection final
+{
+public:
+    ~TcpConnection();
+
+    TcpConnection(const TcpConnection& ) = delete;
+    void operator= (const TcpConnection& ) = delete;
+
+    int Fd() const
+    {
+        return fd_;
+    }
+    EventLoop* Loop() const
+    {
+        return loop_;
+    }
+    //index of the loop in the server
+    int LoopIndex() const;
+    bool Connected() const
+    {
+        return connected_;
+    }
+
+    Buffer& Input()
+    {
+        return input_;
+    }
+    //bytes waiting for the socket
+    std::size_t PendingOutput() const
+    {
+        return output_.Totalbytes();
+    }
+
+    void Send(const void* data, std::size_t len);
+    void Send(Buffer&& buf);
+    void Send(BufferVector&& data);
+    //close the write side once the output is out
+    void Shutdown();
+    //close now, dropping the output
+    void Close();
+
+private:
+    friend class TcpServer;
+    friend struct internal::Reactor;
+
+    static constexpr std::size_t kReadSize = 16384;
+    static constexpr std::size_t kMaxReadPerEvent = 16 * kReadSize;
+    static constexpr int kMaxIov = 64;
+
+    TcpConnection(internal::Reactor* reactor, int fd);
+
+    void _OnRead();
+    void _OnWrite();
+    //write the queued output till EAGAIN; false if the connection failed
+    bool _Flush();
+    void _Close();
+
+    internal::Reactor* const reactor_;
+    EventLoop* const loop_;
+    const int fd_;
+    bool connected_;
+    bool shutdown_;
+    bool peerClosed_;   // read 0, only the output is left to do
+    Buffer input_;
+    BufferVector output_;
+};
+
+class TcpServer final
+{
+public:
+    //connected, and closed again (Connected() false then)
+    using ConnectionCallback = std::function<void (TcpConnection* conn)>;
+    //new input arrived; consume what was used, the rest stays for next time
+    using MessageCallback = std::function<void (TcpConnection* conn, Buffer& input)>;
+
+    explicit TcpServer(const TcpServerOptions& options = TcpServerOptions());
+    ~TcpServer();
+
+    TcpServer(const TcpServer& ) = delete;
+    void operator= (const TcpServer& ) = delete;
+
+    //before Start()
+    void SetConnectionCallback(ConnectionCallback f)
+    {
+        onConnection_ = std::move(f);
+    }
+    void SetMessageCallback(MessageCallback f)
+    {
+        onMessage_ = std::move(f);
+    }
+
+    //bind the listeners and start the loops; false if the address can't be bound
+    bool Start();
+    //quit the loops, closing the listeners and every connection; not from a loop
+    void Stop();
+
+    uint16_t Port() const
+    {
+        return port_;
+    }
+    std::size_t LoopCount() const
+    {
+        return reactors_.size();
+    }
+    //loop i, to queue tasks or timers to; nullptr when not running
+    EventLoop* LoopAt(std::size_t i) const;
+
+    TcpLoopStats Stats(std::size_t i) const;
+    //the sum over the loops
+    TcpLoopStats TotalStats() const;
+
+private:
+    friend struct internal::Reactor;
+    friend class TcpConnection;
+
+    int _Listen(uint16_t port);
+    void _Run(internal::Reactor* reactor);
+
+    const TcpServerOptions options_;
+    ConnectionCallback onConnection_;
+    MessageCallback onMessage_;
+    std::vector<std::unique_ptr<internal::Reactor>> reactors_;
+    uint16_t port_;
+    bool started_;
+};
+
+}   // end namespace mrpc
+
+#endif
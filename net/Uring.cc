@@ -0,0 +1,252 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/time_types.h>
+
+#include "Uring.h"
+
+namespace mrpc
+{
+
+namespace internal
+{
+
+Uring::Uring():fd_(-1),
+               sqMap_(MAP_FAILED),
+               sqMapSize_(0),
+               cqMap_(MAP_FAILED),
+               cqMapSize_(0),
+               sqes_(static_cast<io_uring_sqe*>(MAP_FAILED)),
+               sqesSize_(0),
+               sqHead_(nullptr),
+               sqTail_(nullptr),
+               sqMask_(0),
+               sqEntries_(0),
+               sqArray_(nullptr),
+               sqLocalTail_(0),
+               sqSubmitted_(0),
+               cqHead_(nullptr),
+               cqTail_(nullptr),
+               cqMask_(0),
+               cqes_(nullptr)
+{
+}
+
+Uring::~Uring()
+{
+    _Close();
+}
+
+void Uring::_Close()
+{
+    if(sqes_ != MAP_FAILED)
+        ::munmap(sqes_, sqesSize_);
+    if(cqMap_ != MAP_FAILED && cqMap_ != sqMap_)
+        ::munmap(cqMap_, cqMapSize_);
+    if(sqMap_ != MAP_FAILED)
+        ::munmap(sqMap_, sqMapSize_);
+    sqes_ = static_cast<io_uring_sqe*>(MAP_FAILED);
+    sqMap_ = cqMap_ = MAP_FAILED;
+    if(fd_ >= 0)
+        ::close(fd_);
+    fd_ = -1;
+}
+
+bool Uring::Init(unsigned entries, unsigned cqEntries)
+{
+    //one thread submits and reaps: completions wait for io_uring_enter() instead
+    //of interrupting the thread (6.1 on); plain flags before that
+    io_uring_params params = {};
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+    params.cq_entries = cqEntries;
+    int fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+    if(fd < 0 && errno == EINVAL)
+    {
+        params = {};
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = cqEntries;
+        fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+    }
+    //ENOSYS: no io_uring; EPERM: kernel.io_uring_disabled or a seccomp filter
+    if(fd < 0)
+        return false;
+    fd_ = fd;
+
+    //timed waits and no lost completions, both 5.11
+    if(!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP))
+    {
+        _Close();
+        return false;
+    }
+
+    sqMapSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqMapSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(single)
+        sqMapSize_ = cqMapSize_ = std::max(sqMapSize_, cqMapSize_);
+
+    sqMap_ = ::mmap(nullptr, sqMapSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    if(sqMap_ == MAP_FAILED)
+    {
+        perror("mmap io_uring sq");
+        _Close();
+        return false;
+    }
+    cqMap_ = single ? sqMap_ : ::mmap(nullptr, cqMapSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                      fd_, IORING_OFF_CQ_RING);
+    sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe*>(::mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                              fd_, IORING_OFF_SQES));
+    if(cqMap_ == MAP_FAILED || sqes_ == MAP_FAILED)
+    {
+        perror("mmap io_uring");
+        _Close();
+        return false;
+    }
+
+    char* sq = static_cast<char*>(sqMap_);
+    sqHead_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sqTail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sqMask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sqEntries_ = params.sq_entries;
+    sqArray_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    //SQE i always sits in slot i
+    for(unsigned i = 0; i < sqEntries_; ++i)
+        sqArray_[i] = i;
+    sqLocalTail_ = sqSubmitted_ = *sqTail_;
+
+    char* cq = static_cast<char*>(cqMap_);
+    cqHead_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cqMask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    return true;
+}
+
+io_uring_sqe* Uring::GetSqe()
+{
+    if(sqLocalTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) >= sqEntries_)
+    {
+        Enter(false, 0);
+        if(sqLocalTail_ - __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE) >= sqEntries_)
+            return nullptr;
+    }
+
+    io_uring_sqe* sqe = &sqes_[sqLocalTail_ & sqMask_];
+    ++sqLocalTail_;
+    memset(sqe, 0, sizeof *sqe);
+    return sqe;
+}
+
+bool Uring::Enter(bool wait, int64_t timeoutNs)
+{
+    //the kernel sees the SQEs handed out since the last call only now
+    __atomic_store_n(sqTail_, sqLocalTail_, __ATOMIC_RELEASE);
+    const unsigned submit = sqLocalTail_ - sqSubmitted_;
+
+    __kernel_timespec ts = {};
+    io_uring_getevents_arg arg = {};
+    if(wait && timeoutNs >= 0)
+    {
+        ts.tv_sec = timeoutNs / 1000000000;
+        ts.tv_nsec = timeoutNs % 1000000000;
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+    }
+
+    const int n = static_cast<int>(::syscall(__NR_io_uring_enter, fd_, submit, wait ? 1 : 0,
+                                             IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof arg));
+    if(n >= 0)
+    {
+        sqSubmitted_ += static_cast<unsigned>(n);
+        return true;
+    }
+    //EBUSY/EAGAIN: completions to reap first, the rest is submitted next time
+    if(errno == ETIME || errno == EINTR || errno == EBUSY || errno == EAGAIN)
+        return true;
+    perror("io_uring_enter");
+    return false;
+}
+
+int Uring::Register(unsigned opcode, void* arg, unsigned count)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_register, fd_, opcode, arg, count));
+}
+
+BufferRing::BufferRing():ring_(nullptr),
+                         bufs_(static_cast<io_uring_buf_ring*>(MAP_FAILED)),
+                         bufsSize_(0),
+                         data_(static_cast<char*>(MAP_FAILED)),
+                         dataSize_(0),
+                         count_(0),
+                         size_(0),
+                         group_(0),
+                         tail_(0)
+{
+}
+
+BufferRing::~BufferRing()
+{
+    if(ring_)
+    {
+        io_uring_buf_reg reg = {};
+        reg.bgid = group_;
+        ring_->Register(IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    }
+    if(bufs_ != MAP_FAILED)
+        ::munmap(bufs_, bufsSize_);
+    if(data_ != MAP_FAILED)
+        ::munmap(data_, dataSize_);
+}
+
+bool BufferRing::Init(Uring* ring, uint16_t group, unsigned count, unsigned size)
+{
+    if(count == 0 || count > 32768 || (count & (count - 1)) != 0)
+        return false;
+
+    //the ring of buffer descriptors must be page aligned, mmap gives that
+    bufsSize_ = count * sizeof(io_uring_buf);
+    bufs_ = static_cast<io_uring_buf_ring*>(::mmap(nullptr, bufsSize_, PROT_READ | PROT_WRITE,
+                                                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    dataSize_ = static_cast<std::size_t>(count) * size;
+    data_ = static_cast<char*>(::mmap(nullptr, dataSize_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+    if(bufs_ == MAP_FAILED || data_ == MAP_FAILED)
+    {
+        perror("mmap buffer ring");
+        return false;
+    }
+
+    io_uring_buf_reg reg = {};
+    reg.ring_addr = reinterpret_cast<uint64_t>(bufs_);
+    reg.ring_entries = count;
+    reg.bgid = group;
+    //EINVAL before 5.19
+    if(ring->Register(IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+        return false;
+
+    ring_ = ring;
+    count_ = count;
+    size_ = size;
+    group_ = group;
+    for(unsigned i = 0; i < count; ++i)
+        Recycle(static_cast<uint16_t>(i));
+    return true;
+}
+
+void BufferRing::Recycle(uint16_t id)
+{
+    //not bufs_->bufs: in C++ __DECLARE_FLEX_ARRAY puts it 8 bytes off
+    io_uring_buf* buf = reinterpret_cast<io_uring_buf*>(bufs_) + (tail_ & (count_ - 1));
+    buf->addr = reinterpret_cast<uint64_t>(Data(id));
+    buf->len = size_;
+    buf->bid = id;
+    ++tail_;
+    __atomic_store_n(&bufs_->tail, tail_, __ATOMIC_RELEASE);
+}
+
+}   // end namespace internal
+
+}   // end namespace mrpc
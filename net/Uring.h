@@ -0,0 +1,133 @@
+#ifndef URING_H_
+#define URING_H_
+
+// io_uring by its raw syscalls, without liburing
+// Uring maps the rings and hands out SQEs; they pile up till Enter() submits them
+// all at once, together with the wait for completions. CQEs are read in place.
+// The shared ring indexes are read and written by __atomic builtins, the kernel
+// being the other side.
+//
+// BufferRing: a provided buffer ring (IORING_REGISTER_PBUF_RING). Receives with
+// IOSQE_BUFFER_SELECT take a buffer from it, the completion names which one; it
+// goes back to the ring by Recycle() once the data is used.
+//
+// Kernel 5.19 on: EXT_ARG waits, buffer rings and multishot accept.
+
+#include <cstddef>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+namespace mrpc
+{
+
+namespace internal
+{
+
+class Uring final
+{
+public:
+    Uring();
+    ~Uring();
+
+    Uring(const Uring& ) = delete;
+    void operator= (const Uring& ) = delete;
+
+    //false if io_uring is missing, disabled or too old
+    bool Init(unsigned entries, unsigned cqEntries);
+
+    int Fd() const
+    {
+        return fd_;
+    }
+
+    //a zeroed SQE; the queued ones are submitted first if the ring is full
+    io_uring_sqe* GetSqe();
+
+    //submit what's queued; wait: also wait for one completion, at most timeoutNs
+    //(< 0: forever). Return false on an error other than a timeout or a signal.
+    bool Enter(bool wait, int64_t timeoutNs);
+
+    //call f(const io_uring_cqe&) for each completion ready, then hand them back
+    template <typename F>
+    unsigned ForEachCqe(F&& f);
+
+    int Register(unsigned opcode, void* arg, unsigned count);
+
+private:
+    int fd_;
+
+    void* sqMap_;
+    std::size_t sqMapSize_;
+    void* cqMap_;
+    std::size_t cqMapSize_;
+    io_uring_sqe* sqes_;
+    std::size_t sqesSize_;
+
+    unsigned* sqHead_;
+    unsigned* sqTail_;
+    unsigned sqMask_;
+    unsigned sqEntries_;
+    unsigned* sqArray_;
+    unsigned sqLocalTail_;      // SQEs handed out
+    unsigned sqSubmitted_;      // of them, submitted
+
+    unsigned* cqHead_;
+    unsigned* cqTail_;
+    unsigned cqMask_;
+    io_uring_cqe* cqes_;
+
+    void _Close();
+};
+
+template <typename F>
+unsigned Uring::ForEachCqe(F&& f)
+{
+    const unsigned head = *cqHead_;
+    const unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+    for(unsigned i = head; i != tail; ++i)
+        f(cqes_[i & cqMask_]);
+    __atomic_store_n(cqHead_, tail, __ATOMIC_RELEASE);
+    return tail - head;
+}
+
+class BufferRing final
+{
+public:
+    BufferRing();
+    ~BufferRing();
+
+    BufferRing(const BufferRing& ) = delete;
+    void operator= (const BufferRing& ) = delete;
+
+    //count buffers of size bytes as group; count a power of 2, at most 32768
+    bool Init(Uring* ring, uint16_t group, unsigned count, unsigned size);
+
+    uint16_t Group() const
+    {
+        return group_;
+    }
+    char* Data(uint16_t id) const
+    {
+        return data_ + static_cast<std::size_t>(id) * size_;
+    }
+
+    //give buffer id back to the kernel
+    void Recycle(uint16_t id);
+
+private:
+    Uring* ring_;
+    io_uring_buf_ring* bufs_;
+    std::size_t bufsSize_;
+    char* data_;
+    std::size_t dataSize_;
+    unsigned count_;
+    unsigned size_;
+    uint16_t group_;
+    uint16_t tail_;
+};
+
+}   // end namespace internal
+
+}   // end namespace mrpc
+
+#endif
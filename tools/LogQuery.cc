@@ -0,0 +1,183 @@
+// logquery: print the records of Logger files within a time range and level set
+//
+// usage: logquery [-f from] [-t to] [-l INF,DBG,WRN,ERR,USR] [-r tag] [-j threads] [-n] [-s] path...
+//   -f/-t  "YYYY-MM-DD[HH:MM:SS.uuuuuu]", "YYYY-MM-DD HH:MM:SS" or "YYYY-MM-DD"
+//   -r     read the files of the route tag in a directory instead of the main ones
+//   -n     don't write <file>.idx back
+//   -s     print index statistics instead of records
+// a path may be a log file or a directory holding <time>@<pid>-<seq>.log files
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../util/Buffer.h"
+#include "../util/LogReader.h"
+
+using namespace mrpc;
+
+static void Usage(const char* prog)
+{
+    fprintf(stderr, "usage: %s [-f from] [-t to] [-l INF,DBG,WRN,ERR,USR] [-r tag] [-j threads] [-n] [-s] path...\n", prog);
+    exit(1);
+}
+
+static unsigned int ParseLevels(const char* arg)
+{
+    unsigned int levels = 0;
+    std::string list(arg);
+    std::size_t start = 0;
+    while(start <= list.size())
+    {
+        auto comma = list.find(',', start);
+        if(comma == std::string::npos)
+            comma = list.size();
+        const std::string tag = "[" + list.substr(start, comma - start) + "]:";
+        const unsigned int level = ParseLogLevel(tag.data(), tag.size());
+        if(level == 0)
+        {
+            fprintf(stderr, "unknown level %s\n", tag.c_str());
+            exit(1);
+        }
+        levels |= level;
+        start = comma + 1;
+    }
+    return levels;
+}
+
+static void CollectFiles(const std::string& path, const std::string& route, std::vector<std::string>* files)
+{
+    struct stat st;
+    if(::stat(path.c_str(), &st) != 0)
+    {
+        perror(path.c_str());
+        return;
+    }
+
+    if(!S_ISDIR(st.st_mode))
+    {
+        files->push_back(path);
+        return;
+    }
+
+    // routed records are in the main files too unless the route is exclusive
+    std::vector<std::string> names;
+    if(!ListLogFiles(path, route, &names))
+    {
+        perror(path.c_str());
+        return;
+    }
+    files->insert(files->end(), names.begin(), names.end());
+}
+
+static void WriteAll(const void* data, std::size_t len)
+{
+    const char* p = static_cast<const char*>(data);
+    while(len > 0)
+    {
+        auto n = ::write(STDOUT_FILENO, p, len);
+        if(n <= 0)
+        {
+            perror("write");
+            exit(1);
+        }
+        p += n;
+        len -= n;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    LogQuery query;
+    unsigned int threads = 0;
+    bool saveIndex = true;
+    bool stats = false;
+    std::string route;
+
+    int opt;
+    while((opt = ::getopt(argc, argv, "f:t:l:r:j:nsh")) != -1)
+    {
+        switch(opt)
+        {
+            case 'f':
+                if(!ParseLogTime(optarg, strlen(optarg), &query.fromMicros))
+                    Usage(argv[0]);
+                break;
+
+            case 't':
+                if(!ParseLogTime(optarg, strlen(optarg), &query.toMicros))
+                    Usage(argv[0]);
+                // a bare date means the whole day
+                if(strlen(optarg) == 10)
+                    query.toMicros += 86400LL * 1000000 - 1;
+                break;
+
+            case 'l':
+                query.levels = ParseLevels(optarg);
+                break;
+
+            case 'r':
+                route = optarg;
+                break;
+
+            case 'j':
+                threads = static_cast<unsigned int>(atoi(optarg));
+                break;
+
+            case 'n':
+                saveIndex = false;
+                break;
+
+            case 's':
+                stats = true;
+                break;
+
+            default:
+                Usage(argv[0]);
+        }
+    }
+
+    if(optind >= argc)
+        Usage(argv[0]);
+
+    std::vector<std::string> files;
+    for(int i = optind; i < argc; ++i)
+        CollectFiles(argv[i], route, &files);
+
+    Buffer out;
+    const std::size_t kOutChunk = 1024 * 1024;
+
+    auto total = QueryLogFiles(files, query, threads,
+        [&](const LogSegment& seg, const std::vector<LogRecord>& records)
+        {
+            if(stats)
+            {
+                fprintf(stdout, "%s: %zu bytes, %zu blocks, %zu matched\n",
+                        seg.FileName().c_str(), seg.Size(), seg.Index().size(), records.size());
+                return;
+            }
+
+            for(const auto& rec : records)
+            {
+                out.PushData(rec.line.data, rec.line.len);
+                if(out.readablesize() >= kOutChunk)
+                {
+                    WriteAll(out.readaddr(), out.readablesize());
+                    out.Clear();
+                }
+            }
+        },
+        saveIndex);
+
+    if(!out.Isempty())
+        WriteAll(out.readaddr(), out.readablesize());
+
+    if(stats)
+        fprintf(stdout, "total matched %zu\n", total);
+
+    return 0;
+}
@@ -0,0 +1,264 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#include "../../net/RpcFrame.h"
+
+using namespace mrpc;
+
+struct Sent
+{
+    uint8_t flags;
+    uint64_t requestId;
+    uint32_t methodId;
+    std::string payload;
+};
+
+static std::string Flatten(const BufferVector& frames)
+{
+    std::string wire;
+    for(const Buffer& buf : frames)
+        wire.append(buf.readaddr(), buf.readablesize());
+    return wire;
+}
+
+static std::string RandomPayload(std::mt19937& rng, std::size_t maxLen)
+{
+    std::string payload(rng() % (maxLen + 1), '\0');
+    for(char& c : payload)
+        c = static_cast<char>(rng());
+    return payload;
+}
+
+//every encoder in turn, with and without crc
+static std::vector<Sent> EncodeSome(std::mt19937& rng, int count, BufferVector* out)
+{
+    std::vector<Sent> sent;
+    for(int i = 0; i < count; ++i)
+    {
+        Sent s{static_cast<uint8_t>(i % 2 ? kFrameCrc : 0), rng() * 977ull + i, static_cast<uint32_t>(rng()),
+               RandomPayload(rng, i % 5 == 0 ? 5000 : 200)};
+        FrameHeader header;
+        header.flags = s.flags;
+        header.requestId = s.requestId;
+        header.methodId = s.methodId;
+        switch(i % 3)
+        {
+            case 0:
+                EncodeFrame(header, Buffer(s.payload.data(), s.payload.size()), out);
+                break;
+            case 1:
+            {
+                BufferVector body;
+                body.Append(Buffer(s.payload.data(), s.payload.size() / 2));
+                body.Append(Buffer(s.payload.data() + s.payload.size() / 2, s.payload.size() - s.payload.size() / 2));
+                EncodeFrame(header, std::move(body), out);
+                break;
+            }
+            default:
+                EncodeFrame(header, s.payload.data(), s.payload.size(), out);
+        }
+        sent.push_back(std::move(s));
+    }
+    return sent;
+}
+
+//feed wire in chunks of at most maxChunk, collecting what was decoded
+static FrameStatus Feed(const std::string& wire, std::mt19937& rng, std::size_t maxChunk, std::vector<Sent>* got,
+                        std::size_t maxPayload = FrameDecoder::kDefaultMaxPayload)
+{
+    FrameDecoder decoder(maxPayload);
+    Buffer input;
+    std::size_t fed = 0;
+    while(fed < wire.size())
+    {
+        const std::size_t n = std::min(wire.size() - fed, 1 + rng() % maxChunk);
+        input.PushData(wire.data() + fed, n);
+        fed += n;
+        const char* begin = input.readaddr();
+        const char* end = begin + input.readablesize();
+        const bool ok = decoder.Decode(input, [&](const Frame& frame) {
+            //a view into the input, nothing copied
+            EXPECT_GE(static_cast<const char*>(frame.payload.data), begin);
+            EXPECT_LE(static_cast<const char*>(frame.payload.data) + frame.payload.len, end);
+            EXPECT_EQ(frame.header.length, frame.payload.len);
+            got->push_back({frame.header.flags, frame.header.requestId, frame.header.methodId,
+                            std::string(static_cast<const char*>(frame.payload.data), frame.payload.len)});
+        });
+        if(!ok)
+            return decoder.Status();
+        EXPECT_GE(decoder.Wanted(), input.readablesize());
+    }
+    EXPECT_EQ(got->size(), decoder.Frames());
+    return input.readablesize() == 0 ? FrameStatus::kOk : FrameStatus::kIncomplete;
+}
+
+static void ExpectSame(const std::vector<Sent>& sent, const std::vector<Sent>& got)
+{
+    ASSERT_EQ(sent.size(), got.size());
+    for(std::size_t i = 0; i < sent.size(); ++i)
+    {
+        EXPECT_EQ(sent[i].flags, got[i].flags);
+        EXPECT_EQ(sent[i].requestId, got[i].requestId);
+        EXPECT_EQ(sent[i].methodId, got[i].methodId);
+        EXPECT_TRUE(sent[i].payload == got[i].payload) << "frame " << i;
+    }
+}
+
+TEST(RpcFrame, layout)
+{
+    FrameHeader header;
+    header.flags = kFrameResponse;
+    header.requestId = 0x0102030405060708ull;
+    header.methodId = 0x0a0b0c0d;
+    BufferVector out;
+    EncodeFrame(header, "abc", 3, &out);
+
+    const std::string wire = Flatten(out);
+    ASSERT_EQ(kFrameHeaderSize + 3, wire.size());
+    const unsigned char expect[kFrameHeaderSize] = {'R', 'M', kFrameVersion, kFrameResponse, 3, 0, 0, 0,
+                                                     8, 7, 6, 5, 4, 3, 2, 1, 0x0d, 0x0c, 0x0b, 0x0a, 0, 0, 0, 0};
+    EXPECT_EQ(0, memcmp(expect, wire.data(), kFrameHeaderSize));
+    EXPECT_EQ("abc", wire.substr(kFrameHeaderSize));
+}
+
+TEST(RpcFrame, zero_copy_encode)
+{
+    std::string body(1024, 'b');
+    Buffer payload(body.data(), body.size());
+    const char* data = payload.readaddr();
+    ASSERT_EQ(0u, payload.writablesize());
+
+    BufferVector out;
+    EncodeFrame(FrameHeader(), "x", 1, &out);
+    FrameHeader header;
+    header.flags = kFrameCrc;
+    EncodeFrame(header, std::move(payload), &out);
+    //a full payload Buffer is not grown for the next header
+    EncodeFrame(FrameHeader(), Buffer(), &out);
+
+    //the header joined the small frame before; the payload is the Buffer it was
+    ASSERT_EQ(3u, out.buffers.size());
+    auto it = out.begin();
+    EXPECT_EQ(2 * kFrameHeaderSize + 1, it->readablesize());
+    ++it;
+    EXPECT_EQ(data, it->readaddr());
+    EXPECT_EQ(1024u, it->readablesize());
+    ++it;
+    EXPECT_EQ(kFrameHeaderSize, it->readablesize());
+    EXPECT_EQ(3 * kFrameHeaderSize + 1025, out.Totalbytes());
+}
+
+TEST(RpcFrame, roundtrip)
+{
+    std::mt19937 rng(1);
+    BufferVector out;
+    const std::vector<Sent> sent = EncodeSome(rng, 300, &out);
+    const std::string wire = Flatten(out);
+    EXPECT_EQ(wire.size(), out.Totalbytes());
+
+    //all at once, byte by byte and in random chunks
+    for(std::size_t maxChunk : {wire.size(), std::size_t(1), std::size_t(7), std::size_t(4096)})
+    {
+        std::vector<Sent> got;
+        EXPECT_EQ(FrameStatus::kOk, Feed(wire, rng, maxChunk, &got));
+        ExpectSame(sent, got);
+    }
+}
+
+TEST(RpcFrame, errors)
+{
+    std::mt19937 rng(2);
+    FrameHeader header;
+    header.flags = kFrameCrc;
+    BufferVector out;
+    EncodeFrame(header, "hello", 5, &out);
+    const std::string good = Flatten(out);
+    std::vector<Sent> got;
+
+    std::string wire = good;
+    wire[0] ^= 1;
+    EXPECT_EQ(FrameStatus::kBadMagic, Feed(wire, rng, 64, &got));
+
+    wire = good;
+    wire[2] = kFrameVersion + 1;
+    EXPECT_EQ(FrameStatus::kBadVersion, Feed(wire, rng, 64, &got));
+
+    wire = good;
+    wire[kFrameHeaderSize + 1] ^= 0x20;
+    EXPECT_EQ(FrameStatus::kBadCrc, Feed(wire, rng, 64, &got));
+    wire = good;
+    wire[9] ^= 0x20;
+    EXPECT_EQ(FrameStatus::kBadCrc, Feed(wire, rng, 64, &got));
+
+    //the length is refused from the header alone
+    wire = good.substr(0, kFrameHeaderSize);
+    EXPECT_EQ(FrameStatus::kTooLarge, Feed(wire, rng, 64, &got, 4));
+    EXPECT_TRUE(got.empty());
+
+    //a truncated frame is just incomplete, the decoder wants the rest
+    Buffer input(good.data(), good.size() - 1);
+    FrameDecoder decoder;
+    EXPECT_TRUE(decoder.Decode(input, [](const Frame& ) { ADD_FAILURE(); }));
+    EXPECT_EQ(good.size(), decoder.Wanted());
+    EXPECT_EQ(good.size() - 1, input.readablesize());
+
+    //once bad, it stays bad
+    Buffer bad("garbage garbage garbage garbage", 31);
+    EXPECT_FALSE(decoder.Decode(bad, [](const Frame& ) {}));
+    Buffer more(good.data(), good.size());
+    EXPECT_FALSE(decoder.Decode(more, [](const Frame& ) { ADD_FAILURE(); }));
+    EXPECT_EQ(FrameStatus::kBadMagic, decoder.Status());
+}
+
+//mutated and random streams: never read out of bounds (run under asan), every
+//frame handed out is whole, and crc frames that pass are ones that were sent
+TEST(RpcFrame, fuzz)
+{
+    std::mt19937 rng(3);
+    for(int round = 0; round < 2000; ++round)
+    {
+        BufferVector out;
+        const std::vector<Sent> sent = EncodeSome(rng, 1 + rng() % 8, &out);
+        std::string wire = Flatten(out);
+        switch(rng() % 4)
+        {
+            case 0:
+                for(int i = 1 + rng() % 3; i > 0; --i)
+                    wire[rng() % wire.size()] ^= static_cast<char>(1 << (rng() % 8));
+                break;
+            case 1:
+                wire.resize(rng() % wire.size());
+                break;
+            case 2:
+                wire.insert(rng() % wire.size(), RandomPayload(rng, 40));
+                break;
+            default:
+                wire = RandomPayload(rng, 300);
+                if(wire.size() >= 2 && rng() % 2)
+                {
+                    wire[0] = 'R';
+                    wire[1] = 'M';
+                }
+        }
+
+        std::vector<Sent> got;
+        Feed(wire, rng, 1 + rng() % 512, &got, 1 << 20);
+        for(const Sent& g : got)
+        {
+            if(!(g.flags & kFrameCrc))
+                continue;
+            bool found = false;
+            for(const Sent& s : sent)
+                found = found || (s.requestId == g.requestId && s.methodId == g.methodId && s.payload == g.payload);
+            EXPECT_TRUE(found) << "round " << round;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,350 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "../../net/ShmTransport.h"
+
+using namespace mrpc;
+
+//a ring in anonymous shared memory, inherited by fork
+class ShmRegion
+{
+public:
+    ShmRegion(std::size_t capacity):size_(ShmRing::RegionSize(capacity))
+    {
+        memory_ = ::mmap(0, size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        EXPECT_NE(MAP_FAILED, memory_);
+    }
+    ~ShmRegion()
+    {
+        ::munmap(memory_, size_);
+    }
+
+    void* Memory() const
+    {
+        return memory_;
+    }
+    std::size_t Size() const
+    {
+        return size_;
+    }
+
+private:
+    void* memory_;
+    std::size_t size_;
+};
+
+//message seq of producer, its length varies so the frames wrap at every position
+static std::string MessageOf(int producer, int seq)
+{
+    std::string msg = std::to_string(producer) + ":" + std::to_string(seq) + ":";
+    msg.append(seq % 97, static_cast<char>('a' + (producer + seq) % 26));
+    return msg;
+}
+
+static std::string Str(const Slice& msg)
+{
+    return std::string(static_cast<const char*>(msg.data), msg.len);
+}
+
+static int ParseProducer(const std::string& msg, int* seq)
+{
+    int producer;
+    EXPECT_EQ(2, sscanf(msg.c_str(), "%d:%d:", &producer, seq)) << msg;
+    EXPECT_EQ(MessageOf(producer, *seq), msg);
+    return producer;
+}
+
+TEST(ShmRing, init_attach)
+{
+    ShmRegion region(1024);
+    ShmRing ring;
+    EXPECT_FALSE(ring.Init(region.Memory(), 1000));
+    EXPECT_FALSE(ring.Init(region.Memory(), 32));
+
+    ShmRing peer;
+    memset(region.Memory(), 0, region.Size());
+    EXPECT_FALSE(peer.Attach(region.Memory(), region.Size()));
+
+    ASSERT_TRUE(ring.Init(region.Memory(), 1024));
+    EXPECT_FALSE(peer.Attach(region.Memory(), region.Size() - 1));
+    ASSERT_TRUE(peer.Attach(region.Memory(), region.Size()));
+    EXPECT_EQ(1024u / 2 - 8, peer.MaxMessageSize());
+
+    std::string big(ring.MaxMessageSize() + 1, 'x');
+    EXPECT_EQ(ShmRing::kTooLarge, ring.Send(big.data(), big.size()));
+    big.pop_back();
+    EXPECT_EQ(ShmRing::kOk, ring.Send(big.data(), big.size()));
+    Slice msg;
+    ASSERT_EQ(ShmRing::kOk, peer.Receive(&msg));
+    EXPECT_TRUE(big == Str(msg));
+}
+
+//frames of every size wrap around a small ring many times, in one thread
+TEST(ShmRing, wraparound)
+{
+    ShmRegion region(256);
+    ShmRing producer, consumer;
+    ASSERT_TRUE(producer.Init(region.Memory(), 256));
+    ASSERT_TRUE(consumer.Attach(region.Memory(), region.Size()));
+
+    Slice msg;
+    EXPECT_EQ(ShmRing::kTimeout, consumer.Receive(&msg, 0));
+    for(int i = 0; i < 5000; ++i)
+    {
+        const std::string sent(i % (producer.MaxMessageSize() + 1), static_cast<char>(i));
+        ASSERT_EQ(ShmRing::kOk, producer.Send(sent.data(), sent.size(), 0)) << i;
+        ASSERT_EQ(ShmRing::kOk, consumer.Receive(&msg, 0)) << i;
+        ASSERT_TRUE(sent == Str(msg)) << i;
+        //the message is a view into the ring
+        EXPECT_GE(static_cast<const char*>(msg.data), static_cast<const char*>(region.Memory()));
+        EXPECT_LE(static_cast<const char*>(msg.data) + msg.len,
+                  static_cast<const char*>(region.Memory()) + region.Size());
+        //else kept until the next Receive, too long for a frame of half the ring
+        consumer.Release();
+    }
+    EXPECT_EQ(ShmRing::kTimeout, consumer.Receive(&msg, 0));
+
+    //full: the producer times out, one release makes room again
+    int sent = 0;
+    while(producer.Send("12345678", 8, 0) == ShmRing::kOk)
+        ++sent;
+    EXPECT_EQ(256 / 16, sent);
+    EXPECT_EQ(ShmRing::kTimeout, producer.Send("12345678", 8, 10));
+    ASSERT_EQ(ShmRing::kOk, consumer.Receive(&msg, 0));
+    EXPECT_EQ(ShmRing::kTimeout, producer.Send("12345678", 8, 0));
+    consumer.Release();
+    EXPECT_EQ(ShmRing::kOk, producer.Send("12345678", 8, 0));
+
+    //gathered from several buffers
+    for(; sent > 0; --sent)
+        ASSERT_EQ(ShmRing::kOk, consumer.Receive(&msg, 0));
+    consumer.Release();
+    //Push() would merge them into one
+    BufferVector parts;
+    for(const char* part : {"hello ", "shm", " ring"})
+    {
+        parts.buffers.emplace_back(part, strlen(part));
+        parts.totalbytes += strlen(part);
+    }
+    ASSERT_EQ(3u, parts.buffers.size());
+    EXPECT_EQ(ShmRing::kOk, producer.Send(parts, 0));
+    ASSERT_EQ(ShmRing::kOk, consumer.Receive(&msg, 0));
+    EXPECT_EQ("hello shm ring", Str(msg));
+}
+
+//both sides sleep on the futex: the consumer on an empty ring, the producer on a full one
+TEST(ShmRing, wakeup)
+{
+    const int kMessages = 20000;
+    ShmRegion region(1024);
+    ShmRing producer, consumer;
+    ASSERT_TRUE(producer.Init(region.Memory(), 1024));
+    ASSERT_TRUE(consumer.Attach(region.Memory(), region.Size()));
+    producer.SetSpin(0);
+    consumer.SetSpin(0);
+
+    std::thread receiver([&]() {
+        Slice msg;
+        for(int i = 0; i < kMessages; ++i)
+        {
+            ASSERT_EQ(ShmRing::kOk, consumer.Receive(&msg, 5000)) << i;
+            int seq;
+            ParseProducer(Str(msg), &seq);
+            ASSERT_EQ(i, seq);
+            //stall now and then, the ring fills up
+            if(i % 5000 == 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+        consumer.Release();
+    });
+
+    //the consumer is asleep on an empty ring first
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    for(int i = 0; i < kMessages; ++i)
+    {
+        const std::string msg = MessageOf(0, i);
+        ASSERT_EQ(ShmRing::kOk, producer.Send(msg.data(), msg.size(), 5000)) << i;
+    }
+    receiver.join();
+}
+
+//producer threads with a ring each on the same memory; each one's messages stay in order
+TEST(ShmRing, mpsc)
+{
+    const int kProducers = 4;
+    const int kMessages = 20000;
+    ShmRegion region(4096);
+    ShmRing consumer;
+    ASSERT_TRUE(consumer.Init(region.Memory(), 4096, true));
+
+    std::vector<std::thread> producers;
+    for(int p = 0; p < kProducers; ++p)
+    {
+        producers.emplace_back([&, p]() {
+            ShmRing ring;
+            ASSERT_TRUE(ring.Attach(region.Memory(), region.Size()));
+            ring.SetSpin(p % 2 ? 0 : 100);
+            for(int i = 0; i < kMessages; ++i)
+            {
+                const std::string msg = MessageOf(p, i);
+                ASSERT_EQ(ShmRing::kOk, ring.Send(msg.data(), msg.size(), 5000));
+            }
+        });
+    }
+
+    std::vector<int> next(kProducers, 0);
+    Slice msg;
+    for(int i = 0; i < kProducers * kMessages; ++i)
+    {
+        ASSERT_EQ(ShmRing::kOk, consumer.Receive(&msg, 5000)) << i;
+        int seq;
+        const int p = ParseProducer(Str(msg), &seq);
+        ASSERT_LT(p, kProducers);
+        ASSERT_EQ(next[p], seq) << p;
+        ++next[p];
+    }
+    consumer.Release();
+    for(auto& t : producers)
+        t.join();
+    EXPECT_EQ(ShmRing::kTimeout, consumer.Receive(&msg, 0));
+}
+
+static pid_t Fork(const std::function<void()>& child)
+{
+    const pid_t pid = ::fork();
+    if(pid == 0)
+    {
+        child();
+        ::_exit(0);
+    }
+    return pid;
+}
+
+//the consumer gets what the producer sent before dying, then kPeerDead
+TEST(ShmChannel, producer_dead)
+{
+    ShmChannel channel;
+    ASSERT_TRUE(channel.CreateMemfd(4096));
+
+    const pid_t pid = Fork([&]() {
+        ShmChannel peer;
+        if(!peer.Attach(channel.Fd()))
+            ::_exit(1);
+        for(int i = 0; i < 10; ++i)
+        {
+            const std::string msg = MessageOf(1, i);
+            peer.Out().Send(msg.data(), msg.size());
+        }
+    });
+    ASSERT_GT(pid, 0);
+    int status;
+    ASSERT_EQ(pid, ::waitpid(pid, &status, 0));
+    ASSERT_EQ(0, WEXITSTATUS(status));
+
+    Slice msg;
+    for(int i = 0; i < 10; ++i)
+    {
+        ASSERT_EQ(ShmRing::kOk, channel.In().Receive(&msg, 1000));
+        EXPECT_EQ(MessageOf(1, i), Str(msg));
+    }
+    EXPECT_EQ(ShmRing::kPeerDead, channel.In().Receive(&msg, 1000));
+}
+
+//a producer blocked on a full ring learns that the consumer died
+TEST(ShmChannel, consumer_dead)
+{
+    ShmChannel channel;
+    ASSERT_TRUE(channel.CreateMemfd(4096));
+
+    const pid_t pid = Fork([&]() {
+        ShmChannel peer;
+        peer.Attach(channel.Fd());
+    });
+    ASSERT_GT(pid, 0);
+    int status;
+    ASSERT_EQ(pid, ::waitpid(pid, &status, 0));
+
+    const std::string msg(100, 'x');
+    ShmRing::Result result;
+    int sent = 0;
+    while((result = channel.Out().Send(msg.data(), msg.size(), 1000)) == ShmRing::kOk)
+        ++sent;
+    EXPECT_EQ(ShmRing::kPeerDead, result);
+    EXPECT_GT(sent, 0);
+}
+
+//with mpsc the consumer goes on while one producer lives, a producer killed at any
+//point leaves neither a torn frame nor the lock behind
+TEST(ShmChannel, mpsc_producer_killed)
+{
+    ShmChannel channel;
+    ASSERT_TRUE(channel.CreateMemfd(4096, true));
+    ShmRing& in = channel.In();
+
+    auto producer = [&](int id) {
+        return Fork([&channel, id]() {
+            ShmChannel peer;
+            if(!peer.Attach(channel.Fd()))
+                ::_exit(1);
+            for(int i = 0; ; ++i)
+            {
+                const std::string msg = MessageOf(id, i);
+                peer.Out().Send(msg.data(), msg.size());
+            }
+        });
+    };
+
+    const pid_t steady = producer(0);
+    ASSERT_GT(steady, 0);
+    std::vector<int> next(2, 0);
+    Slice msg;
+    auto receive = [&](int count) {
+        for(int i = 0; i < count; ++i)
+        {
+            ASSERT_EQ(ShmRing::kOk, in.Receive(&msg, 5000)) << i;
+            int seq;
+            const int p = ParseProducer(Str(msg), &seq);
+            ASSERT_TRUE(p == 0 || p == 1) << p;
+            ASSERT_EQ(next[p], seq);
+            ++next[p];
+        }
+    };
+
+    for(int round = 0; round < 20; ++round)
+    {
+        next[1] = 0;
+        const pid_t victim = producer(1);
+        ASSERT_GT(victim, 0);
+        receive(500 + round * 37);
+        ::kill(victim, SIGKILL);
+        ASSERT_EQ(victim, ::waitpid(victim, nullptr, 0));
+        //whatever the victim held, the steady producer keeps going
+        const int before = next[0];
+        while(next[0] < before + 100)
+            receive(1);
+        if(::testing::Test::HasFatalFailure())
+            break;
+    }
+
+    ::kill(steady, SIGKILL);
+    ASSERT_EQ(steady, ::waitpid(steady, nullptr, 0));
+    ShmRing::Result result;
+    while((result = in.Receive(&msg, 1000)) == ShmRing::kOk)
+        ;
+    EXPECT_EQ(ShmRing::kPeerDead, result);
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
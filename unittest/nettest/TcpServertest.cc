@@ -0,0 +1,284 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "../../net/TcpServer.h"
+
+using namespace mrpc;
+
+static int Connect(uint16_t port)
+{
+    const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0)
+    {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool ReadAll(int fd, std::string* out, std::size_t len)
+{
+    char buf[65536];
+    while(out->size() < len)
+    {
+        const ssize_t n = ::read(fd, buf, std::min(sizeof buf, len - out->size()));
+        if(n <= 0)
+            return false;
+        out->append(buf, n);
+    }
+    return true;
+}
+
+static TcpServerOptions Options(LoopBackend backend, int loops)
+{
+    TcpServerOptions options;
+    options.host = "127.0.0.1";
+    options.loops = loops;
+    options.backend = backend;
+    return options;
+}
+
+class TcpServerBackend : public testing::TestWithParam<LoopBackend>
+{
+};
+
+TEST_P(TcpServerBackend, echo)
+{
+    TcpServer server(Options(GetParam(), 3));
+
+    //each connection sees one thread only, the one of its loop
+    std::mutex mutex;
+    std::map<TcpConnection*, std::thread::id> threads;
+    std::atomic<int> migrated{0};
+    std::atomic<int> closed{0};
+    server.SetConnectionCallback([&](TcpConnection* conn) {
+        EXPECT_TRUE(conn->Loop()->IsInLoopThread());
+        std::lock_guard<std::mutex> lock(mutex);
+        if(conn->Connected())
+        {
+            threads[conn] = std::this_thread::get_id();
+            return;
+        }
+        if(threads[conn] != std::this_thread::get_id())
+            ++migrated;
+        threads.erase(conn);
+        ++closed;
+    });
+    server.SetMessageCallback([&](TcpConnection* conn, Buffer& input) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(threads[conn] != std::this_thread::get_id())
+                ++migrated;
+        }
+        conn->Send(input.readaddr(), input.readablesize());
+        input.Consume(input.readablesize());
+    });
+    ASSERT_TRUE(server.Start());
+    ASSERT_NE(0, server.Port());
+    EXPECT_EQ(3u, server.LoopCount());
+    for(std::size_t i = 0; i < server.LoopCount(); ++i)
+        EXPECT_NE(nullptr, server.LoopAt(i));
+
+    const int kClients = 24;
+    const std::string message(1000, 'm');
+    std::vector<int> clients;
+    for(int i = 0; i < kClients; ++i)
+    {
+        const int fd = Connect(server.Port());
+        ASSERT_GE(fd, 0);
+        clients.push_back(fd);
+    }
+    for(int round = 0; round < 10; ++round)
+    {
+        for(int fd : clients)
+        {
+            ASSERT_EQ(static_cast<ssize_t>(message.size()), ::write(fd, message.data(), message.size()));
+            std::string got;
+            ASSERT_TRUE(ReadAll(fd, &got, message.size()));
+            EXPECT_EQ(message, got);
+        }
+    }
+
+    EXPECT_EQ(static_cast<uint64_t>(kClients), server.TotalStats().active);
+
+    for(int fd : clients)
+        ::close(fd);
+    for(int i = 0; i < 1000 && closed.load() < kClients; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    EXPECT_EQ(kClients, closed.load());
+    EXPECT_EQ(0, migrated.load());
+
+    //counted after the write returns, so exact only once the loops are past it
+    const TcpLoopStats total = server.TotalStats();
+    EXPECT_EQ(static_cast<uint64_t>(kClients), total.accepted);
+    EXPECT_EQ(static_cast<uint64_t>(kClients), total.closed);
+    EXPECT_EQ(0u, total.active);
+    EXPECT_EQ(static_cast<uint64_t>(kClients) * 10 * message.size(), total.bytesIn);
+    EXPECT_EQ(total.bytesIn, total.bytesOut);
+
+    server.Stop();
+    EXPECT_EQ(nullptr, server.LoopAt(0));
+}
+
+//more than the socket takes: queued, sent as the client reads, then shut down
+TEST_P(TcpServerBackend, backpressure)
+{
+    TcpServer server(Options(GetParam(), 1));
+    const std::size_t kSize = 8 << 20;
+    std::string data(kSize, '\0');
+    for(std::size_t i = 0; i < kSize; ++i)
+        data[i] = static_cast<char>(i * 131 + i / 7919);
+
+    std::atomic<std::size_t> queued{0};
+    server.SetConnectionCallback([&](TcpConnection* conn) {
+        if(!conn->Connected())
+            return;
+        //half copied in, half moved in as a Buffer
+        conn->Send(data.data(), kSize / 2);
+        conn->Send(Buffer(data.data() + kSize / 2, kSize / 2));
+        queued = conn->PendingOutput();
+        conn->Shutdown();
+    });
+    ASSERT_TRUE(server.Start());
+
+    const int fd = Connect(server.Port());
+    ASSERT_GE(fd, 0);
+    std::string got;
+    EXPECT_TRUE(ReadAll(fd, &got, kSize));
+    EXPECT_TRUE(got == data);
+    EXPECT_GT(queued.load(), 0u);
+    //the write side was shut down once all of it was out
+    char c;
+    EXPECT_EQ(0, ::read(fd, &c, 1));
+    EXPECT_EQ(kSize, server.Stats(0).bytesOut);
+    ::close(fd);
+}
+
+//the client half closes right after its request: the whole reply still goes out
+TEST_P(TcpServerBackend, half_close)
+{
+    TcpServer server(Options(GetParam(), 1));
+    const std::size_t kSize = 8 << 20;
+    std::string data(kSize, '\0');
+    for(std::size_t i = 0; i < kSize; ++i)
+        data[i] = static_cast<char>(i * 131 + i / 7919);
+
+    std::atomic<int> closed{0};
+    server.SetConnectionCallback([&](TcpConnection* conn) {
+        if(!conn->Connected())
+            ++closed;
+    });
+    server.SetMessageCallback([&](TcpConnection* conn, Buffer& input) {
+        if(input.readablesize() < 3)
+            return;
+        input.Consume(3);
+        conn->Send(data.data(), kSize);
+    });
+    ASSERT_TRUE(server.Start());
+
+    const int fd = Connect(server.Port());
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(3, ::write(fd, "get", 3));
+    ASSERT_EQ(0, ::shutdown(fd, SHUT_WR));
+    //let the server see the request and the end of it before reading anything
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    std::string got;
+    EXPECT_TRUE(ReadAll(fd, &got, kSize));
+    EXPECT_TRUE(got == data);
+    //closed once all of it was out
+    char c;
+    EXPECT_EQ(0, ::read(fd, &c, 1));
+    for(int i = 0; i < 1000 && closed.load() == 0; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    EXPECT_EQ(1, closed.load());
+    EXPECT_EQ(kSize, server.Stats(0).bytesOut);
+    ::close(fd);
+}
+
+//a peer that keeps sending is read a bounded chunk at a time, the rest on later events
+TEST_P(TcpServerBackend, read_limit)
+{
+    TcpServer server(Options(GetParam(), 1));
+    const std::size_t kSize = 16 << 20;
+    std::atomic<std::size_t> largest{0};
+    std::atomic<int> calls{0};
+    server.SetMessageCallback([&](TcpConnection*, Buffer& input) {
+        largest = std::max(largest.load(), input.readablesize());
+        ++calls;
+        input.Consume(input.readablesize());
+    });
+    ASSERT_TRUE(server.Start());
+
+    const int fd = Connect(server.Port());
+    ASSERT_GE(fd, 0);
+    const int size = 4 << 20;
+    ::setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof size);
+    const std::string chunk(1 << 20, 'f');
+    for(std::size_t sent = 0; sent < kSize; sent += chunk.size())
+        ASSERT_EQ(static_cast<ssize_t>(chunk.size()), ::write(fd, chunk.data(), chunk.size()));
+
+    for(int i = 0; i < 5000 && server.Stats(0).bytesIn < kSize; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    EXPECT_EQ(kSize, server.Stats(0).bytesIn);
+    //kMaxReadPerEvent
+    EXPECT_LE(largest.load(), static_cast<std::size_t>(256 << 10));
+    EXPECT_GE(calls.load(), static_cast<int>(kSize / (256 << 10)));
+    ::close(fd);
+}
+
+//stopping closes what is still connected
+TEST_P(TcpServerBackend, stop)
+{
+    TcpServer server(Options(GetParam(), 2));
+    std::atomic<int> connected{0};
+    std::atomic<int> closed{0};
+    server.SetConnectionCallback([&](TcpConnection* conn) {
+        if(conn->Connected())
+            ++connected;
+        else
+            ++closed;
+    });
+    ASSERT_TRUE(server.Start());
+
+    std::vector<int> clients;
+    for(int i = 0; i < 8; ++i)
+        clients.push_back(Connect(server.Port()));
+    for(int i = 0; i < 1000 && connected.load() < 8; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    EXPECT_EQ(8, connected.load());
+
+    server.Stop();
+    EXPECT_EQ(8, closed.load());
+    for(int fd : clients)
+    {
+        char c;
+        EXPECT_EQ(0, ::read(fd, &c, 1));
+        ::close(fd);
+    }
+    //the port is free again
+    EXPECT_LT(Connect(server.Port()), 0);
+}
+
+INSTANTIATE_TEST_SUITE_P(TcpServer, TcpServerBackend, testing::Values(LoopBackend::kEpoll, LoopBackend::kUring),
+                         [](const testing::TestParamInfo<LoopBackend>& info) {
+                             return info.param == LoopBackend::kEpoll ? "epoll" : "uring";
+                         });
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -1,4 +1,5 @@
 #include <gtest/gtest.h>
+#include <string>
 #include "../../util/Buffer.h"
 
 using namespace mrpc;
@@ -108,6 +109,56 @@ TEST(Buffer, pop_and_push)
 }
 
 
+//past the default size the capacity grows by half or up to a power of two, in
+//turn, and the unread bytes are kept
+TEST(Buffer, grow)
+{
+    Buffer buf;
+    std::string data;
+    for(int i = 0; i < 5000; ++i)
+        data.push_back(static_cast<char>('a' + i % 26));
+
+    buf.PushData(data.data(), 200);
+    EXPECT_EQ(256u, buf.capacity());
+    buf.PushData(data.data() + 200, 100);
+    EXPECT_EQ(384u, buf.capacity());
+    buf.Consume(50);
+    buf.PushData(data.data() + 300, 4700);
+    EXPECT_EQ(6144u, buf.capacity());
+    EXPECT_EQ(data.substr(50), std::string(buf.readaddr(), buf.readablesize()));
+}
+
+//space made by moving the unread bytes to the front keeps them all
+TEST(Buffer, compact)
+{
+    Buffer buf;
+    std::string data;
+    for(int i = 0; i < 200; ++i)
+        data.push_back(static_cast<char>('a' + i % 26));
+    buf.PushData(data.data(), data.size());
+    buf.Consume(150);
+    buf.PushData(data.data(), 100);
+    EXPECT_EQ(256u, buf.capacity());
+    EXPECT_EQ(150u, buf.readablesize());
+    EXPECT_EQ(data.substr(150) + data.substr(0, 100), std::string(buf.readaddr(), buf.readablesize()));
+}
+
+TEST(Buffer, move)
+{
+    Buffer a("hello", 5);
+    Buffer b(std::move(a));
+    EXPECT_EQ(0u, a.readablesize());
+    EXPECT_EQ("hello", std::string(b.readaddr(), b.readablesize()));
+
+    a = std::move(b);
+    EXPECT_EQ(0u, b.readablesize());
+    EXPECT_EQ("hello", std::string(a.readaddr(), a.readablesize()));
+
+    BufferVector vec;
+    vec.Push(std::move(a));
+    EXPECT_EQ(5u, vec.Totalbytes());
+}
+
 int main(int argc, char** argv)
 {
     testing::InitGoogleTest(&argc, argv);
@@ -0,0 +1,154 @@
+#include <gtest/gtest.h>
+#include <csignal>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../../util/Logger.h"
+#include "../../util/ConsoleSink.h"
+
+using namespace mrpc;
+using internal::ConsoleSink;
+
+class ConsoleSinkPipe : public testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        ASSERT_EQ(0, ::pipe2(fds_, O_CLOEXEC));
+    }
+    void TearDown() override
+    {
+        for(int fd : fds_)
+        {
+            if(fd >= 0)
+                ::close(fd);
+        }
+    }
+
+    std::string ReadAll()
+    {
+        std::string out;
+        char buf[65536];
+        const int flags = ::fcntl(fds_[0], F_GETFL);
+        ::fcntl(fds_[0], F_SETFL, flags | O_NONBLOCK);
+        ssize_t n;
+        while((n = ::read(fds_[0], buf, sizeof buf)) > 0)
+            out.append(buf, n);
+        ::fcntl(fds_[0], F_SETFL, flags);
+        return out;
+    }
+
+    int fds_[2] = {-1, -1};
+};
+
+TEST_F(ConsoleSinkPipe, plain)
+{
+    ConsoleSink sink(fds_[1]);
+    EXPECT_FALSE(sink.IsColored());
+
+    sink.Append(logINFO, "first\n", 6);
+    sink.Append(logERROR, "second\n", 7);
+    EXPECT_EQ(13u, sink.PendingBytes());
+    EXPECT_EQ("", ReadAll());
+
+    EXPECT_TRUE(sink.Flush());
+    EXPECT_EQ(0u, sink.PendingBytes());
+    EXPECT_EQ("first\nsecond\n", ReadAll());
+    EXPECT_TRUE(sink.Flush());
+}
+
+TEST_F(ConsoleSinkPipe, colored)
+{
+    ConsoleSink sink(fds_[1]);
+    sink.SetColored(true);
+    sink.Append(logINFO, "info\n", 5);
+    sink.Append(logWARN, "warn\n", 5);
+    sink.Append(logERROR, "error\n", 6);
+    EXPECT_TRUE(sink.Flush());
+    EXPECT_EQ("\033[1;32;40minfo\n\033[0m"
+              "\033[1;33;40mwarn\n\033[0m"
+              "\033[1;31;40merror\n\033[0m", ReadAll());
+}
+
+//a full non-blocking fd takes part of the block; the rest waits for the next cycle
+TEST_F(ConsoleSinkPipe, partial_write)
+{
+    ASSERT_GT(::fcntl(fds_[1], F_SETPIPE_SZ, 4096), 0);
+    ::fcntl(fds_[1], F_SETFL, ::fcntl(fds_[1], F_GETFL) | O_NONBLOCK);
+
+    ConsoleSink sink(fds_[1]);
+    std::string expect;
+    for(int i = 0; i < 1000; ++i)
+    {
+        const std::string rec = "record " + std::to_string(i) + std::string(i % 50, '.') + "\n";
+        sink.Append(logINFO, rec.data(), rec.size());
+        expect += rec;
+    }
+
+    EXPECT_FALSE(sink.Flush());
+    EXPECT_GT(sink.PendingBytes(), 0u);
+    EXPECT_LT(sink.PendingBytes(), expect.size());
+
+    std::string got;
+    int cycles = 0;
+    for(; cycles < 1000; ++cycles)
+    {
+        got += ReadAll();
+        if(sink.Flush())
+            break;
+    }
+    got += ReadAll();
+    EXPECT_GT(cycles, 1);
+    EXPECT_EQ(0u, sink.PendingBytes());
+    EXPECT_TRUE(expect == got);
+}
+
+//the buffer stays between cycles, only a large one is given back
+TEST_F(ConsoleSinkPipe, keep_buffer)
+{
+    ConsoleSink sink(fds_[1]);
+    const std::string rec(1000, 'x');
+    for(int i = 0; i < 30; ++i)
+        sink.Append(logINFO, rec.data(), rec.size());
+    ASSERT_TRUE(sink.Flush());
+    ReadAll();
+    const std::size_t capacity = sink.Capacity();
+    EXPECT_GE(capacity, 30000u);
+
+    for(int cycle = 0; cycle < 10; ++cycle)
+    {
+        sink.Append(logINFO, rec.data(), rec.size());
+        ASSERT_TRUE(sink.Flush());
+        ReadAll();
+        EXPECT_EQ(capacity, sink.Capacity());
+    }
+
+    //a burst beyond kShrinkAbove, drained by a reader meanwhile
+    ::fcntl(fds_[1], F_SETFL, ::fcntl(fds_[1], F_GETFL) | O_NONBLOCK);
+    for(std::size_t n = 0; n <= ConsoleSink::kShrinkAbove; n += rec.size())
+        sink.Append(logINFO, rec.data(), rec.size());
+    EXPECT_GT(sink.Capacity(), ConsoleSink::kShrinkAbove);
+    while(!sink.Flush())
+        ReadAll();
+    ReadAll();
+    EXPECT_EQ(0u, sink.Capacity());
+}
+
+//the console is gone: the output is dropped, nothing is kept to retry
+TEST_F(ConsoleSinkPipe, closed)
+{
+    signal(SIGPIPE, SIG_IGN);
+    ::close(fds_[0]);
+    fds_[0] = -1;
+
+    ConsoleSink sink(fds_[1]);
+    sink.Append(logERROR, "lost\n", 5);
+    EXPECT_TRUE(sink.Flush());
+    EXPECT_EQ(0u, sink.PendingBytes());
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,187 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+#include <unistd.h>
+#include "../../util/Coroutine.h"
+#include "../../util/ThreadPool.h"
+
+using namespace mrpc;
+using namespace mrpc::internal;
+
+static Task<int> Add(int a, int b)
+{
+    co_return a + b;
+}
+
+static Task<int> Sum(int n)
+{
+    int sum = 0;
+    for(int i = 0; i < n; ++i)
+        sum += co_await Add(i, 1);
+    co_return sum;
+}
+
+static Task<void> Nested(int depth, int* leaves)
+{
+    if(depth == 0)
+    {
+        ++*leaves;
+        co_return;
+    }
+    co_await Nested(depth - 1, leaves);
+    co_await Nested(depth - 1, leaves);
+}
+
+TEST(Coroutine, task)
+{
+    EXPECT_EQ(3, SyncWait(Add(1, 2)));
+    //awaits done at once resume the awaiting one by symmetric transfer
+    EXPECT_EQ(50005000L, SyncWait([]() -> Task<long> {
+        long sum = 0;
+        for(int i = 0; i < 10000; ++i)
+            sum += co_await Add(i, 1);
+        co_return sum;
+    }()));
+    EXPECT_EQ(5050, SyncWait(Sum(100)));
+
+    int leaves = 0;
+    SyncWait(Nested(10, &leaves));
+    EXPECT_EQ(1024, leaves);
+
+    //lazy: nothing runs till awaited
+    int ran = 0;
+    {
+        Task<void> task = [](int* ran) -> Task<void> { ++*ran; co_return; }(&ran);
+        EXPECT_FALSE(task.IsDone());
+    }
+    EXPECT_EQ(0, ran);
+}
+
+TEST(Coroutine, frame_recycled)
+{
+    //same size class of 64 bytes
+    void* a = AllocFrame(200);
+    FreeFrame(a, 200);
+    void* b = AllocFrame(250);
+    EXPECT_EQ(a, b);
+    FreeFrame(b, 250);
+
+    //too large for the lists
+    void* c = AllocFrame(kMaxRecycledFrame + 1);
+    FreeFrame(c, kMaxRecycledFrame + 1);
+}
+
+static Task<int> OnPool(ThreadPool& pool, std::thread::id caller)
+{
+    co_await pool.Schedule();
+    EXPECT_GE(pool.WorkerIndex(), 0);
+    EXPECT_NE(caller, std::this_thread::get_id());
+    int sum = 0;
+    for(int i = 0; i < 100; ++i)
+    {
+        co_await pool.Schedule();
+        sum += co_await Add(i, 0);
+    }
+    co_return sum;
+}
+
+TEST(Coroutine, schedule)
+{
+    ThreadPool pool(2);
+    EXPECT_EQ(4950, SyncWait(OnPool(pool, std::this_thread::get_id())));
+}
+
+static Task<void> Sleeper(std::chrono::milliseconds d, std::atomic<int>* done)
+{
+    const auto start = std::chrono::steady_clock::now();
+    co_await SleepFor(d);
+    EXPECT_GE(std::chrono::steady_clock::now() - start, d);
+    done->fetch_add(1);
+}
+
+//from a worker: the timer is scheduled remotely, and resumed on the loop thread
+static Task<void> PoolSleeper(ThreadPool& pool, TimerManager& timers, std::thread::id loop, std::atomic<int>* done)
+{
+    co_await pool.Schedule();
+    co_await SleepFor(timers, std::chrono::milliseconds(3));
+    EXPECT_EQ(loop, std::this_thread::get_id());
+    done->fetch_add(1);
+}
+
+TEST(Coroutine, sleep)
+{
+    TimerManager timers;
+    timers.Attach();
+    ThreadPool pool(1);
+
+    std::atomic<int> done{0};
+    Spawn(Sleeper(std::chrono::milliseconds(5), &done));
+    Spawn(Sleeper(std::chrono::milliseconds(1), &done));
+    Spawn(Sleeper(std::chrono::milliseconds(0), &done));
+    Spawn(PoolSleeper(pool, timers, std::this_thread::get_id(), &done));
+    EXPECT_EQ(1, done.load());
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while(done.load() < 4 && std::chrono::steady_clock::now() < deadline)
+    {
+        timers.Update();
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    EXPECT_EQ(4, done.load());
+    timers.Detach();
+}
+
+static Task<void> Reader(IoPoller& poller, int fd, std::string* got)
+{
+    char buf[16];
+    while(true)
+    {
+        const uint32_t events = co_await poller.Readable(fd);
+        EXPECT_TRUE(events & (EPOLLIN | EPOLLHUP));
+        const ssize_t n = ::read(fd, buf, sizeof buf);
+        if(n <= 0)
+            break;
+        got->append(buf, n);
+    }
+}
+
+TEST(Coroutine, io)
+{
+    int fds[2];
+    ASSERT_EQ(0, ::pipe(fds));
+    IoPoller poller;
+    std::string got;
+    Spawn(Reader(poller, fds[0], &got));
+    EXPECT_EQ(1u, poller.Waiting());
+    EXPECT_EQ(0, poller.Poll(0));
+
+    ASSERT_EQ(5, ::write(fds[1], "hello", 5));
+    EXPECT_EQ(1, poller.Poll(1000));
+    EXPECT_EQ("hello", got);
+
+    ASSERT_EQ(6, ::write(fds[1], " world", 6));
+    ::close(fds[1]);
+    while(poller.Waiting() > 0)
+        poller.Poll(1000);
+    EXPECT_EQ("hello world", got);
+
+    poller.Forget(fds[0]);
+    ::close(fds[0]);
+
+    //not a pollable fd: resumed at once with EPOLLERR
+    char path[] = "/tmp/coroXXXXXX";
+    const int file = ::mkstemp(path);
+    ::unlink(path);
+    uint32_t events = 0;
+    Spawn([](IoPoller& poller, int fd, uint32_t* events) -> Task<void> {
+        *events = co_await poller.Readable(fd);
+    }(poller, file, &events));
+    EXPECT_EQ(uint32_t(EPOLLERR), events);
+    ::close(file);
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,136 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <sched.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include "../../util/CpuTopology.h"
+#include "../../util/ThreadPool.h"
+
+using namespace mrpc;
+
+static std::vector<int> Allowed()
+{
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    sched_getaffinity(0, sizeof set, &set);
+    for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if(CPU_ISSET(cpu, &set))
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+static std::string ToList(const std::vector<int>& cpus)
+{
+    std::string text;
+    for(int cpu : cpus)
+        text += (text.empty() ? "" : ",") + std::to_string(cpu);
+    return text + "\n";
+}
+
+//a fake /sys/devices/system with these node cpulists
+static std::string FakeSysfs(const std::vector<std::string>& nodes)
+{
+    char dir[] = "/tmp/cputopoXXXXXX";
+    EXPECT_TRUE(mkdtemp(dir));
+    const std::string root(dir);
+    mkdir((root + "/node").c_str(), 0755);
+    for(std::size_t i = 0; i < nodes.size(); ++i)
+    {
+        const std::string node = root + "/node/node" + std::to_string(i);
+        mkdir(node.c_str(), 0755);
+        FILE* fp = fopen((node + "/cpulist").c_str(), "w");
+        fputs(nodes[i].c_str(), fp);
+        fclose(fp);
+    }
+    return root;
+}
+
+static void RemoveFake(const std::string& root)
+{
+    EXPECT_EQ(0, system(("rm -rf " + root).c_str()));
+}
+
+TEST(CpuTopology, parse)
+{
+    std::vector<int> cpus;
+    EXPECT_TRUE(CpuTopology::ParseCpuList("0-3,8,10-11\n", &cpus));
+    EXPECT_EQ(std::vector<int>({0, 1, 2, 3, 8, 10, 11}), cpus);
+    EXPECT_TRUE(CpuTopology::ParseCpuList("5", &cpus));
+    EXPECT_EQ(std::vector<int>({5}), cpus);
+    EXPECT_TRUE(CpuTopology::ParseCpuList("\n", &cpus));
+    EXPECT_TRUE(cpus.empty());
+
+    EXPECT_FALSE(CpuTopology::ParseCpuList("3-1", &cpus));
+    EXPECT_FALSE(CpuTopology::ParseCpuList("1,a", &cpus));
+    EXPECT_FALSE(CpuTopology::ParseCpuList("-1", &cpus));
+}
+
+//nodes are cut to the allowed cpus, memory-only nodes dropped
+TEST(CpuTopology, detect)
+{
+    const std::vector<int> allowed = Allowed();
+    ASSERT_FALSE(allowed.empty());
+
+    const std::string sysfs = FakeSysfs({ToList(allowed), "\n", "4000-4001\n"});
+    CpuTopology topology = CpuTopology::Detect(sysfs.c_str());
+    RemoveFake(sysfs);
+    ASSERT_EQ(1u, topology.Nodes().size());
+    EXPECT_EQ(0, topology.Nodes()[0].id_);
+    EXPECT_EQ(allowed, topology.Nodes()[0].cpus_);
+    EXPECT_EQ(0, topology.NodeIndexOf(allowed[0]));
+    EXPECT_EQ(-1, topology.NodeIndexOf(4000));
+
+    //no NUMA in sysfs: one node of all
+    CpuTopology flat = CpuTopology::Detect("/nonexistent");
+    ASSERT_EQ(1u, flat.Nodes().size());
+    EXPECT_EQ(allowed, flat.Nodes()[0].cpus_);
+
+    //the real one has all the allowed cpus
+    EXPECT_EQ(allowed.size(), CpuTopology::Detect().CpuCount());
+
+    CpuTopology left = flat.Exclude({allowed.back()});
+    EXPECT_EQ(allowed.size() - 1, left.CpuCount());
+}
+
+//a pool of two node groups, tasks from a worker of one group run in the other too
+TEST(CpuTopology, pool_groups)
+{
+    const std::vector<int> allowed = Allowed();
+    const std::string sysfs = FakeSysfs({ToList(allowed), ToList(allowed)});
+    CpuTopology topology = CpuTopology::Detect(sysfs.c_str());
+    RemoveFake(sysfs);
+    ASSERT_EQ(2u, topology.Nodes().size());
+
+    ThreadPool pool(topology, 2);
+    EXPECT_EQ(2u, pool.Groups());
+    EXPECT_EQ(4u, pool.Size());
+    EXPECT_EQ(-1, pool.GroupIndex());
+
+    std::atomic<int> count{0};
+    std::atomic<int> groups[2];
+    groups[0] = groups[1] = 0;
+    auto f = pool.Submit([&]() {
+        pool.ParallelFor(0, 2000, 1, [&](int ) {
+            const int group = pool.GroupIndex();
+            if(group >= 0)
+                groups[group].fetch_add(1);
+            //on its pinned cpu
+            EXPECT_NE(-1, topology.NodeIndexOf(CpuTopology::CurrentCpu()));
+            count.fetch_add(1);
+        });
+    });
+    f.get();    //not Wait(): all run on the workers
+    EXPECT_EQ(2000, count.load());
+    EXPECT_EQ(2000, groups[0] + groups[1]);
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
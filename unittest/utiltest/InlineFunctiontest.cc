@@ -0,0 +1,132 @@
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <string>
+#include "../../util/InlineFunction.h"
+#include "../../util/Timer.h"
+
+using namespace mrpc;
+
+//count the heap allocations of the whole program.
+//All the plain forms are replaced together so every new pairs with its own delete;
+//nothrow and aligned ones are left to the library
+static std::size_t s_allocs = 0;
+
+static void* CountedAlloc(std::size_t size)
+{
+    ++s_allocs;
+    if(void* p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size)
+{
+    return CountedAlloc(size);
+}
+
+void* operator new[](std::size_t size)
+{
+    return CountedAlloc(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(void* p, std::size_t ) noexcept
+{
+    free(p);
+}
+
+void operator delete[](void* p, std::size_t ) noexcept
+{
+    free(p);
+}
+
+//test call, move and reset
+TEST(InlineFunction, basic)
+{
+    int sum = 0;
+    InlineFunction<int (int)> add = [&sum](int v) { sum += v; return sum; };
+    EXPECT_TRUE(static_cast<bool>(add));
+    EXPECT_EQ(1, add(1));
+
+    InlineFunction<int (int)> moved(std::move(add));
+    EXPECT_FALSE(static_cast<bool>(add));
+    EXPECT_EQ(3, moved(2));
+
+    moved = nullptr;
+    EXPECT_FALSE(static_cast<bool>(moved));
+}
+
+//captures with destructors are moved and destroyed exactly once
+TEST(InlineFunction, non_trivial)
+{
+    auto counter = std::make_shared<int>(0);
+    {
+        InlineFunction<void ()> a = [counter]() { ++*counter; };
+        EXPECT_EQ(2, counter.use_count());
+
+        InlineFunction<void ()> b;
+        b = std::move(a);
+        EXPECT_EQ(2, counter.use_count());
+        b();
+
+        auto owned = std::make_unique<std::string>("move only");
+        InlineFunction<void ()> c = [owned = std::move(owned), counter]() { *counter += owned->size() > 0; };
+        c();
+        EXPECT_EQ(3, counter.use_count());
+    }
+    EXPECT_EQ(1, counter.use_count());
+    EXPECT_EQ(2, *counter);
+}
+
+//scheduling a deadline callback does not allocate once the timer slots exist
+TEST(InlineFunction, timer_no_alloc)
+{
+    internal::TimerManager mgr;
+    std::vector<TimerId> ids;
+    ids.reserve(1000);
+
+    //warm up: the timer slots
+    for(int i = 0; i < 400; ++i)
+        ids.push_back(mgr.ScheduleAfter(DurationMs(1), []() {}));
+    for(const auto& id : ids)
+        mgr.Cancel(id);
+    ids.clear();
+
+    struct Request
+    {
+        int fd;
+        uint64_t seq;
+    } req = {7, 42};
+    int expired = 0;
+    void* conn = &expired;
+
+    const std::size_t before = s_allocs;
+    for(int i = 0; i < 200; ++i)
+    {
+        //a lambda with captures, and a function with bound arguments
+        ids.push_back(mgr.ScheduleAfter(DurationMs(1000), [&expired, req, conn, i]() {
+            expired += req.fd + static_cast<int>(req.seq) + i + (conn != nullptr);
+        }));
+        ids.push_back(mgr.ScheduleAfter(DurationMs(1000), [](int* n, uint64_t seq) { *n += seq; }, &expired, req.seq));
+    }
+    for(const auto& id : ids)
+        mgr.Cancel(id);
+    EXPECT_EQ(before, s_allocs);
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,315 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "../../util/LogReader.h"
+#include "../../util/TimeUtil.h"
+
+using namespace mrpc;
+
+static const char* const kTags[] = {"INF", "DBG", "WRN", "ERR"};
+static const unsigned int kLevels[] = {logINFO, logDEBUG, logWARN, logERROR};
+
+//2024-03-01 10:00:00 plus i seconds
+static int64_t MicrosOf(int i)
+{
+    return (DaysFromCivil(2024, 3, 1) * 86400 + 10 * 3600 + i) * 1000000LL + i % 1000;
+}
+
+//record i as Logger writes it; every 100th spans two lines
+static std::string RecordOf(int i)
+{
+    const int s = 10 * 3600 + i;
+    char line[128];
+    int n = snprintf(line, sizeof line, "2024-03-01[%02d:%02d:%02d.%06d][%s]:message %d", s / 3600, s / 60 % 60,
+                     s % 60, i % 1000, kTags[i % 4], i);
+    std::string rec(line, n);
+    if(i % 100 == 0)
+        rec += "\n  continued";
+    return rec + "|42\n";
+}
+
+static void WriteFile(const std::string& name, int from, int to, const char* mode = "w")
+{
+    FILE* fp = fopen(name.c_str(), mode);
+    ASSERT_NE(nullptr, fp);
+    for(int i = from; i < to; ++i)
+    {
+        const std::string rec = RecordOf(i);
+        fwrite(rec.data(), 1, rec.size(), fp);
+    }
+    fclose(fp);
+}
+
+class LogReaderFile : public testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        file_ = "/tmp/logreader_" + std::to_string(::getpid()) + "_" +
+                testing::UnitTest::GetInstance()->current_test_info()->name() + ".log";
+    }
+    void TearDown() override
+    {
+        ::unlink(file_.c_str());
+        ::unlink((file_ + ".idx").c_str());
+    }
+
+    std::string file_;
+};
+
+TEST(LogReader, parse_time)
+{
+    int64_t micros = 0;
+    EXPECT_TRUE(ParseLogTime("1970-01-01[00:00:00.000001]", 27, &micros));
+    EXPECT_EQ(1, micros);
+    EXPECT_TRUE(ParseLogTime("1970-01-02", 10, &micros));
+    EXPECT_EQ(86400LL * 1000000, micros);
+
+    //all the accepted forms of the same second
+    const int64_t expect = MicrosOf(0);
+    for(const char* s : {"2024-03-01[10:00:00.000000]", "2024-03-01 10:00:00", "2024-03-01T10:00:00",
+                         "2024-03-01 10:00:00.0"})
+    {
+        micros = 0;
+        EXPECT_TRUE(ParseLogTime(s, strlen(s), &micros)) << s;
+        EXPECT_EQ(expect, micros) << s;
+    }
+    //a short fraction is scaled
+    EXPECT_TRUE(ParseLogTime("2024-03-01 10:00:00.5", 21, &micros));
+    EXPECT_EQ(expect + 500000, micros);
+
+    for(const char* s : {"2024-13-01", "2024-03-00", "2024/03/01", "2024-3-01", "2024-03-01X10:00:00",
+                         "2024-03-01 10:00", "2024-03-01 10-00-00", "2024-03-01 10:00:00.", "2024-03-01 10:00:00,5",
+                         "2024-03", ""})
+    {
+        EXPECT_FALSE(ParseLogTime(s, strlen(s), &micros)) << s;
+    }
+}
+
+TEST(LogReader, parse_level)
+{
+    EXPECT_EQ(static_cast<unsigned int>(logINFO), ParseLogLevel("[INF]:x", 7));
+    EXPECT_EQ(static_cast<unsigned int>(logDEBUG), ParseLogLevel("[DBG]:", 6));
+    EXPECT_EQ(static_cast<unsigned int>(logWARN), ParseLogLevel("[WRN]:", 6));
+    EXPECT_EQ(static_cast<unsigned int>(logERROR), ParseLogLevel("[ERR]:", 6));
+    EXPECT_EQ(static_cast<unsigned int>(logUSR), ParseLogLevel("[USR]:", 6));
+    EXPECT_EQ(0u, ParseLogLevel("[IMF]:", 6));
+    EXPECT_EQ(0u, ParseLogLevel("[INF]", 5));
+    EXPECT_EQ(0u, ParseLogLevel("(INF):", 6));
+
+    EXPECT_TRUE(IsLogFileName("2024-03-01[10:00:00.000123]@123-1.log"));
+    EXPECT_TRUE(IsLogFileName("/var/log/2024-03-01[10:00:00.000123]@123-12err.log"));
+    EXPECT_FALSE(IsLogFileName("2024-03-01[10:00:00.000123]@123-1.log.idx"));
+    EXPECT_FALSE(IsLogFileName("2024-03-01[10:00:00.000123]-1.log"));
+    EXPECT_FALSE(IsLogFileName("notatime@123-1.log"));
+
+    std::string tag = "x";
+    EXPECT_TRUE(IsLogFileName("2024-03-01[10:00:00.000123]@123-1.log", &tag));
+    EXPECT_EQ("", tag);
+    EXPECT_TRUE(IsLogFileName("2024-03-01[10:00:00.000123]@123-1.ERR.log", &tag));
+    EXPECT_EQ("ERR", tag);
+}
+
+TEST_F(LogReaderFile, query)
+{
+    const int kRecords = 20000;
+    WriteFile(file_, 0, kRecords);
+
+    LogSegment segment;
+    ASSERT_TRUE(segment.Open(file_));
+    EXPECT_GT(segment.Index().size(), 10u);
+    EXPECT_EQ(0, ::access((file_ + ".idx").c_str(), F_OK));
+
+    //everything, in file order
+    std::vector<LogRecord> records;
+    EXPECT_EQ(static_cast<std::size_t>(kRecords), segment.Query(LogQuery(), &records));
+    for(int i = 0; i < kRecords; ++i)
+    {
+        ASSERT_EQ(MicrosOf(i), records[i].micros);
+        EXPECT_EQ(kLevels[i % 4], records[i].level);
+        EXPECT_EQ(RecordOf(i), std::string(static_cast<const char*>(records[i].line.data), records[i].line.len));
+    }
+
+    //a time range, inclusive at both ends
+    LogQuery query;
+    query.fromMicros = MicrosOf(5000);
+    query.toMicros = MicrosOf(5999);
+    records.clear();
+    EXPECT_EQ(1000u, segment.Query(query, &records));
+    EXPECT_EQ(MicrosOf(5000), records.front().micros);
+    EXPECT_EQ(MicrosOf(5999), records.back().micros);
+
+    //levels, alone and combined
+    query = LogQuery();
+    query.levels = logWARN;
+    records.clear();
+    EXPECT_EQ(static_cast<std::size_t>(kRecords / 4), segment.Query(query, &records));
+    query.levels = logWARN | logERROR;
+    records.clear();
+    EXPECT_EQ(static_cast<std::size_t>(kRecords / 2), segment.Query(query, &records));
+    query.levels = logUSR;
+    records.clear();
+    EXPECT_EQ(0u, segment.Query(query, &records));
+}
+
+//the side index is used as it is, only the last block is rescanned
+TEST_F(LogReaderFile, load_index)
+{
+    WriteFile(file_, 0, 20000);
+    std::size_t blocks;
+    {
+        LogSegment segment;
+        ASSERT_TRUE(segment.Open(file_));
+        blocks = segment.Index().size();
+    }
+
+    //no level in the first block any more: a loaded index skips it, a rebuilt one wouldn't
+    const std::string idx = file_ + ".idx";
+    FILE* fp = fopen(idx.c_str(), "r+b");
+    ASSERT_NE(nullptr, fp);
+    const long levelsAt = 32 + offsetof(LogIndexEntry, levels);     // past the 32 byte header
+    const uint32_t none = 0;
+    ASSERT_EQ(0, fseek(fp, levelsAt, SEEK_SET));
+    ASSERT_EQ(1u, fwrite(&none, sizeof none, 1, fp));
+    fclose(fp);
+
+    LogSegment segment;
+    ASSERT_TRUE(segment.Open(file_));
+    EXPECT_EQ(blocks, segment.Index().size());
+    EXPECT_EQ(0u, segment.Index().front().levels);
+    LogQuery query;
+    query.levels = logINFO;
+    query.toMicros = MicrosOf(99);
+    std::vector<LogRecord> records;
+    EXPECT_EQ(0u, segment.Query(query, &records));
+}
+
+//a bad index is rebuilt and written back
+TEST_F(LogReaderFile, rebuild_index)
+{
+    WriteFile(file_, 0, 5000);
+    const std::string idx = file_ + ".idx";
+    FILE* fp = fopen(idx.c_str(), "wb");
+    ASSERT_NE(nullptr, fp);
+    fputs("not an index at all, not even close to one", fp);
+    fclose(fp);
+
+    LogSegment segment;
+    ASSERT_TRUE(segment.Open(file_));
+    std::vector<LogRecord> records;
+    EXPECT_EQ(5000u, segment.Query(LogQuery(), &records));
+
+    LogSegment again;
+    ASSERT_TRUE(again.Open(file_, false));
+    EXPECT_EQ(segment.Index().size(), again.Index().size());
+    EXPECT_EQ(segment.Index().back().offset, again.Index().back().offset);
+    EXPECT_EQ(segment.Index().front().levels, again.Index().front().levels);
+
+    //no index and not allowed to save one: still queries, leaves nothing behind
+    ::unlink(idx.c_str());
+    LogSegment readonly;
+    ASSERT_TRUE(readonly.Open(file_, false));
+    records.clear();
+    EXPECT_EQ(5000u, readonly.Query(LogQuery(), &records));
+    EXPECT_NE(0, ::access(idx.c_str(), F_OK));
+}
+
+//a live file: zero padded like OMmapFile leaves it, then appended to
+TEST_F(LogReaderFile, extend)
+{
+    WriteFile(file_, 0, 3000);
+    {
+        FILE* fp = fopen(file_.c_str(), "ab");
+        const std::string zeros(100000, '\0');
+        fwrite(zeros.data(), 1, zeros.size(), fp);
+        fclose(fp);
+    }
+
+    LogSegment segment;
+    ASSERT_TRUE(segment.Open(file_));
+    std::size_t size = 0;
+    for(int i = 0; i < 3000; ++i)
+        size += RecordOf(i).size();
+    EXPECT_EQ(size, segment.Size());
+    EXPECT_FALSE(segment.Refresh());
+
+    ASSERT_EQ(0, truncate(file_.c_str(), size));
+    WriteFile(file_, 3000, 8000, "ab");
+    EXPECT_TRUE(segment.Refresh());
+    std::vector<LogRecord> records;
+    EXPECT_EQ(8000u, segment.Query(LogQuery(), &records));
+    EXPECT_EQ(MicrosOf(7999), records.back().micros);
+
+    //the saved index covers the new records as well
+    LogSegment reopened;
+    ASSERT_TRUE(reopened.Open(file_, false));
+    EXPECT_EQ(segment.Index().size(), reopened.Index().size());
+    EXPECT_EQ(segment.Size(), reopened.Size());
+}
+
+TEST(LogReader, query_files)
+{
+    std::vector<std::string> files;
+    for(int f = 0; f < 3; ++f)
+    {
+        files.push_back("/tmp/logreader_" + std::to_string(::getpid()) + "_files" + std::to_string(f) + ".log");
+        WriteFile(files.back(), f * 1000, f * 1000 + 1000);
+    }
+    files.push_back("/tmp/logreader_does_not_exist.log");
+
+    LogQuery query;
+    query.levels = logERROR;
+    std::vector<std::string> order;
+    const std::size_t total = QueryLogFiles(files, query, 2,
+        [&](const LogSegment& segment, const std::vector<LogRecord>& records) {
+            order.push_back(segment.FileName());
+            EXPECT_EQ(250u, records.size());
+        }, false);
+    EXPECT_EQ(750u, total);
+    ASSERT_EQ(3u, order.size());
+    for(int f = 0; f < 3; ++f)
+    {
+        EXPECT_EQ(files[f], order[f]);
+        ::unlink(files[f].c_str());
+    }
+}
+
+//a route not exclusive copies records of the main file: a directory lists the main files only
+TEST(LogReader, list_files)
+{
+    const std::string dir = "/tmp/logreader_" + std::to_string(::getpid()) + "_dir";
+    ASSERT_EQ(0, ::mkdir(dir.c_str(), 0755));
+    const std::string first = dir + "/2024-03-01[10:00:00.000123]@123-1.log";
+    const std::string second = dir + "/2024-03-01[10:00:01.000000]@123-2.log";
+    const std::string route = dir + "/2024-03-01[10:00:00.000123]@123-1.ERR.log";
+    WriteFile(second, 1000, 2000);
+    WriteFile(first, 0, 1000);
+    WriteFile(route, 0, 1000);
+    WriteFile(first + ".idx", 0, 0);
+
+    std::vector<std::string> files;
+    ASSERT_TRUE(ListLogFiles(dir, "", &files));
+    ASSERT_EQ(2u, files.size());
+    EXPECT_EQ(first, files[0]);
+    EXPECT_EQ(second, files[1]);
+    EXPECT_EQ(2000u, QueryLogFiles(files, LogQuery(), 1, [](const LogSegment&, const std::vector<LogRecord>&) {}, false));
+
+    ASSERT_TRUE(ListLogFiles(dir, "ERR", &files));
+    ASSERT_EQ(1u, files.size());
+    EXPECT_EQ(route, files[0]);
+    EXPECT_FALSE(ListLogFiles(dir + "/none", "", &files));
+
+    const std::string cmd = "rm -rf " + dir;
+    EXPECT_EQ(0, system(cmd.c_str()));
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,151 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <unistd.h>
+#include "../../util/Logger.h"
+#include "../../util/LogReader.h"
+
+using namespace mrpc;
+
+static std::string MakeTestDir(const char* name)
+{
+    std::string dir = std::string("/tmp/logger_") + name + "_" + std::to_string(::getpid());
+    std::string cmd = "rm -rf " + dir;
+    EXPECT_EQ(0, system(cmd.c_str()));
+    return dir;
+}
+
+static void RemoveTestDir(const std::string& dir)
+{
+    std::string cmd = "rm -rf " + dir;
+    EXPECT_EQ(0, system(cmd.c_str()));
+}
+
+//records per file, keyed by the route tag ("" for the main file)
+static std::map<std::string, std::vector<std::string>> ReadLogs(const std::string& dir)
+{
+    std::map<std::string, std::vector<std::string>> logs;
+    DIR* d = ::opendir(dir.c_str());
+    if(!d)
+        return logs;
+    while(dirent* ent = ::readdir(d))
+    {
+        const std::string name = ent->d_name;
+        if(!IsLogFileName(name))
+            continue;
+        //<time>@<pid>-<seq>[.<tag>].log
+        const std::string stem = name.substr(0, name.size() - 4);
+        const auto dot = stem.rfind('.');
+        const auto at = stem.find('@');
+        const std::string tag = dot != std::string::npos && dot > at ? stem.substr(dot + 1) : "";
+
+        LogSegment segment;
+        EXPECT_TRUE(segment.Open(dir + "/" + name, false));
+        std::vector<LogRecord> records;
+        segment.Query(LogQuery(), &records);
+        for(const auto& rec : records)
+            logs[tag].emplace_back(static_cast<const char*>(rec.line.data), rec.line.len);
+    }
+    ::closedir(d);
+    return logs;
+}
+
+static std::size_t Count(const std::vector<std::string>& records, const char* what)
+{
+    std::size_t n = 0;
+    for(const auto& rec : records)
+        n += rec.find(what) != std::string::npos;
+    return n;
+}
+
+//exclusive routes take their levels out of the main file, the others copy them
+TEST(Logger, route)
+{
+    const auto dir = MakeTestDir("route");
+    LogManager::Instance().start();
+    {
+        auto log = LogManager::Instance().CreateLog(logALL, logFile, dir.c_str());
+        EXPECT_FALSE(log->AddRoute(0, "none"));
+        EXPECT_FALSE(log->AddRoute(logERROR, ""));
+        EXPECT_TRUE(log->AddRoute(logERROR, "err", true));
+        EXPECT_TRUE(log->AddRoute(logWARN | logERROR, "alert"));
+
+        for(int i = 0; i < 100; ++i)
+        {
+            LOG_INF(log) << "info " << i;
+            LOG_DEB(log) << "debug " << i;
+            LOG_WRN(log) << "warn " << i;
+            LOG_ERR(log) << "error " << i;
+        }
+        LogManager::Instance().stop();
+
+        auto logs = ReadLogs(dir);
+        ASSERT_EQ(3u, logs.size());
+        EXPECT_EQ(300u, logs[""].size());
+        EXPECT_EQ(100u, Count(logs[""], "[INF]:info "));
+        EXPECT_EQ(100u, Count(logs[""], "[DBG]:debug "));
+        EXPECT_EQ(100u, Count(logs[""], "[WRN]:warn "));
+        EXPECT_EQ(0u, Count(logs[""], "[ERR]"));
+
+        EXPECT_EQ(100u, logs["err"].size());
+        EXPECT_EQ(100u, Count(logs["err"], "[ERR]:error "));
+
+        EXPECT_EQ(200u, logs["alert"].size());
+        EXPECT_EQ(100u, Count(logs["alert"], "[WRN]:warn "));
+        EXPECT_EQ(100u, Count(logs["alert"], "[ERR]:error "));
+    }
+    RemoveTestDir(dir);
+}
+
+//routes added while another thread logs and the io thread writes
+TEST(Logger, route_while_logging)
+{
+    const auto dir = MakeTestDir("live");
+    LogManager::Instance().start();
+    {
+        auto log = LogManager::Instance().CreateLog(logALL, logFile, dir.c_str());
+        std::atomic<bool> stop{false};
+        std::atomic<int> written{0};
+        std::thread writer([&]() {
+            while(!stop)
+            {
+                LOG_ERR(log) << "error " << written.fetch_add(1);
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        });
+
+        const char* tags[] = {"a", "b", "c", "d", "e", "f", "g", "h"};
+        for(const char* tag : tags)
+        {
+            const int before = written.load();
+            while(written.load() < before + 20)
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            EXPECT_TRUE(log->AddRoute(logERROR, tag));
+        }
+        //the last route gets some records too
+        const int before = written.load();
+        while(written.load() < before + 100)
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        stop = true;
+        writer.join();
+        LogManager::Instance().stop();
+
+        auto logs = ReadLogs(dir);
+        EXPECT_EQ(static_cast<std::size_t>(written.load()), logs[""].size());
+        //each route has a tail of the records, the earlier ones more
+        for(const char* tag : tags)
+            EXPECT_GT(logs[tag].size(), 0u) << tag;
+        EXPECT_GE(logs["a"].size(), logs["h"].size());
+    }
+    RemoveTestDir(dir);
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
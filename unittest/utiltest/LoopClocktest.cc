@@ -0,0 +1,58 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include "../../util/LoopClock.h"
+#include "../../util/TimeUtil.h"
+
+using namespace mrpc;
+
+//the time stays until Refresh, on the attached thread only
+TEST(LoopClock, cached)
+{
+    EXPECT_EQ(nullptr, LoopClock::Current());
+
+    LoopClock clock;
+    clock.Attach();
+    EXPECT_EQ(&clock, LoopClock::Current());
+
+    const auto steady = LoopClock::SteadyNow();
+    const auto wall = LoopClock::SystemNow();
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    EXPECT_EQ(steady, LoopClock::SteadyNow());
+    EXPECT_EQ(wall, LoopClock::SystemNow());
+
+    //log timestamps share it
+    Time now;
+    EXPECT_EQ(std::chrono::duration_cast<std::chrono::microseconds>(wall.time_since_epoch()).count(),
+              now.Microseconds());
+
+    std::thread([steady]() {
+        EXPECT_EQ(nullptr, LoopClock::Current());
+        EXPECT_GT(LoopClock::SteadyNow(), steady);
+    }).join();
+
+    clock.Refresh();
+    EXPECT_GE(LoopClock::SteadyNow() - steady, std::chrono::milliseconds(2));
+    EXPECT_GT(LoopClock::SystemNow(), wall);
+
+    clock.Detach();
+    EXPECT_EQ(nullptr, LoopClock::Current());
+}
+
+//the coarse clocks are within a few ticks of the fine ones
+TEST(LoopClock, coarse)
+{
+    LoopClock clock(true);
+    EXPECT_TRUE(clock.IsCoarse());
+
+    const auto steady = std::chrono::steady_clock::now();
+    const auto wall = std::chrono::system_clock::now();
+    clock.Refresh();
+    EXPECT_LT(std::chrono::abs(clock.Now() - steady), std::chrono::milliseconds(20));
+    EXPECT_LT(std::chrono::abs(clock.WallNow() - wall), std::chrono::milliseconds(20));
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
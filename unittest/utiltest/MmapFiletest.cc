@@ -0,0 +1,287 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../../util/MmapFile.h"
+
+using namespace mrpc;
+using internal::IMmapFile;
+using internal::OMmapFile;
+using internal::SyncOptions;
+
+class MmapFileTest : public testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        file_ = "/tmp/mmapfile_" + std::to_string(::getpid()) + "_" +
+                testing::UnitTest::GetInstance()->current_test_info()->name();
+        ::unlink(file_.c_str());
+    }
+    void TearDown() override
+    {
+        ::unlink(file_.c_str());
+    }
+
+    void Append(const std::string& data)
+    {
+        const int fd = ::open(file_.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        ASSERT_GE(fd, 0);
+        ASSERT_EQ(static_cast<ssize_t>(data.size()), ::write(fd, data.data(), data.size()));
+        ::close(fd);
+    }
+
+    static std::string Str(const Slice& s)
+    {
+        return std::string(static_cast<const char*>(s.data), s.len);
+    }
+
+    std::string Content()
+    {
+        IMmapFile in;
+        EXPECT_TRUE(in.Open(file_));
+        return in.Size() ? std::string(in.Data(), in.Size()) : std::string();
+    }
+
+    struct stat Stat()
+    {
+        struct stat st;
+        EXPECT_EQ(0, ::stat(file_.c_str(), &st));
+        return st;
+    }
+
+    std::string file_;
+};
+
+//wait for the syncer to catch up to offset
+static bool WaitSynced(const OMmapFile& out, std::size_t offset)
+{
+    for(int i = 0; i < 2000 && out.SyncedOffset() != offset; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    return out.SyncedOffset() == offset;
+}
+
+//the mapping follows a growing file, an empty one has none until it grows
+TEST_F(MmapFileTest, refresh)
+{
+    Append("");
+    IMmapFile in;
+    ASSERT_TRUE(in.Open(file_));
+    EXPECT_TRUE(in.IsOpen());
+    EXPECT_EQ(nullptr, in.Data());
+    EXPECT_EQ(0u, in.Size());
+    EXPECT_FALSE(in.Refresh());
+
+    Append("hello");
+    EXPECT_TRUE(in.Refresh());
+    EXPECT_EQ(5u, in.Size());
+    EXPECT_EQ("hello", std::string(in.Data(), in.Size()));
+    EXPECT_FALSE(in.Refresh());
+
+    //across several pages, the old content is still there
+    std::string expect = "hello";
+    for(int i = 0; i < 3; ++i)
+    {
+        const std::string more(10000, static_cast<char>('a' + i));
+        Append(more);
+        expect += more;
+        EXPECT_TRUE(in.Refresh());
+        ASSERT_EQ(expect.size(), in.Size());
+        EXPECT_TRUE(expect == std::string(in.Data(), in.Size()));
+    }
+
+    in.Close();
+    EXPECT_FALSE(in.IsOpen());
+    EXPECT_FALSE(in.Refresh());
+    EXPECT_FALSE(in.Open(file_ + "_missing"));
+}
+
+//views are cut at the end of file, never past it
+TEST_F(MmapFileTest, view)
+{
+    Append("0123456789");
+    IMmapFile in;
+    ASSERT_TRUE(in.Open(file_, IMmapFile::kPopulate));
+
+    EXPECT_EQ("0123456789", Str(in.View(0, 10)));
+    EXPECT_EQ("234", Str(in.View(2, 3)));
+    EXPECT_EQ("789", Str(in.View(7, 100)));
+    EXPECT_EQ("9", Str(in.View(9, SIZE_MAX)));
+    EXPECT_EQ(in.Data() + 4, in.View(4, 1).data);
+    EXPECT_EQ(0u, in.View(4, 0).len);
+
+    EXPECT_EQ(nullptr, in.View(10, 1).data);
+    EXPECT_EQ(0u, in.View(10, 1).len);
+    EXPECT_EQ(nullptr, in.View(SIZE_MAX, 1).data);
+
+    //a view taken after Refresh sees the new tail
+    Append("abc");
+    EXPECT_EQ(0u, in.View(10, 3).len);
+    EXPECT_TRUE(in.Refresh());
+    EXPECT_EQ("9abc", Str(in.View(9, 100)));
+
+    IMmapFile empty;
+    EXPECT_EQ(0u, empty.View(0, 1).len);
+}
+
+TEST_F(MmapFileTest, advise)
+{
+    const std::size_t page = ::sysconf(_SC_PAGESIZE);
+    Append(std::string(4 * page + 100, 'x'));
+    IMmapFile in;
+    ASSERT_TRUE(in.Open(file_, IMmapFile::kHugePage));
+
+    for(auto advice : {IMmapFile::kSequential, IMmapFile::kRandom, IMmapFile::kWillNeed, IMmapFile::kNormal})
+        EXPECT_TRUE(in.Advise(advice));
+
+    //unaligned ranges, cut at the end of file
+    EXPECT_TRUE(in.Advise(IMmapFile::kWillNeed, page + 1, 10));
+    EXPECT_TRUE(in.Advise(IMmapFile::kWillNeed, 3 * page + 7, SIZE_MAX));
+    EXPECT_TRUE(in.Advise(IMmapFile::kDontNeed, 0, in.Size()));
+    EXPECT_FALSE(in.Advise(IMmapFile::kWillNeed, in.Size(), 1));
+
+    //a kept advice is applied again to the grown mapping, and the data is intact
+    EXPECT_TRUE(in.Advise(IMmapFile::kSequential));
+    Append(std::string(page, 'y'));
+    EXPECT_TRUE(in.Refresh());
+    EXPECT_TRUE(in.Advise(IMmapFile::kWillNeed, 4 * page, page));
+    EXPECT_EQ('x', in.Data()[4 * page + 99]);
+    EXPECT_EQ('y', in.Data()[in.Size() - 1]);
+
+    //nothing mapped, nothing to advise
+    IMmapFile empty;
+    EXPECT_FALSE(empty.Advise(IMmapFile::kRandom));
+}
+
+//the file is preallocated, the mapping grows by mremap, the tail is cut on Close
+TEST_F(MmapFileTest, write_grow)
+{
+    const std::size_t kDefaultSize = 1024 * 1024;
+    OMmapFile out;
+    ASSERT_TRUE(out.Open(file_, false));
+    EXPECT_EQ(kDefaultSize, static_cast<std::size_t>(Stat().st_size));
+    EXPECT_GE(static_cast<std::size_t>(Stat().st_blocks) * 512, kDefaultSize);
+
+    //across two growths, records straddling the old ends
+    std::string expect;
+    for(int i = 0; expect.size() < 3 * kDefaultSize; ++i)
+    {
+        const std::string rec = std::to_string(i) + std::string(i % 1000, static_cast<char>('a' + i % 26));
+        out.Write(rec.data(), rec.size());
+        expect += rec;
+    }
+    EXPECT_EQ(expect.size(), out.Offset());
+    EXPECT_EQ(4 * kDefaultSize, static_cast<std::size_t>(Stat().st_size));
+    EXPECT_GE(static_cast<std::size_t>(Stat().st_blocks) * 512, 4 * kDefaultSize);
+
+    out.Close();
+    EXPECT_FALSE(out.IsOpen());
+    EXPECT_EQ(expect.size(), static_cast<std::size_t>(Stat().st_size));
+    EXPECT_TRUE(expect == Content());
+
+    //reopened for append, it goes on after the old end
+    ASSERT_TRUE(out.Open(file_));
+    EXPECT_EQ(expect.size(), out.Offset());
+    out.Write("tail", 4);
+    out.Close();
+    EXPECT_TRUE(expect + "tail" == Content());
+}
+
+TEST_F(MmapFileTest, truncate)
+{
+    OMmapFile out;
+    ASSERT_TRUE(out.Open(file_, false));
+    out.Write("0123456789", 10);
+    EXPECT_TRUE(out.Sync());
+    EXPECT_FALSE(out.Sync());
+    EXPECT_EQ(10u, out.SyncedOffset());
+
+    //cutting the mapping below the offset cuts the data
+    out.Truncate(4);
+    EXPECT_EQ(4u, out.Offset());
+    EXPECT_EQ(4u, out.SyncedOffset());
+    EXPECT_EQ(4u, static_cast<std::size_t>(Stat().st_size));
+    out.Write("abcdefgh", 8);
+    EXPECT_EQ(12u, out.Offset());
+    out.Close();
+    EXPECT_EQ("0123abcdefgh", Content());
+
+    //0 starts over
+    ASSERT_TRUE(out.Open(file_));
+    out.Truncate(0);
+    EXPECT_EQ(0u, out.Offset());
+    EXPECT_EQ(0u, out.SyncedOffset());
+    out.Write("new", 3);
+    EXPECT_TRUE(out.Sync());
+    out.Close();
+    EXPECT_EQ("new", Content());
+
+    //and after a growth past the default size too
+    ASSERT_TRUE(out.Open(file_, false));
+    const std::string big(3 * 1024 * 1024, 'b');
+    out.Write(big.data(), big.size());
+    out.Truncate(0);
+    EXPECT_EQ(1024u * 1024, static_cast<std::size_t>(Stat().st_size));
+    out.Write("again", 5);
+    out.Close();
+    EXPECT_EQ("again", Content());
+}
+
+//Sync only publishes, the syncer writes back within the interval, or sooner past bytes
+TEST_F(MmapFileTest, async_sync)
+{
+    SyncOptions options;
+    options.async = true;
+    options.interval = std::chrono::milliseconds(20);
+    options.bytes = 64 * 1024;
+
+    OMmapFile out;
+    out.SetSyncOptions(options);
+    ASSERT_TRUE(out.Open(file_, false));
+    EXPECT_EQ(0u, out.SyncedOffset());
+
+    out.Write("hello", 5);
+    EXPECT_EQ(0u, out.SyncedOffset());
+    EXPECT_TRUE(out.Sync());
+    EXPECT_TRUE(WaitSynced(out, 5));
+
+    //written but not published: nothing to write back
+    out.Write("world", 5);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(5u, out.SyncedOffset());
+
+    //a big batch kicks the syncer, while writes go on
+    const std::string chunk(4096, 'c');
+    for(int round = 0; round < 20; ++round)
+    {
+        for(int i = 0; i < 32; ++i)
+            out.Write(chunk.data(), chunk.size());
+        EXPECT_TRUE(out.Sync());
+    }
+    EXPECT_TRUE(WaitSynced(out, out.Offset()));
+
+    //a cut takes the synced offset with it, the syncer goes on from there
+    out.Truncate(100);
+    EXPECT_EQ(100u, out.SyncedOffset());
+    out.Write("more", 4);
+    EXPECT_TRUE(out.Sync());
+    EXPECT_TRUE(WaitSynced(out, 104));
+
+    out.Truncate(0);
+    EXPECT_EQ(0u, out.SyncedOffset());
+    out.Write("end", 3);
+    EXPECT_TRUE(out.Sync());
+    EXPECT_TRUE(WaitSynced(out, 3));
+    out.Close();
+    EXPECT_EQ("end", Content());
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
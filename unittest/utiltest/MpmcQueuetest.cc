@@ -0,0 +1,197 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../../util/MpmcQueue.h"
+#include "../../util/MpscQueue.h"
+
+using namespace mrpc;
+
+TEST(MpmcQueue, basic)
+{
+    MpmcQueue<std::string> q(3);
+    EXPECT_EQ(4u, q.Capacity());
+
+    std::string s;
+    EXPECT_FALSE(q.TryPop(s));
+    for(int i = 0; i < 4; ++i)
+        EXPECT_TRUE(q.TryPush(std::to_string(i)));
+    EXPECT_FALSE(q.TryPush("full"));
+    EXPECT_EQ(4u, q.SizeApprox());
+
+    //around the ring a few laps
+    for(int i = 4; i < 20; ++i)
+    {
+        ASSERT_TRUE(q.TryPop(s));
+        EXPECT_EQ(std::to_string(i - 4), s);
+        EXPECT_TRUE(q.TryEmplace(std::to_string(i)));
+    }
+    EXPECT_EQ(4u, q.SizeApprox());
+}
+
+TEST(MpmcQueue, batch)
+{
+    MpmcQueue<int> q(8);
+    int in[12];
+    for(int i = 0; i < 12; ++i)
+        in[i] = i;
+    EXPECT_EQ(8u, q.TryPushBatch(in, 12));
+    EXPECT_EQ(0u, q.TryPushBatch(in + 8, 4));
+
+    int out[12];
+    EXPECT_EQ(3u, q.TryPopBatch(out, 3));
+    EXPECT_EQ(3u, q.TryPushBatch(in + 8, 4));
+    EXPECT_EQ(8u, q.TryPopBatch(out + 3, 12));
+    EXPECT_EQ(0u, q.TryPopBatch(out, 12));
+    for(int i = 0; i < 11; ++i)
+        EXPECT_EQ(i, out[i]);
+}
+
+//what's left is destroyed with the queue
+TEST(MpmcQueue, destroy)
+{
+    auto value = std::make_shared<int>(1);
+    {
+        MpmcQueue<std::shared_ptr<int>> q(4);
+        q.TryPush(value);
+        q.TryPush(value);
+        std::shared_ptr<int> p;
+        q.TryPop(p);
+        EXPECT_EQ(3, value.use_count());
+    }
+    EXPECT_EQ(1, value.use_count());
+}
+
+//every value pushed is popped exactly once, in order per producer
+TEST(MpmcQueue, threads)
+{
+    const int kThreads = 4;
+    const long kPerThread = 100000;
+    MpmcQueue<long> q(64);
+
+    std::vector<std::vector<long>> got(kThreads);
+    std::atomic<long> popped{0};
+    std::vector<std::thread> threads;
+    for(int t = 0; t < kThreads; ++t)
+    {
+        threads.emplace_back([&q, t, kPerThread]() {
+            long batch[8];
+            for(long i = 0; i < kPerThread; )
+            {
+                if(i % 3 == 0)
+                {
+                    const long n = std::min(8L, kPerThread - i);
+                    for(long j = 0; j < n; ++j)
+                        batch[j] = t * kPerThread + i + j;
+                    const std::size_t pushed = q.TryPushBatch(batch, n);
+                    i += pushed;
+                    if(pushed == 0)
+                        std::this_thread::yield();
+                }
+                else if(q.TryPush(t * kPerThread + i))
+                {
+                    ++i;
+                }
+                else
+                {
+                    std::this_thread::yield();
+                }
+            }
+        });
+        threads.emplace_back([&q, &got, &popped, t, kThreads, kPerThread]() {
+            long batch[8];
+            while(popped.load() < kThreads * kPerThread)
+            {
+                const std::size_t n = q.TryPopBatch(batch, t % 2 ? 8 : 1);
+                if(n == 0)
+                    std::this_thread::yield();
+                got[t].insert(got[t].end(), batch, batch + n);
+                popped.fetch_add(n);
+            }
+        });
+    }
+    for(auto& t : threads)
+        t.join();
+
+    std::vector<char> seen(kThreads * kPerThread, 0);
+    for(const auto& values : got)
+    {
+        std::vector<long> last(kThreads, -1);
+        for(long v : values)
+        {
+            ASSERT_EQ(0, seen[v]);
+            seen[v] = 1;
+            EXPECT_LT(last[v / kPerThread], v);
+            last[v / kPerThread] = v;
+        }
+    }
+    for(char s : seen)
+        EXPECT_EQ(1, s);
+}
+
+struct Item : public MpscNode
+{
+    long value_;
+};
+
+TEST(MpscQueue, batch)
+{
+    const int kProducers = 4;
+    const long kPerThread = 50000;
+    const long kBatch = 16;
+    std::vector<Item> items(kProducers * kPerThread);
+    MpscQueue q;
+
+    std::vector<std::thread> producers;
+    for(int t = 0; t < kProducers; ++t)
+    {
+        producers.emplace_back([&items, &q, t, kPerThread, kBatch]() {
+            MpscNode* nodes[kBatch];
+            for(long i = 0; i < kPerThread; i += kBatch)
+            {
+                for(long j = 0; j < kBatch; ++j)
+                {
+                    Item& item = items[t * kPerThread + i + j];
+                    item.value_ = t * kPerThread + i + j;
+                    nodes[j] = &item;
+                }
+                if(t % 2)
+                    q.PushBatch(nodes, kBatch);
+                else
+                    for(long j = 0; j < kBatch; ++j)
+                        q.Push(nodes[j]);
+            }
+        });
+    }
+
+    std::vector<long> last(kProducers, -1);
+    long popped = 0;
+    MpscNode* nodes[32];
+    while(popped < kProducers * kPerThread)
+    {
+        const std::size_t n = q.PopBatch(nodes, 32);
+        if(n == 0)
+            std::this_thread::yield();
+        for(std::size_t i = 0; i < n; ++i)
+        {
+            const long v = static_cast<Item*>(nodes[i])->value_;
+            ASSERT_LT(last[v / kPerThread], v);
+            last[v / kPerThread] = v;
+        }
+        popped += n;
+    }
+    for(auto& t : producers)
+        t.join();
+    EXPECT_TRUE(q.Empty());
+    EXPECT_EQ(0u, q.PopBatch(nodes, 32));
+    q.PushBatch(nodes, 0);
+    EXPECT_TRUE(q.Empty());
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,325 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../../util/ThreadPool.h"
+
+using namespace mrpc;
+using namespace mrpc::internal;
+
+//the owner pops LIFO, thieves steal FIFO, every task comes out once
+TEST(WorkDeque, steal)
+{
+    WorkDeque deque;
+    const int kTasks = 100000;
+    std::vector<PoolTask> tasks(kTasks);
+    std::vector<std::atomic<int>> seen(kTasks);
+    for(auto& s : seen)
+        s.store(0);
+
+    std::atomic<bool> done{false};
+    std::vector<std::thread> thieves;
+    for(int t = 0; t < 3; ++t)
+    {
+        thieves.emplace_back([&]() {
+            while(!done.load())
+            {
+                if(PoolTask* task = deque.Steal())
+                    seen[task - tasks.data()].fetch_add(1);
+                else
+                    std::this_thread::yield();
+            }
+        });
+    }
+
+    //pushes beyond the initial capacity make it grow under the thieves
+    for(int i = 0; i < kTasks; ++i)
+    {
+        deque.Push(&tasks[i]);
+        if(i % 3 == 0)
+        {
+            if(PoolTask* task = deque.Pop())
+                seen[task - tasks.data()].fetch_add(1);
+        }
+    }
+    while(PoolTask* task = deque.Pop())
+        seen[task - tasks.data()].fetch_add(1);
+    while(!deque.Empty())
+        std::this_thread::yield();
+    done = true;
+    for(auto& t : thieves)
+        t.join();
+
+    for(int i = 0; i < kTasks; ++i)
+        ASSERT_EQ(1, seen[i].load()) << i;
+}
+
+TEST(ThreadPool, submit)
+{
+    ThreadPool pool(4);
+    EXPECT_EQ(4u, pool.Size());
+    EXPECT_EQ(-1, pool.WorkerIndex());
+
+    auto sum = pool.Submit([](int a, int b) { return a + b; }, 1, 2);
+    auto str = pool.Submit([](const std::string& s) { return s + "!"; }, std::string("hi"));
+    auto index = pool.Submit([&pool]() { return pool.WorkerIndex(); });
+    EXPECT_EQ(3, sum.get());
+    EXPECT_EQ("hi!", str.get());
+    const int i = index.get();
+    EXPECT_GE(i, 0);
+    EXPECT_LT(i, 4);
+
+    //larger than a task holds inline
+    char big[256] = "big";
+    auto large = pool.Submit([big]() { return std::string(big); });
+    EXPECT_EQ("big", large.get());
+}
+
+static long Fib(ThreadPool& pool, int n)
+{
+    if(n < 2)
+        return n;
+    if(n < 12)
+        return Fib(pool, n - 1) + Fib(pool, n - 2);
+
+    auto left = pool.Submit(Fib, std::ref(pool), n - 1);
+    const long right = Fib(pool, n - 2);
+    return pool.Wait(left) + right;
+}
+
+//fork/join: workers wait for their subtasks by running tasks
+TEST(ThreadPool, fork_join)
+{
+    ThreadPool pool(4);
+    auto f = pool.Submit(Fib, std::ref(pool), 25);
+    EXPECT_EQ(75025, pool.Wait(f));
+}
+
+//many submitters from outside, and the destructor runs all queued tasks
+TEST(ThreadPool, fan_out)
+{
+    std::atomic<int> count{0};
+    const int kThreads = 4, kPerThread = 20000;
+    {
+        ThreadPool pool(3);
+        std::vector<std::thread> threads;
+        for(int t = 0; t < kThreads; ++t)
+        {
+            threads.emplace_back([&]() {
+                for(int i = 0; i < kPerThread; ++i)
+                    pool.Post([&count]() { count.fetch_add(1, std::memory_order_relaxed); });
+            });
+        }
+        for(auto& t : threads)
+            t.join();
+
+        //and one fanning out from a worker to its own deque
+        pool.Post([&pool, &count]() {
+            for(int i = 0; i < kPerThread; ++i)
+                pool.Post([&count]() { count.fetch_add(1, std::memory_order_relaxed); });
+        });
+    }
+    EXPECT_EQ((kThreads + 1) * kPerThread, count.load());
+}
+
+//idle workers park, a single later task still wakes one
+TEST(ThreadPool, wakeup)
+{
+    ThreadPool pool(2);
+    for(int i = 0; i < 50; ++i)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        auto f = pool.Submit([i]() { return i; });
+        ASSERT_EQ(std::future_status::ready, f.wait_for(std::chrono::seconds(5)));
+        EXPECT_EQ(i, f.get());
+    }
+}
+
+//every index once, for any grain, and nested in a task
+TEST(ThreadPool, parallel_for)
+{
+    ThreadPool pool(3);
+    const int kSize = 100000;
+    for(int grain : {0, 1, 7, 1000, 200000})
+    {
+        std::vector<std::atomic<int>> seen(kSize);
+        for(auto& s : seen)
+            s.store(0);
+        pool.ParallelFor(0, kSize, grain, [&seen](int i) { seen[i].fetch_add(1, std::memory_order_relaxed); });
+        for(int i = 0; i < kSize; ++i)
+            ASSERT_EQ(1, seen[i].load()) << "grain " << grain << " index " << i;
+    }
+
+    int calls = 0;
+    pool.ParallelFor(5, 5, 1, [&calls](int ) { ++calls; });
+    pool.ParallelFor(5, 3, 1, [&calls](int ) { ++calls; });
+    EXPECT_EQ(0, calls);
+
+    std::atomic<long> sum{0};
+    auto f = pool.Submit([&pool, &sum]() {
+        pool.ParallelFor(0, 100, 1, [&pool, &sum](int i) {
+            pool.ParallelFor(0, 100, 10, [&sum, i](int j) { sum.fetch_add(i * j, std::memory_order_relaxed); });
+        });
+    });
+    pool.Wait(f);
+    EXPECT_EQ(4950L * 4950L, sum.load());
+}
+
+TEST(ThreadPool, parallel_reduce)
+{
+    ThreadPool pool(4);
+    const long kSize = 1000000;
+    const long sum = pool.ParallelReduce(0L, kSize, 1024L, 0L,
+                                         [](long i) { return i; },
+                                         [](long a, long b) { return a + b; });
+    EXPECT_EQ(kSize * (kSize - 1) / 2, sum);
+
+    const int max = pool.ParallelReduce(0, 1000, 1, -1,
+                                        [](int i) { return (i * 37) % 1000; },
+                                        [](int a, int b) { return std::max(a, b); });
+    EXPECT_EQ(999, max);
+
+    const std::string empty = pool.ParallelReduce(0, 0, 1, std::string(),
+                                                  [](int ) { return std::string("x"); },
+                                                  [](std::string a, std::string b) { return a + b; });
+    EXPECT_EQ("", empty);
+}
+
+TEST(ThreadPool, parallel_invoke)
+{
+    ThreadPool pool(2);
+    int a = 0, b = 0, c = 0;
+    pool.ParallelInvoke([&a]() { a = 1; }, [&b]() { b = 2; }, [&c]() { c = 3; });
+    EXPECT_EQ(6, a + b + c);
+
+    pool.ParallelInvoke([&a]() { a = 10; });
+    EXPECT_EQ(10, a);
+}
+
+//a throw on the calling thread unwinds only after the workers left the body
+TEST(ThreadPool, parallel_throw)
+{
+    ThreadPool pool(3);
+    std::atomic<int> inside{0};
+    std::atomic<int> calls{0};
+    for(int round = 0; round < 20; ++round)
+    {
+        calls = 0;
+        EXPECT_THROW(pool.ParallelFor(0, 1000, 1, [&](int ) {
+            inside.fetch_add(1);
+            ++calls;
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            inside.fetch_sub(1);
+            if(pool.WorkerIndex() < 0)
+                throw std::runtime_error("caller");
+        }), std::runtime_error);
+        EXPECT_EQ(0, inside.load());
+        //the rest of the range was given up
+        EXPECT_LT(calls.load(), 1000);
+    }
+
+    std::atomic<bool> done{false};
+    EXPECT_THROW(pool.ParallelInvoke([]() { throw std::runtime_error("first"); },
+                                     [&done]() {
+                                         std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                                         done = true;
+                                     }),
+                 std::runtime_error);
+    EXPECT_TRUE(done.load());
+
+    //the pool is still fine
+    std::atomic<int> sum{0};
+    pool.ParallelFor(0, 100, 1, [&sum](int i) { sum += i; });
+    EXPECT_EQ(4950, sum.load());
+}
+
+//hold the only worker till released, so the tasks queue up behind it
+class Gate
+{
+public:
+    explicit Gate(ThreadPool& pool)
+    {
+        pool.Post([this]() {
+            started_ = true;
+            while(!open_)
+                std::this_thread::yield();
+        });
+        while(!started_)
+            std::this_thread::yield();
+    }
+
+    void Open()
+    {
+        open_ = true;
+    }
+
+private:
+    std::atomic<bool> started_{false};
+    std::atomic<bool> open_{false};
+};
+
+//classes in order, earliest deadline first within a class
+TEST(ThreadPool, priority)
+{
+    ThreadPool pool(1);
+    Gate gate(pool);
+
+    std::mutex mutex;
+    std::string order;
+    auto record = [&](char c) {
+        std::lock_guard<std::mutex> guard(mutex);
+        order += c;
+    };
+
+    const auto now = std::chrono::steady_clock::now();
+    std::vector<std::future<void>> futures;
+    futures.push_back(pool.Submit(TaskPriority::kLow, record, 'A'));
+    futures.push_back(pool.Submit(record, 'B'));
+    futures.push_back(pool.Submit(now + std::chrono::seconds(30), record, 'C'));
+    futures.push_back(pool.Submit(now + std::chrono::seconds(20), record, 'D'));
+    futures.push_back(pool.Submit(TaskPriority::kHigh, record, 'E'));
+    futures.push_back(pool.Submit(TaskPriority::kHigh, now + std::chrono::seconds(10), record, 'F'));
+    futures.push_back(pool.Submit(TaskPriority::kHigh, record, 'G'));
+    gate.Open();
+
+    for(auto& f : futures)
+        f.get();
+    EXPECT_EQ("FEGDCBA", order);
+
+    EXPECT_EQ(3u, pool.Stats(TaskPriority::kHigh).tasks_);
+    EXPECT_EQ(2u, pool.Stats(TaskPriority::kNormal).tasks_);
+    EXPECT_EQ(1u, pool.Stats(TaskPriority::kLow).tasks_);
+}
+
+//a task still queued at its deadline never runs, its future is broken
+TEST(ThreadPool, deadline)
+{
+    ThreadPool pool(1);
+    Gate gate(pool);
+
+    std::atomic<int> ran{0};
+    const auto start = std::chrono::steady_clock::now();
+    auto late = pool.Submit(start + std::chrono::milliseconds(1), [&ran]() { ++ran; return 1; });
+    auto onTime = pool.Submit(start + std::chrono::seconds(30), [&ran]() { ++ran; return 2; });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    gate.Open();
+
+    EXPECT_EQ(2, onTime.get());
+    EXPECT_THROW(late.get(), std::future_error);
+    EXPECT_EQ(1, ran.load());
+
+    const auto stats = pool.Stats(TaskPriority::kNormal);
+    EXPECT_EQ(1u, stats.tasks_);
+    EXPECT_EQ(1u, stats.dropped_);
+    EXPECT_GE(stats.maxDelay_, std::chrono::milliseconds(20));
+    EXPECT_EQ(stats.totalDelay_, stats.maxDelay_);
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,122 @@
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include "../../util/TimeUtil.h"
+
+using namespace mrpc;
+
+static Time At(int64_t micros)
+{
+    return Time(std::chrono::system_clock::time_point(std::chrono::microseconds(micros)));
+}
+
+//what localtime_r and strftime make of it
+static std::string Expect(int64_t micros, const char* sep)
+{
+    time_t seconds = micros / 1000000;
+    long usec = micros % 1000000;
+    if(usec < 0)
+    {
+        --seconds;
+        usec += 1000000;
+    }
+    tm local;
+    localtime_r(&seconds, &local);
+    char buf[64];
+    strftime(buf, sizeof buf, "%Y-%m-%d", &local);
+    std::string s(buf);
+    s += sep;
+    strftime(buf, sizeof buf, "%H:%M:%S", &local);
+    s += buf;
+    snprintf(buf, sizeof buf, ".%06ld", usec);
+    s += buf;
+    return s;
+}
+
+TEST(TimeUtil, civil)
+{
+    for(int64_t days = -800000; days < 800000; days += 7)
+    {
+        int64_t y;
+        unsigned m, d;
+        CivilFromDays(days, &y, &m, &d);
+        ASSERT_EQ(days, DaysFromCivil(y, m, d));
+    }
+    int64_t y;
+    unsigned m, d;
+    CivilFromDays(DaysFromCivil(2024, 2, 29), &y, &m, &d);
+    EXPECT_EQ(2024, y);
+    EXPECT_EQ(2u, m);
+    EXPECT_EQ(29u, d);
+}
+
+TEST(TimeUtil, format)
+{
+    std::mt19937_64 rng(42);
+    std::vector<int64_t> samples = {
+        0, 999999, 1000000,
+        951782400000000,        // 2000-02-29 00:00:00 UTC
+        1711846799999999,       // the second before 2024-03-31 01:00 UTC, summer time starts
+        1711846800000000,
+        1729990799999999,       // the second before 2024-10-27 01:00 UTC, summer time ends
+        1729990800000000,
+        4102444799999999,       // 2099-12-31 23:59:59 UTC
+    };
+    for(int i = 0; i < 100000; ++i)
+        samples.push_back(static_cast<int64_t>(rng() % 4102444800000000ULL));
+
+    char buf[64];
+    for(int64_t micros : samples)
+    {
+        const Time t = At(micros);
+        ASSERT_EQ(Time::kFormatTimeLen, t.FormatTime(buf));
+        ASSERT_EQ(Expect(micros, "[") + "]", std::string(buf, Time::kFormatTimeLen)) << micros;
+
+        const Time iso = At(micros);
+        ASSERT_EQ(Time::kIso8601Len, iso.FormatIso8601(buf));
+        time_t seconds = micros / 1000000;
+        tm local;
+        localtime_r(&seconds, &local);
+        const char* offset = local.tm_gmtoff == 3600 ? "+01:00" : "+02:00";
+        ASSERT_EQ(Expect(micros, "T") + offset, std::string(buf, Time::kIso8601Len)) << micros;
+
+        const std::size_t len = t.FormatEpochMicros(buf);
+        ASSERT_EQ(std::to_string(micros), std::string(buf, len));
+
+        t.FormatMicros(buf);
+        snprintf(buf + 6, 8, "%06ld", static_cast<long>(micros % 1000000));
+        ASSERT_EQ(std::string(buf + 6, 6), std::string(buf, 6));
+
+        ASSERT_EQ(local.tm_year + 1900, t.GetYear());
+        ASSERT_EQ(local.tm_mon + 1, t.GetMonth());
+        ASSERT_EQ(local.tm_mday, t.GetDay());
+        ASSERT_EQ(local.tm_hour, t.GetHour());
+        ASSERT_EQ(local.tm_min, t.GetMinute());
+        ASSERT_EQ(local.tm_sec, t.GetSecond());
+    }
+}
+
+TEST(TimeUtil, negative)
+{
+    char buf[64];
+    const Time t = At(-1);
+    EXPECT_EQ(Expect(-1, "[") + "]", std::string(buf, t.FormatTime(buf)));
+    EXPECT_EQ("-1", std::string(buf, t.FormatEpochMicros(buf)));
+
+    //1900-01-01, before the epoch by years
+    const int64_t old = -2208988800000000LL + 123456;
+    const Time past = At(old);
+    EXPECT_EQ(std::to_string(old), std::string(buf, past.FormatEpochMicros(buf)));
+    EXPECT_EQ(Expect(old, "[") + "]", std::string(buf, past.FormatTime(buf)));
+}
+
+int main(int argc, char** argv)
+{
+    //central europe, no tzdata needed: +01:00, +02:00 from the last sunday of march to the last of october
+    setenv("TZ", "CET-1CEST,M3.5.0,M10.5.0/3", 1);
+    tzset();
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,375 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <map>
+#include <random>
+#include <thread>
+#include <vector>
+#include <poll.h>
+#include "../../util/Timer.h"
+
+using namespace mrpc;
+using namespace mrpc::internal;
+
+//test the wheel against a multimap, across all levels
+TEST(TimingWheel, order)
+{
+    std::mt19937_64 rng(1);
+    const uint64_t start = 123456;
+    TimingWheel wheel(start);
+    std::vector<WheelNode> nodes(20000);
+    std::multimap<uint64_t, WheelNode*> expect;
+    for(auto& node : nodes)
+    {
+        node.expire_ = start + 1 + rng() % (uint64_t(1) << (rng() % 28));
+        wheel.Add(&node);
+        expect.emplace(node.expire_, &node);
+    }
+    EXPECT_EQ(nodes.size(), wheel.Size());
+
+    uint64_t now = start;
+    while(wheel.Size() > 0)
+    {
+        uint64_t next;
+        ASSERT_TRUE(wheel.NextExpire(&next));
+        EXPECT_LE(next, expect.begin()->first);
+
+        now += 1 + rng() % (1 << (rng() % 22));
+        wheel.Advance(now, [&](WheelNode* node) {
+            EXPECT_LE(node->expire_, now);
+            EXPECT_EQ(expect.begin()->first, node->expire_);
+            expect.erase(expect.begin());
+        });
+        if(!expect.empty())
+        {
+            EXPECT_GT(expect.begin()->first, now);
+        }
+    }
+    EXPECT_TRUE(expect.empty());
+}
+
+//test remove and a node added late
+TEST(TimingWheel, remove)
+{
+    TimingWheel wheel;
+    WheelNode a, b, late;
+    a.expire_ = 100;
+    b.expire_ = 100000;
+    wheel.Add(&a);
+    wheel.Add(&b);
+
+    wheel.Remove(&b);
+    EXPECT_FALSE(b.IsLinked());
+    EXPECT_EQ(1u, wheel.Size());
+
+    int fired = 0;
+    wheel.Advance(50, [&](WheelNode* ) { ++fired; });
+    late.expire_ = 10;     //in the past, fires on the next tick
+    wheel.Add(&late);
+    EXPECT_EQ(51u, late.expire_);
+    wheel.Advance(51, [&](WheelNode* n) { EXPECT_EQ(&late, n); ++fired; });
+    EXPECT_EQ(1, fired);
+    wheel.Advance(1000, [&](WheelNode* n) { EXPECT_EQ(&a, n); ++fired; });
+    EXPECT_EQ(2, fired);
+    EXPECT_EQ(0u, wheel.Size());
+}
+
+//test schedule, repeat and cancel by TimerManager
+TEST(TimerManager, schedule)
+{
+    TimerManager mgr;
+    int once = 0, repeat = 0, cancelled = 0, self = 0;
+
+    mgr.ScheduleAfter(DurationMs(5), [&]() { ++once; });
+    mgr.ScheduleAfterWithRepeat<3>(DurationMs(2), [&]() { ++repeat; });
+    auto id = mgr.ScheduleAfter(DurationMs(5), [&]() { ++cancelled; });
+    TimerId selfId;
+    selfId = mgr.ScheduleAfterWithRepeat<Kforever>(DurationMs(1), [&]() {
+        if(++self == 2)
+            mgr.Cancel(selfId);
+    });
+
+    EXPECT_TRUE(mgr.Cancel(id));
+    EXPECT_FALSE(mgr.Cancel(id));
+    EXPECT_LE(mgr.NearestTimer(), DurationMs(2));
+
+    const auto deadline = std::chrono::steady_clock::now() + DurationMs(100);
+    while(std::chrono::steady_clock::now() < deadline)
+    {
+        mgr.Update();
+        std::this_thread::sleep_for(DurationMs(1));
+    }
+
+    EXPECT_EQ(1, once);
+    EXPECT_EQ(3, repeat);
+    EXPECT_EQ(0, cancelled);
+    EXPECT_EQ(2, self);
+    EXPECT_EQ(DurationMs::max(), mgr.NearestTimer());
+}
+
+//a timer never fires before its time point
+TEST(TimerManager, not_early)
+{
+    TimerManager mgr;
+    TimePoint fired;
+    const auto when = std::chrono::steady_clock::now() + std::chrono::microseconds(2500);
+    mgr.ScheduleAt(when, [&]() { fired = std::chrono::steady_clock::now(); });
+
+    while(fired == TimePoint())
+        mgr.Update();
+    EXPECT_GE(fired, when);
+}
+
+//most timers are cancelled, like request deadlines: only the rest fires,
+//stale handles never match, and slots are reused at once
+TEST(TimerManager, cancel_stress)
+{
+    TimerManager mgr;
+    std::mt19937 rng(7);
+    const int kTimers = 200000;
+    std::vector<TimerId> ids(kTimers);
+    std::vector<int> fired(kTimers, 0);
+    std::vector<bool> alive(kTimers, true);
+
+    const auto now = std::chrono::steady_clock::now();
+    for(int i = 0; i < kTimers; ++i)
+    {
+        //churn: most die right after they are scheduled
+        auto churn = mgr.ScheduleAfter(DurationMs(1000 + rng() % 100000), []() {});
+        if(rng() % 20 != 0)
+        {
+            EXPECT_TRUE(mgr.Cancel(churn));
+        }
+        ids[i] = mgr.ScheduleAt(now + DurationMs(1 + rng() % 30), [&fired, i]() { ++fired[i]; });
+    }
+
+    int cancelled = 0;
+    for(int i = 0; i < kTimers; ++i)
+    {
+        if(rng() % 100 < 95)
+        {
+            EXPECT_TRUE(mgr.Cancel(ids[i]));
+            EXPECT_FALSE(mgr.Cancel(ids[i]));
+            alive[i] = false;
+            ++cancelled;
+        }
+    }
+    //200000 ids and about 10000 churn survivors at most
+    EXPECT_LT(mgr.Capacity(), std::size_t(kTimers) * 11 / 10);
+
+    //the slots of the cancelled are reused, the stale handles must not hit them
+    std::vector<TimerId> reused;
+    for(int i = 0; i < cancelled; ++i)
+        reused.push_back(mgr.ScheduleAfter(DurationMs(1000000), []() {}));
+    for(int i = 0; i < kTimers; ++i)
+    {
+        if(!alive[i])
+        {
+            EXPECT_FALSE(mgr.Cancel(ids[i]));
+        }
+    }
+    for(const auto& id : reused)
+        EXPECT_TRUE(mgr.Cancel(id));
+
+    const auto deadline = now + DurationMs(200);
+    while(std::chrono::steady_clock::now() < deadline)
+    {
+        mgr.Update();
+        std::this_thread::sleep_for(DurationMs(1));
+    }
+
+    for(int i = 0; i < kTimers; ++i)
+        ASSERT_EQ(alive[i] ? 1 : 0, fired[i]) << i;
+    for(int i = 0; i < kTimers; ++i)
+    {
+        if(alive[i])
+        {
+            EXPECT_FALSE(mgr.Cancel(ids[i]));
+        }
+    }
+}
+
+//schedule and cancel from other threads, the loop applies them in Update
+TEST(TimerManager, remote)
+{
+    TimerManager mgr;
+    std::atomic<int> wakeups{0};
+    mgr.SetWakeup([&wakeups]() { wakeups.fetch_add(1); });
+
+    //the loop is idle: it may sleep forever
+    EXPECT_EQ(DurationMs::max(), mgr.NearestTimer());
+
+    const int kThreads = 4, kPerThread = 2000;
+    std::atomic<int> fired{0};
+    std::vector<std::thread> threads;
+    for(int t = 0; t < kThreads; ++t)
+    {
+        threads.emplace_back([&mgr, &fired]() {
+            for(int i = 0; i < kPerThread; ++i)
+            {
+                auto id = mgr.RemoteScheduleAfter(DurationMs(5 + i % 20), [&fired]() { fired.fetch_add(1); });
+                EXPECT_EQ(UINT32_MAX, id.index_);
+                if(i % 2 == 0)
+                    mgr.RemoteCancel(id);
+            }
+        });
+    }
+    for(auto& t : threads)
+        t.join();
+
+    //the first remote timer is earlier than forever
+    EXPECT_GE(wakeups.load(), 1);
+    EXPECT_EQ(DurationMs(0), mgr.NearestTimer());
+
+    const auto deadline = std::chrono::steady_clock::now() + DurationMs(100);
+    while(std::chrono::steady_clock::now() < deadline)
+    {
+        mgr.Update();
+        std::this_thread::sleep_for(DurationMs(1));
+    }
+    EXPECT_EQ(kThreads * kPerThread / 2, fired.load());
+    EXPECT_EQ(0u, mgr.Size());
+
+    //a remote id cancelled on the loop thread before Update applied it
+    auto id = mgr.RemoteScheduleAfter(DurationMs(1), [&fired]() { fired.fetch_add(1); });
+    EXPECT_TRUE(mgr.Cancel(id));
+    EXPECT_FALSE(mgr.Cancel(id));
+    EXPECT_EQ(0u, mgr.Size());
+
+    //a later remote timer does not wake a loop waiting for an earlier one
+    mgr.ScheduleAfter(DurationMs(10), []() {});
+    mgr.PrepareWait();
+    const int before = wakeups.load();
+    mgr.RemoteScheduleAfter(DurationMs(1000), []() {});
+    EXPECT_EQ(before, wakeups.load());
+    mgr.RemoteScheduleAfter(DurationMs(0), []() {});
+    EXPECT_EQ(before + 1, wakeups.load());
+}
+
+//poll the timerfd as a loop does, count the rounds which fired something
+template <typename Done>
+static int RunLoop(TimerManager& mgr, Done done, int* fired)
+{
+    pollfd pfd = {mgr.TimerFd(), POLLIN, 0};
+    int wakeups = 0;
+    while(!done())
+    {
+        mgr.PrepareWait();
+        EXPECT_EQ(1, ::poll(&pfd, 1, 1000));
+        const int before = *fired;
+        mgr.Update();
+        wakeups += *fired != before;
+    }
+    return wakeups;
+}
+
+//timers with no slack fire on time by the timerfd, not on the next ms
+TEST(TimerManager, precise)
+{
+    TimerManager mgr;
+    ASSERT_GE(mgr.TimerFd(), 0);
+
+    int fired = 0;
+    std::vector<DurationNs> late;
+    const auto start = std::chrono::steady_clock::now();
+    for(int i = 1; i <= 5; ++i)
+    {
+        const auto when = start + std::chrono::microseconds(200 * i);
+        mgr.ScheduleAtWithSlack<1>(when, DurationNs(0), DurationNs(0), [&, when]() {
+            late.push_back(std::chrono::steady_clock::now() - when);
+            ++fired;
+        });
+    }
+    //and a repeated one of 300us
+    int ticks = 0;
+    mgr.ScheduleAtWithSlack<4>(start + std::chrono::microseconds(300), std::chrono::microseconds(300),
+                               DurationNs(0), [&]() { ++ticks; ++fired; });
+
+    RunLoop(mgr, [&]() { return mgr.Size() == 0; }, &fired);
+    EXPECT_EQ(4, ticks);
+    ASSERT_EQ(5u, late.size());
+    for(const auto& d : late)
+    {
+        EXPECT_GE(d.count(), 0);
+        EXPECT_LT(d, DurationMs(1));
+    }
+    EXPECT_LT(std::chrono::steady_clock::now() - start, DurationMs(5));
+}
+
+//the queries only look, the timerfd is armed by PrepareWait
+TEST(TimerManager, prepare_wait)
+{
+    TimerManager mgr;
+    pollfd pfd = {mgr.TimerFd(), POLLIN, 0};
+    ASSERT_GE(pfd.fd, 0);
+    EXPECT_EQ(DurationNs::max(), mgr.PrepareWait());
+
+    mgr.ScheduleAfterWithSlack(std::chrono::microseconds(200), DurationNs(0), []() {});
+    const DurationNs nearest = mgr.NearestTimerNs();
+    EXPECT_GT(nearest, DurationNs(0));
+    EXPECT_LE(nearest, std::chrono::microseconds(200));
+    EXPECT_LE(mgr.NearestTimer(), DurationMs(1));
+    EXPECT_EQ(0, ::poll(&pfd, 1, 5));
+
+    EXPECT_LE(mgr.PrepareWait(), DurationNs(0));
+    EXPECT_EQ(1, ::poll(&pfd, 1, 1000));
+    mgr.Update();
+    EXPECT_EQ(0u, mgr.Size());
+}
+
+//with a coarse loop clock, the wait lasts till the cached clock has reached the
+//deadline; a loaded machine may tick late, so one more wait is allowed
+TEST(TimerManager, coarse_wait)
+{
+    LoopClock clock(true);
+    clock.Attach();
+    TimerManager mgr;
+    int fired = 0;
+    mgr.ScheduleAfter(DurationMs(1), [&fired]() { ++fired; });
+
+    int waits = 0;
+    for(; fired == 0 && waits < 100; ++waits)
+    {
+        const DurationNs wait = mgr.PrepareWait();
+        EXPECT_GT(wait, clock.Resolution());
+        std::this_thread::sleep_for(wait);
+        clock.Refresh();
+        mgr.Update();
+    }
+    EXPECT_EQ(1, fired);
+    EXPECT_LE(waits, 2);
+    clock.Detach();
+}
+
+//timers with slack share wakeups, and fire within [deadline, deadline + slack]
+TEST(TimerManager, slack)
+{
+    std::mt19937 rng(3);
+    int wakeups[2];
+    for(int round = 0; round < 2; ++round)
+    {
+        TimerManager mgr;
+        const DurationNs slack = round == 0 ? TimerManager::kDefaultSlack : DurationNs(DurationMs(32));
+        int fired = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < 1000; ++i)
+        {
+            const auto when = start + DurationMs(10) + std::chrono::microseconds(rng() % 30000);
+            mgr.ScheduleAtWithSlack<1>(when, DurationNs(0), slack, [&, when]() {
+                const auto now = std::chrono::steady_clock::now();
+                EXPECT_GE(now, when);
+                EXPECT_LT(now, when + slack + DurationMs(5));
+                ++fired;
+            });
+        }
+        wakeups[round] = RunLoop(mgr, [&]() { return mgr.Size() == 0; }, &fired);
+        EXPECT_EQ(1000, fired);
+    }
+    EXPECT_GT(wakeups[0], 10);
+    EXPECT_LE(wakeups[1], 3);
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
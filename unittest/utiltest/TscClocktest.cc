@@ -0,0 +1,100 @@
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+#include "../../util/TscClock.h"
+
+using namespace mrpc;
+
+//a fake /sys/devices/system with this clocksource
+static std::string FakeSysfs(const char* source)
+{
+    char dir[] = "/tmp/tscclockXXXXXX";
+    EXPECT_TRUE(mkdtemp(dir));
+    const std::string root(dir);
+    mkdir((root + "/clocksource").c_str(), 0755);
+    mkdir((root + "/clocksource/clocksource0").c_str(), 0755);
+    FILE* fp = fopen((root + "/clocksource/clocksource0/current_clocksource").c_str(), "w");
+    fputs(source, fp);
+    fclose(fp);
+    return root;
+}
+
+static void RemoveFake(const std::string& root)
+{
+    EXPECT_EQ(0, system(("rm -rf " + root).c_str()));
+}
+
+TEST(TscClock, detect)
+{
+    //without sysfs it's up to the cpu alone
+    const bool invariant = TscClock::Detect("/nonexistent");
+
+    std::string root = FakeSysfs("tsc\n");
+    EXPECT_EQ(invariant, TscClock::Detect(root.c_str()));
+    RemoveFake(root);
+
+    root = FakeSysfs("kvm-clock\n");
+    EXPECT_FALSE(TscClock::Detect(root.c_str()));
+    RemoveFake(root);
+
+    printf("invariant %d, enabled %d\n", invariant, TscClock::Enabled());
+}
+
+//it keeps with steady_clock, both ways of reading it
+TEST(TscClock, now)
+{
+    using namespace std::chrono;
+    const auto tscStart = TscClock::Now();
+    const auto start = steady_clock::now();
+    const uint64_t ticks = TscClock::Ticks();
+    printf("%.0f ticks/s\n", TscClock::Frequency());
+
+    std::this_thread::sleep_for(milliseconds(20));
+
+    const auto tscEnd = TscClock::Now();
+    const auto end = steady_clock::now();
+    const int64_t elapsed = TscClock::ToNanoseconds(TscClock::TicksOrdered() - ticks);
+    EXPECT_LT(std::abs(duration_cast<nanoseconds>(tscStart - start).count()), 100000);
+    EXPECT_LT(std::abs(duration_cast<nanoseconds>(tscEnd - end).count()), 100000);
+    EXPECT_NEAR(duration_cast<nanoseconds>(end - start).count(), elapsed, 200000);
+
+    EXPECT_LT(std::abs(duration_cast<microseconds>(TscClock::WallNow() - system_clock::now()).count()), 1000);
+}
+
+//a recalibration on another thread keeps readers close to steady_clock
+TEST(TscClock, threads)
+{
+    using namespace std::chrono;
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> readers;
+    for(int t = 0; t < 4; ++t)
+    {
+        readers.emplace_back([&stop]() {
+            while(!stop.load())
+            {
+                const auto before = steady_clock::now();
+                const auto now = TscClock::Now();
+                const auto after = steady_clock::now();
+                ASSERT_GT(now, before - microseconds(100));
+                ASSERT_LT(now, after + microseconds(100));
+            }
+        });
+    }
+    for(int i = 0; i < 50; ++i)
+    {
+        TscClock::Calibrate();
+        std::this_thread::sleep_for(microseconds(200));
+    }
+    stop = true;
+    for(auto& t : readers)
+        t.join();
+}
+
+int main(int argc, char** argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -30,10 +30,24 @@ Buffer& Buffer::_Movefrom(Buffer&& other)
     writepos_ = other.writepos_;
     capacity_ = other.capacity_;
     buffer_ = std::move(other.buffer_);
+    other.readpos_ = other.writepos_ = other.capacity_ = 0;
 
     return *this;
 }
 
+Buffer::Buffer(Buffer&& other):
+    readpos_(0),
+    writepos_(0),
+    capacity_(0)
+{
+    _Movefrom(std::move(other));
+}
+
+void Buffer::operator = (Buffer&& other)
+{
+    _Movefrom(std::move(other));
+}
+
 void Buffer::Shrink()
 {
     if(Isempty())
@@ -77,13 +91,13 @@ void Buffer::Assurespace(size_t needsize)
     size_t pre_cap = capacity_;
     while(writablesize()+readpos_ < needsize)
     {
-        if(capacity_ <= Kdefaultsize)
+        if(capacity_ < Kdefaultsize)
         {
             capacity_ = Kdefaultsize;
         }
         else if(capacity_ <= Kmaxbuffersize)
         {
-            size_t new_capacity_ = Roundup2power(pre_cap);
+            size_t new_capacity_ = Roundup2power(capacity_);
             if(new_capacity_ > capacity_)
                 capacity_ = new_capacity_;
             else
@@ -94,18 +108,21 @@ void Buffer::Assurespace(size_t needsize)
             assert(false);
         }
     }
+    //the readable size before readpos_ moves
+    size_t readsize = readablesize();
     if(capacity_ == pre_cap)
     {
-        memmove(&buffer_[0], &buffer_[readpos_], readablesize());
+        memmove(&buffer_[0], &buffer_[readpos_], readsize);
         readpos_ = 0;
-        writepos_ = readablesize();
+        writepos_ = readsize;
     }
     else
     {
         unique_ptr<char[]> new_buffer_(new char[capacity_]);
-        memcpy(&new_buffer_[0], &buffer_[readpos_], readablesize());
+        if(readsize > 0)
+            memcpy(&new_buffer_[0], &buffer_[readpos_], readsize);
         readpos_ = 0;
-        writepos_ = readablesize();
+        writepos_ = readsize;
         buffer_.swap(new_buffer_);
     }
     return;
@@ -66,6 +66,10 @@ public:
     {
         return &buffer_[readpos_];
     }
+    const char* readaddr() const
+    {
+        return &buffer_[readpos_];
+    }
 
     char* writeaddr()
     {
@@ -132,6 +136,14 @@ public:
         }
         buffers.push_back(Buffer(data, len));
     }
+//不合并，buf整个放到末尾，内容不会被拷贝，例如rpc帧的body
+    void Append(Buffer&& buf)
+    {
+        if(buf.readablesize() == 0)
+            return;
+        totalbytes += buf.readablesize();
+        buffers.push_back(std::move(buf));
+    }
     void Pop()
     {
         if(Isempty())
@@ -139,6 +151,23 @@ public:
         totalbytes -= buffers.front().readablesize();
         buffers.pop_front();
     }
+//丢弃开头的len个字节，例如已经写入socket的部分
+    void Consume(size_t len)
+    {
+        while(len > 0 && !Isempty())
+        {
+            Buffer& front = buffers.front();
+            size_t size = front.readablesize();
+            if(len < size)
+            {
+                front.Consume(len);
+                totalbytes -= len;
+                return;
+            }
+            len -= size;
+            Pop();
+        }
+    }
 
     bool Isempty() const
     {
@@ -0,0 +1,124 @@
+#include <cassert>
+#include <cstring>
+#include <cstdio>
+#include <errno.h>
+#include <unistd.h>
+
+#include "Logger.h"
+#include "ConsoleSink.h"
+
+namespace mrpc {
+namespace internal {
+
+namespace
+{
+
+enum LogColor
+{
+    Red = 1,
+    Green,
+    Yellow,
+    Normal,
+    Blue,
+    Purple,
+    White,
+    Max,
+};
+
+struct ColorCode
+{
+    const char* code;
+    std::size_t len;
+};
+
+#define COLOR_CODE(s) {s, sizeof(s) - 1}
+
+const ColorCode kColorCodes[Max] =
+{
+    COLOR_CODE(""),
+    COLOR_CODE("\033[1;31;40m"),
+    COLOR_CODE("\033[1;32;40m"),
+    COLOR_CODE("\033[1;33;40m"),
+    COLOR_CODE("\033[0m"),
+    COLOR_CODE("\033[1;34;40m"),
+    COLOR_CODE("\033[1;35;40m"),
+    COLOR_CODE("\033[1;37;40m"),
+};
+
+#undef COLOR_CODE
+
+inline LogColor LevelColor(unsigned int level)
+{
+    switch(level)
+    {
+        case logINFO:
+            return Green;
+        case logDEBUG:
+            return White;
+        case logWARN:
+            return Yellow;
+        case logERROR:
+            return Red;
+        case logUSR:
+            return Purple;
+        default:
+            return Red;
+    }
+}
+
+}   // end namespace
+
+constexpr std::size_t ConsoleSink::kShrinkAbove;
+
+ConsoleSink::ConsoleSink(int fd):fd_(fd),
+                                 colored_(::isatty(fd) == 1)
+{}
+
+void ConsoleSink::Append(unsigned int level, const char* data, std::size_t len)
+{
+    assert(len > 0 && data);
+
+    if(!colored_)
+    {
+        pending_.PushData(data, len);
+        return;
+    }
+
+    const auto& color = kColorCodes[LevelColor(level)];
+    const auto& reset = kColorCodes[Normal];
+
+    // one reservation for the three pieces
+    pending_.Assurespace(color.len + len + reset.len);
+    pending_.PushData(color.code, color.len);
+    pending_.PushData(data, len);
+    pending_.PushData(reset.code, reset.len);
+}
+
+bool ConsoleSink::Flush()
+{
+    while(!pending_.Isempty())
+    {
+        auto n = ::write(fd_, pending_.readaddr(), pending_.readablesize());
+        if(n > 0)
+        {
+            pending_.Consume(n);
+            continue;
+        }
+
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n < 0 && errno == EAGAIN)
+            return false;   // keep it for next cycle, never stall the io thread
+
+        pending_.Clear();   // console is gone, drop the output
+        break;
+    }
+
+    // the usual cycle reuses the buffer, only a burst's is freed
+    if(pending_.capacity() > kShrinkAbove)
+        pending_.Shrink();
+    return true;
+}
+
+}   // end namespace internal
+}   // end namespace mrpc
@@ -0,0 +1,58 @@
+#ifndef CONSOLESINK_H_
+#define CONSOLESINK_H_
+
+#include <cstddef>
+#include <unistd.h>
+#include "Buffer.h"
+
+namespace mrpc {
+namespace internal {
+
+//Console output of Logger, used by the io thread only.
+//Records of one drain cycle are assembled with their colour codes into one
+//contiguous block, and Flush hands the block to the kernel with a single syscall,
+//instead of locking stdio three times per record
+class ConsoleSink
+{
+public:
+    explicit ConsoleSink(int fd = STDOUT_FILENO);
+
+    ConsoleSink(const ConsoleSink& ) = delete;
+    void operator= (const ConsoleSink& ) = delete;
+
+    void Append(unsigned int level, const char* data, std::size_t len);
+    //return false if some bytes are still pending, eg. the fd is non-blocking and full
+    bool Flush();
+
+    //colours are on only if fd is a tty, until someone forces it
+    void SetColored(bool colored)
+    {
+        colored_ = colored;
+    }
+    bool IsColored() const
+    {
+        return colored_;
+    }
+    std::size_t PendingBytes() const
+    {
+        return pending_.readablesize();
+    }
+    //memory kept between cycles
+    std::size_t Capacity() const
+    {
+        return pending_.capacity();
+    }
+
+    //a buffer grown past it by a burst is given back once drained
+    static constexpr std::size_t kShrinkAbove = 1024 * 1024;
+
+private:
+    int fd_;
+    bool colored_;
+    Buffer pending_;
+};
+
+}   // end namespace internal
+}   // end namespace mrpc
+
+#endif
@@ -0,0 +1,148 @@
+#include <cstdio>
+#include <errno.h>
+#include <new>
+#include <unistd.h>
+#include "Coroutine.h"
+
+namespace mrpc
+{
+
+namespace internal
+{
+
+//size classes of 64 bytes; a list holds at most kMaxFree frames, the rest go back to the heap
+static const std::size_t kFrameGrain = 64;
+static const std::size_t kFrameClasses = kMaxRecycledFrame / kFrameGrain;
+static const std::size_t kMaxFree = 256;
+
+namespace
+{
+
+struct FrameNode
+{
+    FrameNode* next_;
+};
+
+//frames freed on this thread, whichever thread allocated them
+struct FrameCache
+{
+    FrameNode* lists_[kFrameClasses] = {};
+    std::size_t counts_[kFrameClasses] = {};
+
+    ~FrameCache()
+    {
+        for(auto& list : lists_)
+        {
+            while(list)
+            {
+                FrameNode* next = list->next_;
+                ::operator delete(list);
+                list = next;
+            }
+        }
+    }
+};
+
+thread_local FrameCache frameCache;
+
+}   // end anonymous namespace
+
+void* AllocFrame(std::size_t size)
+{
+    if(size > kMaxRecycledFrame)
+        return ::operator new(size);
+
+    const std::size_t c = (size - 1) / kFrameGrain;
+    FrameCache& cache = frameCache;
+    if(FrameNode* frame = cache.lists_[c])
+    {
+        cache.lists_[c] = frame->next_;
+        --cache.counts_[c];
+        return frame;
+    }
+    return ::operator new((c + 1) * kFrameGrain);
+}
+
+void FreeFrame(void* frame, std::size_t size)
+{
+    if(size > kMaxRecycledFrame)
+    {
+        ::operator delete(frame);
+        return;
+    }
+
+    const std::size_t c = (size - 1) / kFrameGrain;
+    FrameCache& cache = frameCache;
+    if(cache.counts_[c] >= kMaxFree)
+    {
+        ::operator delete(frame);
+        return;
+    }
+    FrameNode* node = static_cast<FrameNode*>(frame);
+    node->next_ = cache.lists_[c];
+    cache.lists_[c] = node;
+    ++cache.counts_[c];
+}
+
+}   // end namespace internal
+
+IoPoller::IoPoller():epfd_(::epoll_create1(EPOLL_CLOEXEC)),
+                     waiting_(0)
+{
+    if(epfd_ < 0)
+        perror("epoll_create1");
+}
+
+IoPoller::~IoPoller()
+{
+    assert(waiting_ == 0);
+    if(epfd_ >= 0)
+        ::close(epfd_);
+}
+
+bool IoPoller::_Watch(Awaiter* awaiter)
+{
+    epoll_event ev = {};
+    ev.events = awaiter->events_ | EPOLLONESHOT;
+    ev.data.ptr = awaiter;
+
+    //one-shot leaves the fd registered but disabled: re-arm it, or add it the first time
+    if(::epoll_ctl(epfd_, EPOLL_CTL_MOD, awaiter->fd_, &ev) != 0 &&
+       (errno != ENOENT || ::epoll_ctl(epfd_, EPOLL_CTL_ADD, awaiter->fd_, &ev) != 0))
+    {
+        awaiter->revents_ = EPOLLERR;
+        return false;
+    }
+    ++waiting_;
+    return true;
+}
+
+void IoPoller::Forget(int fd)
+{
+    ::epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+int IoPoller::Poll(int timeoutMs)
+{
+    const int kMaxEvents = 64;
+    epoll_event events[kMaxEvents];
+    const int n = ::epoll_wait(epfd_, events, kMaxEvents, timeoutMs);
+    if(n < 0)
+    {
+        if(errno != EINTR)
+            perror("epoll_wait");
+        return 0;
+    }
+
+    for(int i = 0; i < n; ++i)
+    {
+        Awaiter* awaiter = static_cast<Awaiter*>(events[i].data.ptr);
+        awaiter->revents_ = events[i].events;
+        --waiting_;
+        //the awaiter lives in the frame, gone after this
+        awaiter->handle_.resume();
+    }
+    return n;
+}
+
+}   // end namespace mrpc
@@ -0,0 +1,375 @@
+#ifndef COROUTINE_H_
+#define COROUTINE_H_
+
+// C++20 coroutines over ThreadPool, TimerManager and fd readiness; needs -std=c++20
+//
+//   Task<int> Handler(ThreadPool& pool, int fd)
+//   {
+//       co_await pool.Schedule();                  // on a worker
+//       co_await SleepFor(DurationMs(5));          // by the TimerManager of this thread
+//       int n = co_await Other(fd);                // a Task<int>
+//       co_return n;
+//   }
+//
+// Task<T> is lazy: it starts when awaited, by Spawn() or by SyncWait(). Awaiting a
+// Task and finishing one transfer control symmetrically, so a chain of them does
+// not grow the stack. Frames come from a per-thread recycling allocator.
+// No exceptions: one escaping a coroutine terminates.
+
+#include <coroutine>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <cassert>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include "Timer.h"
+
+namespace mrpc
+{
+
+template <typename T = void>
+class Task;
+
+namespace internal
+{
+
+//frames up to kMaxRecycledFrame bytes are kept in free lists of this thread when freed
+constexpr std::size_t kMaxRecycledFrame = 1024;
+
+void* AllocFrame(std::size_t size);
+void FreeFrame(void* frame, std::size_t size);
+
+//SyncWait blocks on it till the task finished
+struct SyncState
+{
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool done_ = false;
+};
+
+class PromiseBase
+{
+public:
+    static void* operator new(std::size_t size)
+    {
+        return AllocFrame(size);
+    }
+    static void operator delete(void* frame, std::size_t size)
+    {
+        FreeFrame(frame, size);
+    }
+
+    std::suspend_always initial_suspend() noexcept
+    {
+        return {};
+    }
+
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept
+        {
+            return false;
+        }
+
+        //to the awaiting coroutine if any; a detached one destroys itself
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+        {
+            PromiseBase& promise = handle.promise();
+            if(promise.continuation_)
+                return promise.continuation_;
+
+            if(promise.sync_)
+            {
+                //under the lock: SyncWait may return and free it right after
+                std::lock_guard<std::mutex> guard(promise.sync_->mutex_);
+                promise.sync_->done_ = true;
+                promise.sync_->cond_.notify_one();
+            }
+            else if(promise.detached_)
+            {
+                handle.destroy();
+            }
+            return std::noop_coroutine();
+        }
+
+        void await_resume() noexcept
+        {}
+    };
+
+    FinalAwaiter final_suspend() noexcept
+    {
+        return {};
+    }
+
+    void unhandled_exception() noexcept
+    {
+        std::terminate();
+    }
+
+    std::coroutine_handle<> continuation_;
+    SyncState* sync_ = nullptr;
+    bool detached_ = false;
+};
+
+template <typename T>
+class Promise : public PromiseBase
+{
+public:
+    Task<T> get_return_object() noexcept;
+
+    template <typename U>
+    void return_value(U&& value)
+    {
+        value_.emplace(std::forward<U>(value));
+    }
+
+    T Result()
+    {
+        assert(value_);
+        return std::move(*value_);
+    }
+
+private:
+    std::optional<T> value_;
+};
+
+template <>
+class Promise<void> : public PromiseBase
+{
+public:
+    Task<void> get_return_object() noexcept;
+
+    void return_void() noexcept
+    {}
+    void Result() noexcept
+    {}
+};
+
+}   // end namespace internal
+
+template <typename T>
+class Task final
+{
+public:
+    using promise_type = internal::Promise<T>;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    Task() noexcept = default;
+    explicit Task(Handle handle) noexcept : handle_(handle)
+    {}
+    Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr))
+    {}
+    Task& operator= (Task&& other) noexcept
+    {
+        if(this != &other)
+        {
+            if(handle_)
+                handle_.destroy();
+            handle_ = std::exchange(other.handle_, nullptr);
+        }
+        return *this;
+    }
+    ~Task()
+    {
+        if(handle_)
+            handle_.destroy();
+    }
+
+    Task(const Task& ) = delete;
+    void operator= (const Task& ) = delete;
+
+    bool IsDone() const
+    {
+        return !handle_ || handle_.done();
+    }
+
+    //co_await task: start it, resume the awaiting one when it's done
+    bool await_ready() const noexcept
+    {
+        return IsDone();
+    }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        handle_.promise().continuation_ = awaiting;
+        return handle_;
+    }
+    T await_resume()
+    {
+        return handle_.promise().Result();
+    }
+
+private:
+    template <typename U>
+    friend U SyncWait(Task<U> task);
+    friend void Spawn(Task<void> task);
+
+    Handle handle_;
+};
+
+namespace internal
+{
+
+template <typename T>
+Task<T> Promise<T>::get_return_object() noexcept
+{
+    return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() noexcept
+{
+    return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+}   // end namespace internal
+
+//run the task and block the calling thread till it's done, e.g. in main or tests;
+//never on a thread the task needs, like the loop thread of its timers
+template <typename T>
+T SyncWait(Task<T> task)
+{
+    internal::SyncState state;
+    task.handle_.promise().sync_ = &state;
+    task.handle_.resume();
+
+    std::unique_lock<std::mutex> lock(state.mutex_);
+    state.cond_.wait(lock, [&state]() { return state.done_; });
+    return task.handle_.promise().Result();
+}
+
+//start the task, it frees itself when done
+inline void Spawn(Task<void> task)
+{
+    auto handle = std::exchange(task.handle_, nullptr);
+    handle.promise().detached_ = true;
+    handle.resume();
+}
+
+//co_await SleepFor(d): resumed by the timers after d, on their loop thread.
+//From another thread it's scheduled by RemoteScheduleAfter.
+template <typename Duration>
+class SleepAwaiter
+{
+public:
+    SleepAwaiter(internal::TimerManager* timers, const Duration& duration) : timers_(timers),
+                                                                             duration_(duration)
+    {}
+
+    bool await_ready() const noexcept
+    {
+        return duration_ <= Duration::zero();
+    }
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        if(internal::TimerManager::Current() == timers_)
+            timers_->ScheduleAfter(duration_, [handle]() { handle.resume(); });
+        else
+            timers_->RemoteScheduleAfter(duration_, [handle]() { handle.resume(); });
+    }
+    void await_resume() const noexcept
+    {}
+
+private:
+    internal::TimerManager* timers_;
+    Duration duration_;
+};
+
+template <typename Duration>
+SleepAwaiter<Duration> SleepFor(internal::TimerManager& timers, const Duration& duration)
+{
+    return SleepAwaiter<Duration>(&timers, duration);
+}
+
+//by the timers attached to this thread
+template <typename Duration>
+SleepAwaiter<Duration> SleepFor(const Duration& duration)
+{
+    assert(internal::TimerManager::Current());
+    return SleepAwaiter<Duration>(internal::TimerManager::Current(), duration);
+}
+
+//epoll in one-shot mode for coroutines waiting on fds; Poll() resumes them on the
+//calling thread. One waiter per fd at a time; Forget() an fd before closing it.
+class IoPoller final
+{
+public:
+    class Awaiter
+    {
+    public:
+        Awaiter(IoPoller* poller, int fd, uint32_t events) : poller_(poller),
+                                                             fd_(fd),
+                                                             events_(events),
+                                                             revents_(0)
+        {}
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+        //false: not watched, resume at once with EPOLLERR
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            handle_ = handle;
+            return poller_->_Watch(this);
+        }
+        //the events ready, EPOLLERR/EPOLLHUP included
+        uint32_t await_resume() const noexcept
+        {
+            return revents_;
+        }
+
+    private:
+        friend class IoPoller;
+
+        IoPoller* poller_;
+        int fd_;
+        uint32_t events_;
+        uint32_t revents_;
+        std::coroutine_handle<> handle_;
+    };
+
+    IoPoller();
+    ~IoPoller();
+
+    IoPoller(const IoPoller& ) = delete;
+    void operator= (const IoPoller& ) = delete;
+
+    Awaiter Readable(int fd)
+    {
+        return Awaiter(this, fd, EPOLLIN);
+    }
+    Awaiter Writable(int fd)
+    {
+        return Awaiter(this, fd, EPOLLOUT);
+    }
+
+    void Forget(int fd);
+
+    //wait up to timeoutMs (-1: forever) and resume the ready ones; return how many
+    int Poll(int timeoutMs);
+
+    //the epoll fd, readable when Poll() has something to resume; to nest in a loop
+    int Fd() const
+    {
+        return epfd_;
+    }
+
+    //coroutines suspended on it
+    std::size_t Waiting() const
+    {
+        return waiting_;
+    }
+
+private:
+    bool _Watch(Awaiter* awaiter);
+
+    int epfd_;
+    std::size_t waiting_;
+};
+
+}   // end namespace mrpc
+
+#endif
@@ -0,0 +1,183 @@
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <iterator>
+#include <sched.h>
+#include <dirent.h>
+#include <pthread.h>
+#include "CpuTopology.h"
+
+namespace mrpc {
+
+static bool ReadFile(const std::string& path, std::string* text)
+{
+    FILE* fp = ::fopen(path.c_str(), "r");
+    if(!fp)
+        return false;
+
+    char buf[4096];
+    const std::size_t n = ::fread(buf, 1, sizeof buf, fp);
+    ::fclose(fp);
+    text->assign(buf, n);
+    return true;
+}
+
+//the cpus this process may run on, empty if unknown
+static std::vector<int> AllowedCpus()
+{
+    std::vector<int> cpus;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if(::sched_getaffinity(0, sizeof set, &set) != 0)
+        return cpus;
+
+    for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if(CPU_ISSET(cpu, &set))
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+bool CpuTopology::ParseCpuList(const std::string& text, std::vector<int>* cpus)
+{
+    cpus->clear();
+    const char* p = text.c_str();
+    while(*p && *p != '\n')
+    {
+        char* end;
+        const long first = ::strtol(p, &end, 10);
+        if(end == p || first < 0)
+            return false;
+        long last = first;
+        p = end;
+        if(*p == '-')
+        {
+            ++p;
+            last = ::strtol(p, &end, 10);
+            if(end == p || last < first)
+                return false;
+            p = end;
+        }
+        for(long cpu = first; cpu <= last; ++cpu)
+            cpus->push_back(static_cast<int>(cpu));
+
+        if(*p == ',')
+            ++p;
+        else if(*p && *p != '\n')
+            return false;
+    }
+
+    std::sort(cpus->begin(), cpus->end());
+    cpus->erase(std::unique(cpus->begin(), cpus->end()), cpus->end());
+    return true;
+}
+
+CpuTopology CpuTopology::Detect(const char* sysfs)
+{
+    CpuTopology topology;
+    std::vector<int> allowed = AllowedCpus();
+    if(allowed.empty())
+    {
+        std::string online;
+        if(!ReadFile(std::string(sysfs) + "/cpu/online", &online) || !ParseCpuList(online, &allowed))
+            allowed.push_back(0);
+    }
+
+    const std::string nodeDir = std::string(sysfs) + "/node";
+    if(DIR* dir = ::opendir(nodeDir.c_str()))
+    {
+        while(dirent* entry = ::readdir(dir))
+        {
+            int id;
+            char tail;
+            if(::sscanf(entry->d_name, "node%d%c", &id, &tail) != 1)
+                continue;
+
+            std::string text;
+            Node node;
+            node.id_ = id;
+            if(!ReadFile(nodeDir + "/" + entry->d_name + "/cpulist", &text) || !ParseCpuList(text, &node.cpus_))
+                continue;
+
+            std::vector<int> cpus;
+            std::set_intersection(node.cpus_.begin(), node.cpus_.end(),
+                                  allowed.begin(), allowed.end(), std::back_inserter(cpus));
+            node.cpus_.swap(cpus);
+            if(!node.cpus_.empty())
+                topology.nodes_.push_back(std::move(node));
+        }
+        ::closedir(dir);
+    }
+
+    if(topology.nodes_.empty())
+    {
+        //no NUMA: one node of all
+        Node node;
+        node.id_ = 0;
+        node.cpus_ = allowed;
+        topology.nodes_.push_back(std::move(node));
+    }
+
+    std::sort(topology.nodes_.begin(), topology.nodes_.end(),
+              [](const Node& a, const Node& b) { return a.id_ < b.id_; });
+    return topology;
+}
+
+std::size_t CpuTopology::CpuCount() const
+{
+    std::size_t count = 0;
+    for(const auto& node : nodes_)
+        count += node.cpus_.size();
+    return count;
+}
+
+int CpuTopology::NodeIndexOf(int cpu) const
+{
+    for(std::size_t i = 0; i < nodes_.size(); ++i)
+    {
+        if(std::binary_search(nodes_[i].cpus_.begin(), nodes_[i].cpus_.end(), cpu))
+            return static_cast<int>(i);
+    }
+    return -1;
+}
+
+CpuTopology CpuTopology::Exclude(const std::vector<int>& cpus) const
+{
+    CpuTopology topology;
+    for(const auto& node : nodes_)
+    {
+        Node left;
+        left.id_ = node.id_;
+        for(int cpu : node.cpus_)
+        {
+            if(std::find(cpus.begin(), cpus.end(), cpu) == cpus.end())
+                left.cpus_.push_back(cpu);
+        }
+        if(!left.cpus_.empty())
+            topology.nodes_.push_back(std::move(left));
+    }
+    return topology;
+}
+
+bool CpuTopology::PinCurrentThread(const std::vector<int>& cpus)
+{
+    if(cpus.empty())
+        return false;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(int cpu : cpus)
+    {
+        if(cpu >= 0 && cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    }
+    return ::pthread_setaffinity_np(::pthread_self(), sizeof set, &set) == 0;
+}
+
+int CpuTopology::CurrentCpu()
+{
+    return ::sched_getcpu();
+}
+
+}   // end namespace mrpc
@@ -0,0 +1,54 @@
+#ifndef CPUTOPOLOGY_H_
+#define CPUTOPOLOGY_H_
+
+// NUMA nodes and their cpus, from /sys/devices/system/node/node*/cpulist
+// Only the cpus this process may run on (sched_getaffinity) are kept, and nodes left
+// with none (memory-only nodes, or excluded by a cpuset) are dropped. Without NUMA
+// in sysfs the machine is one node 0 with all the allowed cpus.
+
+#include <string>
+#include <vector>
+
+namespace mrpc {
+
+class CpuTopology final
+{
+public:
+    struct Node
+    {
+        int id_;
+        std::vector<int> cpus_;     // sorted
+    };
+
+    //sysfs: the root of the sysfs system directory, tests point it elsewhere
+    static CpuTopology Detect(const char* sysfs = "/sys/devices/system");
+
+    const std::vector<Node>& Nodes() const
+    {
+        return nodes_;
+    }
+    std::size_t CpuCount() const;
+
+    //the index in Nodes() of the node of this cpu, -1 if none
+    int NodeIndexOf(int cpu) const;
+
+    //a copy without these cpus, e.g. housekeeping cores kept for the logger;
+    //nodes left with no cpu are dropped
+    CpuTopology Exclude(const std::vector<int>& cpus) const;
+
+    //"0-3,8,10-11", the format of cpulist; false if malformed
+    static bool ParseCpuList(const std::string& text, std::vector<int>* cpus);
+
+    //set the affinity of the calling thread, false if failed (e.g. forbidden by a cpuset)
+    static bool PinCurrentThread(const std::vector<int>& cpus);
+
+    //the cpu the calling thread runs on now, -1 if unknown
+    static int CurrentCpu();
+
+private:
+    std::vector<Node> nodes_;
+};
+
+}   // end namespace mrpc
+
+#endif
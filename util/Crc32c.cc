@@ -0,0 +1,78 @@
+#include <cstring>
+#include <mutex>
+#include "Crc32c.h"
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+namespace mrpc
+{
+
+#if defined(__SSE4_2__)
+
+uint32_t Crc32c(const void* data, std::size_t len, uint32_t crc)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    uint64_t c = ~crc;
+    for(; len >= 8; len -= 8, p += 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+    }
+
+    uint32_t c32 = static_cast<uint32_t>(c);
+    for(; len > 0; --len, ++p)
+        c32 = _mm_crc32_u8(c32, *p);
+    return ~c32;
+}
+
+#else
+
+// slice-by-8 tables, built once
+static uint32_t TABLE[8][256];
+static std::once_flag init_;
+
+static void Init()
+{
+    const uint32_t kPoly = 0x82f63b78;   // reversed Castagnoli
+    for(uint32_t i = 0; i < 256; ++i)
+    {
+        uint32_t c = i;
+        for(int k = 0; k < 8; ++k)
+            c = (c & 1) ? (c >> 1) ^ kPoly : c >> 1;
+        TABLE[0][i] = c;
+    }
+    for(uint32_t i = 0; i < 256; ++i)
+    {
+        for(int t = 1; t < 8; ++t)
+            TABLE[t][i] = (TABLE[t - 1][i] >> 8) ^ TABLE[0][TABLE[t - 1][i] & 0xff];
+    }
+}
+
+uint32_t Crc32c(const void* data, std::size_t len, uint32_t crc)
+{
+    std::call_once(init_, &Init);
+
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    uint32_t c = ~crc;
+    for(; len >= 8; len -= 8, p += 8)
+    {
+        uint32_t lo, hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= c;
+        c = TABLE[7][lo & 0xff] ^ TABLE[6][(lo >> 8) & 0xff] ^
+            TABLE[5][(lo >> 16) & 0xff] ^ TABLE[4][lo >> 24] ^
+            TABLE[3][hi & 0xff] ^ TABLE[2][(hi >> 8) & 0xff] ^
+            TABLE[1][(hi >> 16) & 0xff] ^ TABLE[0][hi >> 24];
+    }
+    for(; len > 0; --len, ++p)
+        c = TABLE[0][(c ^ *p) & 0xff] ^ (c >> 8);
+    return ~c;
+}
+
+#endif
+
+}   // end namespace mrpc
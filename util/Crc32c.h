@@ -0,0 +1,29 @@
+#ifndef CRC32C_H_
+#define CRC32C_H_
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace mrpc
+{
+
+//CRC-32C (Castagnoli), the one of iSCSI/ext4, hardware accelerated by SSE4.2
+//crc:the value of the data before, to checksum a record piece by piece
+uint32_t Crc32c(const void* data, std::size_t len, uint32_t crc = 0);
+
+//a crc stored beside the data it covers is masked, else the crc of a
+//record containing crcs is easily zero
+inline uint32_t MaskCrc(uint32_t crc)
+{
+    return ((crc >> 15) | (crc << 17)) + 0xa282ead8u;
+}
+
+inline uint32_t UnmaskCrc(uint32_t masked)
+{
+    const uint32_t rot = masked - 0xa282ead8u;
+    return (rot >> 17) | (rot << 15);
+}
+
+}   // end namespace mrpc
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef FUTEX_H_
+#define FUTEX_H_
+
+//thin wrappers of futex(2) over a std::atomic<uint32_t>
+//shared:the word lives in memory shared between processes, else it is private to this one
+
+#include <atomic>
+#include <ctime>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+namespace mrpc {
+namespace internal {
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex word must be 32 bits");
+
+//sleep while *word == expected, wake up by FutexWake, a signal or timeout (nullptr: forever)
+//return 0 if woken up, -1 and errno: EAGAIN the word changed, ETIMEDOUT, EINTR
+inline int FutexWait(std::atomic<uint32_t>* word, uint32_t expected, const struct timespec* timeout = nullptr, bool shared = false)
+{
+    const int op = shared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE;
+    return static_cast<int>(::syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), op, expected, timeout, nullptr, 0));
+}
+
+//wake up at most count waiters, return how many woken
+inline int FutexWake(std::atomic<uint32_t>* word, int count = 1, bool shared = false)
+{
+    const int op = shared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE;
+    return static_cast<int>(::syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), op, count, nullptr, nullptr, 0));
+}
+
+inline void CpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+}   // end namespace internal
+}   // end namespace mrpc
+
+#endif
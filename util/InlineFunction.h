@@ -0,0 +1,162 @@
+#ifndef INLINEFUNCTION_H_
+#define INLINEFUNCTION_H_
+
+// A move-only std::function which never allocates
+// The callable is stored in a buffer of Capacity bytes inside the object, a
+// callable too large (or over-aligned) fails to compile instead of going to the heap.
+// Trivially copyable callables, e.g. lambdas capturing pointers and ints, are
+// moved by memcpy.
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace mrpc {
+
+template <typename Signature, std::size_t Capacity = 48>
+class InlineFunction;
+
+template <typename R, typename... Args, std::size_t Capacity>
+class InlineFunction<R (Args...), Capacity>
+{
+public:
+    static constexpr std::size_t kCapacity = Capacity;
+
+    InlineFunction() noexcept : ops_(nullptr)
+    {}
+    InlineFunction(std::nullptr_t) noexcept : ops_(nullptr)
+    {}
+
+    template <typename F,
+              typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, InlineFunction>::value>::type>
+    InlineFunction(F&& f) : ops_(nullptr)
+    {
+        _Store(std::forward<F>(f));
+    }
+
+    InlineFunction(InlineFunction&& other) noexcept : ops_(nullptr)
+    {
+        _MoveFrom(other);
+    }
+
+    InlineFunction& operator= (InlineFunction&& other) noexcept
+    {
+        if(this != &other)
+        {
+            _Reset();
+            _MoveFrom(other);
+        }
+        return *this;
+    }
+
+    InlineFunction& operator= (std::nullptr_t) noexcept
+    {
+        _Reset();
+        return *this;
+    }
+
+    template <typename F,
+              typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, InlineFunction>::value>::type>
+    InlineFunction& operator= (F&& f)
+    {
+        _Reset();
+        _Store(std::forward<F>(f));
+        return *this;
+    }
+
+    InlineFunction(const InlineFunction& ) = delete;
+    void operator= (const InlineFunction& ) = delete;
+
+    ~InlineFunction()
+    {
+        _Reset();
+    }
+
+    R operator() (Args... args)
+    {
+        return ops_->invoke_(storage_, std::forward<Args>(args)...);
+    }
+
+    explicit operator bool() const
+    {
+        return ops_ != nullptr;
+    }
+
+private:
+    struct Ops
+    {
+        R (*invoke_)(void* f, Args&&... args);
+        void (*move_)(void* dst, void* src);    //nullptr: memcpy
+        void (*destroy_)(void* f);              //nullptr: nothing to do
+    };
+
+    template <typename F>
+    static R _Invoke(void* f, Args&&... args)
+    {
+        return (*static_cast<F*>(f))(std::forward<Args>(args)...);
+    }
+
+    template <typename F>
+    static void _Move(void* dst, void* src)
+    {
+        ::new (dst) F(std::move(*static_cast<F*>(src)));
+        static_cast<F*>(src)->~F();
+    }
+
+    template <typename F>
+    static void _Destroy(void* f)
+    {
+        static_cast<F*>(f)->~F();
+    }
+
+    template <typename F>
+    struct OpsFor
+    {
+        static constexpr Ops ops_ = {
+            &_Invoke<F>,
+            std::is_trivially_copyable<F>::value ? nullptr : &_Move<F>,
+            std::is_trivially_destructible<F>::value ? nullptr : &_Destroy<F>,
+        };
+    };
+
+    template <typename F>
+    void _Store(F&& f)
+    {
+        using Fn = typename std::decay<F>::type;
+        static_assert(sizeof(Fn) <= Capacity, "callable is too large for this InlineFunction, capture less or a pointer");
+        static_assert(alignof(Fn) <= alignof(std::max_align_t), "callable is over-aligned");
+        static_assert(std::is_nothrow_move_constructible<Fn>::value, "callable must be nothrow movable");
+
+        ::new (static_cast<void*>(storage_)) Fn(std::forward<F>(f));
+        ops_ = &OpsFor<Fn>::ops_;
+    }
+
+    void _MoveFrom(InlineFunction& other) noexcept
+    {
+        if(!other.ops_)
+            return;
+
+        if(other.ops_->move_)
+            other.ops_->move_(storage_, other.storage_);
+        else
+            memcpy(storage_, other.storage_, Capacity);
+        ops_ = other.ops_;
+        other.ops_ = nullptr;
+    }
+
+    void _Reset() noexcept
+    {
+        if(ops_ && ops_->destroy_)
+            ops_->destroy_(storage_);
+        ops_ = nullptr;
+    }
+
+    alignas(std::max_align_t) unsigned char storage_[Capacity];
+    const Ops* ops_;
+};
+
+}   // end namespace mrpc
+
+#endif
@@ -0,0 +1,431 @@
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <algorithm>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "TimeUtil.h"
+#include "LogReader.h"
+
+namespace mrpc
+{
+
+// same layout as Logger::Flush writes
+static const std::size_t kPrefixTimeLen = 27;
+static const std::size_t kPrefixLevelLen = 6;
+
+static const uint32_t kIndexMagic = 0x49474C4D;     // "MLGI"
+static const uint32_t kIndexVersion = 1;
+
+const std::size_t LogSegment::kBlockSize = 64 * 1024;
+
+namespace
+{
+
+struct IndexHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t blockSize;
+    uint64_t indexedLength;
+    uint64_t count;
+};
+
+inline bool ParseDigits(const char* p, int n, unsigned* value)
+{
+    unsigned v = 0;
+    for(int i = 0; i < n; ++i)
+    {
+        if(p[i] < '0' || p[i] > '9')
+            return false;
+        v = v * 10 + (p[i] - '0');
+    }
+    *value = v;
+    return true;
+}
+
+// the fast path for the fixed prefix written by Time::FormatTime
+inline bool ParseRecordTime(const char* p, std::size_t len, int64_t* micros)
+{
+    if(len < kPrefixTimeLen || p[4] != '-' || p[7] != '-' || p[10] != '[' || p[26] != ']')
+        return false;
+    return ParseLogTime(p, kPrefixTimeLen, micros);
+}
+
+}   // end namespace
+
+bool ParseLogTime(const char* str, std::size_t len, int64_t* micros)
+{
+    unsigned year, month, day, hour = 0, minute = 0, second = 0, usec = 0;
+    if(len < 10 || str[4] != '-' || str[7] != '-')
+        return false;
+    if(!ParseDigits(str, 4, &year) || !ParseDigits(str + 5, 2, &month) || !ParseDigits(str + 8, 2, &day))
+        return false;
+    if(month < 1 || month > 12 || day < 1 || day > 31)
+        return false;
+
+    if(len > 10)
+    {
+        const char sep = str[10];
+        if((sep != '[' && sep != ' ' && sep != 'T') || len < 19 || str[13] != ':' || str[16] != ':')
+            return false;
+        if(!ParseDigits(str + 11, 2, &hour) || !ParseDigits(str + 14, 2, &minute) || !ParseDigits(str + 17, 2, &second))
+            return false;
+        if(len > 19)
+        {
+            if(str[19] != '.')
+                return false;
+            std::size_t n = 0;
+            while(20 + n < len && n < 6 && str[20 + n] >= '0' && str[20 + n] <= '9')
+                ++n;
+            if(n == 0 || !ParseDigits(str + 20, static_cast<int>(n), &usec))
+                return false;
+            for(std::size_t i = n; i < 6; ++i)
+                usec *= 10;
+        }
+    }
+
+    const int64_t days = DaysFromCivil(year, month, day);
+    *micros = ((days * 86400 + hour * 3600 + minute * 60 + second) * 1000000LL) + usec;
+    return true;
+}
+
+unsigned int ParseLogLevel(const char* data, std::size_t len)
+{
+    if(len < kPrefixLevelLen || data[0] != '[' || data[4] != ']' || data[5] != ':')
+        return 0;
+    switch(data[1])
+    {
+        case 'I':
+            return memcmp(data + 1, "INF", 3) == 0 ? static_cast<unsigned int>(logINFO) : 0;
+        case 'D':
+            return memcmp(data + 1, "DBG", 3) == 0 ? static_cast<unsigned int>(logDEBUG) : 0;
+        case 'W':
+            return memcmp(data + 1, "WRN", 3) == 0 ? static_cast<unsigned int>(logWARN) : 0;
+        case 'E':
+            return memcmp(data + 1, "ERR", 3) == 0 ? static_cast<unsigned int>(logERROR) : 0;
+        case 'U':
+            return memcmp(data + 1, "USR", 3) == 0 ? static_cast<unsigned int>(logUSR) : 0;
+        default:
+            return 0;
+    }
+}
+
+bool IsLogFileName(const std::string& name, std::string* tag)
+{
+    const auto slash = name.rfind('/');
+    const std::string base = slash == std::string::npos ? name : name.substr(slash + 1);
+    if(base.size() < 4 || base.compare(base.size() - 4, 4, ".log") != 0)
+        return false;
+
+    const auto at = base.find('@');
+    if(at == std::string::npos)
+        return false;
+    const auto dash = base.find('-', at);
+    if(dash == std::string::npos)
+        return false;
+
+    int64_t micros;
+    if(!ParseLogTime(base.data(), at, &micros))
+        return false;
+
+    if(tag)
+    {
+        //<seq>[.<tag>] before ".log"
+        const auto dot = base.find('.', dash);
+        *tag = dot < base.size() - 4 ? base.substr(dot + 1, base.size() - 4 - dot - 1) : std::string();
+    }
+    return true;
+}
+
+bool ListLogFiles(const std::string& dir, const std::string& tag, std::vector<std::string>* files)
+{
+    files->clear();
+
+    DIR* d = ::opendir(dir.c_str());
+    if(!d)
+        return false;
+
+    std::string fileTag;
+    while(struct dirent* ent = ::readdir(d))
+    {
+        if(IsLogFileName(ent->d_name, &fileTag) && fileTag == tag)
+            files->push_back(dir + "/" + ent->d_name);
+    }
+    ::closedir(d);
+
+    // names begin with the creating time
+    std::sort(files->begin(), files->end());
+    return true;
+}
+
+LogSegment::LogSegment():memory_(nullptr),
+                         length_(0)
+{}
+
+LogSegment::~LogSegment()
+{
+    Close();
+}
+
+void LogSegment::Close()
+{
+    mmap_.Close();
+    memory_ = nullptr;
+    length_ = 0;
+    index_.clear();
+}
+
+bool LogSegment::Open(const std::string& file, bool saveIndex)
+{
+    Close();
+    file_ = file;
+
+    if(!mmap_.Open(file))
+        return false;
+    mmap_.Advise(internal::IMmapFile::kSequential);
+
+    _UpdateIndex(saveIndex);
+    return true;
+}
+
+bool LogSegment::Refresh(bool saveIndex)
+{
+    if(!mmap_.IsOpen())
+        return false;
+
+    const std::size_t oldLength = length_;
+    mmap_.Refresh();
+    _UpdateIndex(saveIndex);
+    return length_ != oldLength;
+}
+
+void LogSegment::_UpdateIndex(bool saveIndex)
+{
+    memory_ = mmap_.Data();
+
+    // a live file is preallocated by OMmapFile, ignore the zero tail
+    length_ = mmap_.Size();
+    while(length_ > 0 && memory_[length_ - 1] == '\0')
+        --length_;
+
+    const std::string idxName = file_ + ".idx";
+    uint64_t indexedLength = 0;
+    bool loaded = true;
+    if(index_.empty())
+        loaded = _LoadIndex(idxName, &indexedLength);
+    else
+        indexedLength = index_.back().offset + index_.back().length;
+
+    uint64_t indexed = 0;
+    if(loaded && !index_.empty())
+    {
+        // the last block may be partial, rescan from it
+        indexed = index_.back().offset;
+        index_.pop_back();
+    }
+
+    _BuildIndex(indexed);
+
+    if(saveIndex && (!loaded || indexedLength != length_))
+        _SaveIndex(idxName);
+}
+
+bool LogSegment::_LoadIndex(const std::string& name, uint64_t* indexedLength)
+{
+    index_.clear();
+
+    FILE* fp = ::fopen(name.c_str(), "rb");
+    if(!fp)
+        return false;
+
+    IndexHeader header;
+    bool ok = ::fread(&header, sizeof header, 1, fp) == 1 &&
+              header.magic == kIndexMagic &&
+              header.version == kIndexVersion &&
+              header.blockSize == kBlockSize &&
+              header.indexedLength <= length_;
+
+    if(ok)
+    {
+        index_.resize(header.count);
+        ok = header.count == 0 || ::fread(&index_[0], sizeof(LogIndexEntry), header.count, fp) == header.count;
+    }
+    ::fclose(fp);
+
+    if(ok && !index_.empty())
+    {
+        const auto& last = index_.back();
+        ok = last.offset + last.length <= length_;
+    }
+    if(!ok)
+        index_.clear();
+    else
+        *indexedLength = header.indexedLength;
+    return ok;
+}
+
+bool LogSegment::_SaveIndex(const std::string& name) const
+{
+    // write aside then rename, a concurrent reader never sees a half index
+    const std::string tmp = name + ".tmp";
+    FILE* fp = ::fopen(tmp.c_str(), "wb");
+    if(!fp)
+        return false;
+
+    IndexHeader header;
+    header.magic = kIndexMagic;
+    header.version = kIndexVersion;
+    header.blockSize = kBlockSize;
+    header.indexedLength = length_;
+    header.count = index_.size();
+
+    bool ok = ::fwrite(&header, sizeof header, 1, fp) == 1;
+    if(ok && !index_.empty())
+        ok = ::fwrite(&index_[0], sizeof(LogIndexEntry), index_.size(), fp) == index_.size();
+    ok = (::fclose(fp) == 0) && ok;
+
+    if(ok)
+        ok = ::rename(tmp.c_str(), name.c_str()) == 0;
+    if(!ok)
+        ::unlink(tmp.c_str());
+    return ok;
+}
+
+// a record may span several lines, it ends before the next line carrying a timestamp
+std::size_t LogSegment::_NextRecord(std::size_t offset) const
+{
+    const char* end = memory_ + length_;
+    const char* p = memory_ + offset;
+    int64_t micros;
+    while(p < end)
+    {
+        const char* nl = static_cast<const char*>(::memchr(p, '\n', end - p));
+        if(!nl)
+            return length_;
+        p = nl + 1;
+        if(p < end && ParseRecordTime(p, end - p, &micros))
+            break;
+    }
+    return p - memory_;
+}
+
+void LogSegment::_BuildIndex(uint64_t from)
+{
+    std::size_t offset = from;
+    while(offset < length_)
+    {
+        LogIndexEntry entry;
+        entry.minMicros = INT64_MAX;
+        entry.maxMicros = INT64_MIN;
+        entry.offset = offset;
+        entry.levels = 0;
+
+        std::size_t end = offset;
+        while(end < length_ && end - offset < kBlockSize)
+        {
+            const char* rec = memory_ + end;
+            const std::size_t left = length_ - end;
+            int64_t micros;
+            if(ParseRecordTime(rec, left, &micros))
+            {
+                entry.minMicros = std::min(entry.minMicros, micros);
+                entry.maxMicros = std::max(entry.maxMicros, micros);
+                entry.levels |= ParseLogLevel(rec + kPrefixTimeLen, left - kPrefixTimeLen);
+            }
+            end = _NextRecord(end);
+        }
+
+        entry.length = static_cast<uint32_t>(end - offset);
+        index_.push_back(entry);
+        offset = end;
+    }
+}
+
+std::size_t LogSegment::Query(const LogQuery& query, std::vector<LogRecord>* out) const
+{
+    std::size_t found = 0;
+    for(const auto& entry : index_)
+    {
+        if(entry.maxMicros < query.fromMicros || entry.minMicros > query.toMicros)
+            continue;
+        if(query.levels != static_cast<unsigned int>(logALL) && !(entry.levels & query.levels))
+            continue;
+
+        std::size_t offset = entry.offset;
+        const std::size_t blockEnd = entry.offset + entry.length;
+        while(offset < blockEnd)
+        {
+            const std::size_t next = _NextRecord(offset);
+            const char* rec = memory_ + offset;
+            int64_t micros;
+            if(ParseRecordTime(rec, next - offset, &micros) &&
+               micros >= query.fromMicros && micros <= query.toMicros)
+            {
+                const unsigned int level = ParseLogLevel(rec + kPrefixTimeLen, next - offset - kPrefixTimeLen);
+                if(query.levels == static_cast<unsigned int>(logALL) || (level & query.levels))
+                {
+                    out->emplace_back(micros, level, rec, next - offset);
+                    ++found;
+                }
+            }
+            offset = next;
+        }
+    }
+    return found;
+}
+
+std::size_t QueryLogFiles(const std::vector<std::string>& files,
+                          const LogQuery& query,
+                          unsigned int threads,
+                          const LogQueryCallback& callback,
+                          bool saveIndex)
+{
+    const std::size_t n = files.size();
+    std::vector<std::unique_ptr<LogSegment>> segments(n);
+    std::vector<std::vector<LogRecord>> results(n);
+    std::vector<char> opened(n, 0);
+    std::atomic<std::size_t> next{0};
+
+    auto worker = [&]()
+    {
+        std::size_t i;
+        while((i = next.fetch_add(1)) < n)
+        {
+            segments[i].reset(new LogSegment());
+            if(segments[i]->Open(files[i], saveIndex))
+            {
+                opened[i] = 1;
+                segments[i]->Query(query, &results[i]);
+            }
+        }
+    };
+
+    if(threads == 0)
+        threads = std::max(1U, std::thread::hardware_concurrency());
+    threads = static_cast<unsigned int>(std::min<std::size_t>(threads, n));
+
+    std::vector<std::thread> workers;
+    for(unsigned int i = 1; i < threads; ++i)
+        workers.emplace_back(worker);
+    worker();
+    for(auto& t : workers)
+        t.join();
+
+    std::size_t total = 0;
+    for(std::size_t i = 0; i < n; ++i)
+    {
+        if(!opened[i])
+            continue;
+        total += results[i].size();
+        if(callback)
+            callback(*segments[i], results[i]);
+    }
+    return total;
+}
+
+}   // end namespace mrpc
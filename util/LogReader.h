@@ -0,0 +1,124 @@
+#ifndef LOGREADER_H_
+#define LOGREADER_H_
+
+// Reader for the files written by Logger: <time>@<pid>-<seq>.log
+// Every record looks like  2020-06-01[12:34:56.123456][INF]:msg|tid\n
+// A segment is mapped by IMmapFile, and a sparse side index (<file>.idx) records for each
+// block the min/max timestamp and a bitmap of the levels inside it, so a query
+// only touches the blocks which may contain matching records.
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <stdint.h>
+#include "Buffer.h"
+#include "Logger.h"
+#include "MmapFile.h"
+
+namespace mrpc
+{
+
+struct LogIndexEntry
+{
+    int64_t minMicros;
+    int64_t maxMicros;
+    uint64_t offset;
+    uint32_t length;
+    uint32_t levels;    // bitmap of LogLevel
+};
+
+struct LogRecord
+{
+    int64_t micros;     // wall clock of the record, as written (local time)
+    unsigned int level;
+    Slice line;         // view into the mapped segment, '\n' included
+    LogRecord(int64_t m, unsigned int l, const char* data, std::size_t len):
+        micros(m), level(l), line(data, len)
+        {}
+};
+
+struct LogQuery
+{
+    int64_t fromMicros = INT64_MIN;     // inclusive
+    int64_t toMicros = INT64_MAX;       // inclusive
+    unsigned int levels = logALL;
+};
+
+class LogSegment
+{
+public:
+    LogSegment();
+    ~LogSegment();
+
+    LogSegment(const LogSegment& ) = delete;
+    void operator= (const LogSegment& ) = delete;
+
+    //map the file, then load its side index or (re)build it
+    //saveIndex:write the index back to <file>.idx if it was built or extended
+    bool Open(const std::string& file, bool saveIndex = true);
+    void Close();
+
+    //pick up the records appended since Open, for a file still being written.
+    //Records returned by Query before are invalid if it returns true
+    bool Refresh(bool saveIndex = true);
+
+    //append the records matching query to out, in file order
+    std::size_t Query(const LogQuery& query, std::vector<LogRecord>* out) const;
+
+    const std::string& FileName() const
+    {
+        return file_;
+    }
+    const std::vector<LogIndexEntry>& Index() const
+    {
+        return index_;
+    }
+    //the valid length, zero padding of a live file excluded
+    std::size_t Size() const
+    {
+        return length_;
+    }
+
+    static const std::size_t kBlockSize;
+
+private:
+    std::string file_;
+    internal::IMmapFile mmap_;
+    const char* memory_;
+    std::size_t length_;
+    std::vector<LogIndexEntry> index_;
+
+    bool _LoadIndex(const std::string& name, uint64_t* indexedLength);
+    bool _SaveIndex(const std::string& name) const;
+    void _BuildIndex(uint64_t from);
+    void _UpdateIndex(bool saveIndex);
+    std::size_t _NextRecord(std::size_t offset) const;
+};
+
+//parse "YYYY-MM-DD[HH:MM:SS.uuuuuu]", also accepts "YYYY-MM-DD HH:MM:SS[.uuuuuu]",
+//"YYYY-MM-DDTHH:MM:SS" and a bare "YYYY-MM-DD". Returns false if not a timestamp
+bool ParseLogTime(const char* str, std::size_t len, int64_t* micros);
+
+//parse the level tag "[INF]:" etc. at the head of data, 0 if unknown
+unsigned int ParseLogLevel(const char* data, std::size_t len);
+
+//true if name looks like <time>@<pid>-<seq>[.<tag>].log; tag gets the route tag
+//of Logger::AddRoute, empty for a main file
+bool IsLogFileName(const std::string& name, std::string* tag = nullptr);
+
+//the log files in dir with the route tag, "" for the main files only (a route
+//not exclusive holds copies of their records); sorted, so chronological
+bool ListLogFiles(const std::string& dir, const std::string& tag, std::vector<std::string>* files);
+
+//scan several segments in parallel, with at most threads workers.
+//callback is called in the order of files, from the calling thread
+using LogQueryCallback = std::function<void (const LogSegment& , const std::vector<LogRecord>& )>;
+std::size_t QueryLogFiles(const std::vector<std::string>& files,
+                          const LogQuery& query,
+                          unsigned int threads,
+                          const LogQueryCallback& callback,
+                          bool saveIndex = true);
+
+}   // end namespace mrpc
+
+#endif
@@ -12,28 +12,12 @@
 
 #include "TimeUtil.h"
 #include "Logger.h"
+#include "CpuTopology.h"
 
 
 
 namespace mrpc
 {
-namespace 
-{
-
-enum LogColor
-{
-    Red = 1,
-    Green,
-    Yellow,
-    Normal,
-    Blue,
-    Purple,
-    White,
-    Max,
-};
-
-}   // end namespace
-
 // TODO config
 static const size_t kDefaultLogSize = 32 * 1024 * 1024;
 
@@ -66,9 +50,15 @@ unsigned int Logger::seq_ = 0;
 Logger::Logger() : 
             shutdown_(false),
             level_(logINFO),
-            dest_(0)
+            dest_(0),
+            fileLevel_(logALL)
 {
     _Reset();
+
+    // the io thread never waits for the disk
+    internal::SyncOptions options;
+    options.async = true;
+    file_.SetSyncOptions(options);
 }
 
 Logger::~Logger()
@@ -100,15 +90,37 @@ bool Logger::Init(unsigned int level, unsigned int dest, const char* dir)
     return true;
 }
 
-bool Logger::_CheckChangeFile()
+bool Logger::AddRoute(unsigned int levels, const char* tag, bool exclusive)
+{
+    if(!tag || !*tag || levels == 0)
+        return false;
+
+    if(!(dest_ & logFile) && directory_ != "." && !MakeDir(directory_.c_str()))
+        return false;
+
+    std::unique_ptr<LogRoute> route(new LogRoute());
+    route->level_ = levels;
+    route->tag_ = std::string(".") + tag;
+    route->file_.SetSyncOptions(file_.GetSyncOptions());
+
+    std::lock_guard<std::mutex> guard(routesMutex_);
+    routes_.push_back(std::move(route));
+
+    if(exclusive)
+        fileLevel_ &= ~levels;
+
+    return true;
+}
+
+bool Logger::_CheckChangeFile(const internal::OMmapFile& file) const
 {
-    if(!file_.IsOpen())
+    if(!file.IsOpen())
         return true;
     
-    return file_.Offset() + kMaxCharPerLog > kDefaultLogSize;
+    return file.Offset() + kMaxCharPerLog > kDefaultLogSize;
 }
 
-const std::string& Logger::_MakeFileName()
+const std::string& Logger::_MakeFileName(const std::string& tag)
 {
     char time[32];
     Time now;
@@ -119,18 +131,22 @@ const std::string& Logger::_MakeFileName()
     pid << "@" << ::getpid() << "-";
 
     seq_++;     // why not lock?
-    fileName_ = directory_ + "/" + time + pid.str() + std::to_string(seq_) + ".log";
+    fileName_ = directory_ + "/" + time + pid.str() + std::to_string(seq_) + tag + ".log";
 
     return fileName_;
 }
 
-bool Logger::_OpenLogFile(const std::string& name)
+bool Logger::_OpenLogFile(internal::OMmapFile& file, const std::string& name)
 {
-    return file_.Open(name.data(), true);
+    return file.Open(name.data(), true);
 }
 
 void Logger::_CloseLogFile()
 {
+    std::lock_guard<std::mutex> guard(routesMutex_);
+    for(auto& route : routes_)
+        route->file_.Close();
+
     return file_.Close();
 }
 
@@ -160,20 +176,17 @@ void Logger::Flush(LogLevel level)
     Time now;
 
     auto seconds = now.Millseconds() / 1000;
+    auto usec = now.Microseconds() % 1000000;
     if(seconds != lastLogSecond_)
     {
         now.FormatTime(tmpBuffer_);
         lastLogSecond_ = seconds;
+        lastLogMSecond_ = usec;
     }
-    else
+    else if(usec != lastLogMSecond_)
     {
-        auto msec = now.Microseconds() / 1000000;
-        if(msec != lastLogMSecond_)
-        {
-            snprintf(tmpBuffer_ + 20, 7, "%06d", static_cast<int>(msec));
-            tmpBuffer_[26] = ']';
-            lastLogMSecond_ = msec;
-        }
+        now.FormatMicros(tmpBuffer_ + 20);
+        lastLogMSecond_ = usec;
     }
 
     switch(level)
@@ -261,23 +274,6 @@ void Logger::Flush(LogLevel level)
     }
 }
 
-void Logger::_Color(unsigned int color)
-{
-    const char* colorstring[Max] = 
-    {
-        "",
-        "\033[1;31;40m",
-        "\033[1;32;40m",
-        "\033[1;33;40m",
-        "\033[0m",
-        "\033[1;34;40m",
-        "\033[1;35;40m",
-        "\033[1;37;40m",
-    };
-
-    fprintf(stdout, "%s", colorstring[color]);
-}
-
 Logger& Logger::operator<< (const char* msg)
 {
     if(IsLevelForbid(curlevel_))
@@ -479,6 +475,8 @@ bool Logger::Update()
         }
     }
 
+    // not mutex_: the loggers go on filling buffers while the io thread writes
+    std::lock_guard<std::mutex> guard(routesMutex_);
     for(auto& pbuf : tmpBufs)
     {
         const char* data = pbuf->buffer_.readaddr();
@@ -487,7 +485,13 @@ bool Logger::Update()
         assert(nWritten == size);
     }
 
+    // one write for the whole drain cycle
+    if(dest_ & logConsole)
+        console_.Flush();
+
     file_.Sync();
+    for(auto& route : routes_)
+        route->file_.Sync();
 
     return todo;
 }
@@ -506,8 +510,11 @@ size_t Logger::_Log(const char* data, size_t dataLen)
     size_t nOffset = 0;
     while(nOffset + minLogSize < dataLen)
     {
-        int level = *(int*)(data + nOffset);
-        size_t len = *(size_t*)(data + nOffset + sizeof(int));
+        // records are packed, level and len are not aligned
+        int level;
+        size_t len;
+        memcpy(&level, data + nOffset, sizeof level);
+        memcpy(&len, data + nOffset + sizeof(int), sizeof len);
         if(dataLen < nOffset + minLogSize + len)
         {
             std::cerr << "_WriteLog skip 0!!!\n";
@@ -526,50 +533,30 @@ void Logger::_WriteLog(unsigned int level, size_t len, const char* data)
     assert(len > 0 && data);
 
     if(dest_ & logConsole)
-    {
-        switch(level)
-        {
-            case(logINFO):
-                _Color(Green);
-                break;
+        console_.Append(level, data, len);
 
-            case(logDEBUG):
-                _Color(White);
-                break;
-            
-            case(logWARN):
-                _Color(Yellow);
-                break;
-            
-            case(logERROR):
-                _Color(Red);
-                break;
+    if((dest_ & logFile) && (level & fileLevel_))
+        _WriteFile(file_, std::string(), len, data);
 
-            case(logUSR):
-                _Color(Purple);
-                break;
-            
-            default:
-                _Color(Red);
-                break;
-        }
-
-        fprintf(stdout, "%.*s", static_cast<int>(len), data);
-        _Color(Normal);
+    // the same record is written to every route, nothing formatted again
+    for(auto& route : routes_)
+    {
+        if(level & route->level_)
+            _WriteFile(route->file_, route->tag_, len, data);
     }
+}
 
-    if(dest_ & logFile)
+void Logger::_WriteFile(internal::OMmapFile& file, const std::string& tag, size_t len, const char* data)
+{
+    while(_CheckChangeFile(file))
     {
-        while(_CheckChangeFile())
-        {
-            _CloseLogFile();
-            if(!_OpenLogFile(_MakeFileName().c_str()))
-                break;
-        }
-
-        assert(file_.IsOpen());
-        file_.Write(data, len);
+        file.Close();
+        if(!_OpenLogFile(file, _MakeFileName(tag)))
+            break;
     }
+
+    assert(file.IsOpen());
+    file.Write(data, len);
 }
 
 Logger& Logger::SetCurLevel(unsigned int level)
@@ -594,16 +581,18 @@ LogManager& LogManager::Instance()
     return mgr;
 }
 
-LogManager::LogManager() : shutdown_(true)
+LogManager::LogManager() : shutdown_(true),
+                           ioCpu_(-1)
 {
     nullLog_.Init(0);
 }
 
-void LogManager::start()
+void LogManager::start(int ioCpu)
 {
     std::unique_lock<std::mutex> guard(mutex_);
     assert(shutdown_);
     shutdown_ = false;
+    ioCpu_ = ioCpu;
 
     auto io = std::bind(&LogManager::Run, this);
     iothread_ = std::thread{std::move(io)};
@@ -621,7 +610,7 @@ void LogManager::stop()
     }
 
     {
-        std::lock_guard<std::mutex> guard(mutex_);
+        std::lock_guard<std::mutex> guard(logsMutex_);
         for(auto& plog : logs_)
             plog->shutdown();
     }
@@ -642,7 +631,12 @@ std::shared_ptr<Logger> LogManager::CreateLog(unsigned int level, unsigned int d
     else
     {
         std::lock_guard<std::mutex> guard(logsMutex_);
-        if(shutdown_)
+        bool shutdown;
+        {
+            std::lock_guard<std::mutex> stateGuard(mutex_);
+            shutdown = shutdown_;
+        }
+        if(shutdown)
         {
             std::cerr << "Warning: Please call LogManager::Start() first.\n";
             std::shared_ptr<Logger> nulllog(&nullLog_, [](Logger* ) {});
@@ -672,6 +666,9 @@ void LogManager::Run()
 {
     const std::chrono::milliseconds kFlushInterval(1);
 
+    if(ioCpu_ >= 0 && !CpuTopology::PinCurrentThread(std::vector<int>(1, ioCpu_)))
+        std::cerr << "Warning: can not pin the log io thread to cpu " << ioCpu_ << std::endl;
+
     bool run = true;
     while(run)
     {
@@ -692,7 +689,7 @@ void LogManager::Run()
 
         if(tmpBusy.empty())
         {
-            std::unique_lock<std::mutex> guard(mutex_);
+            std::unique_lock<std::mutex> guard(logsMutex_);
             for(auto& plog : logs_)
                 tmpBusy.push_back(plog.get());
         }
@@ -701,8 +698,7 @@ void LogManager::Run()
             plog->Update();
     }
 
-    std::unique_lock<std::mutex> guard(mutex_);
-    assert(shutdown_);
+    std::unique_lock<std::mutex> guard(logsMutex_);
     while(!logs_.empty())
     {
         for(auto it(logs_.begin()); it != logs_.end(); )
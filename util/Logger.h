@@ -12,6 +12,7 @@
 #include <set>
 #include "Buffer.h"
 #include "MmapFile.h"
+#include "ConsoleSink.h"
 enum LogLevel
 {
     logINFO  = 0x01 << 0,
@@ -71,6 +72,12 @@ public:
 
     Logger& SetCurLevel(unsigned int level);
 
+// route records of levels to an extra file <time>@<pid>-<seq>.<tag>.log besides the main one,
+// exclusive: these levels will not be written to the main file any more.
+// Routing is done by the io thread on the record already formatted; a route added while
+// logging takes the records the io thread has not written yet
+    bool AddRoute(unsigned int levels, const char* tag, bool exclusive = false);
+
     void shutdown();
     bool Update();
 
@@ -102,15 +109,27 @@ private:
     std::string fileName_;
 
     internal::OMmapFile file_;
+    unsigned int fileLevel_;    // levels to the main file
+
+    struct LogRoute
+    {
+        unsigned int level_;
+        std::string tag_;
+        internal::OMmapFile file_;
+    };
+    std::vector<std::unique_ptr<LogRoute>> routes_;
+    std::mutex routesMutex_;    // routes_ and fileLevel_, held by the io thread while writing
+
+    internal::ConsoleSink console_;
 
     std::size_t _Log(const char* data, std::size_t len);
 
-    bool _CheckChangeFile();
-    const std::string& _MakeFileName();
-    bool _OpenLogFile(const std::string& name);
+    bool _CheckChangeFile(const internal::OMmapFile& file) const;
+    const std::string& _MakeFileName(const std::string& tag);
+    bool _OpenLogFile(internal::OMmapFile& file, const std::string& name);
     void _CloseLogFile();
+    void _WriteFile(internal::OMmapFile& file, const std::string& tag, std::size_t len, const char* data);
     void _WriteLog(unsigned int level, std::size_t nlen, const char* data);
-    void _Color(unsigned int color);
     void _Reset();
 
     static unsigned int seq_;
@@ -121,7 +140,9 @@ class LogManager
 public:
     static LogManager& Instance();
     
-    void start();
+    //ioCpu: pin the io thread to this cpu, e.g. a housekeeping core kept out of the
+    //thread pools by CpuTopology::Exclude; -1: not pinned
+    void start(int ioCpu = -1);
     void stop();
 
     std::shared_ptr<Logger> CreateLog(unsigned int level,
@@ -148,6 +169,7 @@ private:
     //null object
     Logger nullLog_;
     std::thread iothread_;
+    int ioCpu_;
 };
 
 class LogHelper
@@ -0,0 +1,79 @@
+#include <cassert>
+#include <time.h>
+#include "LoopClock.h"
+
+namespace mrpc {
+
+thread_local LoopClock* LoopClock::current_ = nullptr;
+
+static std::chrono::nanoseconds ReadClock(clockid_t id)
+{
+    timespec ts;
+    ::clock_gettime(id, &ts);
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+static std::chrono::nanoseconds ReadResolution(clockid_t id)
+{
+    timespec ts;
+    if(::clock_getres(id, &ts) != 0)
+        return std::chrono::milliseconds(4);
+    return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+LoopClock::LoopClock(bool coarse):wallValid_(false),
+                                  coarse_(coarse)
+{
+    Refresh();
+}
+
+LoopClock::~LoopClock()
+{
+    if(current_ == this)
+        current_ = nullptr;
+}
+
+void LoopClock::Refresh()
+{
+    // steady_clock and system_clock are CLOCK_MONOTONIC and CLOCK_REALTIME
+    if(coarse_)
+        steady_ = SteadyPoint(ReadClock(CLOCK_MONOTONIC_COARSE));
+    else
+        steady_ = std::chrono::steady_clock::now();
+    wallValid_ = false;
+}
+
+LoopClock::SystemPoint LoopClock::WallNow() const
+{
+    if(!wallValid_)
+    {
+        if(coarse_)
+            wall_ = SystemPoint(std::chrono::duration_cast<SystemPoint::duration>(ReadClock(CLOCK_REALTIME_COARSE)));
+        else
+            wall_ = std::chrono::system_clock::now();
+        wallValid_ = true;
+    }
+    return wall_;
+}
+
+std::chrono::nanoseconds LoopClock::Resolution() const
+{
+    if(!coarse_)
+        return std::chrono::nanoseconds(0);
+    static const std::chrono::nanoseconds tick = ReadResolution(CLOCK_MONOTONIC_COARSE);
+    return tick;
+}
+
+void LoopClock::Attach()
+{
+    assert(!current_ || current_ == this);
+    current_ = this;
+}
+
+void LoopClock::Detach()
+{
+    if(current_ == this)
+        current_ = nullptr;
+}
+
+}   // end namespace mrpc
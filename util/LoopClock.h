@@ -0,0 +1,79 @@
+#ifndef LOOPCLOCK_H_
+#define LOOPCLOCK_H_
+
+// Clock cache of an event loop
+// The loop calls Refresh() once per iteration, after it wakes up; then timers,
+// log timestamps and deadline checks on that thread read the cached time points
+// instead of the clock. Within one iteration they all see the same time.
+//
+// coarse: read CLOCK_MONOTONIC_COARSE/CLOCK_REALTIME_COARSE, cheaper still but only
+//         as fine as the kernel tick (1~4ms); not for sub-millisecond timers.
+
+#include <chrono>
+
+namespace mrpc {
+
+class LoopClock final
+{
+public:
+    using SteadyPoint = std::chrono::steady_clock::time_point;
+    using SystemPoint = std::chrono::system_clock::time_point;
+
+    explicit LoopClock(bool coarse = false);
+    ~LoopClock();
+
+    LoopClock(const LoopClock& ) = delete;
+    void operator= (const LoopClock& ) = delete;
+
+    //read the steady clock now, the system clock on the first WallNow()
+    void Refresh();
+
+    SteadyPoint Now() const
+    {
+        return steady_;
+    }
+    SystemPoint WallNow() const;
+
+    void SetCoarse(bool coarse)
+    {
+        coarse_ = coarse;
+    }
+    bool IsCoarse() const
+    {
+        return coarse_;
+    }
+    //how far Now() may lag the fine clock between ticks: the kernel tick if coarse, 0 if not
+    std::chrono::nanoseconds Resolution() const;
+
+    //make it the clock of this thread, by the loop thread; and undo it
+    void Attach();
+    void Detach();
+
+    //the clock of this thread, nullptr if none attached
+    static LoopClock* Current()
+    {
+        return current_;
+    }
+
+    //the cached time if this thread has a clock attached, otherwise read the clock
+    static SteadyPoint SteadyNow()
+    {
+        return current_ ? current_->steady_ : std::chrono::steady_clock::now();
+    }
+    static SystemPoint SystemNow()
+    {
+        return current_ ? current_->WallNow() : std::chrono::system_clock::now();
+    }
+
+private:
+    SteadyPoint steady_;
+    mutable SystemPoint wall_;
+    mutable bool wallValid_;
+    bool coarse_;
+
+    static thread_local LoopClock* current_;
+};
+
+}   // end namespace mrpc
+
+#endif
@@ -6,6 +6,12 @@
 #include <sys/mman.h>
 #include <string>
 #include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
 #include "MmapFile.h"
 
 namespace mrpc {
@@ -15,6 +21,142 @@ static const size_t kDefaultSize = 1*1024*1024;
 static const int kInvalidFile = -1;
 static char* const kInvalidAddr = reinterpret_cast<char*>(-1);
 
+static std::size_t PageSize()
+{
+    static const std::size_t kPageSize = ::sysconf(_SC_PAGESIZE);
+    return kPageSize;
+}
+
+//the state of one file shared with the syncer thread
+//mutex_ guards fd_ and the writes of synced_, so Close never races with a writeback
+//in progress; the writer reads synced_ without it
+class AsyncSyncState
+{
+public:
+    std::mutex mutex_;
+    int fd_ = kInvalidFile;
+    std::atomic<std::size_t> synced_{0};
+    std::atomic<std::size_t> published_{0};
+    SyncOptions options_;
+    std::chrono::steady_clock::time_point last_;
+
+    //write back [synced_, published_), call with mutex_ held
+    void WriteBack(unsigned int flags)
+    {
+        const std::size_t to = published_.load(std::memory_order_acquire);
+        const std::size_t from = synced_.load(std::memory_order_relaxed);
+        if(fd_ == kInvalidFile || to <= from)
+            return;
+
+        ::sync_file_range(fd_, from, to - from, flags);
+        synced_.store(to, std::memory_order_release);
+        last_ = std::chrono::steady_clock::now();
+    }
+};
+
+namespace
+{
+
+const unsigned int kWaitWriteBack = SYNC_FILE_RANGE_WAIT_BEFORE |
+                                    SYNC_FILE_RANGE_WRITE |
+                                    SYNC_FILE_RANGE_WAIT_AFTER;
+
+//one thread for every async OMmapFile of the process.
+//Leaked on purpose: files may still be closed by other static destructors
+class MmapSyncer
+{
+public:
+    static MmapSyncer& Instance()
+    {
+        static MmapSyncer* syncer = new MmapSyncer();
+        return *syncer;
+    }
+
+    void Register(const std::shared_ptr<AsyncSyncState>& state)
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        states_.push_back(state);
+        if(!running_)
+        {
+            running_ = true;
+            std::thread(&MmapSyncer::Run, this).detach();
+        }
+    }
+
+    void Unregister(const AsyncSyncState* state)
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        for(auto it(states_.begin()); it != states_.end(); ++it)
+        {
+            if(it->get() == state)
+            {
+                states_.erase(it);
+                break;
+            }
+        }
+    }
+
+    void Kick()
+    {
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            kicked_ = true;
+        }
+        cond_.notify_one();
+    }
+
+private:
+    MmapSyncer() = default;
+
+    void Run()
+    {
+        using namespace std::chrono;
+        const milliseconds kMaxWait(1000);
+
+        std::vector<std::shared_ptr<AsyncSyncState>> states;
+        while(true)
+        {
+            {
+                std::unique_lock<std::mutex> guard(mutex_);
+                cond_.wait_for(guard, wait_, [this]() { return kicked_; });
+                kicked_ = false;
+                states = states_;
+            }
+
+            const auto now = steady_clock::now();
+            wait_ = kMaxWait;
+            for(auto& state : states)
+            {
+                std::lock_guard<std::mutex> guard(state->mutex_);
+                const auto& options = state->options_;
+                auto dirty = state->published_.load(std::memory_order_acquire) -
+                             state->synced_.load(std::memory_order_relaxed);
+                if(dirty > 0 && (now >= state->last_ + options.interval || dirty >= options.bytes))
+                {
+                    state->WriteBack(kWaitWriteBack);
+                    dirty = 0;
+                }
+
+                // a clean file gets dirty silently, look at it again after one interval
+                auto left = options.interval;
+                if(dirty > 0)
+                    left = duration_cast<milliseconds>(state->last_ + options.interval - now);
+                wait_ = std::max(milliseconds(1), std::min(wait_, left));
+            }
+            states.clear();
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::vector<std::shared_ptr<AsyncSyncState>> states_;
+    std::chrono::milliseconds wait_{1000};
+    bool kicked_ = false;
+    bool running_ = false;
+};
+
+}   // end namespace
+
 OMmapFile::OMmapFile():file_(kInvalidFile),
                         memory_(kInvalidAddr),
                         offset_(0),
@@ -65,20 +207,47 @@ bool OMmapFile::Open(const char* file, bool bAppend)
     // it is a new file
     else
     {
+        ::ftruncate(file_, 0);
         size_ = kDefaultSize;
         offset_ = 0;
     }
+    syncpos_ = offset_;
 
-    int ret = ::ftruncate(file_, size_);
-    assert(ret == 0);
+    bool ret = _Preallocate(size_);
+    assert(ret);
     
-    return _MapWriteOnly();
+    if(!_MapWriteOnly())
+        return false;
+
+    if(options_.async)
+    {
+        async_ = std::make_shared<AsyncSyncState>();
+        async_->fd_ = file_;
+        async_->synced_ = offset_;
+        async_->published_ = offset_;
+        async_->options_ = options_;
+        async_->last_ = std::chrono::steady_clock::now();
+        MmapSyncer::Instance().Register(async_);
+    }
+
+    return true;
 }
 
 void OMmapFile::Close()
 {
     if(file_ != kInvalidFile)
     {   
+        if(async_)
+        {
+            // start writeback of the rest, but don't wait for it
+            MmapSyncer::Instance().Unregister(async_.get());
+            std::lock_guard<std::mutex> guard(async_->mutex_);
+            async_->published_ = offset_;
+            async_->WriteBack(SYNC_FILE_RANGE_WRITE);
+            async_->fd_ = kInvalidFile;
+        }
+        async_.reset();
+
         ::munmap(memory_, size_);       //unmap the relationship between memory and file
         ::ftruncate(file_, offset_);    //truncate size of file
         ::close(file_);
@@ -98,11 +267,39 @@ bool OMmapFile::Sync()
     if(syncpos_ >= offset_)
         return false;
     
-    ::msync(memory_ + syncpos_, offset_ - syncpos_, MS_SYNC);
+    if(async_)
+    {
+        // never block the writer, the syncer does the job
+        const std::size_t dirty = offset_ - async_->synced_.load(std::memory_order_relaxed);
+        async_->published_.store(offset_, std::memory_order_release);
+        if(dirty >= options_.bytes)
+            MmapSyncer::Instance().Kick();
+    }
+    else
+    {
+        // msync wants a page aligned address
+        const std::size_t begin = syncpos_ & ~(PageSize() - 1);
+        ::msync(memory_ + begin, offset_ - begin, MS_SYNC);
+    }
     syncpos_ = offset_;
     return true;
 }
 
+std::size_t OMmapFile::SyncedOffset() const
+{
+    if(async_)
+        return async_->synced_.load(std::memory_order_acquire);
+    return syncpos_;
+}
+
+bool OMmapFile::SyncData() const
+{
+    if(file_ == kInvalidFile)
+        return false;
+
+    return ::fdatasync(file_) == 0;
+}
+
 bool OMmapFile::_MapWriteOnly()
 {
     if(size_ == 0 || file_ == kInvalidFile)
@@ -115,18 +312,71 @@ bool OMmapFile::_MapWriteOnly()
     return (memory_ != kInvalidAddr);
 }
 
+// reserve the blocks up front, so page faults on the mapping never hit ENOSPC
+// and the file doesn't get fragmented by small extensions
+bool OMmapFile::_Preallocate(std::size_t size)
+{
+    if(::fallocate(file_, 0, 0, size) == 0)
+        return true;
+
+    // eg. tmpfs on old kernels, or some network filesystems
+    return ::ftruncate(file_, size) == 0;
+}
+
+// resize the mapping in place if possible; never leave the old region mapped
+bool OMmapFile::_Remap(std::size_t size)
+{
+    void* addr = ::mremap(memory_, size_, size, MREMAP_MAYMOVE);
+    if(addr == MAP_FAILED)
+    {
+        perror("OMmapFile mremap failed");
+        return false;
+    }
+
+    memory_ = static_cast<char*>(addr);
+    return true;
+}
+
 void OMmapFile::Truncate(std::size_t  size) {
     if (size == size_)
         return;
 
+    if (size == 0) {
+        // drop the content and start over like a new file, a mapping can't be empty
+        int ret = ::ftruncate(file_, 0);
+        assert (ret == 0);
+        offset_ = 0;
+        size = kDefaultSize;
+        bool ok = _Preallocate(size);
+        assert (ok);
+    }
+
+    if (size > size_) {
+        bool ret = _Preallocate(size);
+        assert (ret);
+        if (!_Remap(size))
+            return;
+    }
+    else if (size < size_) {
+        // shrink the mapping first, the pages beyond eof would raise SIGBUS
+        if (!_Remap(size))
+            return;
+        int ret = ::ftruncate(file_, size);
+        assert (ret == 0);
+    }
+
     size_ = size;
-    int ret = ::ftruncate(file_, size_);
-    assert (ret == 0);
 
     if (offset_> size_)
         offset_ = size_;
-
-    _MapWriteOnly();
+    if (syncpos_ > offset_)
+        syncpos_ = offset_;
+    // what was cut is no longer dirty, nor synced
+    if (async_ && async_->published_.load(std::memory_order_relaxed) > offset_) {
+        std::lock_guard<std::mutex> guard(async_->mutex_);
+        async_->published_ = offset_;
+        async_->synced_ = std::min(async_->synced_.load(), offset_);
+    }
 }
 
 bool OMmapFile::IsOpen() const
@@ -138,7 +388,7 @@ void OMmapFile::Write(const void* data, size_t len)
 {
     _AssureSpace(len);
 
-    assert(offset_ + len < size_);
+    assert(offset_ + len <= size_);
 
     ::memcpy(memory_ + offset_, data, len);
     offset_ += len;
@@ -159,5 +409,175 @@ void OMmapFile::_AssureSpace(size_t len)
     _ExtendFileSize(newsize);
 }
 
+IMmapFile::IMmapFile():file_(kInvalidFile),
+                      memory_(nullptr),
+                      size_(0),
+                      flags_(0),
+                      advice_(kNormal)
+{}
+
+IMmapFile::~IMmapFile()
+{
+    Close();
+}
+
+bool IMmapFile::Open(const std::string& file, unsigned int flags)
+{
+    return Open(file.c_str(), flags);
+}
+
+bool IMmapFile::Open(const char* file, unsigned int flags)
+{
+    Close();
+
+    file_ = ::open(file, O_RDONLY);
+    if(file_ == kInvalidFile)
+    {
+        char err[128];
+        snprintf(err, sizeof(err) - 1, "OpenReadOnly %s failed.\n", file);
+        perror(err);
+        return false;
+    }
+
+    flags_ = flags;
+    struct stat st;
+    if(::fstat(file_, &st) != 0 || !_Map(st.st_size))
+    {
+        Close();
+        return false;
+    }
+
+    return true;
+}
+
+void IMmapFile::Close()
+{
+    if(file_ != kInvalidFile)
+    {
+        if(memory_)
+            ::munmap(memory_, size_);
+        ::close(file_);
+
+        file_ = kInvalidFile;
+        memory_ = nullptr;
+        size_ = 0;
+        flags_ = 0;
+        advice_ = kNormal;
+    }
+}
+
+bool IMmapFile::IsOpen() const
+{
+    return file_ != kInvalidFile;
+}
+
+// an empty file has no mapping, memory_ stays null
+bool IMmapFile::_Map(std::size_t size)
+{
+    if(size == size_)
+        return true;
+
+    const std::size_t oldsize = size_;
+    void* addr = MAP_FAILED;
+    if(size == 0)
+    {
+        ::munmap(memory_, size_);
+        addr = nullptr;
+    }
+    else if(!memory_)
+    {
+        const int populate = (flags_ & kPopulate) ? MAP_POPULATE : 0;
+        addr = ::mmap(0, size, PROT_READ, MAP_SHARED | populate, file_, 0);
+    }
+    else
+    {
+        addr = ::mremap(memory_, size_, size, MREMAP_MAYMOVE);
+    }
+
+    if(addr == MAP_FAILED)
+    {
+        perror("IMmapFile map failed");
+        return false;
+    }
+
+    memory_ = static_cast<char*>(addr);
+    size_ = size;
+    _ApplyFlags(oldsize < size ? oldsize : size);
+    return true;
+}
+
+// from: where the newly mapped part begins
+void IMmapFile::_ApplyFlags(std::size_t from)
+{
+    if(!memory_)
+        return;
+
+    if(flags_ & kHugePage)
+        ::madvise(memory_, size_, MADV_HUGEPAGE);
+    if(advice_ != kNormal)
+        Advise(advice_, 0, size_);
+    // MAP_POPULATE only works at mmap time, prefetch the grown part instead
+    if((flags_ & kPopulate) && from > 0 && from < size_)
+        Advise(kWillNeed, from, size_ - from);
+}
+
+static int ToMadvise(IMmapFile::Advice advice)
+{
+    switch(advice)
+    {
+        case IMmapFile::kSequential:
+            return MADV_SEQUENTIAL;
+        case IMmapFile::kRandom:
+            return MADV_RANDOM;
+        case IMmapFile::kWillNeed:
+            return MADV_WILLNEED;
+        case IMmapFile::kDontNeed:
+            return MADV_DONTNEED;
+        default:
+            return MADV_NORMAL;
+    }
+}
+
+bool IMmapFile::Advise(Advice advice)
+{
+    // willneed and dontneed are one-shot actions, not a property to keep
+    if(advice != kWillNeed && advice != kDontNeed)
+        advice_ = advice;
+    return Advise(advice, 0, size_);
+}
+
+bool IMmapFile::Advise(Advice advice, std::size_t offset, std::size_t len)
+{
+    if(!memory_ || offset >= size_)
+        return false;
+
+    // madvise wants a page aligned address
+    static const std::size_t kPageSize = ::sysconf(_SC_PAGESIZE);
+    const std::size_t begin = offset & ~(kPageSize - 1);
+    const std::size_t end = offset + std::min(len, size_ - offset);
+
+    return ::madvise(memory_ + begin, end - begin, ToMadvise(advice)) == 0;
+}
+
+bool IMmapFile::Refresh()
+{
+    if(file_ == kInvalidFile)
+        return false;
+
+    struct stat st;
+    if(::fstat(file_, &st) != 0 || static_cast<std::size_t>(st.st_size) == size_)
+        return false;
+
+    return _Map(st.st_size);
+}
+
+Slice IMmapFile::View(std::size_t offset, std::size_t len) const
+{
+    if(!memory_ || offset >= size_)
+        return Slice();
+
+    return Slice(memory_ + offset, std::min(len, size_ - offset));
+}
+
 }   // end namespace internal
 }   // end namespace mrpcc
\ No newline at end of file
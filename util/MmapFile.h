@@ -2,25 +2,62 @@
 #define MMAPFILE_H_
 
 #include <string>
+#include <chrono>
+#include <memory>
+#include "Buffer.h"
 namespace mrpc {
 namespace internal{
 
+//durability of OMmapFile
+//blocking: Sync() writes the dirty range back by msync(MS_SYNC) in the calling thread
+//async: Sync() only publishes the offset, a background syncer writes it back by
+//sync_file_range once interval elapsed or bytes are dirty
+struct SyncOptions
+{
+    bool async = false;
+    std::chrono::milliseconds interval{100};
+    std::size_t bytes = 4 * 1024 * 1024;
+};
+
+class AsyncSyncState;
+
 class OMmapFile
 {
 public:
     OMmapFile();
     ~OMmapFile();
 
+    OMmapFile(const OMmapFile& ) = delete;
+    void operator= (const OMmapFile& ) = delete;
+
     bool Open(const std::string& file, bool bAppend = true);
     bool Open(const char* file, bool bAppend = true);
     void Close();
     bool Sync();
+    //fdatasync, the data and the extents written so far are on disk when it returns.
+    //It never touches the mapping, so another thread may Write meanwhile
+    bool SyncData() const;
+    //how far the file is written back: by the last Sync() in blocking mode,
+    //by the syncer in async mode
+    std::size_t SyncedOffset() const;
+    //resize the file and the mapping, the offset is cut to it.
+    //0 drops the whole content, the file starts over as if opened with bAppend false
     void Truncate(std::size_t size);
     void Write(const void* data, std::size_t len);
 
     template<typename T>
     void Write(const T& t);
 
+    //takes effect from the next Open
+    void SetSyncOptions(const SyncOptions& options)
+    {
+        options_ = options;
+    }
+    const SyncOptions& GetSyncOptions() const
+    {
+        return options_;
+    }
+
     std::size_t Offset() const
     {
         return offset_;
@@ -30,15 +67,18 @@ public:
 private:
     int file_;
     char* memory_;
-    std::size_t syncpos_;
     std::size_t offset_;
     std::size_t size_;
+    std::size_t syncpos_;
+
+    SyncOptions options_;
+    std::shared_ptr<AsyncSyncState> async_;
 
     bool _MapWriteOnly();
+    bool _Preallocate(std::size_t size);
+    bool _Remap(std::size_t size);
     void _ExtendFileSize(std::size_t size);
     void _AssureSpace(std::size_t size);
-
-
 };
 
 template<typename T>
@@ -47,6 +87,70 @@ inline void OMmapFile::Write(const T& t)
     this->Write(&t, sizeof(t));
 }
 
+//read-only mapping of a whole file
+//The mapping follows the file if it grows, see Refresh(); a file must not shrink
+//while mapped, touching the truncated pages raises SIGBUS
+class IMmapFile
+{
+public:
+    enum Flag
+    {
+        kPopulate = 0x01 << 0,  // prefault the pages by MAP_POPULATE
+        kHugePage = 0x01 << 1,  // try MADV_HUGEPAGE, silently ignored if unsupported
+    };
+
+    enum Advice
+    {
+        kNormal,
+        kSequential,
+        kRandom,
+        kWillNeed,
+        kDontNeed,
+    };
+
+    IMmapFile();
+    ~IMmapFile();
+
+    IMmapFile(const IMmapFile& ) = delete;
+    void operator= (const IMmapFile& ) = delete;
+
+    bool Open(const std::string& file, unsigned int flags = 0);
+    bool Open(const char* file, unsigned int flags = 0);
+    void Close();
+    bool IsOpen() const;
+
+    //advice for the whole mapping, it is kept across Refresh()
+    bool Advise(Advice advice);
+    //advice for a range, eg. kWillNeed before jumping to a far offset
+    bool Advise(Advice advice, std::size_t offset, std::size_t len);
+
+    //remap if the file size changed, return true if so.
+    //The address may move, all Slices and pointers taken before are invalid then
+    bool Refresh();
+
+    //zero-copy view of [offset, offset+len), truncated at the end of file
+    Slice View(std::size_t offset, std::size_t len) const;
+
+    const char* Data() const
+    {
+        return memory_;
+    }
+    std::size_t Size() const
+    {
+        return size_;
+    }
+
+private:
+    int file_;
+    char* memory_;
+    std::size_t size_;
+    unsigned int flags_;
+    Advice advice_;
+
+    bool _Map(std::size_t size);
+    void _ApplyFlags(std::size_t from);
+};
+
 }
 }
 
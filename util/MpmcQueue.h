@@ -0,0 +1,225 @@
+#ifndef MPMCQUEUE_H_
+#define MPMCQUEUE_H_
+
+// Bounded multi-producer multi-consumer queue (Dmitry Vyukov)
+// A ring of cells, each with a sequence number telling whether it is free for
+// the producer of position p (seq == p) or full for its consumer (seq == p + 1).
+// A producer or consumer claims a position by one CAS on its counter, then
+// fills or empties the cell and publishes it by storing the sequence.
+// Never blocks: TryPush fails when full, TryPop when empty.
+// The two counters are on their own cache lines; the capacity is rounded up to
+// a power of two.
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+
+namespace mrpc {
+
+template <typename T>
+class MpmcQueue final
+{
+public:
+    explicit MpmcQueue(std::size_t capacity) : mask_(_RoundUp(capacity) - 1),
+                                               cells_(new Cell[mask_ + 1]),
+                                               enqueue_(0),
+                                               dequeue_(0)
+    {
+        for(std::size_t i = 0; i <= mask_; ++i)
+            cells_[i].seq_.store(i, std::memory_order_relaxed);
+    }
+
+    ~MpmcQueue()
+    {
+        const std::size_t end = enqueue_.load(std::memory_order_relaxed);
+        for(std::size_t pos = dequeue_.load(std::memory_order_relaxed); pos != end; ++pos)
+            cells_[pos & mask_].Value()->~T();
+    }
+
+    MpmcQueue(const MpmcQueue& ) = delete;
+    void operator= (const MpmcQueue& ) = delete;
+
+    template <typename... Args>
+    bool TryEmplace(Args&&... args)
+    {
+        std::size_t pos = enqueue_.load(std::memory_order_relaxed);
+        Cell* cell;
+        while(true)
+        {
+            cell = &cells_[pos & mask_];
+            const std::size_t seq = cell->seq_.load(std::memory_order_acquire);
+            const std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(seq - pos);
+            if(diff == 0)
+            {
+                if(enqueue_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if(diff < 0)
+            {
+                return false;   // full: the cell of the last lap not consumed yet
+            }
+            else
+            {
+                pos = enqueue_.load(std::memory_order_relaxed);
+            }
+        }
+        new (cell->storage_) T(std::forward<Args>(args)...);
+        cell->seq_.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool TryPush(const T& value)
+    {
+        return TryEmplace(value);
+    }
+    bool TryPush(T&& value)
+    {
+        return TryEmplace(std::move(value));
+    }
+
+    bool TryPop(T& value)
+    {
+        std::size_t pos = dequeue_.load(std::memory_order_relaxed);
+        Cell* cell;
+        while(true)
+        {
+            cell = &cells_[pos & mask_];
+            const std::size_t seq = cell->seq_.load(std::memory_order_acquire);
+            const std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(seq - (pos + 1));
+            if(diff == 0)
+            {
+                if(dequeue_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if(diff < 0)
+            {
+                return false;   // empty
+            }
+            else
+            {
+                pos = dequeue_.load(std::memory_order_relaxed);
+            }
+        }
+        _Take(cell, pos, value);
+        return true;
+    }
+
+    //move up to count values from values, claiming their positions by one CAS;
+    //return how many pushed, less than count when the queue fills up
+    std::size_t TryPushBatch(T* values, std::size_t count)
+    {
+        std::size_t pos = enqueue_.load(std::memory_order_relaxed);
+        std::size_t n;
+        while(true)
+        {
+            n = _Ready(pos, 0, count);
+            if(n == 0)
+            {
+                const std::size_t seq = cells_[pos & mask_].seq_.load(std::memory_order_acquire);
+                if(static_cast<std::ptrdiff_t>(seq - pos) < 0)
+                    return 0;
+                pos = enqueue_.load(std::memory_order_relaxed);
+                continue;
+            }
+            if(enqueue_.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed))
+                break;
+        }
+        for(std::size_t i = 0; i < n; ++i)
+        {
+            Cell& cell = cells_[(pos + i) & mask_];
+            new (cell.storage_) T(std::move(values[i]));
+            cell.seq_.store(pos + i + 1, std::memory_order_release);
+        }
+        return n;
+    }
+
+    //pop up to count values into values by one CAS; return how many
+    std::size_t TryPopBatch(T* values, std::size_t count)
+    {
+        std::size_t pos = dequeue_.load(std::memory_order_relaxed);
+        std::size_t n;
+        while(true)
+        {
+            n = _Ready(pos, 1, count);
+            if(n == 0)
+            {
+                const std::size_t seq = cells_[pos & mask_].seq_.load(std::memory_order_acquire);
+                if(static_cast<std::ptrdiff_t>(seq - (pos + 1)) < 0)
+                    return 0;
+                pos = dequeue_.load(std::memory_order_relaxed);
+                continue;
+            }
+            if(dequeue_.compare_exchange_weak(pos, pos + n, std::memory_order_relaxed))
+                break;
+        }
+        for(std::size_t i = 0; i < n; ++i)
+            _Take(&cells_[(pos + i) & mask_], pos + i, values[i]);
+        return n;
+    }
+
+    std::size_t Capacity() const
+    {
+        return mask_ + 1;
+    }
+
+    //a snapshot, may be stale when returned
+    std::size_t SizeApprox() const
+    {
+        const std::size_t dequeue = dequeue_.load(std::memory_order_acquire);
+        const std::size_t enqueue = enqueue_.load(std::memory_order_acquire);
+        return enqueue > dequeue ? enqueue - dequeue : 0;
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<std::size_t> seq_;
+        alignas(T) unsigned char storage_[sizeof(T)];
+
+        T* Value()
+        {
+            return std::launder(reinterpret_cast<T*>(storage_));
+        }
+    };
+
+    static std::size_t _RoundUp(std::size_t capacity)
+    {
+        std::size_t size = 2;
+        while(size < capacity)
+            size <<= 1;
+        return size;
+    }
+
+    //how many cells from pos on are ready: free for producers (offset 0) or full
+    //for consumers (offset 1), at most count and never more than a lap
+    std::size_t _Ready(std::size_t pos, std::size_t offset, std::size_t count) const
+    {
+        if(count > mask_ + 1)
+            count = mask_ + 1;
+        std::size_t n = 0;
+        while(n < count && cells_[(pos + n) & mask_].seq_.load(std::memory_order_acquire) == pos + n + offset)
+            ++n;
+        return n;
+    }
+
+    //the cell is free again for the producer of the next lap
+    void _Take(Cell* cell, std::size_t pos, T& value)
+    {
+        T* stored = cell->Value();
+        value = std::move(*stored);
+        stored->~T();
+        cell->seq_.store(pos + mask_ + 1, std::memory_order_release);
+    }
+
+    const std::size_t mask_;
+    const std::unique_ptr<Cell[]> cells_;
+    alignas(64) std::atomic<std::size_t> enqueue_;  // producers
+    alignas(64) std::atomic<std::size_t> dequeue_;  // consumers, the line padded by the alignment
+};
+
+}   // end namespace mrpc
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef MPSCQUEUE_H_
+#define MPSCQUEUE_H_
+
+// Intrusive unbounded multi-producer single-consumer queue (Dmitry Vyukov)
+// Push is wait-free: one exchange and one store; PushBatch links a chain of
+// nodes first and pushes them all the same way. Pop is lock-free for the
+// single consumer; it may return nullptr for a moment while a producer is
+// between its two steps, the node shows up on a later Pop.
+// The queue never allocates, the nodes belong to the caller.
+
+#include <atomic>
+#include <cstddef>
+
+namespace mrpc {
+
+struct MpscNode
+{
+    std::atomic<MpscNode*> next_{nullptr};
+};
+
+class MpscQueue final
+{
+public:
+    MpscQueue() : head_(&stub_),
+                  tail_(&stub_)
+    {}
+
+    MpscQueue(const MpscQueue& ) = delete;
+    void operator= (const MpscQueue& ) = delete;
+
+    //any thread
+    void Push(MpscNode* node)
+    {
+        node->next_.store(nullptr, std::memory_order_relaxed);
+        MpscNode* prev = head_.exchange(node, std::memory_order_acq_rel);
+        prev->next_.store(node, std::memory_order_release);
+    }
+
+    //any thread; link count nodes and push them by one exchange, in order
+    void PushBatch(MpscNode* const* nodes, std::size_t count)
+    {
+        if(count == 0)
+            return;
+        for(std::size_t i = 0; i + 1 < count; ++i)
+            nodes[i]->next_.store(nodes[i + 1], std::memory_order_relaxed);
+        nodes[count - 1]->next_.store(nullptr, std::memory_order_relaxed);
+        MpscNode* prev = head_.exchange(nodes[count - 1], std::memory_order_acq_rel);
+        prev->next_.store(nodes[0], std::memory_order_release);
+    }
+
+    //the consumer thread only; pop up to count nodes, return how many
+    std::size_t PopBatch(MpscNode** nodes, std::size_t count)
+    {
+        std::size_t n = 0;
+        while(n < count && (nodes[n] = Pop()) != nullptr)
+            ++n;
+        return n;
+    }
+
+    //the consumer thread only
+    MpscNode* Pop()
+    {
+        MpscNode* tail = tail_;
+        MpscNode* next = tail->next_.load(std::memory_order_acquire);
+        if(tail == &stub_)
+        {
+            if(!next)
+                return nullptr;
+            tail_ = next;
+            tail = next;
+            next = next->next_.load(std::memory_order_acquire);
+        }
+
+        if(next)
+        {
+            tail_ = next;
+            return tail;
+        }
+
+        // a producer is linking a node after tail
+        if(tail != head_.load(std::memory_order_acquire))
+            return nullptr;
+
+        // tail is the last one, put the stub behind it to take it out
+        Push(&stub_);
+        next = tail->next_.load(std::memory_order_acquire);
+        if(next)
+        {
+            tail_ = next;
+            return tail;
+        }
+        return nullptr;
+    }
+
+    //the consumer thread only; a node being pushed counts
+    bool Empty() const
+    {
+        return tail_ == &stub_ && head_.load(std::memory_order_seq_cst) == &stub_;
+    }
+
+private:
+    alignas(64) std::atomic<MpscNode*> head_;   // producers
+    alignas(64) MpscNode* tail_;                // consumer
+    MpscNode stub_;
+};
+
+}   // end namespace mrpc
+
+#endif
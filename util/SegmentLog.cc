@@ -0,0 +1,370 @@
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <cinttypes>
+#include <algorithm>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Crc32c.h"
+#include "SegmentLog.h"
+
+namespace mrpc
+{
+
+static const char* const kSegmentSuffix = ".seg";
+
+static std::string SegmentName(const std::string& dir, uint64_t firstLsn)
+{
+    char name[32];
+    snprintf(name, sizeof name, "%020" PRIu64 "%s", firstLsn, kSegmentSuffix);
+    return dir + "/" + name;
+}
+
+static uint32_t RecordCrc(uint32_t len, const void* data)
+{
+    uint32_t crc = Crc32c(&len, sizeof len);
+    return MaskCrc(Crc32c(data, len, crc));
+}
+
+bool ListSegments(const std::string& dir, std::vector<std::pair<uint64_t, std::string>>* segments)
+{
+    segments->clear();
+
+    DIR* d = ::opendir(dir.c_str());
+    if(!d)
+        return false;
+
+    const std::size_t suffixLen = strlen(kSegmentSuffix);
+    while(struct dirent* ent = ::readdir(d))
+    {
+        const std::string name(ent->d_name);
+        if(name.size() != 20 + suffixLen || name.compare(20, suffixLen, kSegmentSuffix) != 0)
+            continue;
+        if(name.find_first_not_of("0123456789") != 20)
+            continue;
+
+        segments->emplace_back(strtoull(name.c_str(), nullptr, 10), dir + "/" + name);
+    }
+    ::closedir(d);
+
+    std::sort(segments->begin(), segments->end());
+    return true;
+}
+
+std::size_t ParseSegmentRecord(const char* data, std::size_t size, std::size_t offset, Slice* record)
+{
+    if(offset + SegmentLog::kHeaderSize > size)
+        return 0;
+
+    uint32_t len, crc;
+    memcpy(&len, data + offset, sizeof len);
+    memcpy(&crc, data + offset + sizeof len, sizeof crc);
+    if(len > size - offset - SegmentLog::kHeaderSize)
+        return 0;
+
+    const char* payload = data + offset + SegmentLog::kHeaderSize;
+    if(RecordCrc(len, payload) != crc)
+        return 0;
+
+    record->data = payload;
+    record->len = len;
+    return SegmentLog::kHeaderSize + len;
+}
+
+SegmentLog::SegmentLog():lastLsn_(0),
+                         durableLsn_(0),
+                         syncCount_(0),
+                         syncing_(false)
+{}
+
+SegmentLog::~SegmentLog()
+{
+    Close();
+}
+
+bool SegmentLog::Open(const std::string& dir, const SegmentLogOptions& options)
+{
+    Close();
+
+    dir_ = dir;
+    options_ = options;
+    if(options_.async)
+    {
+        internal::SyncOptions async = options_.asyncOptions;
+        async.async = true;
+        segment_.SetSyncOptions(async);
+    }
+    else
+    {
+        segment_.SetSyncOptions(internal::SyncOptions());
+    }
+
+    if(::mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+    {
+        perror("SegmentLog mkdir failed");
+        return false;
+    }
+
+    std::vector<std::pair<uint64_t, std::string>> segments;
+    if(!ListSegments(dir, &segments))
+        return false;
+
+    std::lock_guard<std::mutex> guard(mutex_);
+    if(segments.empty())
+        return _OpenSegment(1);
+
+    return _Recover(segments.back().second, segments.back().first);
+}
+
+void SegmentLog::Close()
+{
+    std::unique_lock<std::mutex> guard(mutex_);
+    cond_.wait(guard, [this]() { return !syncing_; });
+
+    if(segment_.IsOpen() && !options_.async)
+        segment_.SyncData();
+    segment_.Close();
+    published_.clear();
+    lastLsn_ = durableLsn_ = 0;
+}
+
+// find the end of the valid records, and cut the rest
+bool SegmentLog::_Recover(const std::string& name, uint64_t firstLsn)
+{
+    std::size_t validEnd = 0;
+    uint64_t count = 0;
+    {
+        internal::IMmapFile file;
+        if(!file.Open(name))
+            return false;
+        file.Advise(internal::IMmapFile::kSequential);
+
+        Slice record;
+        std::size_t frame;
+        while((frame = ParseSegmentRecord(file.Data(), file.Size(), validEnd, &record)) != 0)
+        {
+            validEnd += frame;
+            ++count;
+        }
+    }
+
+    if(validEnd == 0)
+    {
+        ::unlink(name.c_str());
+        return _OpenSegment(firstLsn);
+    }
+
+    if(!segment_.Open(name, true))
+        return false;
+    segment_.Truncate(validEnd);
+    // the cut must be durable before new records go after it
+    segment_.SyncData();
+
+    lastLsn_ = durableLsn_ = firstLsn + count - 1;
+    return true;
+}
+
+bool SegmentLog::_OpenSegment(uint64_t firstLsn)
+{
+    if(!segment_.Open(SegmentName(dir_, firstLsn), false))
+        return false;
+
+    published_.clear();
+    lastLsn_ = durableLsn_ = firstLsn - 1;
+    return true;
+}
+
+// called with mutex_ held and nobody syncing
+bool SegmentLog::_Roll()
+{
+    assert(!syncing_);
+
+    // the syncer doesn't follow a closed file, so the async mode syncs here too
+    const uint64_t last = lastLsn_;
+    const uint64_t durable = segment_.SyncData() ? last : durableLsn_;
+    ++syncCount_;
+    segment_.Close();
+
+    if(!_OpenSegment(last + 1))
+        return false;
+
+    durableLsn_ = durable;
+    cond_.notify_all();
+    return true;
+}
+
+uint64_t SegmentLog::Append(const void* data, std::size_t len)
+{
+    if(len > UINT32_MAX)
+        return 0;
+
+    const uint32_t len32 = static_cast<uint32_t>(len);
+    const uint32_t crc = RecordCrc(len32, data);
+
+    std::unique_lock<std::mutex> guard(mutex_);
+    if(!segment_.IsOpen())
+        return 0;
+
+    if(segment_.Offset() > 0 && segment_.Offset() + kHeaderSize + len > options_.segmentSize)
+    {
+        // the syncer leader must be done with the old segment
+        cond_.wait(guard, [this]() { return !syncing_; });
+        if(!_Roll())
+            return 0;
+    }
+
+    segment_.Write(len32);
+    segment_.Write(crc);
+    segment_.Write(data, len);
+    return ++lastLsn_;
+}
+
+bool SegmentLog::Commit(uint64_t lsn)
+{
+    std::unique_lock<std::mutex> guard(mutex_);
+    if(!segment_.IsOpen() || lsn > lastLsn_)
+        return false;
+
+    if(options_.async)
+    {
+        if(segment_.Sync())
+            published_.emplace_back(segment_.Offset(), lastLsn_);
+        // forget what the syncer is done with
+        const std::size_t synced = segment_.SyncedOffset();
+        while(!published_.empty() && published_.front().first <= synced)
+        {
+            durableLsn_ = published_.front().second;
+            published_.pop_front();
+        }
+        return true;
+    }
+
+    // group commit: one leader syncs everything appended so far, the others wait for it
+    while(durableLsn_ < lsn)
+    {
+        if(syncing_)
+        {
+            cond_.wait(guard);
+            continue;
+        }
+
+        syncing_ = true;
+        const uint64_t target = lastLsn_;
+        guard.unlock();
+
+        const bool ok = segment_.SyncData();
+
+        guard.lock();
+        syncing_ = false;
+        ++syncCount_;
+        if(ok)
+            durableLsn_ = std::max(durableLsn_, target);
+        cond_.notify_all();
+
+        if(!ok)
+            return false;
+    }
+
+    return true;
+}
+
+uint64_t SegmentLog::LastLsn() const
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    return lastLsn_;
+}
+
+uint64_t SegmentLog::DurableLsn() const
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    if(!options_.async)
+        return durableLsn_;
+
+    uint64_t lsn = durableLsn_;
+    const std::size_t synced = segment_.SyncedOffset();
+    for(const auto& commit : published_)
+    {
+        if(commit.first > synced)
+            break;
+        lsn = commit.second;
+    }
+    return lsn;
+}
+
+uint64_t SegmentLog::SyncCount() const
+{
+    std::lock_guard<std::mutex> guard(mutex_);
+    return syncCount_;
+}
+
+SegmentLogReader::SegmentLogReader():current_(0),
+                                     offset_(0),
+                                     lsn_(0)
+{}
+
+bool SegmentLogReader::Open(const std::string& dir, uint64_t fromLsn)
+{
+    file_.Close();
+    if(!ListSegments(dir, &segments_))
+        return false;
+
+    // start from the last segment beginning at or before fromLsn
+    current_ = 0;
+    while(current_ + 1 < segments_.size() && segments_[current_ + 1].first <= fromLsn)
+        ++current_;
+
+    if(segments_.empty())
+        return true;
+    if(!_OpenSegment(current_))
+        return false;
+
+    Slice record;
+    std::size_t frame;
+    while(lsn_ < fromLsn && (frame = ParseSegmentRecord(file_.Data(), file_.Size(), offset_, &record)) != 0)
+    {
+        offset_ += frame;
+        ++lsn_;
+    }
+    return true;
+}
+
+bool SegmentLogReader::_OpenSegment(std::size_t index)
+{
+    current_ = index;
+    offset_ = 0;
+    lsn_ = segments_[index].first;
+    if(!file_.Open(segments_[index].second))
+        return false;
+
+    file_.Advise(internal::IMmapFile::kSequential);
+    return true;
+}
+
+bool SegmentLogReader::Next(Slice* record, uint64_t* lsn)
+{
+    while(current_ < segments_.size() && file_.IsOpen())
+    {
+        std::size_t frame = ParseSegmentRecord(file_.Data(), file_.Size(), offset_, record);
+        // a segment still written may have grown under us
+        if(frame == 0 && file_.Refresh())
+            frame = ParseSegmentRecord(file_.Data(), file_.Size(), offset_, record);
+
+        if(frame != 0)
+        {
+            offset_ += frame;
+            if(lsn)
+                *lsn = lsn_;
+            ++lsn_;
+            return true;
+        }
+
+        if(current_ + 1 >= segments_.size() || !_OpenSegment(current_ + 1))
+            break;
+    }
+    return false;
+}
+
+}   // end namespace mrpc
@@ -0,0 +1,122 @@
+#ifndef SEGMENTLOG_H_
+#define SEGMENTLOG_H_
+
+// Append-only write-ahead log made of segment files <dir>/<first lsn>.seg
+// Every record is framed as  | length(4) | masked crc32c(4) of length and data | data |
+// Records are numbered by a log sequence number (lsn) starting from 1.
+//
+// Durability:
+//   sync mode: Commit(lsn) returns once lsn is on disk. Concurrent committers share
+//              one fdatasync, the first one syncs for everybody appended before it
+//   async mode: Commit only publishes, OMmapFile's background syncer writes back;
+//               DurableLsn follows what it has written back so far
+//   A segment is synced in both modes before rolling to the next one
+//
+// Open() recovers the last segment: the tail after the last valid record
+// (torn or never written) is truncated.
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <stdint.h>
+#include "Buffer.h"
+#include "MmapFile.h"
+
+namespace mrpc
+{
+
+struct SegmentLogOptions
+{
+    std::size_t segmentSize = 64 * 1024 * 1024;    // roll to a new segment beyond it
+    bool async = false;
+    internal::SyncOptions asyncOptions;             // used in async mode
+};
+
+class SegmentLog
+{
+public:
+    SegmentLog();
+    ~SegmentLog();
+
+    SegmentLog(const SegmentLog& ) = delete;
+    void operator= (const SegmentLog& ) = delete;
+
+    bool Open(const std::string& dir, const SegmentLogOptions& options = SegmentLogOptions());
+    void Close();
+
+    //thread-safe, return the lsn of the record, 0 if failed
+    uint64_t Append(const void* data, std::size_t len);
+    uint64_t Append(const Slice& record)
+    {
+        return Append(record.data, record.len);
+    }
+
+    //wait until the records up to lsn are durable, thread-safe
+    bool Commit(uint64_t lsn);
+
+    uint64_t AppendAndCommit(const void* data, std::size_t len)
+    {
+        const uint64_t lsn = Append(data, len);
+        return (lsn && Commit(lsn)) ? lsn : 0;
+    }
+
+    uint64_t LastLsn() const;
+    uint64_t DurableLsn() const;
+    //how many fdatasync done, appended records / SyncCount is the batch size
+    uint64_t SyncCount() const;
+
+    static const std::size_t kHeaderSize = 8;
+
+private:
+    std::string dir_;
+    SegmentLogOptions options_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    internal::OMmapFile segment_;
+    uint64_t lastLsn_;
+    uint64_t durableLsn_;
+    uint64_t syncCount_;
+    bool syncing_;
+    //async mode: the end offset in the segment and the last lsn of each Commit,
+    //durable once the syncer got past the offset
+    std::deque<std::pair<std::size_t, uint64_t>> published_;
+
+    bool _Recover(const std::string& name, uint64_t firstLsn);
+    bool _OpenSegment(uint64_t firstLsn);
+    bool _Roll();
+};
+
+//read back the records of a log directory, through mmap
+class SegmentLogReader
+{
+public:
+    SegmentLogReader();
+
+    //position at the first record whose lsn >= fromLsn
+    bool Open(const std::string& dir, uint64_t fromLsn = 1);
+
+    //the record is a view into the mapping, valid until the next call
+    bool Next(Slice* record, uint64_t* lsn = nullptr);
+
+private:
+    std::vector<std::pair<uint64_t, std::string>> segments_;    // first lsn, file name
+    std::size_t current_;
+    internal::IMmapFile file_;
+    std::size_t offset_;
+    uint64_t lsn_;
+
+    bool _OpenSegment(std::size_t index);
+};
+
+//list the segments of dir sorted by their first lsn
+bool ListSegments(const std::string& dir, std::vector<std::pair<uint64_t, std::string>>* segments);
+
+//validate the record at offset of data, return its total frame size or 0 if invalid
+std::size_t ParseSegmentRecord(const char* data, std::size_t size, std::size_t offset, Slice* record);
+
+}   // end namespace mrpc
+
+#endif
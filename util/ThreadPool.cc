@@ -0,0 +1,550 @@
+#include <cassert>
+#include <algorithm>
+#include "Futex.h"
+#include "ThreadPool.h"
+
+namespace mrpc
+{
+
+namespace internal
+{
+
+static const int64_t kInitialCapacity = 256;
+
+WorkDeque::WorkDeque():top_(0),
+                       bottom_(0),
+                       array_(nullptr)
+{
+    arrays_.emplace_back(new Array(kInitialCapacity));
+    array_.store(arrays_.back().get(), std::memory_order_relaxed);
+}
+
+WorkDeque::~WorkDeque()
+{
+    assert(Empty());
+}
+
+void WorkDeque::Push(PoolTask* task)
+{
+    const int64_t b = bottom_.load(std::memory_order_relaxed);
+    const int64_t t = top_.load(std::memory_order_acquire);
+    Array* array = array_.load(std::memory_order_relaxed);
+    if(b - t > array->Capacity() - 1)
+        array = _Grow(array, b, t);
+
+    array->Put(b, task);
+    //the paper has a release fence and a relaxed store, the same on x86 and tsan understands this one
+    bottom_.store(b + 1, std::memory_order_release);
+}
+
+PoolTask* WorkDeque::Pop()
+{
+    const int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    Array* array = array_.load(std::memory_order_relaxed);
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top_.load(std::memory_order_relaxed);
+
+    PoolTask* task = nullptr;
+    if(t <= b)
+    {
+        task = array->Get(b);
+        if(t == b)
+        {
+            //the last one, race with the thieves
+            if(!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                task = nullptr;
+            bottom_.store(b + 1, std::memory_order_relaxed);
+        }
+    }
+    else
+    {
+        bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+    return task;
+}
+
+PoolTask* WorkDeque::Steal()
+{
+    int64_t t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const int64_t b = bottom_.load(std::memory_order_acquire);
+    if(t >= b)
+        return nullptr;
+
+    Array* array = array_.load(std::memory_order_acquire);
+    PoolTask* task = array->Get(t);
+    //lost to the owner or another thief
+    if(!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        return nullptr;
+    return task;
+}
+
+WorkDeque::Array* WorkDeque::_Grow(Array* array, int64_t bottom, int64_t top)
+{
+    Array* bigger = new Array(array->Capacity() * 2);
+    for(int64_t i = top; i < bottom; ++i)
+        bigger->Put(i, array->Get(i));
+
+    arrays_.emplace_back(bigger);
+    array_.store(bigger, std::memory_order_release);
+    return bigger;
+}
+
+}   // end namespace internal
+
+using internal::PoolTask;
+
+//the pool and index of the worker running on this thread
+static thread_local ThreadPool* tlsPool = nullptr;
+static thread_local int tlsIndex = -1;
+
+//tasks taken from the injection queue at most at once
+static const std::size_t kInjectBatch = 32;
+
+//std::push_heap makes a max heap: the later deadline is the "less"
+template <typename T>
+static bool LaterFirst(const T& a, const T& b)
+{
+    if(a.deadline_ != b.deadline_)
+        return a.deadline_ > b.deadline_;
+    return a.seq_ > b.seq_;
+}
+
+ThreadPool::ThreadPool(std::size_t threads):sleepers_(0),
+                                            stop_(false)
+{
+    const std::size_t cpus = std::max(1u, std::thread::hardware_concurrency());
+    if(threads == 0)
+        threads = cpus;
+    //spinning only makes sense if the thief and the victim can run at the same time
+    spin_ = cpus > 1 ? 64 : 0;
+
+    _AddGroup(std::vector<int>(), threads, false);
+    _Start();
+}
+
+ThreadPool::ThreadPool(const CpuTopology& topology, std::size_t threadsPerNode, bool pinCore):sleepers_(0),
+                                                                                              stop_(false)
+{
+    spin_ = topology.CpuCount() > 1 ? 64 : 0;
+
+    for(const auto& node : topology.Nodes())
+    {
+        for(int cpu : node.cpus_)
+        {
+            if(cpu >= static_cast<int>(cpuGroup_.size()))
+                cpuGroup_.resize(cpu + 1, -1);
+            cpuGroup_[cpu] = static_cast<int>(groups_.size());
+        }
+        _AddGroup(node.cpus_, threadsPerNode ? threadsPerNode : node.cpus_.size(), pinCore);
+    }
+    if(groups_.empty())
+        _AddGroup(std::vector<int>(), std::max(1u, std::thread::hardware_concurrency()), false);
+    _Start();
+}
+
+void ThreadPool::_AddGroup(const std::vector<int>& cpus, std::size_t threads, bool pinCore)
+{
+    groups_.emplace_back(new Group);
+    Group& group = *groups_.back();
+    for(std::size_t i = 0; i < threads; ++i)
+    {
+        Worker* worker = new Worker;
+        worker->group_ = groups_.size() - 1;
+        worker->seed_ = static_cast<uint32_t>(workers_.size() * 2654435761u + 1);
+        if(pinCore && !cpus.empty())
+            worker->cpus_.push_back(cpus[i % cpus.size()]);
+        else
+            worker->cpus_ = cpus;
+
+        group.workers_.push_back(workers_.size());
+        workers_.emplace_back(worker);
+    }
+}
+
+void ThreadPool::_Start()
+{
+    //start after all created, a worker may steal from any other
+    for(std::size_t i = 0; i < workers_.size(); ++i)
+        workers_[i]->thread_ = std::thread(&ThreadPool::_Run, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    stop_.store(true, std::memory_order_seq_cst);
+    //a worker parking later sees stop_ under idleMutex_
+    while(sleepers_.load(std::memory_order_relaxed) > 0)
+        _Wake(0);
+
+    for(auto& worker : workers_)
+        worker->thread_.join();
+    for(auto& group : groups_)
+        assert(group->injected_.load() == 0);
+}
+
+int ThreadPool::WorkerIndex() const
+{
+    return tlsPool == this ? tlsIndex : -1;
+}
+
+int ThreadPool::GroupIndex() const
+{
+    const int index = WorkerIndex();
+    return index >= 0 ? static_cast<int>(workers_[index]->group_) : -1;
+}
+
+std::size_t ThreadPool::_LocalGroup() const
+{
+    if(groups_.size() == 1)
+        return 0;
+
+    const int cpu = CpuTopology::CurrentCpu();
+    if(cpu >= 0 && cpu < static_cast<int>(cpuGroup_.size()) && cpuGroup_[cpu] >= 0)
+        return cpuGroup_[cpu];
+    return 0;
+}
+
+void ThreadPool::_Push(PoolTask* task)
+{
+    std::size_t home;
+    const int index = WorkerIndex();
+    if(index >= 0)
+    {
+        Worker* self = workers_[index].get();
+        self->deque_.Push(task);
+        home = self->group_;
+    }
+    else
+    {
+        home = _LocalGroup();
+        Group& group = *groups_[home];
+        std::lock_guard<std::mutex> guard(group.mutex_);
+        if(group.tail_)
+            group.tail_->next_ = task;
+        else
+            group.head_ = task;
+        group.tail_ = task;
+        group.injected_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    //pairs with _Park: either we see the sleeper, or it sees the task
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(sleepers_.load(std::memory_order_relaxed) > 0)
+        _Wake(home);
+}
+
+void ThreadPool::_Wake(std::size_t group)
+{
+    Worker* worker = nullptr;
+    {
+        std::lock_guard<std::mutex> guard(idleMutex_);
+        if(idle_.empty())
+            return;
+
+        //one of the group if any, the most recently parked: its cache is the warmest
+        auto it = idle_.end() - 1;
+        for(auto i = idle_.rbegin(); i != idle_.rend(); ++i)
+        {
+            if((*i)->group_ == group)
+            {
+                it = i.base() - 1;
+                break;
+            }
+        }
+        worker = *it;
+        idle_.erase(it);
+        sleepers_.store(idle_.size(), std::memory_order_relaxed);
+    }
+    worker->parked_.store(0, std::memory_order_release);
+    internal::FutexWake(&worker->parked_, 1);
+}
+
+void ThreadPool::_PushClass(PoolTask* task, TaskPriority priority, const TimePoint& deadline)
+{
+    const int index = WorkerIndex();
+    const std::size_t home = index >= 0 ? workers_[index]->group_ : _LocalGroup();
+
+    ClassQueue& queue = classes_[static_cast<int>(priority)];
+    {
+        std::lock_guard<std::mutex> guard(queue.mutex_);
+        queue.heap_.push_back(ClassTask{deadline, queue.seq_++, std::chrono::steady_clock::now(), task});
+        std::push_heap(queue.heap_.begin(), queue.heap_.end(), LaterFirst<ClassTask>);
+        queue.size_.store(queue.heap_.size(), std::memory_order_relaxed);
+    }
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(sleepers_.load(std::memory_order_relaxed) > 0)
+        _Wake(home);
+}
+
+PoolTask* ThreadPool::_TakeClass(TaskPriority priority)
+{
+    ClassQueue& queue = classes_[static_cast<int>(priority)];
+    if(queue.size_.load(std::memory_order_relaxed) == 0)
+        return nullptr;
+
+    const TimePoint now = std::chrono::steady_clock::now();
+    PoolTask* task = nullptr;
+    PoolTask* expired = nullptr;
+    int64_t delay = 0;
+    {
+        std::lock_guard<std::mutex> guard(queue.mutex_);
+        while(!queue.heap_.empty())
+        {
+            std::pop_heap(queue.heap_.begin(), queue.heap_.end(), LaterFirst<ClassTask>);
+            const ClassTask top = queue.heap_.back();
+            queue.heap_.pop_back();
+            if(top.deadline_ < now)
+            {
+                top.task_->next_ = expired;
+                expired = top.task_;
+                continue;
+            }
+            task = top.task_;
+            delay = std::chrono::duration_cast<DurationNs>(now - top.submitted_).count();
+            break;
+        }
+        queue.size_.store(queue.heap_.size(), std::memory_order_relaxed);
+    }
+
+    //out of the lock: destroying a Submit() task sets broken_promise on its future
+    while(expired)
+    {
+        PoolTask* next = expired->next_;
+        delete expired;
+        expired = next;
+        queue.dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if(task)
+    {
+        queue.tasks_.fetch_add(1, std::memory_order_relaxed);
+        queue.totalDelay_.fetch_add(delay, std::memory_order_relaxed);
+        int64_t max = queue.maxDelay_.load(std::memory_order_relaxed);
+        while(delay > max && !queue.maxDelay_.compare_exchange_weak(max, delay, std::memory_order_relaxed))
+            ;
+    }
+    return task;
+}
+
+ThreadPool::QueueStats ThreadPool::Stats(TaskPriority priority) const
+{
+    const ClassQueue& queue = classes_[static_cast<int>(priority)];
+    QueueStats stats;
+    stats.tasks_ = queue.tasks_.load(std::memory_order_relaxed);
+    stats.dropped_ = queue.dropped_.load(std::memory_order_relaxed);
+    stats.totalDelay_ = DurationNs(queue.totalDelay_.load(std::memory_order_relaxed));
+    stats.maxDelay_ = DurationNs(queue.maxDelay_.load(std::memory_order_relaxed));
+    return stats;
+}
+
+bool ThreadPool::RunPendingTask()
+{
+    const int index = WorkerIndex();
+    PoolTask* task = index >= 0 ? _Find(workers_[index].get(), workers_[index]->group_) :
+                                  _Find(nullptr, _LocalGroup());
+
+    if(!task)
+        return false;
+
+    task->func_();
+    delete task;
+    return true;
+}
+
+void ThreadPool::_HelpUntilZero(const std::atomic<int>& pending)
+{
+    while(pending.load(std::memory_order_acquire) != 0)
+    {
+        if(!RunPendingTask())
+            std::this_thread::yield();
+    }
+}
+
+PoolTask* ThreadPool::_Find(Worker* self, std::size_t home)
+{
+    //plain tasks count as kNormal with no deadline, so they come after those with one
+    if(PoolTask* task = _TakeClass(TaskPriority::kHigh))
+        return task;
+    if(PoolTask* task = _TakeClass(TaskPriority::kNormal))
+        return task;
+    if(self)
+    {
+        if(PoolTask* task = self->deque_.Pop())
+            return task;
+    }
+    if(PoolTask* task = _Search(self, home))
+        return task;
+    return _TakeClass(TaskPriority::kLow);
+}
+
+PoolTask* ThreadPool::_Search(Worker* self, std::size_t home)
+{
+    //the home group first, then the others: a remote task is still better than idling
+    for(std::size_t i = 0; i < groups_.size(); ++i)
+    {
+        Group& group = *groups_[(home + i) % groups_.size()];
+        if(PoolTask* task = _TakeInjected(group, self))
+            return task;
+        if(PoolTask* task = _Steal(group, self))
+            return task;
+    }
+    return nullptr;
+}
+
+PoolTask* ThreadPool::_TakeInjected(Group& group, Worker* self)
+{
+    if(group.injected_.load(std::memory_order_relaxed) == 0)
+        return nullptr;
+
+    PoolTask* first = nullptr;
+    {
+        std::lock_guard<std::mutex> guard(group.mutex_);
+        const std::size_t total = group.injected_.load(std::memory_order_relaxed);
+        if(total == 0)
+            return nullptr;
+
+        //a fair share, the others take the rest or steal it from us
+        std::size_t take = 1;
+        if(self)
+            take = std::min({kInjectBatch, total, total / group.workers_.size() + 1});
+
+        first = group.head_;
+        PoolTask* last = first;
+        for(std::size_t i = 1; i < take; ++i)
+            last = last->next_;
+        group.head_ = last->next_;
+        if(!group.head_)
+            group.tail_ = nullptr;
+        last->next_ = nullptr;
+        group.injected_.store(total - take, std::memory_order_relaxed);
+    }
+
+    if(self)
+    {
+        //the rest to the local deque, idle workers steal them from there
+        for(PoolTask* task = first->next_; task; )
+        {
+            PoolTask* next = task->next_;
+            task->next_ = nullptr;
+            self->deque_.Push(task);
+            task = next;
+        }
+    }
+    first->next_ = nullptr;
+    return first;
+}
+
+PoolTask* ThreadPool::_Steal(Group& group, Worker* self)
+{
+    const std::size_t n = group.workers_.size();
+    std::size_t start = 0;
+    if(self)
+    {
+        //xorshift, a random victim avoids all thieves rushing at one
+        uint32_t x = self->seed_;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        self->seed_ = x;
+        start = x % n;
+    }
+
+    for(std::size_t i = 0; i < n; ++i)
+    {
+        Worker* victim = workers_[group.workers_[(start + i) % n]].get();
+        if(victim == self)
+            continue;
+        if(PoolTask* task = victim->deque_.Steal())
+            return task;
+    }
+    return nullptr;
+}
+
+bool ThreadPool::_HasWork() const
+{
+    for(const auto& queue : classes_)
+    {
+        if(queue.size_.load(std::memory_order_relaxed) > 0)
+            return true;
+    }
+    for(const auto& group : groups_)
+    {
+        if(group->injected_.load(std::memory_order_relaxed) > 0)
+            return true;
+    }
+    for(const auto& worker : workers_)
+    {
+        if(!worker->deque_.Empty())
+            return true;
+    }
+    return false;
+}
+
+void ThreadPool::_Park(Worker* self)
+{
+    self->parked_.store(1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> guard(idleMutex_);
+        idle_.push_back(self);
+        sleepers_.store(idle_.size(), std::memory_order_relaxed);
+    }
+
+    //look again after announcing, a task pushed before is seen here
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(_HasWork() || stop_.load(std::memory_order_relaxed))
+    {
+        std::lock_guard<std::mutex> guard(idleMutex_);
+        auto it = std::find(idle_.begin(), idle_.end(), self);
+        if(it != idle_.end())
+        {
+            idle_.erase(it);
+            sleepers_.store(idle_.size(), std::memory_order_relaxed);
+            self->parked_.store(0, std::memory_order_relaxed);
+        }
+        //else a waker took us off the list, it clears parked_ soon
+    }
+
+    while(self->parked_.load(std::memory_order_acquire) == 1)
+        internal::FutexWait(&self->parked_, 1);
+}
+
+void ThreadPool::_Run(std::size_t index)
+{
+    tlsPool = this;
+    tlsIndex = static_cast<int>(index);
+    Worker* self = workers_[index].get();
+    //a cpuset may forbid it, then the worker just floats
+    if(!self->cpus_.empty())
+        CpuTopology::PinCurrentThread(self->cpus_);
+
+    int idle = 0;
+    while(true)
+    {
+        if(PoolTask* task = _Find(self, self->group_))
+        {
+            task->func_();
+            delete task;
+            idle = 0;
+            continue;
+        }
+
+        //exit only when all queued tasks have run
+        if(stop_.load(std::memory_order_acquire) && !_HasWork())
+            break;
+
+        if(idle++ < spin_)
+        {
+            internal::CpuRelax();
+            continue;
+        }
+        _Park(self);
+        idle = 0;
+    }
+
+    tlsPool = nullptr;
+    tlsIndex = -1;
+}
+
+}   // end namespace mrpc
@@ -1,28 +1,493 @@
 #ifndef THREADPOOL_H_
 #define THREADPOOL_H_
 
+// A powerful threadpool implementation with future feature
+//
+// Work stealing: each worker owns a Chase-Lev deque, it pushes and pops tasks at the
+// bottom (LIFO, hot in cache), idle workers steal from the top of the others (FIFO).
+// Tasks submitted from a worker go to its own deque; from other threads to an
+// injection queue, from which workers take batches. Workers with nothing to do
+// park on a futex each; Submit wakes one of them if any, and takes it off the idle
+// list, so the next Submit does not wake it again before it runs.
+//
+// NUMA: the workers may be split into groups, one per node, pinned to the cpus of the
+// node. Each group has its own injection queue; a task from outside goes to the group
+// of the node the caller runs on, and workers look in their own group before the others,
+// so a task mostly runs next to the memory it was given.
+//
+// Priority: tasks submitted with a class or a deadline go to a queue per class instead,
+// earliest deadline first within it. Workers serve kHigh, then kNormal, then the plain
+// tasks, and kLow only when there is nothing else. A task found past its deadline is
+// dropped without running.
+
 #include <future>
 #include <thread>
 #include <mutex>
-#include <condition_variable>
 #include <atomic>
+#include <memory>
+#include <vector>
+#include <functional>
+#include <type_traits>
+#include <algorithm>
+#include <stdint.h>
+#include "InlineFunction.h"
+#include "CpuTopology.h"
+#include "Timer.h"
 
 namespace mrpc
 {
 
-class ThreadPool final
+namespace internal
+{
+
+struct PoolTask
+{
+    InlineFunction<void (), 64> func_;
+    PoolTask* next_ = nullptr;      // in the injection queue
+};
+
+// Chase-Lev deque (Le, Pop, Cohen, Zappa Nardelli, PPoPP'13)
+// Push/Pop by the owner only, Steal by any thread. The array grows, old arrays
+// are kept till the deque dies since a thief may still read them.
+class WorkDeque final
+{
+public:
+    WorkDeque();
+    ~WorkDeque();
+
+    WorkDeque(const WorkDeque& ) = delete;
+    void operator= (const WorkDeque& ) = delete;
+
+    void Push(PoolTask* task);
+    PoolTask* Pop();
+    PoolTask* Steal();
+
+    bool Empty() const
+    {
+        return top_.load(std::memory_order_relaxed) >= bottom_.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Array
+    {
+        explicit Array(int64_t capacity) : mask_(capacity - 1),
+                                           slots_(new std::atomic<PoolTask*>[capacity])
+        {}
+
+        PoolTask* Get(int64_t i) const
+        {
+            return slots_[i & mask_].load(std::memory_order_relaxed);
+        }
+        void Put(int64_t i, PoolTask* task)
+        {
+            slots_[i & mask_].store(task, std::memory_order_relaxed);
+        }
+        int64_t Capacity() const
+        {
+            return mask_ + 1;
+        }
+
+        const int64_t mask_;
+        std::unique_ptr<std::atomic<PoolTask*>[]> slots_;
+    };
+
+    Array* _Grow(Array* array, int64_t bottom, int64_t top);
+
+    alignas(64) std::atomic<int64_t> top_;
+    alignas(64) std::atomic<int64_t> bottom_;
+    std::atomic<Array*> array_;
+    std::vector<std::unique_ptr<Array>> arrays_;    // the current one and the retired
+};
+
+}   // end namespace internal
+
+enum class TaskPriority
 {
+    kHigh,      // health checks, latency critical calls
+    kNormal,    // the class of plain Submit()
+    kLow,       // batch work, run when nothing else is queued
+};
 
+class ThreadPool final
+{
 public:
-    ThreadPool();
+    static constexpr std::size_t kPriorities = 3;
+
+    // queue delay of a class, for the tasks submitted with a class or a deadline
+    struct QueueStats
+    {
+        uint64_t tasks_;            // run
+        uint64_t dropped_;          // found past the deadline, not run
+        DurationNs totalDelay_;     // from Submit to the start, of the run ones
+        DurationNs maxDelay_;
+    };
+
+    //0: as many as hardware threads; one group, not pinned
+    explicit ThreadPool(std::size_t threads = 0);
+    //a group per node of the topology, pinned to the cpus of its node
+    //threadsPerNode 0: one per cpu of the node; pinCore: each worker to one cpu of them
+    explicit ThreadPool(const CpuTopology& topology, std::size_t threadsPerNode = 0, bool pinCore = true);
+    //run the tasks queued, then join the workers
     ~ThreadPool();
+
     ThreadPool(const ThreadPool& ) = delete;
     void operator= (const ThreadPool& ) = delete;
-    
+
+    template <typename F, typename... Args>
+    using ResultOf = typename std::invoke_result<typename std::decay<F>::type, typename std::decay<Args>::type&...>::type;
+
+    //run f(args...) on the pool, args are copied like std::bind
+    template <typename F, typename... Args>
+    auto Submit(F&& f, Args&&... args) -> std::future<ResultOf<F, Args...>>;
+
+    //by priority class; earliest deadline first within the class
+    //a task still queued at its deadline is dropped: its future gets std::future_error
+    //(broken_promise). No deadline: TimePoint::max(); no class: kNormal
+    template <typename F, typename... Args>
+    auto Submit(TaskPriority priority, F&& f, Args&&... args) -> std::future<ResultOf<F, Args...>>;
+    template <typename F, typename... Args>
+    auto Submit(const TimePoint& deadline, F&& f, Args&&... args) -> std::future<ResultOf<F, Args...>>;
+    template <typename F, typename... Args>
+    auto Submit(TaskPriority priority, const TimePoint& deadline, F&& f, Args&&... args) -> std::future<ResultOf<F, Args...>>;
+
+    //fire and forget, cheaper than Submit: no future
+    template <typename F>
+    void Post(F&& f);
+    template <typename F>
+    void Post(TaskPriority priority, const TimePoint& deadline, F&& f);
+
+    QueueStats Stats(TaskPriority priority) const;
+
+    //co_await pool.Schedule(): the coroutine goes on on a worker (Coroutine.h)
+    struct ScheduleAwaiter
+    {
+        ThreadPool* pool_;
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+        template <typename Handle>
+        void await_suspend(Handle handle)
+        {
+            pool_->Post([handle]() mutable { handle.resume(); });
+        }
+        void await_resume() const noexcept
+        {}
+    };
+    ScheduleAwaiter Schedule()
+    {
+        return ScheduleAwaiter{this};
+    }
+
+    //run one queued task on the calling thread, e.g. while waiting for a future;
+    //false if none found
+    bool RunPendingTask();
+
+    //wait for the future, running tasks meanwhile; safe to call from a worker
+    template <typename T>
+    T Wait(std::future<T>& future);
+
+    //f(i) for i in [begin, end), on the pool and the calling thread, return when all done
+    //chunks are guided: a participant takes max(grain, remaining / 2P) indexes at once,
+    //big chunks first and small ones at the end to even out the finish.
+    //An exception on the calling thread stops handing out chunks and is rethrown once the
+    //workers are out of f; one on a worker terminates, like from any task.
+    //The same holds for ParallelReduce and ParallelInvoke
+    template <typename Index, typename F>
+    void ParallelFor(Index begin, Index end, Index grain, F&& f);
+
+    //reduce(..., map(i)) for i in [begin, end), starting from identity
+    //reduce must be associative and commutative: partials are combined in any order
+    template <typename Index, typename T, typename Map, typename Reduce>
+    T ParallelReduce(Index begin, Index end, Index grain, T identity, Map&& map, Reduce&& reduce);
+
+    //run all the functions, the first one on the calling thread
+    template <typename F, typename... Fs>
+    void ParallelInvoke(F&& f, Fs&&... fs);
+
+    std::size_t Size() const
+    {
+        return workers_.size();
+    }
+
+    std::size_t Groups() const
+    {
+        return groups_.size();
+    }
+
+    //the index of the calling worker of this pool, -1 if not a worker
+    int WorkerIndex() const;
+    //the group of the calling worker, -1 if not a worker
+    int GroupIndex() const;
+
+private:
+    struct Worker
+    {
+        internal::WorkDeque deque_;
+        std::thread thread_;
+        uint32_t seed_;                     // for the victim to steal from
+        std::atomic<uint32_t> parked_{0};   // futex word, 1 while on the idle list
+        std::size_t group_;
+        std::vector<int> cpus_;             // pinned to, empty: not pinned
+    };
+
+    // workers of a node and their injection queue, FIFO
+    struct Group
+    {
+        std::vector<std::size_t> workers_;
+        std::mutex mutex_;
+        internal::PoolTask* head_ = nullptr;
+        internal::PoolTask* tail_ = nullptr;
+        alignas(64) std::atomic<std::size_t> injected_{0};
+    };
+
+    struct ClassTask
+    {
+        TimePoint deadline_;
+        uint64_t seq_;              // FIFO among equal deadlines
+        TimePoint submitted_;
+        internal::PoolTask* task_;
+    };
+
+    // tasks of a priority class, a heap by deadline
+    struct ClassQueue
+    {
+        std::mutex mutex_;
+        std::vector<ClassTask> heap_;
+        uint64_t seq_ = 0;
+        alignas(64) std::atomic<std::size_t> size_{0};
+
+        std::atomic<uint64_t> tasks_{0};
+        std::atomic<uint64_t> dropped_{0};
+        std::atomic<int64_t> totalDelay_{0};    // ns
+        std::atomic<int64_t> maxDelay_{0};
+    };
+
+    template <typename F>
+    static internal::PoolTask* _MakeTask(F&& f);
+
+    //the guided loop of ParallelFor/ParallelReduce, body(lo, hi, participant)
+    template <typename Index, typename Body>
+    void _ForEachChunk(Index begin, Index end, Index grain, Body&& body);
+    //run tasks till the count drops to 0
+    void _HelpUntilZero(const std::atomic<int>& pending);
+
+    void _AddGroup(const std::vector<int>& cpus, std::size_t threads, bool pinCore);
+    void _Start();
+    std::size_t _LocalGroup() const;
+
+    void _Push(internal::PoolTask* task);
+    void _PushClass(internal::PoolTask* task, TaskPriority priority, const TimePoint& deadline);
+    internal::PoolTask* _TakeClass(TaskPriority priority);
+    void _Run(std::size_t index);
+    internal::PoolTask* _Find(Worker* self, std::size_t home);
+    internal::PoolTask* _Search(Worker* self, std::size_t home);
+    internal::PoolTask* _TakeInjected(Group& group, Worker* self);
+    internal::PoolTask* _Steal(Group& group, Worker* self);
+    bool _HasWork() const;
+    void _Park(Worker* self);
+    void _Wake(std::size_t group);
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::unique_ptr<Group>> groups_;
+    std::vector<int> cpuGroup_;                     // the group of a cpu, -1 if none
+
+    ClassQueue classes_[kPriorities];
+
+    // parked workers
+    std::mutex idleMutex_;
+    std::vector<Worker*> idle_;
+    alignas(64) std::atomic<std::size_t> sleepers_;    // idle_.size(), read without lock
+
+    std::atomic<bool> stop_;
+    int spin_;                                      // steal rounds before parking
+};
+
+template <typename F>
+void ThreadPool::Post(F&& f)
+{
+    _Push(_MakeTask(std::forward<F>(f)));
 }
+
+template <typename F>
+void ThreadPool::Post(TaskPriority priority, const TimePoint& deadline, F&& f)
+{
+    _PushClass(_MakeTask(std::forward<F>(f)), priority, deadline);
 }
 
+template <typename F>
+internal::PoolTask* ThreadPool::_MakeTask(F&& f)
+{
+    using Fn = typename std::decay<F>::type;
 
-// A powerful threadpool implementation with future feature
+    internal::PoolTask* task = new internal::PoolTask;
+    if constexpr (sizeof(Fn) <= decltype(task->func_)::kCapacity && alignof(Fn) <= alignof(std::max_align_t) &&
+                  std::is_nothrow_move_constructible<Fn>::value)
+    {
+        task->func_ = std::forward<F>(f);
+    }
+    else
+    {
+        //too large to store inline
+        task->func_ = [fn = std::make_unique<Fn>(std::forward<F>(f))]() { (*fn)(); };
+    }
+    return task;
+}
+
+template <typename F, typename... Args>
+auto ThreadPool::Submit(F&& f, Args&&... args) -> std::future<ResultOf<F, Args...>>
+{
+    using R = ResultOf<F, Args...>;
+
+    std::packaged_task<R ()> task(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+    std::future<R> future = task.get_future();
+    Post([task = std::move(task)]() mutable { task(); });
+    return future;
+}
+
+template <typename F, typename... Args>
+auto ThreadPool::Submit(TaskPriority priority, F&& f, Args&&... args) -> std::future<ResultOf<F, Args...>>
+{
+    return Submit(priority, TimePoint::max(), std::forward<F>(f), std::forward<Args>(args)...);
+}
+
+template <typename F, typename... Args>
+auto ThreadPool::Submit(const TimePoint& deadline, F&& f, Args&&... args) -> std::future<ResultOf<F, Args...>>
+{
+    return Submit(TaskPriority::kNormal, deadline, std::forward<F>(f), std::forward<Args>(args)...);
+}
+
+template <typename F, typename... Args>
+auto ThreadPool::Submit(TaskPriority priority, const TimePoint& deadline, F&& f, Args&&... args) -> std::future<ResultOf<F, Args...>>
+{
+    using R = ResultOf<F, Args...>;
+
+    std::packaged_task<R ()> task(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+    std::future<R> future = task.get_future();
+    Post(priority, deadline, [task = std::move(task)]() mutable { task(); });
+    return future;
+}
+
+template <typename T>
+T ThreadPool::Wait(std::future<T>& future)
+{
+    while(future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+    {
+        if(!RunPendingTask())
+            std::this_thread::yield();
+    }
+    return future.get();
+}
+
+template <typename Index, typename Body>
+void ThreadPool::_ForEachChunk(Index begin, Index end, Index grain, Body&& body)
+{
+    if(!(begin < end))
+        return;
+
+    const Index count = end - begin;
+    if(grain < Index(1))
+        grain = Index(1);
+    const std::size_t chunks = static_cast<std::size_t>((count + grain - 1) / grain);
+    const int participants = static_cast<int>(std::min(workers_.size() + 1, chunks));
+    if(participants == 1)
+    {
+        body(begin, end, 0);
+        return;
+    }
+
+    std::atomic<Index> next(begin);
+    auto drain = [&next, end, grain, participants, &body](int id) {
+        Index lo = next.load(std::memory_order_relaxed);
+        while(lo < end)
+        {
+            const Index guided = (end - lo) / Index(2 * participants);
+            const Index hi = end - lo > std::max(grain, guided) ? lo + std::max(grain, guided) : end;
+            if(next.compare_exchange_weak(lo, hi, std::memory_order_relaxed))
+            {
+                body(lo, hi, id);
+                lo = next.load(std::memory_order_relaxed);
+            }
+        }
+    };
+
+    //helpers which find the range done return at once; the stack frame lives till all returned
+    std::atomic<int> pending(participants - 1);
+    for(int id = 1; id < participants; ++id)
+    {
+        Post([&drain, &pending, id]() {
+            drain(id);
+            pending.fetch_sub(1, std::memory_order_release);
+        });
+    }
+    try
+    {
+        drain(0);
+    }
+    catch(...)
+    {
+        //the helpers still use this frame: no more chunks, wait for them, then unwind
+        next.store(end, std::memory_order_relaxed);
+        _HelpUntilZero(pending);
+        throw;
+    }
+    _HelpUntilZero(pending);
+}
+
+template <typename Index, typename F>
+void ThreadPool::ParallelFor(Index begin, Index end, Index grain, F&& f)
+{
+    _ForEachChunk(begin, end, grain, [&f](Index lo, Index hi, int ) {
+        for(Index i = lo; i < hi; ++i)
+            f(i);
+    });
+}
+
+template <typename Index, typename T, typename Map, typename Reduce>
+T ThreadPool::ParallelReduce(Index begin, Index end, Index grain, T identity, Map&& map, Reduce&& reduce)
+{
+    //one partial per participant, padded against false sharing
+    struct alignas(64) Partial
+    {
+        T value_;
+    };
+    std::vector<Partial> partials(workers_.size() + 1, Partial{identity});
+
+    _ForEachChunk(begin, end, grain, [&](Index lo, Index hi, int id) {
+        T value = std::move(partials[id].value_);
+        for(Index i = lo; i < hi; ++i)
+            value = reduce(std::move(value), map(i));
+        partials[id].value_ = std::move(value);
+    });
+
+    T result = std::move(identity);
+    for(auto& partial : partials)
+        result = reduce(std::move(result), std::move(partial.value_));
+    return result;
+}
+
+template <typename F, typename... Fs>
+void ThreadPool::ParallelInvoke(F&& f, Fs&&... fs)
+{
+    std::atomic<int> pending(static_cast<int>(sizeof...(Fs)));
+    //the others by reference, they are done before we return
+    (Post([&fs, &pending]() {
+        fs();
+        pending.fetch_sub(1, std::memory_order_release);
+    }), ...);
+    try
+    {
+        f();
+    }
+    catch(...)
+    {
+        _HelpUntilZero(pending);
+        throw;
+    }
+    _HelpUntilZero(pending);
+}
+
+}   // end namespace mrpc
 
 #endif
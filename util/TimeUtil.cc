@@ -1,17 +1,97 @@
 #include <cstring>  
 #include "TimeUtil.h"
+#include "LoopClock.h"
 
 namespace mrpc
 {
 
+namespace
+{
+
+//offsets change on quarter-hour boundaries only, one looked up holds for the rest of its quarter
+const int64_t kOffsetPeriod = 15 * 60;
+
+struct OffsetCache
+{
+    int64_t begin_ = 1;     // empty
+    int64_t end_ = 0;
+    long offset_ = 0;
+};
+
+thread_local OffsetCache offsetCache;
+
+//seconds east of UTC at the given UTC seconds
+long UtcOffset(int64_t seconds)
+{
+    OffsetCache& cache = offsetCache;
+    if(seconds < cache.begin_ || seconds >= cache.end_)
+    {
+        const time_t now(seconds);
+        tm local;
+        ::localtime_r(&now, &local);
+        cache.offset_ = local.tm_gmtoff;
+        cache.begin_ = seconds - ((seconds % kOffsetPeriod) + kOffsetPeriod) % kOffsetPeriod;
+        cache.end_ = cache.begin_ + kOffsetPeriod;
+    }
+    return cache.offset_;
+}
+
+//v: 0~99; the compiler merges the two into one 16-bit store
+inline void StorePair(char* buf, unsigned v)
+{
+    buf[0] = static_cast<char>('0' + v / 10);
+    buf[1] = static_cast<char>('0' + v % 10);
+}
+
+//the seconds and microseconds, floored
+inline void Split(int64_t micros, int64_t* seconds, unsigned* usec)
+{
+    *seconds = micros / 1000000;
+    int64_t rest = micros % 1000000;
+    if(rest < 0)
+    {
+        --*seconds;
+        rest += 1000000;
+    }
+    *usec = static_cast<unsigned>(rest);
+}
+
+//YYYY-MM-DD?HH:MM:SS.uuuuuu
+void FormatLocal(const tm& t, unsigned usec, char sep, char* buf)
+{
+    const unsigned year = static_cast<unsigned>(t.tm_year + 1900) % 10000;
+    StorePair(buf, year / 100);
+    StorePair(buf + 2, year % 100);
+    buf[4] = '-';
+    StorePair(buf + 5, t.tm_mon + 1);
+    buf[7] = '-';
+    StorePair(buf + 8, t.tm_mday);
+    buf[10] = sep;
+    StorePair(buf + 11, t.tm_hour);
+    buf[13] = ':';
+    StorePair(buf + 14, t.tm_min);
+    buf[16] = ':';
+    StorePair(buf + 17, t.tm_sec);
+    buf[19] = '.';
+    StorePair(buf + 20, usec / 10000);
+    StorePair(buf + 22, usec / 100 % 100);
+    StorePair(buf + 24, usec % 100);
+}
+
+}   // end anonymous namespace
+
 Time::Time():valid_(false)
 {
     this->Now();
 }
 
+Time::Time(std::chrono::system_clock::time_point when):now_(when),
+                                                       valid_(false)
+{}
+
 void Time::Now()
 {
-    now_ = std::chrono::system_clock::now();
+    now_ = LoopClock::SystemNow();      // cached on a loop thread
     valid_ = false; 
 }
 
@@ -30,59 +110,100 @@ void Time::_UpdateTm() const
     if(valid_)
         return;
     valid_ = true;
-    const time_t now(Millseconds() / 1000UL);
-    ::localtime_r(&now, &tm_);
-}
-
-std::once_flag Time::init_;
-
-const char* YEAR[] = 
-{
-    "2015", "2016", "2017", "2018", "2019",
-    "2020", "2021", "2022", "2023", "2024",
-    "2025", "2026", "2027", "2028", "2029",
-    "2030", "2031", "2032", "2033", "2034",
-    "2035", "2036", "2037", "2038", "2039",
-    "2040", "2041", "2042", "2043", "2044",
-    "2045", "2046", "2047", "2048", "2049",
-    nullptr,
-};
 
-char Time::NUMBER[60][2] = {""};
+    int64_t seconds;
+    unsigned usec;
+    Split(Microseconds(), &seconds, &usec);
+    const long offset = UtcOffset(seconds);
+    seconds += offset;
 
-void Time::Init()
-{
-    for (size_t i = 0; i < sizeof NUMBER / sizeof NUMBER[0]; ++i) 
+    int64_t days = seconds / 86400;
+    int64_t rest = seconds % 86400;
+    if(rest < 0)
     {
-        char tmp[3];
-        snprintf(tmp, 3, "%02d", static_cast<int>(i));
-        memcpy(NUMBER[i], tmp, 2);
+        --days;
+        rest += 86400;
     }
+    int64_t year;
+    unsigned month, day;
+    CivilFromDays(days, &year, &month, &day);
+
+    memset(&tm_, 0, sizeof tm_);
+    tm_.tm_year = static_cast<int>(year - 1900);
+    tm_.tm_mon = static_cast<int>(month - 1);
+    tm_.tm_mday = static_cast<int>(day);
+    tm_.tm_hour = static_cast<int>(rest / 3600);
+    tm_.tm_min = static_cast<int>(rest / 60 % 60);
+    tm_.tm_sec = static_cast<int>(rest % 60);
+    tm_.tm_gmtoff = offset;
 }
 
 std::size_t Time::FormatTime(char* buf) const
 {
-    std::call_once(init_, &Time::Init);     //ensure that Init will be called just once
+    _UpdateTm();
+
+    int64_t seconds;
+    unsigned usec;
+    Split(Microseconds(), &seconds, &usec);
+    FormatLocal(tm_, usec, '[', buf);
+    buf[26] = ']';
+
+    return kFormatTimeLen;
+}
 
+std::size_t Time::FormatIso8601(char* buf) const
+{
     _UpdateTm();
 
-    memcpy(buf, YEAR[tm_.tm_year + 1900 - 2020], 4);
-    buf[4] = '-';
-    memcpy(buf + 5, NUMBER[tm_.tm_mon + 1], 2);
-    buf[7] = '-';
-    memcpy(buf + 8, NUMBER[tm_.tm_mday], 2);
-    buf[10] = '[';
-    memcpy(buf + 11, NUMBER[tm_.tm_hour], 2);
-    buf[13] = ':';
-    memcpy(buf + 14, NUMBER[tm_.tm_min], 2);
-    buf[16] = ':';
-    memcpy(buf + 17, NUMBER[tm_.tm_sec], 2);
-    buf[19] = '.';
-    auto Msec = Microseconds();
-    snprintf(buf + 20, 8, "%06d]", static_cast<int>(Msec % 1000000));
+    int64_t seconds;
+    unsigned usec;
+    Split(Microseconds(), &seconds, &usec);
+    FormatLocal(tm_, usec, 'T', buf);
+
+    long offset = tm_.tm_gmtoff;
+    buf[26] = offset < 0 ? '-' : '+';
+    if(offset < 0)
+        offset = -offset;
+    StorePair(buf + 27, static_cast<unsigned>(offset / 3600 % 100));
+    buf[29] = ':';
+    StorePair(buf + 30, static_cast<unsigned>(offset / 60 % 60));
+
+    return kIso8601Len;
+}
+
+std::size_t Time::FormatEpochMicros(char* buf) const
+{
+    const int64_t micros = Microseconds();
+    uint64_t v = micros < 0 ? 0 - static_cast<uint64_t>(micros) : static_cast<uint64_t>(micros);
+
+    //backwards into a scratch, two digits at a time
+    char tmp[kMaxEpochMicrosLen];
+    char* p = tmp + sizeof tmp;
+    while(v >= 10)
+    {
+        p -= 2;
+        StorePair(p, static_cast<unsigned>(v % 100));
+        v /= 100;
+    }
+    if(v > 0 || p == tmp + sizeof tmp)
+        *--p = static_cast<char>('0' + v);
+    if(micros < 0)
+        *--p = '-';
 
-    return 27;
+    const std::size_t len = tmp + sizeof tmp - p;
+    memcpy(buf, p, len);
+    return len;
+}
+
+void Time::FormatMicros(char* buf) const
+{
+    int64_t seconds;
+    unsigned usec;
+    Split(Microseconds(), &seconds, &usec);
+    StorePair(buf, usec / 10000);
+    StorePair(buf + 2, usec / 100 % 100);
+    StorePair(buf + 4, usec % 100);
 }
 
 }
-//end namespace mrpc
\ No newline at end of file
+//end namespace mrpc
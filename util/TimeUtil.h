@@ -1,39 +1,71 @@
 #ifndef TIMEUTIL_H_
 #define TIMEUTIL_H_
 
-
-//call_once(init_, &Time::Init);  init_(std::once_flag) ensures that Init will be called just once
-//if the flag init_ is true, it means Init was called already, then call_once returns right away
-//otherwise Init will be called right away.
+//formatting is table free: the date by CivilFromDays, the local time by a UTC offset
+//cached per thread, the digits stored two at a time
 
 #include <ctime>   
 #include <chrono>   
 #include <stdint.h>   //for int types
-#include <mutex>   
 
 namespace mrpc
 {
 
+//days since 1970-01-01 of a proleptic gregorian date, no table and no localtime_r
+//m: 1~12, d: 1~31
+inline int64_t DaysFromCivil(int64_t y, unsigned m, unsigned d)
+{
+    y -= m <= 2;
+    const int64_t era = (y >= 0 ? y : y - 399) / 400;
+    const unsigned yoe = static_cast<unsigned>(y - era * 400);
+    const unsigned doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    const unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + static_cast<int64_t>(doe) - 719468;
+}
+
+//the inverse of DaysFromCivil
+inline void CivilFromDays(int64_t days, int64_t* y, unsigned* m, unsigned* d)
+{
+    days += 719468;
+    const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    const unsigned doe = static_cast<unsigned>(days - era * 146097);
+    const unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const unsigned mp = (5 * doy + 2) / 153;
+    *d = doy - (153 * mp + 2) / 5 + 1;
+    *m = mp < 10 ? mp + 3 : mp - 9;
+    *y = static_cast<int64_t>(yoe) + era * 400 + (*m <= 2);
+}
+
 //a brief encapsulation for time point
 class Time
 {
 private:   
     std::chrono::system_clock::time_point now_;
     mutable bool valid_;
-    mutable tm tm_;
+    mutable tm tm_;         // local time, tm_gmtoff included; no tm_wday and tm_yday
 
     void _UpdateTm() const;
-    //for format time
-    static std::once_flag init_;
-    static void Init();
-    static const char* YEAR[];
-    static char NUMBER[60][2];
 public:   
+    //"2026-10-19[08:30:00.123456]", local time
+    static constexpr std::size_t kFormatTimeLen = 27;
+    //"2026-10-19T08:30:00.123456+02:00", local time
+    static constexpr std::size_t kIso8601Len = 32;
+    //"1792391400123456", a sign and 19 digits at most
+    static constexpr std::size_t kMaxEpochMicrosLen = 20;
+
     Time();
+    explicit Time(std::chrono::system_clock::time_point when);
     void Now();
     int64_t Millseconds() const;
     int64_t Microseconds() const;
-    std::size_t FormatTime(char* buf)const;
+
+    //they write no '\0', return the length
+    std::size_t FormatTime(char* buf) const;
+    std::size_t FormatIso8601(char* buf) const;
+    std::size_t FormatEpochMicros(char* buf) const;
+    //the 6 digits of microseconds in the second
+    void FormatMicros(char* buf) const;
 
     int GetYear() const
     {
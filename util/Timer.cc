@@ -1,7 +1,10 @@
 // to be tested
 
+#include <cstdio>
 #include <vector>
 #include <cassert>
+#include <unistd.h>
+#include <sys/timerfd.h>
 #include "Timer.h"
 
 namespace mrpc
@@ -9,100 +12,432 @@ namespace mrpc
 namespace internal
 {
 
-unsigned int TimerManager::s_timer_id_gen_ = 0;
+thread_local TimerManager* TimerManager::current_ = nullptr;
 
-TimerManager::TimerManager()
+TimerManager::TimerManager():base_(std::chrono::steady_clock::now()),
+                              firing_(nullptr),
+                              freeList_(kNoSlot),
+                              size_(0),
+                              remoteGen_(0),
+                              earliest_(INT64_MAX),
+                              timerfd_(-1),
+                              armed_(-1)
 {}
 
 TimerManager::~TimerManager()
-{}
+{
+    while(MpscNode* node = remote_.Pop())
+        delete static_cast<RemoteRequest*>(node);
+    if(timerfd_ >= 0)
+        ::close(timerfd_);
+    if(current_ == this)
+        current_ = nullptr;
+}
+
+void TimerManager::Attach()
+{
+    assert(!current_ || current_ == this);
+    current_ = this;
+}
+
+void TimerManager::Detach()
+{
+    if(current_ == this)
+        current_ = nullptr;
+}
+
+TimerManager::Timer* TimerManager::_Alloc()
+{
+    if(freeList_ == kNoSlot)
+    {
+        const uint32_t first = static_cast<uint32_t>(chunks_.size()) << kChunkBits;
+        chunks_.emplace_back(new Timer[kChunkSize]);
+        for(uint32_t i = kChunkSize; i-- > 0; )
+        {
+            Timer& timer = _Slot(first + i);
+            timer.index_ = first + i;
+            timer.nextFree_ = freeList_;
+            freeList_ = first + i;
+        }
+    }
+
+    Timer* timer = &_Slot(freeList_);
+    freeList_ = timer->nextFree_;
+    timer->nextFree_ = kNoSlot;
+    ++size_;
+    return timer;
+}
+
+void TimerManager::_Free(Timer* timer)
+{
+    assert(!timer->IsLinked());
+
+    timer->func_ = nullptr;     //release the captures now
+    timer->count_ = 0;
+    if(timer->remote_)
+    {
+        remoteIds_.erase(timer->remote_);
+        timer->remote_ = 0;
+    }
+    if(++timer->generation_ == 0)
+        timer->generation_ = 1;
+    timer->nextFree_ = freeList_;
+    freeList_ = timer->index_;
+    --size_;
+}
+
+uint64_t TimerManager::_TickOf(const TimePoint& tp) const
+{
+    if(tp <= base_)
+        return 0;
+
+    const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(tp - base_).count();
+    return (static_cast<uint64_t>(ns) + 999999) / 1000000;
+}
+
+uint64_t TimerManager::_FloorTick(const TimePoint& tp) const
+{
+    if(tp <= base_)
+        return 0;
+
+    return std::chrono::duration_cast<DurationMs>(tp - base_).count();
+}
+
+void TimerManager::_Add(Timer* timer)
+{
+    if(timer->IsPrecise())
+    {
+        //near: to the heap; far: to the wheel, moved to the heap in the tick of the deadline
+        const uint64_t tick = _FloorTick(timer->deadline_);
+        if(tick <= wheel_.Now() + 1)
+        {
+            _HeapPush(timer);
+        }
+        else
+        {
+            timer->expire_ = tick;
+            wheel_.Add(timer);
+        }
+        return;
+    }
+
+    //the coarsest tick in [deadline, deadline + slack], so timers with slack line up:
+    //keep the bits of hi above the highest one where lo - 1 and hi differ
+    const uint64_t lo = _TickOf(timer->deadline_);
+    const uint64_t hi = _FloorTick(timer->HardDeadline());
+    uint64_t tick = lo;
+    if(lo > 0 && hi > lo)
+    {
+        const uint64_t diff = (lo - 1) ^ hi;
+        const uint64_t grain = uint64_t(1) << (63 - __builtin_clzll(diff));
+        tick = hi & ~(grain - 1);
+    }
+    timer->expire_ = tick;
+    wheel_.Add(timer);
+}
+
+void TimerManager::_Fire(Timer* timer)
+{
+    //support cancel self
+    firing_ = timer;
+    timer->OnTimer();
+    firing_ = nullptr;
+
+    if(timer->count_ != 0)
+        _Add(timer);    //need reschedule
+    else
+        _Free(timer);
+}
 
 void TimerManager::Update()
 {
-    if(timers_.empty())
+    _ApplyRemote();
+    if(timerfd_ >= 0 && armed_ >= 0)
+    {
+        uint64_t expirations;
+        if(::read(timerfd_, &expirations, sizeof expirations) == sizeof expirations)
+            armed_ = -1;
+    }
+    if(size_ == 0)
         return;
     
-    const auto now = std::chrono::steady_clock::now();
-    
-    for(auto it(timers_.begin()); it != timers_.end(); )
-    {
-        if(it->first > now)
-            return;
-        
-        //support cancel self
-        it->second.OnTimer();
-
-        //erase and replace the timer
-        Timer timer(std::move(it->second));
-        it = timers_.erase(it);
-        if(timer.count_ != 0)
-        {
-            //need reschedule
-            const auto tp = timer.id_->first;
-            auto itNew = timers_.insert(std::make_pair(tp, std::move(timer)));
-            if(it == timers_.end() || it->first > itNew->first)
-                it = itNew;
-        }
+    const auto now = LoopClock::SteadyNow();
+
+    wheel_.Advance(_FloorTick(now), [this](WheelNode* node) {
+        Timer* timer = static_cast<Timer*>(node);
+        if(timer->IsPrecise())
+            _HeapPush(timer);
+        else
+            _Fire(timer);
+    });
+
+    //every precise timer whose deadline passed; stop at the first which hasn't,
+    //it's fired by its hard deadline at the latest, and so are those behind it
+    while(!near_.empty() && near_[0]->deadline_ <= now)
+    {
+        Timer* timer = near_[0];
+        _HeapRemove(timer);
+        _Fire(timer);
     }
 }
 
+void TimerManager::_HeapPush(Timer* timer)
+{
+    near_.push_back(timer);
+    _HeapSet(static_cast<int>(near_.size()) - 1, timer);
+    _HeapUp(timer->heapIndex_);
+}
+
+void TimerManager::_HeapRemove(Timer* timer)
+{
+    const int i = timer->heapIndex_;
+    assert(i >= 0 && near_[i] == timer);
+
+    Timer* last = near_.back();
+    near_.pop_back();
+    timer->heapIndex_ = -1;
+    if(last != timer)
+    {
+        _HeapSet(i, last);
+        _HeapUp(i);
+        _HeapDown(last->heapIndex_);
+    }
+}
+
+void TimerManager::_HeapUp(int i)
+{
+    Timer* timer = near_[i];
+    const TimePoint key = timer->HardDeadline();
+    while(i > 0)
+    {
+        const int parent = (i - 1) / 2;
+        if(near_[parent]->HardDeadline() <= key)
+            break;
+        _HeapSet(i, near_[parent]);
+        i = parent;
+    }
+    _HeapSet(i, timer);
+}
+
+void TimerManager::_HeapDown(int i)
+{
+    const int n = static_cast<int>(near_.size());
+    Timer* timer = near_[i];
+    const TimePoint key = timer->HardDeadline();
+    while(true)
+    {
+        int child = 2 * i + 1;
+        if(child >= n)
+            break;
+        if(child + 1 < n && near_[child + 1]->HardDeadline() < near_[child]->HardDeadline())
+            ++child;
+        if(key <= near_[child]->HardDeadline())
+            break;
+        _HeapSet(i, near_[child]);
+        i = child;
+    }
+    _HeapSet(i, timer);
+}
+
 bool TimerManager::Cancel(TimerId id)
 {
-    auto begin = timers_.lower_bound(id->first);
-    if(begin == timers_.end())
+    if(id.index_ == kRemoteSlot)
+        _ApplyRemote();
+    return _Cancel(id);
+}
+
+bool TimerManager::_Cancel(TimerId id)
+{
+    if(id.index_ == kRemoteSlot)
+    {
+        auto it = remoteIds_.find(id.generation_);
+        if(it == remoteIds_.end())
+            return false;
+        id = it->second;
+    }
+
+    if(!id.IsValid() || id.index_ >= Capacity())
+        return false;
+
+    Timer& timer = _Slot(id.index_);
+    if(timer.generation_ != id.generation_ || timer.count_ == 0)
         return false;
 
-    auto end = timers_.upper_bound(id->first);
-    for(auto it(begin); it != end; ++it)
+    //support cancel self, Update() frees it
+    if(&timer == firing_)
     {
-        if(it->second.UniqueId() == id->second)
-        {
-            it->second.count_ = 0;
-            return true;
-        }
+        timer.count_ = 0;
+        return true;
     }
 
-    return false;
+    if(timer.heapIndex_ >= 0)
+        _HeapRemove(&timer);
+    else
+        wheel_.Remove(&timer);
+    _Free(&timer);
+    return true;
 }
 
 DurationMs TimerManager::NearestTimer() const
 {
-    if(timers_.empty())
+    const DurationNs ns = NearestTimerNs();
+    if(ns == DurationNs::max())
         return DurationMs::max();
-    
-    const auto& timer = timers_.begin()->second;
-    auto now = std::chrono::steady_clock::now();
-    if(now > timer.Id()->first)
+    if(ns < DurationNs(0))
         return DurationMs::min();
-    else
-        return std::chrono::duration_cast<DurationMs>(timer.Id()->first - now);
+
+    //rounded up, not to wake before the timer
+    return std::chrono::ceil<DurationMs>(ns);
 }
 
-TimerManager::Timer::Timer(const TimePoint& tp):
-    id_(std::make_shared<std::pair<TimePoint, unsigned int>>(tp, ++ TimerManager::s_timer_id_gen_)), 
-    count_(Kforever)
-{}
+DurationNs TimerManager::NearestTimerNs() const
+{
+    if(!remote_.Empty())
+        return DurationNs(0);
 
-void TimerManager::Timer::_Move(Timer&& timer)
+    const int64_t when = _Earliest();
+    if(when == INT64_MAX)
+        return DurationNs::max();
+    return DurationNs(_WakeAt(when) - _Ns(LoopClock::SteadyNow()));
+}
+
+DurationNs TimerManager::PrepareWait()
 {
-    this->func_ = std::move(timer.func_);
-    this->interval_ = std::move(timer.interval_);
-    this->id_ = std::move(timer.id_);
-    this->count_ = std::move(timer.count_);
+    const int64_t when = _Earliest();
+
+    //tell Remote* how long the loop may sleep, then look for requests posted before
+    earliest_.store(when, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const bool pending = !remote_.Empty();
+
+    if(timerfd_ >= 0)
+    {
+        int64_t arm = pending ? _Ns(LoopClock::SteadyNow()) : _WakeAt(when);
+        if(arm == INT64_MAX)
+            arm = -1;
+        if(arm != armed_)
+        {
+            //steady_clock is CLOCK_MONOTONIC; all 0 disarms
+            itimerspec spec = {};
+            if(arm >= 0)
+            {
+                spec.it_value.tv_sec = arm / 1000000000;
+                spec.it_value.tv_nsec = std::max<int64_t>(arm % 1000000000, 1);
+            }
+            if(::timerfd_settime(timerfd_, TFD_TIMER_ABSTIME, &spec, nullptr) == 0)
+                armed_ = arm;
+        }
+    }
+
+    if(pending)
+        return DurationNs(0);
+    if(when == INT64_MAX)
+        return DurationNs::max();
+    
+    return DurationNs(_WakeAt(when) - _Ns(LoopClock::SteadyNow()));
 }
 
-TimerManager::Timer::Timer(Timer&& timer)
+// a coarse clock lags the fine one by up to a tick: only a tick past the deadline
+// is it sure to have reached it
+int64_t TimerManager::_WakeAt(int64_t when)
 {
-    _Move(std::move(timer));
+    const LoopClock* clock = LoopClock::Current();
+    if(when == INT64_MAX || !clock || !clock->IsCoarse())
+        return when;
+    return when + clock->Resolution().count();
 }
 
-TimerManager::Timer& TimerManager::Timer::operator= (Timer&& timer)
+// the deadline of the nearest timer in ns, INT64_MAX if none
+int64_t TimerManager::_Earliest() const
 {
-    if(this != &timer)
-        _Move(std::move(timer));
-    return *this;
+    int64_t when = INT64_MAX;
+    uint64_t tick;
+    if(wheel_.NextExpire(&tick))
+        when = _Ns(base_ + DurationMs(tick));
+    if(!near_.empty())
+        when = std::min(when, _Ns(near_[0]->HardDeadline()));
+    return when;
 }
 
+int TimerManager::TimerFd()
+{
+    if(timerfd_ < 0)
+    {
+        timerfd_ = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if(timerfd_ < 0)
+            perror("timerfd_create");
+    }
+    return timerfd_;
+}
+
+void TimerManager::RemoteCancel(TimerId id)
+{
+    RemoteRequest* request = new RemoteRequest;
+    request->id_ = id;
+    _PostRemote(request);
+}
+
+void TimerManager::_PostRemote(RemoteRequest* request)
+{
+    const bool schedule = static_cast<bool>(request->func_);
+    const int64_t deadline = _Ns(request->deadline_);
+    remote_.Push(request);
+    if(!schedule)
+        return;
+
+    //wake the loop only if it may sleep past the new timer, and only once
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t earliest = earliest_.load(std::memory_order_seq_cst);
+    while(deadline < earliest)
+    {
+        if(earliest_.compare_exchange_weak(earliest, deadline, std::memory_order_seq_cst))
+        {
+            if(wakeup_)
+                wakeup_();
+            break;
+        }
+    }
+}
+
+void TimerManager::_ApplyRemote()
+{
+    while(MpscNode* node = remote_.Pop())
+    {
+        RemoteRequest* request = static_cast<RemoteRequest*>(node);
+        if(request->func_)
+        {
+            Timer* t = _Alloc();
+            t->deadline_ = request->deadline_;
+            t->slack_ = request->slack_;
+            t->interval_ = kMinInterval;
+            t->count_ = 1;
+            t->func_ = std::move(request->func_);
+            t->remote_ = request->id_.generation_;
+
+            TimerId id;
+            id.index_ = t->index_;
+            id.generation_ = t->generation_;
+            remoteIds_.emplace(t->remote_, id);
+            _Add(t);
+        }
+        else
+        {
+            _Cancel(request->id_);
+        }
+        delete request;
+    }
+}
+
+TimerManager::Timer::Timer():slack_(0),
+                             interval_(0),
+                             count_(0),
+                             heapIndex_(-1),
+                             index_(0),
+                             generation_(1),
+                             nextFree_(kNoSlot),
+                             remote_(0)
+{}
+
 void TimerManager::Timer::OnTimer()
 {
     if(!func_ || count_ == 0)
@@ -111,7 +446,7 @@ void TimerManager::Timer::OnTimer()
     if(count_ == Kforever || count_-- > 0)
     {
         func_();
-        id_->first += interval_;
+        deadline_ += interval_;
     }
     else
     {
@@ -119,18 +454,6 @@ void TimerManager::Timer::OnTimer()
     }
 }
 
-TimerId TimerManager::Timer::Id() const
-{
-    return id_;
-}
-
-unsigned int TimerManager::Timer::UniqueId() const
-{
-    return id_->second;
-}
-
-
 }//end namespace internal
 }//end namespace mrpc
 
-
@@ -2,24 +2,52 @@
 #ifndef TIMERMANAGER_H_
 #define TIMERMANAGER_H_
 
-#include <map>  
 #include <chrono>  
-#include <functional>
 #include <memory>
+#include <tuple>
+#include <vector>
 #include <ostream>
+#include <atomic>
+#include <unordered_map>
+#include <stdint.h>
+#include "InlineFunction.h"
+#include "LoopClock.h"
+#include "MpscQueue.h"
+#include "TimingWheel.h"
 
 namespace mrpc
 {
 
 using DurationMs = std::chrono::milliseconds;
+using DurationNs = std::chrono::nanoseconds;
 using TimePoint = std::chrono::steady_clock::time_point;        //record program time
-using TimerId = std::shared_ptr<std::pair<TimePoint, unsigned int>>; 
+
+//handle of a timer: the slot in TimerManager and the generation of the slot,
+//a handle of a timer already fired or cancelled never matches again
+struct TimerId
+{
+    uint32_t index_ = 0;
+    uint32_t generation_ = 0;      //0: no timer
+
+    bool IsValid() const
+    {
+        return generation_ != 0;
+    }
+    bool operator== (const TimerId& other) const
+    {
+        return index_ == other.index_ && generation_ == other.generation_;
+    }
+    bool operator!= (const TimerId& other) const
+    {
+        return !(*this == other);
+    }
+};
 
 constexpr int Kforever = -1;
 
 inline std::ostream& operator<< (std::ostream& os, const TimerId& d)
 {
-    os << "[Timer Id:" << (void*)d.get() << "]";
+    os << "[Timer Id:" << d.index_ << "#" << d.generation_ << "]";
     return os;
 }
 
@@ -27,9 +55,26 @@ namespace internal
 {
 
 //TimerManager class; You should not use it directly, but via Eventloop
+//Only the Remote* methods may be called from other threads than the owning loop.
+//
+//A timer fires within [deadline, deadline + slack]:
+//  slack >= 1ms: coarse, in a hierarchical timing wheel of 1ms ticks (TimingWheel.h).
+//                It takes the coarsest tick in its window, so timers with slack
+//                share ticks and wake the loop once.
+//  slack <  1ms: precise, in a heap by deadline + slack once within a tick or so,
+//                fired when the deadline passed (the hrtimer way).
+//The loop sleeps for what PrepareWait() returns, or on TimerFd() which it arms to the same point.
+//"Now" is LoopClock::SteadyNow(): the loop's cached clock on its thread.
 class TimerManager final 
 {
 public:
+    //room for a callback and its arguments, a timer never allocates for them
+    static constexpr std::size_t kCallbackSize = 48;
+    //slack of the timers scheduled without one, the precision of the wheel
+    static constexpr DurationNs kDefaultSlack = DurationMs(1);
+    //the shortest period of a repeated timer
+    static constexpr DurationNs kMinInterval = std::chrono::microseconds(1);
+
     TimerManager();
     ~TimerManager();
 
@@ -43,7 +88,8 @@ public:
     //triggerTime:the absolute time when timer first triggered
     //period:After first trigger, will be triggered by this period repeated until RepeatCount
     //f:function to execute
-    //args:arguments for f   
+    //args:arguments for f, copied like std::bind; f and args are kept inline in the timer,
+    //     up to kCallbackSize bytes, larger ones fail to compile
     template <int RepeatCount, typename Duration, typename F, typename... Args>                                      
     TimerId ScheduleAtWithRepeat(const TimePoint& triggertime, const Duration& period, F&& f, Args&&... args);
 
@@ -59,77 +105,234 @@ public:
     template <typename Duration, typename F, typename... Args>  
     TimerId ScheduleAfter(const Duration& duration, F&& f, Args&&... args);
 
-    //cancel timer
+    //the above with a slack, the others use kDefaultSlack
+    //slack:how late the timer may fire, to share a wakeup with others; 0 for as precise as possible
+    template <int RepeatCount, typename Duration, typename F, typename... Args>
+    TimerId ScheduleAtWithSlack(const TimePoint& triggertime, const Duration& period, DurationNs slack,
+                                F&& f, Args&&... args);
+    template <typename Duration, typename F, typename... Args>
+    TimerId ScheduleAfterWithSlack(const Duration& duration, DurationNs slack, F&& f, Args&&... args);
+
+    //cancel timer, O(1); the callback is released at once
     bool Cancel(TimerId id);
 
     // how far the nearest timer will be triggered
     DurationMs NearestTimer() const;
+    //in ns: may be negative when overdue; 0 while remote requests are queued.
+    //Measured from LoopClock::SteadyNow(), the time Update() compares with; with a
+    //coarse clock one tick later, so the cached clock has reached the deadline on waking
+    DurationNs NearestTimerNs() const;
+
+    //by the loop right before it sleeps: tells the Remote* methods until when, so they
+    //wake it only for an earlier timer, and arms TimerFd() to it. Returns NearestTimerNs()
+    DurationNs PrepareWait();
+
+    //a timerfd armed by PrepareWait(), for the loop to poll instead of a timeout in ms;
+    //-1 if it can't be created
+    int TimerFd();
+
+    //from any thread: queued, and applied by the next Update() of the owning loop.
+    //The id is good for Cancel and RemoteCancel at once, even before it is applied.
+    template <typename F, typename... Args>
+    TimerId RemoteScheduleAt(const TimePoint& triggertime, F&& f, Args&&... args);
+    template <typename Duration, typename F, typename... Args>  
+    TimerId RemoteScheduleAfter(const Duration& duration, F&& f, Args&&... args);
+    void RemoteCancel(TimerId id);
+
+    //called by Remote* from any thread when the loop may sleep past the new timer,
+    //e.g. write an eventfd the loop polls
+    void SetWakeup(InlineFunction<void ()> wakeup)
+    {
+        wakeup_ = std::move(wakeup);
+    }
+
+    //make it the timers of this thread, by the loop thread; and undo it
+    void Attach();
+    void Detach();
+
+    //the timers of this thread, nullptr if none attached
+    static TimerManager* Current()
+    {
+        return current_;
+    }
+
+    //timers pending
+    std::size_t Size() const
+    {
+        return size_;
+    }
+    //timer slots allocated, free slots are reused
+    std::size_t Capacity() const
+    {
+        return chunks_.size() * kChunkSize;
+    }
 
 private:
-    class Timer
+    using Callback = InlineFunction<void (), kCallbackSize>;
+
+    //bind f and args, copied like std::bind
+    template <typename F, typename... Args>
+    static Callback _Bind(F&& f, Args&&... args);
+
+    class Timer : public WheelNode
     {
         friend class TimerManager;
     public:
-        explicit 
-        Timer(const TimePoint& tp);
-
-        //only move
-        Timer(Timer&& timer);
-        Timer& operator= (Timer&& );
+        Timer();
 
         Timer(const Timer& ) = delete;
         void operator= (const Timer& ) = delete;
 
-        template <typename F, typename... Args>
-        void SetCallBack(F&& f, Args&&... args);
-
         void OnTimer();
 
-        TimerId Id() const;
-        unsigned int UniqueId() const;
-
     private:
-        void _Move(Timer&& timer);
+        Callback func_;
+        TimePoint deadline_;
+        DurationNs slack_;
+        DurationNs interval_;
+        int count_;
+        int heapIndex_;         //in near_, -1: not
+
+        uint32_t index_;
+        uint32_t generation_;
+        uint32_t nextFree_;
+        uint32_t remote_;       //generation of the remote id, 0: scheduled locally
+
+        bool IsPrecise() const
+        {
+            return slack_ < kDefaultSlack;
+        }
+        TimePoint HardDeadline() const
+        {
+            return deadline_ + slack_;
+        }
+    };
 
+    //a remote schedule (func_ set) or cancel, from other threads
+    struct RemoteRequest : public MpscNode
+    {
         TimerId id_;
-
-        std::function<void ()> func_;    
-        DurationMs interval_;
-        int count_;
+        TimePoint deadline_;
+        DurationNs slack_;
+        Callback func_;
     };
 
-    std::multimap<TimePoint, Timer> timers_;
+    //ids handed out by Remote*: index kRemoteSlot, generation from remoteGen_
+    static constexpr uint32_t kRemoteSlot = UINT32_MAX;
+
+    bool _Cancel(TimerId id);
+    void _ApplyRemote();
+    void _PostRemote(RemoteRequest* request);
+    int64_t _Earliest() const;
+    //the ns of the steady clock, as published in earliest_
+    static int64_t _Ns(const TimePoint& tp)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(tp.time_since_epoch()).count();
+    }
+
+    //timers live in chunks which never move, so the wheel can link them
+    static constexpr uint32_t kChunkBits = 8;
+    static constexpr uint32_t kChunkSize = 1 << kChunkBits;
+    static constexpr uint32_t kNoSlot = UINT32_MAX;
+
+    Timer* _Alloc();
+    void _Free(Timer* timer);
+    Timer& _Slot(uint32_t index) const
+    {
+        return chunks_[index >> kChunkBits][index & (kChunkSize - 1)];
+    }
+
+    //tick of tp, rounded up so a timer never fires early
+    uint64_t _TickOf(const TimePoint& tp) const;
+    uint64_t _FloorTick(const TimePoint& tp) const;
+    //when to wake for a deadline in ns, by CLOCK_MONOTONIC
+    static int64_t _WakeAt(int64_t when);
+    //to the wheel or to near_
+    void _Add(Timer* timer);
+    void _Fire(Timer* timer);
+
+    //binary heap of the precise timers by hard deadline
+    void _HeapPush(Timer* timer);
+    void _HeapRemove(Timer* timer);
+    void _HeapUp(int i);
+    void _HeapDown(int i);
+    void _HeapSet(int i, Timer* timer)
+    {
+        near_[i] = timer;
+        timer->heapIndex_ = i;
+    }
+
+    const TimePoint base_;      //tick 0
+    TimingWheel wheel_;
+    std::vector<Timer*> near_;
+    Timer* firing_;             //the timer in OnTimer, may cancel itself
+
+    std::vector<std::unique_ptr<Timer[]>> chunks_;
+    uint32_t freeList_;
+    std::size_t size_;
 
-    friend class Timer;
+    MpscQueue remote_;
+    std::unordered_map<uint32_t, TimerId> remoteIds_;   //remote generation -> local id
+    std::atomic<uint32_t> remoteGen_;
+    std::atomic<int64_t> earliest_;                     //deadline the loop sleeps until, ns
+    InlineFunction<void ()> wakeup_;
 
-    //not thread-safe, but why not care?
-    //check whether ensure thread-safe on upper code
-    static unsigned int s_timer_id_gen_;
+    static thread_local TimerManager* current_;
+
+    int timerfd_;
+    int64_t armed_;             //deadline set in timerfd_, ns; -1: none
 };
 
 template <int RepeatCount, typename Duration, typename F, typename... Args>
-TimerId TimerManager::ScheduleAtWithRepeat(const TimePoint& triggertime, const Duration& period, F&& f, Args&&... args)
+TimerId TimerManager::ScheduleAtWithSlack(const TimePoint& triggertime, const Duration& period, DurationNs slack,
+                                          F&& f, Args&&... args)
 {
     static_assert(RepeatCount != 0, "Why you need a timer with a zero count?");
 
     using namespace std::chrono;
 
-    Timer t(triggertime);
-    //precision: millisecond
+    Timer* t = _Alloc();
+    //precision: nanosecond, as the slack allows
 
-    t.interval_ = std::max(DurationMs(1), duration_cast<DurationMs>(period));
-    t.count_ = RepeatCount;
-    TimerId id = t.Id();
+    t->deadline_ = triggertime;
+    t->slack_ = std::max(DurationNs(0), slack);
+    t->interval_ = std::max(kMinInterval, duration_cast<DurationNs>(period));
+    t->count_ = RepeatCount;
 
-    t.SetCallBack(std::forward<F>(f), std::forward<Args>(args)...);
-    timers_.insert(std::make_pair(triggertime, std::move(t)));
+    t->func_ = _Bind(std::forward<F>(f), std::forward<Args>(args)...);
+    _Add(t);
+
+    TimerId id;
+    id.index_ = t->index_;
+    id.generation_ = t->generation_;
     return id;
 }
 
+template <int RepeatCount, typename Duration, typename F, typename... Args>
+TimerId TimerManager::ScheduleAtWithRepeat(const TimePoint& triggertime, const Duration& period, F&& f, Args&&... args)
+{
+    return ScheduleAtWithSlack<RepeatCount>(triggertime, 
+                                            period, 
+                                            kDefaultSlack, 
+                                            std::forward<F>(f), 
+                                            std::forward<Args>(args)...);
+}
+
+template<typename Duration, typename F, typename... Args>
+TimerId TimerManager::ScheduleAfterWithSlack(const Duration& duration, DurationNs slack, F&& f, Args&&... args)
+{
+    const auto now = LoopClock::SteadyNow();
+    return ScheduleAtWithSlack<1>(now + duration, 
+                                  DurationNs(0), 
+                                  slack, 
+                                  std::forward<F>(f), 
+                                  std::forward<Args>(args)...);
+}
+
 template<int RepeatCount, typename Duration, typename F, typename... Args>
 TimerId TimerManager::ScheduleAfterWithRepeat(const Duration& period, F&& f, Args&&... args)
 {
-    const auto now = std::chrono::steady_clock::now();
+    const auto now = LoopClock::SteadyNow();
     return ScheduleAtWithRepeat<RepeatCount>(now + period, 
                                              period, 
                                              std::forward<F>(f), 
@@ -150,16 +353,52 @@ TimerId TimerManager::ScheduleAt(const TimePoint& triggertime, F&& f, Args&&...
 template<typename Duration, typename F, typename... Args>
 TimerId TimerManager::ScheduleAfter(const Duration& duration, F&& f, Args&&... args)
 {
-    const auto now = std::chrono::steady_clock::now();
+    const auto now = LoopClock::SteadyNow();
     return ScheduleAt(now + duration, 
                       std::forward<F>(f), 
                       std::forward<Args>(args)...);
 }
 
 template<typename F, typename... Args>
-void TimerManager::Timer::SetCallBack(F&& f, Args&&... args)
+TimerId TimerManager::RemoteScheduleAt(const TimePoint& triggertime, F&& f, Args&&... args)
+{
+    RemoteRequest* request = new RemoteRequest;
+    request->id_.index_ = kRemoteSlot;
+    do
+    {
+        request->id_.generation_ = remoteGen_.fetch_add(1, std::memory_order_relaxed) + 1;
+    } while(request->id_.generation_ == 0);
+    request->deadline_ = triggertime;
+    request->slack_ = kDefaultSlack;
+    request->func_ = _Bind(std::forward<F>(f), std::forward<Args>(args)...);
+
+    const TimerId id = request->id_;
+    _PostRemote(request);
+    return id;
+}
+
+template<typename Duration, typename F, typename... Args>
+TimerId TimerManager::RemoteScheduleAfter(const Duration& duration, F&& f, Args&&... args)
+{
+    const auto now = LoopClock::SteadyNow();
+    return RemoteScheduleAt(now + duration, 
+                            std::forward<F>(f), 
+                            std::forward<Args>(args)...);
+}
+
+template<typename F, typename... Args>
+TimerManager::Callback TimerManager::_Bind(F&& f, Args&&... args)
 {
-    func_ = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
+    if constexpr(sizeof...(Args) == 0)
+    {
+        return Callback(std::forward<F>(f));
+    }
+    else
+    {
+        return Callback([f = std::forward<F>(f), args = std::make_tuple(std::forward<Args>(args)...)]() mutable {
+            std::apply(f, args);
+        });
+    }
 }
 
 }   //end namespace internal
@@ -0,0 +1,132 @@
+#include <cstring>
+#include "TimingWheel.h"
+
+namespace mrpc {
+namespace internal {
+
+TimingWheel::TimingWheel(uint64_t now):current_(now),
+                                       size_(0)
+{
+    for(auto& head : slots_)
+        head.prev_ = head.next_ = &head;
+    memset(bitmap_, 0, sizeof bitmap_);
+}
+
+int TimingWheel::_LevelSlot(int level, uint64_t tick)
+{
+    if(level == 0)
+        return static_cast<int>(tick & (kLevel0Size - 1));
+
+    const int shift = kLevel0Bits + (level - 1) * kLevelBits;
+    return kLevel0Size + (level - 1) * kLevelSize + static_cast<int>((tick >> shift) & (kLevelSize - 1));
+}
+
+int TimingWheel::_SlotFor(uint64_t expire) const
+{
+    const uint64_t delta = expire - current_;
+    if(delta < (uint64_t(1) << kLevel0Bits))
+        return _LevelSlot(0, expire);
+
+    for(int level = 1; level < kLevels - 1; ++level)
+    {
+        if(delta < (uint64_t(1) << (kLevel0Bits + level * kLevelBits)))
+            return _LevelSlot(level, expire);
+    }
+
+    // too far away, park it at the farthest slot, it is placed again when cascaded
+    if(delta > kMaxSpan)
+        expire = current_ + kMaxSpan;
+    return _LevelSlot(kLevels - 1, expire);
+}
+
+void TimingWheel::_Link(int slot, WheelNode* node)
+{
+    WheelNode& head = slots_[slot];
+    node->prev_ = head.prev_;
+    node->next_ = &head;
+    head.prev_->next_ = node;
+    head.prev_ = node;
+    node->slot_ = slot;
+
+    bitmap_[slot >> 6] |= uint64_t(1) << (slot & 63);
+    ++size_;
+}
+
+void TimingWheel::_Unlink(WheelNode* node)
+{
+    assert(node->IsLinked());
+
+    node->prev_->next_ = node->next_;
+    node->next_->prev_ = node->prev_;
+
+    const int slot = node->slot_;
+    WheelNode& head = slots_[slot];
+    if(head.next_ == &head)
+        bitmap_[slot >> 6] &= ~(uint64_t(1) << (slot & 63));
+
+    node->prev_ = node->next_ = nullptr;
+    node->slot_ = -1;
+    --size_;
+}
+
+void TimingWheel::Add(WheelNode* node)
+{
+    assert(!node->IsLinked());
+
+    // the current tick is processed already
+    if(node->expire_ <= current_)
+        node->expire_ = current_ + 1;
+    _Link(_SlotFor(node->expire_), node);
+}
+
+void TimingWheel::Remove(WheelNode* node)
+{
+    if(node->IsLinked())
+        _Unlink(node);
+}
+
+void TimingWheel::_Cascade(int level, uint64_t tick)
+{
+    WheelNode& head = slots_[_LevelSlot(level, tick)];
+    while(head.next_ != &head)
+    {
+        WheelNode* node = head.next_;
+        _Unlink(node);
+        // expire >= tick, those due right now land in the level 0 slot of this tick
+        _Link(_SlotFor(node->expire_), node);
+    }
+}
+
+// the next tick which has level 0 work or a cascade, not beyond limit
+uint64_t TimingWheel::_NextStop(uint64_t limit) const
+{
+    const uint64_t base = current_ & ~uint64_t(kLevel0Size - 1);
+    uint64_t stop = base + kLevel0Size;
+
+    // level 0 slots after current_ in this round; the bitmap words of level 0 come first
+    for(int idx = static_cast<int>(current_ - base) + 1; idx < kLevel0Size; )
+    {
+        const uint64_t word = bitmap_[idx >> 6] >> (idx & 63);
+        if(word)
+        {
+            stop = base + idx + __builtin_ctzll(word);
+            break;
+        }
+        idx = (idx | 63) + 1;
+    }
+
+    return stop < limit ? stop : limit;
+}
+
+bool TimingWheel::NextExpire(uint64_t* tick) const
+{
+    if(size_ == 0)
+        return false;
+
+    // either a level 0 slot in this round, or the next cascade at the latest
+    *tick = _NextStop(UINT64_MAX);
+    return true;
+}
+
+}   // end namespace internal
+}   // end namespace mrpc
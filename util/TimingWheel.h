@@ -0,0 +1,121 @@
+#ifndef TIMINGWHEEL_H_
+#define TIMINGWHEEL_H_
+
+// Hierarchical timing wheel, the engine of TimerManager
+// level 0: 256 slots of 1 tick; level 1~4: 64 slots of 256, 2^14, 2^20, 2^26 ticks
+// Insert and remove are O(1). A timer far away sits in a coarse slot and is moved
+// down (cascaded) when the lower level wraps, so it's touched at most 4 more times.
+// Ticks are abstract, TimerManager uses 1 tick = 1 ms.
+
+#include <cassert>
+#include <cstddef>
+#include <stdint.h>
+
+namespace mrpc {
+namespace internal {
+
+struct WheelNode
+{
+    WheelNode* prev_ = nullptr;
+    WheelNode* next_ = nullptr;
+    uint64_t expire_ = 0;       // tick
+    int slot_ = -1;             // -1: not in the wheel
+
+    bool IsLinked() const
+    {
+        return slot_ >= 0;
+    }
+};
+
+class TimingWheel final
+{
+public:
+    static constexpr int kLevel0Bits = 8;
+    static constexpr int kLevelBits = 6;
+    static constexpr int kLevels = 5;
+    static constexpr int kLevel0Size = 1 << kLevel0Bits;
+    static constexpr int kLevelSize = 1 << kLevelBits;
+    static constexpr int kSlots = kLevel0Size + (kLevels - 1) * kLevelSize;
+    static constexpr uint64_t kMaxSpan = (uint64_t(1) << (kLevel0Bits + (kLevels - 1) * kLevelBits)) - 1;
+
+    explicit TimingWheel(uint64_t now = 0);
+
+    TimingWheel(const TimingWheel& ) = delete;
+    void operator= (const TimingWheel& ) = delete;
+
+    //node->expire_ must be set; an expire not after Now() fires on the next tick
+    void Add(WheelNode* node);
+    void Remove(WheelNode* node);
+
+    //process the ticks up to now, onExpire(WheelNode*) is called for every due node,
+    //already removed from the wheel, so it may be added again or freed
+    template <typename F>
+    void Advance(uint64_t now, F&& onExpire);
+
+    //a lower bound of the tick of the nearest node, false if empty
+    bool NextExpire(uint64_t* tick) const;
+
+    uint64_t Now() const
+    {
+        return current_;
+    }
+    std::size_t Size() const
+    {
+        return size_;
+    }
+
+private:
+    WheelNode slots_[kSlots];   // sentinels of circular lists
+    uint64_t bitmap_[kSlots / 64];
+    uint64_t current_;          // all ticks <= current_ are processed
+    std::size_t size_;
+
+    int _SlotFor(uint64_t expire) const;
+    static int _LevelSlot(int level, uint64_t tick);
+    void _Link(int slot, WheelNode* node);
+    void _Unlink(WheelNode* node);
+    void _Cascade(int level, uint64_t tick);
+    uint64_t _NextStop(uint64_t limit) const;
+};
+
+template <typename F>
+void TimingWheel::Advance(uint64_t now, F&& onExpire)
+{
+    while(current_ < now)
+    {
+        if(size_ == 0)
+        {
+            current_ = now;
+            return;
+        }
+
+        // jump over the ticks without any work
+        current_ = _NextStop(now);
+        const uint64_t tick = current_;
+
+        // lower level wrapped, bring down the coarse slots
+        if((tick & (kLevel0Size - 1)) == 0)
+        {
+            for(int level = 1; level < kLevels; ++level)
+            {
+                _Cascade(level, tick);
+                const int shift = kLevel0Bits + (level - 1) * kLevelBits;
+                if(((tick >> shift) & (kLevelSize - 1)) != 0)
+                    break;
+            }
+        }
+
+        WheelNode& head = slots_[tick & (kLevel0Size - 1)];
+        while(head.next_ != &head)
+        {
+            WheelNode* node = head.next_;
+            _Unlink(node);
+            onExpire(node);
+        }
+    }
+}
+
+}   // end namespace internal
+}   // end namespace mrpc
+
+#endif
@@ -0,0 +1,162 @@
+#include <fstream>
+#include <string>
+#include <thread>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+#include "TscClock.h"
+
+namespace mrpc {
+
+namespace internal {
+
+TscState tscState;
+
+}   // end namespace internal
+
+constexpr std::chrono::milliseconds TscClock::kFirstSpan;
+constexpr std::chrono::milliseconds TscClock::kCalibrationPeriod;
+
+namespace {
+
+std::atomic<bool> calibrating{false};
+
+//the rate is measured from here, taken at startup
+uint64_t anchorTicks = 0;
+int64_t anchorNs = 0;
+
+int64_t ReadNs(clockid_t id)
+{
+    timespec ts;
+    ::clock_gettime(id, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+//a tick count and the monotonic time read between two of them, the tightest of a few tries
+void Sample(uint64_t* ticks, int64_t* ns)
+{
+    uint64_t best = UINT64_MAX;
+    for(int i = 0; i < 5; ++i)
+    {
+        const uint64_t before = TscClock::Ticks();
+        const int64_t now = ReadNs(CLOCK_MONOTONIC);
+        const uint64_t after = TscClock::Ticks();
+        if(after - before < best)
+        {
+            best = after - before;
+            *ticks = before + best / 2;
+            *ns = now;
+        }
+    }
+}
+
+struct Startup
+{
+    Startup()
+    {
+        internal::TscState& s = internal::tscState;
+        s.enabled_ = TscClock::Detect();
+        if(s.enabled_)
+            Sample(&anchorTicks, &anchorNs);
+    }
+};
+
+Startup startup;
+
+}   // end anonymous namespace
+
+bool TscClock::Detect(const char* sysfs)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    //CPUID 8000_0007h EDX bit 8: invariant TSC
+    unsigned int eax, ebx, ecx, edx;
+    if(!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) || eax < 0x80000007)
+        return false;
+    __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+    if(!(edx & (1u << 8)))
+        return false;
+
+    //not readable: no say of the kernel, go by the cpu
+    std::ifstream in(std::string(sysfs) + "/clocksource/clocksource0/current_clocksource");
+    std::string source;
+    if(in >> source)
+        return source == "tsc";
+    return true;
+#else
+    (void)sysfs;
+    return false;
+#endif
+}
+
+bool TscClock::_Recalibrate(uint64_t ticks)
+{
+    bool expected = false;
+    if(!calibrating.compare_exchange_strong(expected, true, std::memory_order_acquire))
+        return false;
+
+    internal::TscState& s = internal::tscState;
+    const uint64_t baseTicks = s.baseTicks_.load(std::memory_order_relaxed);
+    const uint64_t period = s.period_.load(std::memory_order_relaxed);
+    const bool first = s.mult_.load(std::memory_order_relaxed) == 0;
+    if(!first && ticks != 0 && (ticks <= baseTicks || ticks - baseTicks < period))
+    {
+        //done by another thread meanwhile
+        calibrating.store(false, std::memory_order_release);
+        return true;
+    }
+
+    uint64_t now;
+    int64_t ns;
+    Sample(&now, &ns);
+    const int64_t firstSpan = std::chrono::nanoseconds(kFirstSpan).count();
+    while(ns - anchorNs < firstSpan)
+        Sample(&now, &ns);
+
+    const uint64_t spanTicks = now - anchorTicks;
+    const uint64_t spanNs = static_cast<uint64_t>(ns - anchorNs);
+    const uint64_t mult = static_cast<uint64_t>((static_cast<unsigned __int128>(spanNs) << 32) / spanTicks);
+    const uint64_t nextPeriod = static_cast<uint64_t>(static_cast<unsigned __int128>(spanTicks) *
+                                std::chrono::nanoseconds(kCalibrationPeriod).count() / spanNs);
+    const int64_t wallOffset = ReadNs(CLOCK_REALTIME) - ReadNs(CLOCK_MONOTONIC);
+
+    const uint32_t seq = s.seq_.load(std::memory_order_relaxed);
+    s.seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s.baseTicks_.store(now, std::memory_order_relaxed);
+    s.baseNs_.store(ns, std::memory_order_relaxed);
+    s.mult_.store(mult, std::memory_order_relaxed);
+    s.period_.store(nextPeriod, std::memory_order_relaxed);
+    s.wallOffset_.store(wallOffset, std::memory_order_relaxed);
+    s.seq_.store(seq + 2, std::memory_order_release);
+
+    calibrating.store(false, std::memory_order_release);
+    return true;
+}
+
+void TscClock::Calibrate()
+{
+    if(!Enabled())
+        return;
+    while(!_Recalibrate(0))
+        std::this_thread::yield();
+}
+
+int64_t TscClock::ToNanoseconds(uint64_t ticks)
+{
+    if(!Enabled())
+        return static_cast<int64_t>(ticks);
+    internal::TscState& s = internal::tscState;
+    if(s.mult_.load(std::memory_order_acquire) == 0)
+        Now();      // the first calibration
+    const uint64_t mult = s.mult_.load(std::memory_order_relaxed);
+    return static_cast<int64_t>(static_cast<unsigned __int128>(ticks) * mult >> 32);
+}
+
+double TscClock::Frequency()
+{
+    const uint64_t mult = Enabled() ? internal::tscState.mult_.load(std::memory_order_relaxed) : 0;
+    return mult == 0 ? 0 : 4294967296e9 / mult;
+}
+
+}   // end namespace mrpc
@@ -0,0 +1,159 @@
+#ifndef TSCCLOCK_H_
+#define TSCCLOCK_H_
+
+// A steady clock read by rdtsc, for instrumentation too fine for clock_gettime
+// The tick rate is measured against CLOCK_MONOTONIC: first on the first use, at
+// least kFirstSpan after startup, then again about every kCalibrationPeriod by
+// the caller that finds it due, always over the whole span since startup so the
+// rate gets more exact with time. A recalibration rebases on the monotonic clock,
+// which may step the clock by the error of the last rate, far below 1us.
+//
+// Used only when the TSC is invariant (constant rate in every power state) and the
+// kernel keeps it as its clocksource, i.e. trusts it to be synchronized across
+// cores; otherwise every call goes to std::chrono::steady_clock.
+//
+//   uint64_t start = TscClock::Ticks();
+//   ...
+//   int64_t ns = TscClock::ToNanoseconds(TscClock::Ticks() - start);
+//
+//   Time now(TscClock::WallNow());      // for a log timestamp
+
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace mrpc {
+
+namespace internal {
+
+//ns = baseNs_ + ((ticks - baseTicks_) * mult_ >> 32); read under a sequence lock
+struct TscState
+{
+    bool enabled_;
+    std::atomic<uint32_t> seq_{0};
+    std::atomic<uint64_t> baseTicks_{0};
+    std::atomic<int64_t> baseNs_{0};
+    std::atomic<uint64_t> mult_{0};         // 0: not calibrated yet
+    std::atomic<uint64_t> period_{0};       // ticks till the next calibration
+    std::atomic<int64_t> wallOffset_{0};    // ns from the steady to the system clock
+};
+
+extern TscState tscState;
+
+}   // end namespace internal
+
+class TscClock final
+{
+public:
+    using TimePoint = std::chrono::steady_clock::time_point;
+    using SystemPoint = std::chrono::system_clock::time_point;
+
+    static constexpr std::chrono::milliseconds kFirstSpan{2};
+    static constexpr std::chrono::milliseconds kCalibrationPeriod{1000};
+
+    TscClock() = delete;
+
+    //invariant TSC and the kernel clocksource being tsc, as found under sysfs
+    static bool Detect(const char* sysfs = "/sys/devices/system");
+
+    //false: the fallback to steady_clock
+    static bool Enabled()
+    {
+        return internal::tscState.enabled_;
+    }
+
+    //raw ticks to take differences of; nanoseconds of steady_clock if not enabled
+    static uint64_t Ticks()
+    {
+        if(!Enabled())
+            return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+        return _Rdtsc();
+    }
+
+    //the same, rdtscp: waits for the instructions before it to finish
+    static uint64_t TicksOrdered()
+    {
+        if(!Enabled())
+            return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#if defined(__x86_64__) || defined(__i386__)
+        unsigned int aux;
+        return __rdtscp(&aux);
+#else
+        return _Rdtsc();
+#endif
+    }
+
+    //a difference of Ticks() in nanoseconds
+    static int64_t ToNanoseconds(uint64_t ticks);
+
+    //steady_clock time, comparable with TimerManager deadlines
+    static TimePoint Now()
+    {
+        if(!Enabled())
+            return std::chrono::steady_clock::now();
+        return TimePoint(std::chrono::nanoseconds(_ToNs(_Rdtsc())));
+    }
+
+    //system_clock time, e.g. for a Time
+    static SystemPoint WallNow()
+    {
+        return ToWall(Now());
+    }
+
+    //as of the last calibration; the two clocks drift apart slowly
+    static SystemPoint ToWall(TimePoint tp)
+    {
+        const auto ns = tp.time_since_epoch() +
+                        std::chrono::nanoseconds(internal::tscState.wallOffset_.load(std::memory_order_relaxed));
+        return SystemPoint(std::chrono::duration_cast<SystemPoint::duration>(ns));
+    }
+
+    //ticks per second, 0 if not enabled or not calibrated yet
+    static double Frequency();
+
+    //measure the rate now instead of when due
+    static void Calibrate();
+
+private:
+    static uint64_t _Rdtsc()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return 0;
+#endif
+    }
+
+    static int64_t _ToNs(uint64_t ticks)
+    {
+        internal::TscState& s = internal::tscState;
+        while(true)
+        {
+            const uint32_t seq = s.seq_.load(std::memory_order_acquire);
+            const uint64_t baseTicks = s.baseTicks_.load(std::memory_order_relaxed);
+            const int64_t baseNs = s.baseNs_.load(std::memory_order_relaxed);
+            const uint64_t mult = s.mult_.load(std::memory_order_relaxed);
+            const uint64_t period = s.period_.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(seq & 1 || seq != s.seq_.load(std::memory_order_relaxed))
+                continue;
+
+            //ticks read just before another thread rebased count as the base
+            const uint64_t elapsed = ticks > baseTicks ? ticks - baseTicks : 0;
+            if(elapsed >= period && (_Recalibrate(ticks) || mult == 0))
+                continue;
+            return baseNs + static_cast<int64_t>(static_cast<unsigned __int128>(elapsed) * mult >> 32);
+        }
+    }
+
+    //false if another thread is at it: keep the old rate meanwhile, or wait for
+    //the first one
+    static bool _Recalibrate(uint64_t ticks);
+};
+
+}   // end namespace mrpc
+
+#endif